@@ -0,0 +1,27 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+// Ahead-of-time translation of a loaded LC-3 image to C. Code reachable from
+// the entry point through fall-through, BR and JSR is split into basic
+// blocks, one C function each; a dispatcher runs them with the same
+// semantics as vm_execute. Targets of JMP, JSRR and RET are looked up at run
+// time, and code the translator never saw, or that the program overwrites,
+// runs on an interpreter embedded in the generated program.
+
+// Source lines of that runtime, NULL-terminated
+extern const char* const aot_runtime_source[];
+
+// Write the C translation of memory (LC3_MEMORY_MAX words) entered at entry.
+// Returns 0 on success, 1 on failure.
+int aot_write_c(const uint16_t* memory, uint16_t entry, const char* filename);
+
+// Compile a translated program with $CC (default cc). Returns 0 on success.
+int aot_compile(const char* c_filename, const char* output_filename);
+
+// Translate the object file input_filename to an executable, or only to C
+// when output_filename ends in .c
+int aot_run(const char* input_filename, const char* output_filename);
+
+#endif  // AOT_H
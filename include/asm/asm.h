@@ -1,16 +1,53 @@
 #ifndef ASM_H
 #define ASM_H
 
+#include <stdbool.h>
+
+#include "cache.h"
+#include "log.h"
+#include "program.h"
+#include "symbol.h"
+
 #define LC3_REGISTERS \
   {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "COND", "PC"}
 
-#define LC3_INSTRUCTION_SET                                       \
-  {"BR",   "ADD",   "LD",   "ST",    "JSR",   "AND",     "LDR",   \
-   "STR",  "RTI",   "NOT",  "LDI",   "STI",   "JMP",     "RES",   \
-   "LEA",  "TRAP",  "GETC", "OUT",   "PUTS",  "IN",      "PUTSP", \
-   "HALT", ".ORIG", ".END", ".FILL", ".BLKW", ".STRINGZ"}
+#define LC3_INSTRUCTION_SET                                         \
+  {"BR",   "ADD",   "LD",   "ST",    "JSR",   "AND",      "LDR",     \
+   "STR",  "RTI",   "NOT",  "LDI",   "STI",   "JMP",      "RES",     \
+   "LEA",  "TRAP",  "GETC", "OUT",   "PUTS",  "IN",       "PUTSP",   \
+   "HALT", ".ORIG", ".END", ".FILL", ".BLKW", ".STRINGZ", ".GLOBAL", \
+   ".EXTERN", "HASTRAP", "MUL", "DIVMOD", "MEMCPY", "MEMSET", "ADD32",  \
+   "CAS"}
+
+// Assembler options; a zeroed struct (or a NULL pointer) is the default
+typedef struct {
+  bool optimize;  // -O: run the peephole optimizer
+  bool native;    // --native: write a sparse image with a host-order payload
+} asm_options_t;
+
+// All entry points report through log, which may be NULL for the console, and
+// keep no state between calls so separate jobs can run on separate threads.
+// cache and options may be NULL.
+
+int asm_symbol_run(const char* input_filename, const char* output_filename,
+                   asm_cache_t* cache, const asm_options_t* options,
+                   asm_log_t* log);
+
+// Assemble a source file in memory. When symbols is not NULL it receives the
+// program's symbol table. Returns NULL if any line failed to assemble.
+program_t* asm_assemble(const char* input_filename, asm_cache_t* cache,
+                        const asm_options_t* options,
+                        symbol_table_t** symbols, asm_log_t* log);
+
+// Assemble to an object file, and to a symbol file when symbols_filename is
+// not NULL
+int asm_run(const char* input_filename, const char* output_filename,
+            const char* symbols_filename, asm_cache_t* cache,
+            const asm_options_t* options, asm_log_t* log);
 
-int asm_symbol_run(const char* input_filename, const char* output_filename);
-int asm_run(const char* input_filename, const char* output_filename);
+// Assemble to a relocatable module for lc3 link
+int asm_module_run(const char* input_filename, const char* output_filename,
+                   asm_cache_t* cache, const asm_options_t* options,
+                   asm_log_t* log);
 
 #endif  // ASM_H
@@ -0,0 +1,36 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "asm.h"
+#include "cache.h"
+#include "log.h"
+
+// One source file of a batch assembly. The job owns its output filenames and
+// its buffered log; result is 0 on success.
+typedef struct {
+  char* input_filename;
+  char* obj_filename;
+  char* sym_filename;
+  int result;
+  asm_log_t log;
+} asm_job_t;
+
+typedef struct {
+  asm_job_t* jobs;
+  int job_count;
+  int job_capacity;
+  asm_options_t options;  // Applied to every job
+} asm_batch_t;
+
+asm_batch_t* asm_batch_create(void);
+void asm_batch_destroy(asm_batch_t* batch);
+
+// Queue a source file, or every .asm file below a directory. Returns the
+// number of files queued, or -1 if path cannot be read.
+int asm_batch_add_path(asm_batch_t* batch, const char* path);
+
+// Assemble all queued jobs on thread_count worker threads (0 picks one per
+// online CPU). Returns the number of failed jobs.
+int asm_batch_run(asm_batch_t* batch, int thread_count, asm_cache_t* cache);
+
+#endif  // BATCH_H
@@ -0,0 +1,50 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "program.h"
+#include "symbol.h"
+
+#define ASM_CACHE_PATH_MAX 4096
+#define ASM_CACHE_DEFAULT_MAX_BYTES (64ULL * 1024 * 1024)
+
+// Content-addressed store of assembled programs. Entries are keyed by a hash
+// of the source text and written atomically, so several lc3 processes can
+// share one cache directory.
+typedef struct {
+  char dir[ASM_CACHE_PATH_MAX];
+  uint64_t max_bytes;
+} asm_cache_t;
+
+// Open (creating if needed) a cache rooted at dir
+asm_cache_t* asm_cache_open(const char* dir, uint64_t max_bytes);
+
+// Open the per-user cache: $LC3_CACHE_DIR, $XDG_CACHE_HOME/lc3 or
+// ~/.cache/lc3, bounded by $LC3_CACHE_MAX_BYTES. Returns NULL when
+// $LC3_NO_CACHE is set or no directory is usable.
+asm_cache_t* asm_cache_open_default(void);
+
+void asm_cache_close(asm_cache_t* cache);
+
+uint64_t asm_cache_hash(const void* data, size_t size);
+// Continue a hash, e.g. to salt a key with assembler options
+uint64_t asm_cache_hash_update(uint64_t hash, const void* data, size_t size);
+
+// Hash the contents of a source file. Returns 0 on success.
+int asm_cache_key_file(const char* filename, uint64_t* key);
+
+// Returns the cached program for key, or NULL on a miss. When symbols is not
+// NULL it receives the cached symbol table.
+program_t* asm_cache_lookup(asm_cache_t* cache, uint64_t key,
+                            symbol_table_t** symbols);
+
+// Store an assembled program and evict the least recently used entries once
+// the cache grows beyond its size bound. Returns 0 on success.
+int asm_cache_store(asm_cache_t* cache, uint64_t key, program_t* program,
+                    symbol_table_t* symbols);
+
+void asm_cache_evict(asm_cache_t* cache);
+
+#endif  // CACHE_H
@@ -0,0 +1,37 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "symbol.h"
+
+// Disassembler over the decode table (lc3/decode.h). Addresses that
+// PC-relative operands reach and addresses that start a line are named by
+// the symbol table's labels when there is one. Words that do not encode an
+// instruction, including reserved opcodes and reserved bits set, come out
+// as .FILL.
+
+typedef struct disasm disasm_t;
+
+// symbols may be NULL; it is not needed after this returns. Returns NULL if
+// out of memory.
+disasm_t* disasm_create(const symbol_table_t* symbols);
+void disasm_destroy(disasm_t* disasm);
+
+// Assembly text of the word at address, such as "LD R0, COUNT". Returns
+// buffer.
+char* disasm_word(const disasm_t* disasm, uint16_t address, uint16_t word,
+                  char* buffer, size_t size);
+
+// List count words loaded at origin, a line for each: address, word, label
+// and text. Returns 0 on success, 1 on a write error.
+int disasm_write(const disasm_t* disasm, FILE* out, uint16_t origin,
+                 const uint16_t* words, size_t count);
+
+// List a legacy object file or sparse image, named from the .sym file next
+// to it if there is one. Returns 0 on success, 1 on failure.
+int disasm_file(FILE* out, const char* filename);
+
+#endif  // DISASM_H
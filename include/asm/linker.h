@@ -0,0 +1,16 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include <stdbool.h>
+
+#include "log.h"
+
+// Link relocatable modules into one loadable object file. Sections are laid
+// out back to back, in input order, starting at the origin of the first
+// module's first section; .GLOBAL symbols satisfy .EXTERN references across
+// modules. A symbol file with the final addresses is written next to the
+// output. native selects the output format as for program_write_image.
+int linker_run(int input_count, char* input_filenames[],
+               const char* output_filename, bool native, asm_log_t* log);
+
+#endif  // LINKER_H
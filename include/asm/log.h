@@ -0,0 +1,29 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum { ASM_LOG_INFO, ASM_LOG_WARNING, ASM_LOG_ERROR } asm_log_level_t;
+
+// Per-job diagnostics sink. An unbuffered log prints straight to the console
+// (info and warnings to stdout, errors to stderr); a buffered log collects the
+// messages so concurrent jobs can report them one file at a time.
+typedef struct {
+  bool buffered;
+  bool quiet;  // Drop info messages
+  char* buffer;
+  size_t length;
+  size_t capacity;
+  int warning_count;
+  int error_count;
+} asm_log_t;
+
+void asm_log_init(asm_log_t* log, bool buffered, bool quiet);
+void asm_log_free(asm_log_t* log);
+
+// Report a message; log may be NULL to print to the console
+void asm_log(asm_log_t* log, asm_log_level_t level, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif  // LOG_H
@@ -0,0 +1,31 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include "log.h"
+#include "program.h"
+#include "symbol.h"
+
+// Relocatable object (module) format, version 2. Every field is a big-endian
+// 16-bit word:
+//
+//   header      "LC3R", version, section count, symbol count,
+//               relocation count, string table size, reserved
+//   sections    origin, length, flags; then each section's `length` words
+//   symbols     name offset, section (0xFFFF if undefined), offset, flags
+//   relocations section, offset, type, symbol
+//   strings     NUL-terminated symbol names, padded to a whole word
+//
+// Symbol and relocation offsets are relative to the start of their section so
+// the linker can place sections anywhere.
+#define MODULE_VERSION 2
+#define MODULE_NO_SECTION 0xFFFF
+
+int module_write_file(program_t* program, symbol_table_t* symbols,
+                      const char* filename, asm_log_t* log);
+
+// Read a module back into a program and symbol table. Section words become
+// consecutive instructions and every relocation is left unapplied.
+int module_read_file(const char* filename, program_t** program,
+                     symbol_table_t** symbols, asm_log_t* log);
+
+#endif  // MODULE_H
@@ -0,0 +1,16 @@
+#ifndef OPCODE_H
+#define OPCODE_H
+
+#include <stdbool.h>
+
+// True if token (any case) is an LC-3 instruction, trap alias or assembler
+// directive, i.e. it cannot be a label
+bool opcode_is_mnemonic(const char* token);
+
+// True if token is BR with an optional n/z/p condition suffix
+bool opcode_is_branch(const char* token);
+
+// True if token is BR or BRnzp (letters in any order)
+bool opcode_is_unconditional_branch(const char* token);
+
+#endif  // OPCODE_H
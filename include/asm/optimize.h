@@ -0,0 +1,26 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "log.h"
+#include "program.h"
+#include "symbol.h"
+
+// Per-rule counts from one run of the peephole optimizer
+typedef struct {
+  int redundant_clears;   // AND Rx,Ry,#0 right before Rx is overwritten
+  int folded_adds;        // ADD Rx,Rx,#a; ADD Rx,Rx,#b merged into one ADD
+  int threaded_branches;  // Branches retargeted past an unconditional BR
+  int unreachable_words;  // Code after HALT, JMP/RET or BRnzp nothing reaches
+} optimize_stats_t;
+
+// Rewrite the assembled program in place, then close the gaps left by
+// removed instructions: PC-relative operands, labels, sections and
+// relocations are all moved to the new layout. Only words assembled from
+// instructions are touched; .FILL, .STRINGZ and .BLKW data is kept as is.
+// Code reached only through a numeric address (.FILL x3010 plus JMP) is not
+// seen as reachable. Returns 0 on success; on failure the program is left
+// unchanged.
+int optimize_program(program_t* program, symbol_table_t* symbols,
+                     optimize_stats_t* stats, asm_log_t* log);
+
+#endif  // OPTIMIZE_H
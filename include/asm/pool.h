@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_POOL_LITERALS 32
+#define MAX_POOL_USERS 128
+#define MAX_LITERAL_LENGTH 64
+
+// Literals (LD R0, =#1234 or LDI R0, =PTR) waiting to be placed. Both the
+// symbol pass and the program pass feed every line through one of these so
+// they agree on where pools go. A pool is placed after the next HALT, RET,
+// JMP or unconditional BR, at the end of the section, or, when its first
+// user would otherwise fall out of reach, in place behind a BRnzp around it.
+typedef struct {
+  char literals[MAX_POOL_LITERALS][MAX_LITERAL_LENGTH];  // Text after '='
+  int literal_count;
+  int users[MAX_POOL_USERS];          // Instruction index of each LD/LDI
+  int user_literals[MAX_POOL_USERS];  // Index into literals of each user
+  int user_count;
+  uint16_t first_user;  // Address of the first user
+} literal_pool_t;
+
+void pool_init(literal_pool_t* pool);
+
+// Copy the '=' operand of the LD or LDI starting at text into literal.
+// Returns false when the line has none.
+bool pool_literal(const char* text, char literal[MAX_LITERAL_LENGTH]);
+
+// True for instructions execution never falls through
+bool pool_is_barrier(const char* text);
+
+// True when the pending literals must be placed, behind a branch, before a
+// line of size words at address that uses literal (which may be NULL)
+bool pool_must_flush(const literal_pool_t* pool, uint16_t address, int size,
+                     const char* literal);
+
+// Record that the instruction at address (instruction index, or -1 when
+// only sizing) uses literal; equal literals share one word. Returns the
+// literal's index in the pool, or -1 if the pool is full.
+int pool_add(literal_pool_t* pool, const char* literal, uint16_t address,
+             int instruction);
+
+#endif  // POOL_H
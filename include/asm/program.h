@@ -1,28 +1,108 @@
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../lc3/debug.h"
+#include "log.h"
+#include "relax.h"
 #include "symbol.h"
 
 #define MAX_LINE_LENGTH 256
 #define MAX_INSTRUCTIONS 1000
+#define MAX_SECTIONS 16
+#define MAX_RELOCATIONS 256
+
+// Instruction kinds
+enum {
+  INSTRUCTION_CODE = 0,
+  INSTRUCTION_DATA  // .FILL, .STRINGZ and .BLKW words
+};
 
 // Instruction structure
 typedef struct {
   uint16_t address;
   uint16_t instruction;
+  uint16_t line;  // Source line it was assembled from; 0 if not known
+  uint8_t kind;
 } instruction_t;
 
+// One .ORIG ... .END block
+typedef struct {
+  uint16_t origin;
+  uint16_t length;  // Words spanned, including .BLKW space
+  int first_instruction;
+  int instruction_count;
+} section_t;
+
+// Relocation types
+enum {
+  RELOC_PC_OFFSET9 = 0,  // BR, LD, LDI, LEA, ST, STI
+  RELOC_PC_OFFSET11,     // JSR
+  RELOC_ABS16            // .FILL label
+};
+
+// A label reference whose encoding depends on where sections are placed:
+// references to another section or to a .EXTERN symbol, and .FILL label
+typedef struct {
+  int instruction;  // Index into instructions
+  int symbol;       // Index into the symbol table
+  uint8_t type;
+  bool applied;  // Already resolved against the .ORIG layout
+} relocation_t;
+
 typedef struct {
   uint16_t origin;
   instruction_t instructions[MAX_INSTRUCTIONS];
   int instruction_count;
+  section_t sections[MAX_SECTIONS];
+  int section_count;
+  relocation_t relocations[MAX_RELOCATIONS];
+  int relocation_count;
 } program_t;
 
-program_t* program_create(const char* input_filename, symbol_table_t* symbols);
+// Parse a number from a string (supports #decimal, x/Xhex, and decimal)
+int parse_number(const char* str);
+
+// Assemble the instructions of a file laid out by symbol_parse_file. With
+// relax set, lines whose label operand is out of range are added to it
+// instead of being reported, and the caller lays the file out again (see
+// asm/relax.h); the lines already in relax are assembled in their long form.
+program_t* program_create(const char* input_filename, symbol_table_t* symbols,
+                          relax_set_t* relax, asm_log_t* log);
 void program_destroy(program_t* program);
 
-void program_write_file(program_t* program, const char* filename);
+void program_add_instruction(program_t* program, uint16_t instruction,
+                             uint16_t address);
+void program_add_data(program_t* program, uint16_t word, uint16_t address);
+int program_add_relocation(program_t* program, int instruction, int symbol,
+                           uint8_t type, bool applied);
+
+// Debug info of the program: a range for each label, up to the next label
+// or the end of its section, and the source line of each instruction word.
+// Returns NULL if out of memory.
+debug_info_t* program_debug_info(const program_t* program,
+                                 const symbol_table_t* symbols,
+                                 const char* source_filename);
+
+// Lay all sections out at their .ORIG addresses in one contiguous,
+// zero-padded image. Returns a malloc'd word array, or NULL when the program
+// has unresolved references or overlapping sections.
+uint16_t* program_build_image(program_t* program, uint16_t* origin,
+                              size_t* count, asm_log_t* log);
+
+// Write count words starting at origin as a legacy object file (the origin,
+// then the words, big-endian), or with native set as a sparse image with a
+// host-order payload (see lc3/image.h). Fails if the words run past the end
+// of memory.
+int program_write_image(const char* filename, uint16_t origin,
+                        const uint16_t* words, size_t count, bool native,
+                        asm_log_t* log);
+// Write a program as program_write_image does; a sparse image stores only
+// the sections, not the padding between them
+int program_write_file(program_t* program, const char* filename, bool native,
+                       asm_log_t* log);
 
 #endif  // PROGRAM_H
@@ -0,0 +1,36 @@
+#ifndef RELAX_H
+#define RELAX_H
+
+#include <stdbool.h>
+
+#define MAX_RELAXATIONS 256
+
+// Source lines assembled in their long form because a label operand is out
+// of PC-relative range. The program pass adds lines and the symbol pass sizes
+// them, alternating until no line is added, so the layout only ever grows and
+// always reaches a fixed point. Long forms use inline address literals:
+//
+//   BRz FAR   ->  BRnp #3; LD R7, #1; JMP R7; .FILL FAR   (BRnzp drops BRnp)
+//   LD R0,FAR ->  LDI R0, #1; BRnzp #1; .FILL FAR         (ST uses STI)
+//   LEA R0,FAR -> LD R0, #1; BRnzp #1; .FILL FAR
+//   LDI R0,FAR -> LDI R0, #2; LDR R0, R0, #0; BRnzp #1; .FILL FAR
+//
+// A far BR that can reach a BRnzp to its label hops through that instead
+// (see parse_br) and is never relaxed. A long BR clobbers R7 (like TRAP) and
+// the condition codes, and is warned about. STI and JSR have no long form
+// without a spare register, so are errors when out of range.
+typedef struct {
+  int lines[MAX_RELAXATIONS];  // 1-based source line numbers, ascending
+  int count;
+} relax_set_t;
+
+bool relax_set_contains(const relax_set_t* relax, int line);
+
+// Add line; returns 0 on success, 1 if the set is full
+int relax_set_add(relax_set_t* relax, int line);
+
+// Words taken by the long form of the instruction starting at text, or 0 if
+// the instruction has none
+int relax_size(const char* text);
+
+#endif  // RELAX_H
@@ -3,12 +3,26 @@
 
 #include <stdint.h>
 
+#include "log.h"
+#include "relax.h"
+
 #define MAX_SYMBOLS 100
 
+// Section of a symbol that has no definition (yet)
+#define SYMBOL_NO_SECTION -1
+
+// Symbol flags
+enum {
+  SYMBOL_GLOBAL = 1 << 0,  // Exported with .GLOBAL
+  SYMBOL_EXTERN = 1 << 1   // Imported with .EXTERN
+};
+
 // Label structure for symbol table
 typedef struct {
   char name[64];
   uint16_t address;
+  int16_t section;  // Index of the .ORIG block defining the label
+  uint8_t flags;
 } symbol_t;
 
 typedef struct {
@@ -20,12 +34,30 @@ symbol_table_t* symbol_table_create(void);
 
 void symbol_table_destroy(symbol_table_t* symbol_table);
 
-symbol_table_t* symbol_parse_file(const char* filename);
+// Append a symbol; returns its index, or -1 if the table is full
+int symbol_table_add_symbol(symbol_table_t* symbol_table, const char* name,
+                            uint16_t address, int section, uint8_t flags);
+
+// Words taken by the instruction or directive at text (after any label).
+// Lines in relax (which may be NULL) are sized by their long form.
+int symbol_line_size(const char* text, const relax_set_t* relax, int line);
+
+// Assign label addresses. Lines in relax (which may be NULL) are sized by
+// their long form.
+symbol_table_t* symbol_parse_file(const char* filename,
+                                  const relax_set_t* relax, asm_log_t* log);
+
+// Returns the symbol's index, or -1 if there is no such symbol
+int symbol_table_find(symbol_table_t* symbol_table, const char* label_name);
 
+// Returns the address of a defined symbol, or (uint16_t)-1
 uint16_t symbol_table_find_address(symbol_table_t* symbol_table,
                                    const char* label_name);
 
-void symbol_table_write_file(symbol_table_t* symbol_table,
-                             const char* filename);
+int symbol_table_write_file(symbol_table_t* symbol_table, const char* filename,
+                            asm_log_t* log);
+// Read a file written by symbol_table_write_file. Returns NULL if it cannot
+// be read or a line is malformed.
+symbol_table_t* symbol_table_read_file(const char* filename);
 
 #endif  // SYMBOL_H
@@ -0,0 +1,76 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Debug info written by the assembler next to the object file. Fields are
+// big-endian like the sparse image:
+//
+//   header   "LC3D", version, file count (u16), label count, line count (u32)
+//   files    name offset (u32) for each source file
+//   labels   start, end (u16), name offset (u32); sorted, not overlapping
+//   lines    address, file (u16), line (u32); sorted by address
+//   strings  NUL-terminated names the offsets point into
+//
+// A label's range runs from its address to the next label or the end of its
+// .ORIG block. Lines are listed for instruction words only.
+#define DEBUG_MAGIC "LC3D"
+#define DEBUG_VERSION 1
+#define DEBUG_EXTENSION ".dbg"
+#define DEBUG_HEADER_SIZE 16
+#define DEBUG_FILE_SIZE 4
+#define DEBUG_LABEL_SIZE 8
+#define DEBUG_LINE_SIZE 8
+
+typedef struct {
+  uint16_t start;
+  uint16_t end;  // One past the label's last word
+  char* name;
+} debug_label_t;
+
+typedef struct {
+  uint16_t address;
+  uint16_t file;  // Index into files
+  uint32_t line;
+} debug_line_t;
+
+typedef struct {
+  char** files;
+  int file_count;
+  debug_label_t* labels;
+  int label_count;
+  debug_line_t* lines;
+  int line_count;
+} debug_info_t;
+
+debug_info_t* debug_info_create(void);
+void debug_info_destroy(debug_info_t* info);
+
+// Building: add in any order, then call debug_info_sort. Each returns the
+// new entry's index, or -1 if out of memory.
+int debug_info_add_file(debug_info_t* info, const char* name);
+int debug_info_add_label(debug_info_t* info, const char* name, uint16_t start,
+                         uint16_t end);
+int debug_info_add_line(debug_info_t* info, uint16_t address, uint16_t file,
+                        uint32_t line);
+void debug_info_sort(debug_info_t* info);
+
+// Write atomically. Returns 0 on success, -1 on failure with errno set.
+int debug_info_write_file(const debug_info_t* info, const char* filename);
+// Returns NULL if the file cannot be read or is malformed
+debug_info_t* debug_info_read_file(const char* filename);
+
+// Label whose range holds address, or NULL. O(log n).
+const debug_label_t* debug_info_find_label(const debug_info_t* info,
+                                           uint16_t address);
+// Source line of the word at address, or NULL. O(log n).
+const debug_line_t* debug_info_find_line(const debug_info_t* info,
+                                         uint16_t address);
+
+// Describe address as "LABEL+offset (file:line)", leaving out what is not
+// known; info may be NULL. Returns buffer.
+char* debug_info_describe(const debug_info_t* info, uint16_t address,
+                          char* buffer, size_t size);
+
+#endif  // DEBUG_H
@@ -0,0 +1,97 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+#include "lc3.h"
+
+// Instruction fields, shared by the assembler, the VM and the disassembler
+//
+//   15-12   11-9          8-6          5-0
+//   opcode  DR, SR, nzp   SR1, BaseR   imm5, offset6, SR2; or
+//                                      PCoffset9 (8-0), PCoffset11 (10-0),
+//                                      trapvect8 (7-0)
+#define LC3_OP_SHIFT 12
+#define LC3_R0_SHIFT 9
+#define LC3_R1_SHIFT 6
+#define LC3_IMM_MODE 0x0020  // ADD and AND take imm5 rather than SR2
+#define LC3_JSR_LONG 0x0800  // JSR with PCoffset11 rather than JSRR
+#define LC3_NOT_BITS 0x003F  // Low bits of NOT, all set
+
+// Register in bits 11-9: DR or SR, or the n/z/p bits of BR
+static inline uint16_t lc3_r0(uint16_t instr) {
+  return (instr >> LC3_R0_SHIFT) & 0x7;
+}
+
+// Register in bits 8-6: SR1 or BaseR
+static inline uint16_t lc3_r1(uint16_t instr) {
+  return (instr >> LC3_R1_SHIFT) & 0x7;
+}
+
+// Register in bits 2-0: SR2
+static inline uint16_t lc3_r2(uint16_t instr) { return instr & 0x7; }
+
+// Low bits of instr, sign-extended to 16 bits
+static inline uint16_t lc3_sext(uint16_t instr, int bits) {
+  int shift = 16 - bits;
+  return (uint16_t)((int16_t)(instr << shift) >> shift);
+}
+
+static inline uint16_t lc3_imm5(uint16_t instr) { return lc3_sext(instr, 5); }
+static inline uint16_t lc3_offset6(uint16_t instr) {
+  return lc3_sext(instr, 6);
+}
+static inline uint16_t lc3_pc_offset9(uint16_t instr) {
+  return lc3_sext(instr, 9);
+}
+static inline uint16_t lc3_pc_offset11(uint16_t instr) {
+  return lc3_sext(instr, 11);
+}
+static inline uint8_t lc3_trap_vect(uint16_t instr) { return instr & 0xFF; }
+
+// Opcode and register fields of an instruction; the rest are left 0
+static inline uint16_t lc3_encode(int op, int r0, int r1) {
+  return (uint16_t)(op << LC3_OP_SHIFT | r0 << LC3_R0_SHIFT |
+                    r1 << LC3_R1_SHIFT);
+}
+
+// Low bits of a signed value, for an immediate or offset field
+static inline uint16_t lc3_field(int value, int bits) {
+  return (uint16_t)(value & ((1 << bits) - 1));
+}
+
+static inline uint16_t lc3_encode_trap(int vect) {
+  return lc3_encode(LC3_OP_TRAP, 0, 0) | lc3_field(vect, 8);
+}
+
+// Operands an instruction word takes
+typedef enum {
+  LC3_FORMAT_INVALID,   // Reserved opcode or reserved bits set
+  LC3_FORMAT_REG3,      // ADD, AND: DR, SR1, SR2
+  LC3_FORMAT_REG2_IMM,  // ADD, AND: DR, SR1, imm5; LDR, STR: R, BaseR, off6
+  LC3_FORMAT_REG2,      // NOT: DR, SR
+  LC3_FORMAT_REG_PC,    // LD, LDI, LEA, ST, STI: R, PCoffset9
+  LC3_FORMAT_BRANCH,    // BR: n/z/p, PCoffset9
+  LC3_FORMAT_PC,        // JSR: PCoffset11
+  LC3_FORMAT_BASE,      // JMP, JSRR: BaseR
+  LC3_FORMAT_NONE,      // RET, RTI
+  LC3_FORMAT_TRAP,      // TRAP: trapvect8
+} lc3_format_t;
+
+typedef struct {
+  uint8_t op;      // LC3_OP_*
+  uint8_t format;  // lc3_format_t
+  uint8_t r0;      // DR or SR; the n/z/p bits of BR
+  uint8_t r1;      // SR1 or BaseR
+  uint8_t r2;      // SR2
+  int16_t imm;     // imm5, offset6, PCoffset9, PCoffset11 or trapvect8
+} lc3_decoded_t;
+
+// Decode one instruction word
+lc3_decoded_t lc3_decode(uint16_t instr);
+
+// Every instruction word decoded, indexed by the word. Built on first use;
+// safe to call from any thread.
+const lc3_decoded_t* lc3_decode_table(void);
+
+#endif  // DECODE_H
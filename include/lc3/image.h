@@ -0,0 +1,71 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sparse image container for loadable programs. Header and segment table
+// fields are big-endian:
+//
+//   header   "LC3I", version, flags, segment count, reserved, checksum (u32)
+//   segments address, length, flags, reserved, payload offset (u32)
+//   payload  each segment's words, big-endian unless IMAGE_LITTLE_ENDIAN
+//
+// The checksum is FNV-1a over everything after the header. Gaps between
+// segments are not stored, so code at x3000 and data at xC000 cost only
+// their own words.
+#define IMAGE_MAGIC "LC3I"
+#define IMAGE_VERSION 1
+#define IMAGE_HEADER_SIZE 16
+#define IMAGE_SEGMENT_SIZE 12
+
+// Image flags
+enum {
+  IMAGE_LITTLE_ENDIAN = 1 << 0  // Payload words are little-endian
+};
+
+// Segment flags
+enum {
+  IMAGE_SEGMENT_ZERO = 1 << 0  // All zero; no payload is stored
+};
+
+typedef struct {
+  uint16_t address;
+  uint16_t length;
+  uint16_t flags;
+  const uint16_t* words;  // Host-order words when writing; raw payload words
+                          // (see image_is_native) when read from an image
+} image_segment_t;
+
+// A read-only mapping of an image file, or an image already in memory
+typedef struct {
+  const unsigned char* data;
+  size_t size;
+  uint16_t flags;
+  int segment_count;
+  bool mapped;  // data is a mapping that image_close unmaps
+} image_t;
+
+// Write segments to filename atomically. With native set the payload is
+// stored in host byte order so loading on a same-endian host needs no
+// swapping. Returns 0 on success, -1 on failure with errno set.
+int image_write_file(const char* filename, const image_segment_t* segments,
+                     int segment_count, bool native);
+
+// Map and validate an image. Returns 0 on success, 1 if the file cannot be
+// read or is not a well-formed image.
+int image_open(const char* filename, image_t* image);
+// Validate an image held in memory; data must stay valid and 2-byte
+// aligned while the image is in use. Returns 0 on success, 1 if it is not a
+// well-formed image.
+int image_open_memory(const void* data, size_t size, image_t* image);
+void image_close(image_t* image);
+
+// True when payload words are already in host byte order
+bool image_is_native(const image_t* image);
+
+void image_get_segment(const image_t* image, int index,
+                       image_segment_t* segment);
+
+#endif  // IMAGE_H
@@ -4,6 +4,12 @@
 // LC-3 Architecture Constants
 #define LC3_MEMORY_MAX (1 << 16)  // 65536 memory locations
 #define LC3_PC_START 0x3000       // Default PC start location
+#define LC3_SSP_START 0x3000      // Supervisor stack, growing down
+#define LC3_TRAP_TABLE 0x0000     // Trap vector table
+#define LC3_INTERRUPT_TABLE 0x0100  // Interrupt and exception vector table
+
+// Relocatable modules start with this magic instead of an origin word
+#define LC3_MODULE_MAGIC "LC3R"
 
 // LC-3 Registers
 enum {
@@ -30,7 +36,7 @@ enum {
   LC3_OP_AND,     // Bitwise and
   LC3_OP_LDR,     // Load register
   LC3_OP_STR,     // Store register
-  LC3_OP_RTI,     // Unused
+  LC3_OP_RTI,     // Return from trap or interrupt
   LC3_OP_NOT,     // Bitwise not
   LC3_OP_LDI,     // Load indirect
   LC3_OP_STI,     // Store indirect
@@ -58,10 +64,49 @@ enum {
   LC3_TRAP_HALT = 0x25    // Halt the program
 };
 
+// Extension traps; programs check for each one with LC3_TRAP_HASTRAP first
+enum {
+  LC3_TRAP_HASTRAP = 0x30,  // R0 = 1 if vector R0 is implemented, else 0
+  LC3_TRAP_MUL = 0x31,      // R1:R0 = R0 * R1 (signed 32-bit product)
+  LC3_TRAP_DIVMOD = 0x32,   // R0 = R0 / R1, R1 = R0 % R1 (signed, truncating)
+  LC3_TRAP_MEMCPY = 0x33,   // Copy R2 words from R1 to R0 (may overlap)
+  LC3_TRAP_MEMSET = 0x34,   // Fill R2 words at R0 with R1
+  LC3_TRAP_ADD32 = 0x35,    // R1:R0 += R3:R2
+  LC3_TRAP_CAS = 0x36       // If [R0] == R1 then [R0] = R2; R1 = old [R0],
+                            // R0 = 1 if swapped, else 0
+};
+
+#define LC3_TRAP_COUNT 256
+
+// Exception and interrupt vectors in the interrupt vector table
+enum {
+  LC3_EX_PRIVILEGE = 0x00,  // RTI in user mode
+  LC3_EX_ILLEGAL = 0x01,    // Reserved opcode
+  LC3_INT_KEYBOARD = 0x80,  // Key ready with KBSR interrupts enabled
+  LC3_INT_TIMER = 0x81      // Timer expired with TMR interrupts enabled
+};
+
+// Processor status register bits; bits 2-0 are the condition codes
+#define LC3_PSR_USER 0x8000      // Set in user mode, clear in supervisor mode
+#define LC3_PSR_PRIORITY 0x0700  // Priority level
+
 // Memory Mapped Registers
 enum {
-  LC3_MR_KBSR = 0xFE00,  // Keyboard status
-  LC3_MR_KBDR = 0xFE02   // Keyboard data
+  LC3_MR_KBSR = 0xFE00,    // Keyboard status
+  LC3_MR_KBDR = 0xFE02,    // Keyboard data
+  LC3_MR_DSR = 0xFE04,     // Display status
+  LC3_MR_DDR = 0xFE06,     // Display data
+  LC3_MR_TMR = 0xFE08,     // Timer status
+  LC3_MR_TMI = 0xFE0A,     // Timer interval in instructions; 0 stops it
+  LC3_MR_HARTID = 0xFE10,  // Number of the hart reading it, from 0
+  LC3_MR_HARTS = 0xFE12,   // Number of harts
+  LC3_MR_PSR = 0xFFFC,     // Processor status
+  LC3_MR_MCR = 0xFFFE      // Machine control; clearing bit 15 halts
 };
 
+// Ready bit of KBSR, DSR and TMR, clock enable bit of MCR
+#define LC3_MR_READY 0x8000
+// Interrupt enable bit of KBSR and TMR
+#define LC3_MR_IE 0x4000
+
 #endif  // LC3_H
@@ -0,0 +1,9 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// Nanoseconds on the monotonic clock, for measuring intervals
+uint64_t clock_now_ns(void);
+
+#endif  // CLOCK_H
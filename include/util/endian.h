@@ -0,0 +1,13 @@
+#ifndef ENDIAN_H
+#define ENDIAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// LC-3 object files store words big-endian
+uint16_t swap16(uint16_t val);
+
+// Byte swap `count` words from src into dst (dst and src may be equal)
+void swap16_copy(uint16_t* dst, const uint16_t* src, size_t count);
+
+#endif  // ENDIAN_H
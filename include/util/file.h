@@ -0,0 +1,14 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stddef.h>
+
+// Write `size` bytes to `filename` through a temporary file in the same
+// directory that is renamed into place, so readers never observe a partially
+// written file. Returns 0 on success, -1 on failure with errno set.
+int file_write_atomic(const char* filename, const void* data, size_t size);
+
+// Return a malloc'd copy of filename with its extension replaced (or added)
+char* file_change_extension(const char* filename, const char* extension);
+
+#endif  // FILE_H
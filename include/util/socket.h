@@ -0,0 +1,17 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+// Listen on a Unix stream socket at path, replacing a socket file left by an
+// earlier run. Returns the non-blocking listening fd, or -1 on failure with
+// errno set.
+int socket_listen_unix(const char* path, int backlog);
+
+// Connect to the Unix stream socket at path. Returns the fd, or -1 on
+// failure with errno set.
+int socket_connect_unix(const char* path);
+
+// Make reads and writes on fd return EAGAIN instead of blocking. Returns 0
+// on success, -1 on failure with errno set.
+int socket_set_nonblocking(int fd);
+
+#endif  // SOCKET_H
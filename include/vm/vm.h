@@ -2,16 +2,239 @@
 #define VM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "../lc3/debug.h"
 #include "../lc3/lc3.h"
 
+typedef struct vm vm_t;
+typedef struct vm_cache vm_cache_t;
+typedef struct vm_cycles vm_cycles_t;
+typedef struct vm_profile vm_profile_t;
+
+// Native handler for a TRAP vector
+typedef void (*vm_trap_fn)(vm_t* vm);
+
+#define VM_IDIOM_MAX 255
+#define VM_IDIOM_MAX_LENGTH 6
+
+typedef enum {
+  VM_IDIOM_COPY,       // LDR/STR/ADD/ADD/ADD/BRp word copy
+  VM_IDIOM_MUL_ADD,    // Repeated-addition multiply
+  VM_IDIOM_MUL_SHIFT,  // Shift-and-add multiply
+  VM_IDIOM_DIV_SUB,    // Repeated-subtraction divide
+} vm_idiom_kind_t;
+
+// A loop recognized at load time that runs as one native operation
+typedef struct {
+  uint16_t start;
+  uint16_t length;
+  uint16_t words[VM_IDIOM_MAX_LENGTH];  // The loop as it was recognized
+  vm_idiom_kind_t kind;
+  uint8_t reg[5];  // Registers in the roles listed by each matcher
+} vm_idiom_t;
+
+#define VM_EVENT_MAX 8
+
+// Device events; each kind has at most one pending event
+typedef enum {
+  VM_EVENT_KEYBOARD,  // Poll the keyboard for an interrupt
+  VM_EVENT_DISPLAY,   // The display finished the last character
+  VM_EVENT_TIMER,     // The interval timer expired
+  VM_EVENT_QUANTUM,   // The hart's or session's turn is over
+  VM_EVENT_BUDGET,    // limits.max_instructions ran out
+  VM_EVENT_WATCHDOG,  // Time to compare the clock with the deadline
+  VM_EVENT_STATS,     // Time to check for a statistics report request
+} vm_event_kind_t;
+
+typedef struct {
+  uint64_t time;  // Instruction count at which the event is due
+  vm_event_kind_t kind;
+} vm_event_t;
+
+// Why vm_execute returned. Calling vm_execute again after a stop other than
+// HALT or ERROR resumes the program where it left off.
+typedef enum {
+  VM_STOP_HALT,     // HALT, or MCR's clock enable bit was cleared
+  VM_STOP_ERROR,    // Unknown opcode or trap
+  VM_STOP_QUANTUM,  // The hart's or session's turn is over
+  VM_STOP_INPUT,    // GETC or IN found no buffered input
+  VM_STOP_OUTPUT,   // The output buffer reached its high-water mark
+  VM_STOP_BUDGET,   // limits.max_instructions ran out
+  VM_STOP_TIMEOUT,  // limits.timeout_ms passed
+  VM_STOP_LOOP,     // The loop detector saw the program repeat itself
+} vm_stop_t;
+
+// Limits on a run; 0 or false turns a limit off. See vm_limit.h.
+typedef struct {
+  uint64_t max_instructions;
+  uint64_t timeout_ms;
+  bool detect_loops;
+} vm_limits_t;
+
+// Default for how much buffered output makes output traps stop the VM
+#define VM_IO_HIGH_WATER 4096
+
+// Console I/O for the traps and keyboard/display registers. Unbuffered
+// channels use stdin and stdout directly. Buffered ones never block: input
+// comes from what vm_io_feed supplied, and output collects until the owner
+// takes it, so one thread can host many VMs.
 typedef struct {
-  uint16_t memory[LC3_MEMORY_MAX];
+  bool buffered;
+  uint8_t* input;
+  size_t input_start;  // Next byte to read
+  size_t input_length;
+  size_t input_capacity;
+  bool input_closed;  // Nothing follows the buffered input
+  uint8_t* output;
+  size_t output_length;
+  size_t output_capacity;
+  size_t high_water;  // Output traps stop once this much output is buffered
+} vm_io_t;
+
+// Size of a cache line; counters updated by different threads stay on
+// different lines
+#define VM_CACHE_LINE 64
+
+// Counters of one VM; see vm_stats.h for reports. Instructions retired are
+// the event clock (vm_event_now); opcodes only counts the ones that were
+// interpreted, not those run inside recognized loops.
+typedef struct {
+  _Alignas(VM_CACHE_LINE) uint64_t opcodes[16];
+  uint64_t traps[LC3_TRAP_COUNT];
+  uint64_t branches_taken;
+  uint64_t branches_not_taken;
+  uint64_t memory_reads;  // Loads, stores and stack accesses; not fetches
+  uint64_t memory_writes;
+  uint64_t load_ns;
+  uint64_t run_ns;
+  uint64_t run_start_ns;  // When run_ns was last brought up to date
+} vm_stats_t;
+
+// Device registers occupy xFE00-xFFFF; every hart has its own
+#define VM_DEVICE_COUNT (LC3_MEMORY_MAX - LC3_MR_KBSR)
+
+struct vm {
+  // LC3_MEMORY_MAX words, shared by all harts of an SMP machine and freed
+  // with the VM only when owns_memory is set
+  uint16_t* memory;
+  bool owns_memory;
+  // Labels and source lines of the loaded program, from the .dbg file next
+  // to it; NULL when there is none. Owned by the VM.
+  debug_info_t* debug;
   uint16_t reg[LC3_R_COUNT];
   bool running;
-} vm_t;
+  // Why the last vm_execute returned
+  vm_stop_t stop;
+  vm_io_t io;
+  // Read by programs from HARTID and HARTS
+  uint16_t hart_id;
+  uint16_t hart_count;
+  // Handlers for vectors beyond the standard GETC..HALT and HASTRAP; NULL
+  // vectors stop the VM as unknown traps
+  vm_trap_fn traps[LC3_TRAP_COUNT];
+  // Recognized loops; idiom_at maps a loop head to its index + 1, or 0
+  vm_idiom_t idioms[VM_IDIOM_MAX];
+  int idiom_count;
+  uint8_t idiom_at[LC3_MEMORY_MAX];
+  // One bit per address an instruction was executed from; see vm_coverage.h
+  uint8_t coverage[LC3_MEMORY_MAX / 8];
+  // Simulated caches, NULL when off; see vm_cache.h. Owned by the VM.
+  vm_cache_t* icache;
+  vm_cache_t* dcache;
+  // Estimated cycles by routine, NULL when off; see vm_cycles.h. Owned by
+  // the VM.
+  vm_cycles_t* cycles;
+  // Instructions by call path, NULL when off; see vm_profile.h. Owned by
+  // the VM.
+  vm_profile_t* profile;
+  // Privilege and priority bits of the PSR; the condition codes stay in
+  // reg[LC3_R_COND]. The inactive stack pointer is kept in saved_ssp or
+  // saved_usp while R6 holds the other.
+  uint16_t psr;
+  uint16_t saved_ssp;
+  uint16_t saved_usp;
+  // Trap vector table as the OS image left it. A TRAP through an entry that
+  // still holds this address runs natively when fast_traps is set.
+  uint16_t stock_vectors[LC3_TRAP_COUNT];
+  bool fast_traps;
+  // Pending device events as a min-heap on time. The next one is due at
+  // deadline, countdown instructions from now; vm_execute only looks at the
+  // devices once countdown reaches 0.
+  vm_event_t events[VM_EVENT_MAX];
+  int event_count;
+  uint64_t deadline;
+  int64_t countdown;
+  uint16_t devices[VM_DEVICE_COUNT];
+  // Run limits. deadline_ns is set when the first vm_execute starts.
+  vm_limits_t limits;
+  uint64_t deadline_ns;
+  // Counts stores, device accesses, traps and interrupts. The loop detector
+  // keeps the registers, PSR and this count from the last taken branch.
+  uint32_t effects;
+  uint32_t loop_effects;
+  uint16_t loop_reg[LC3_R_COUNT];
+  uint16_t loop_psr;
+  vm_stats_t stats;
+};
+
+// Describe the address of the instruction just fetched, for messages: its
+// label and source line when the program has debug info
+#define VM_DESCRIBE_MAX 256
+char* vm_describe_pc(const vm_t* vm, char* buffer, size_t size);
+
+// Device registers and the PSR; see vm_device.c
+uint16_t vm_device_read(vm_t* vm, uint16_t address);
+void vm_device_write(vm_t* vm, uint16_t address, uint16_t value);
+
+// Memory access for fetches, loads and stores; xFE00 and up are device
+// registers. Each word is read and written atomically, with acquire and
+// release ordering, so harts sharing memory never see a torn word. Fetches
+// are not counted in stats.memory_reads.
+static inline uint16_t vm_mem_fetch(vm_t* vm, uint16_t address) {
+  if (address >= LC3_MR_KBSR) return vm_device_read(vm, address);
+  return __atomic_load_n(&vm->memory[address], __ATOMIC_ACQUIRE);
+}
+
+static inline uint16_t vm_mem_read(vm_t* vm, uint16_t address) {
+  vm->stats.memory_reads++;
+  return vm_mem_fetch(vm, address);
+}
+
+static inline void vm_mem_write(vm_t* vm, uint16_t address, uint16_t value) {
+  vm->effects++;
+  vm->stats.memory_writes++;
+  if (address >= LC3_MR_KBSR) {
+    vm_device_write(vm, address, value);
+  } else {
+    __atomic_store_n(&vm->memory[address], value, __ATOMIC_RELEASE);
+  }
+}
+
+vm_t* vm_create(void);
+// Create a VM that runs on memory owned by the caller
+vm_t* vm_create_shared(uint16_t* memory);
+// Create a VM holding a copy of src's memory and what loading it computed
+// (recognized loops, stock trap vectors), with registers and devices reset
+vm_t* vm_clone(const vm_t* src);
+// Put registers, devices, console and load-time state back the way
+// vm_create left them so the VM can run another program. Memory is kept.
+void vm_reset(vm_t* vm);
+void vm_destroy(vm_t* vm);
+
+int vm_load_file(vm_t* vm, const char* filename);
+int vm_load_image(vm_t* vm, uint16_t origin, const uint16_t* words,
+                  size_t count);
+
+// Run until the program stops; vm->stop tells why. Returns 1 after an
+// unknown opcode, 0 otherwise.
+int vm_execute(vm_t* vm);
 
+// Load and run a program; the return value is a VM_EXIT_* code (vm_limit.h)
 int vm_run(const char* filename);
+// Load an OS image, then the program, and run the program in user mode
+int vm_run_os(const char* os_filename, const char* filename);
+int vm_run_image(uint16_t origin, const uint16_t* words, size_t count);
 
 #endif  // VM_H
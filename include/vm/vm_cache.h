@@ -0,0 +1,105 @@
+#ifndef VM_CACHE_H
+#define VM_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../lc3/decode.h"
+#include "vm.h"
+
+// Cache simulator. A VM with an instruction or data cache attached runs on
+// a separate build of the interpreter loop (see vm_execute) that feeds every
+// fetch and every LD, LDI, LDR, ST, STI and STR address to the model; a VM
+// without one runs the plain loop, so the model costs nothing when off.
+// Sizes are in words. Caches allocate on writes as well as reads. Device
+// registers, trap routines and recognized loops (which the cached loop
+// interprets instruction by instruction) are not cached.
+
+#define VM_CACHE_MAX_WAYS 64
+
+typedef enum {
+  VM_CACHE_LRU,     // Evict the line used longest ago
+  VM_CACHE_FIFO,    // Evict the line filled longest ago
+  VM_CACHE_RANDOM,  // Evict any line of the set
+} vm_cache_policy_t;
+
+typedef struct {
+  uint32_t size;  // Words; a power of two
+  uint32_t line;  // Words per line; a power of two
+  uint32_t ways;  // 1 for direct-mapped, size / line for fully associative
+  vm_cache_policy_t policy;
+} vm_cache_config_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;  // Misses that replaced a valid line
+} vm_cache_counts_t;
+
+struct vm_cache {
+  vm_cache_config_t config;
+  uint32_t set_mask;
+  int line_shift;
+  uint16_t* tags;   // sets * ways line numbers
+  uint64_t* stamp;  // Last use (LRU) or fill (FIFO); 0 for an empty way
+  uint64_t clock;
+  uint32_t random;
+  vm_cache_counts_t total;
+  // Counts by accessed address, summed by label in reports
+  vm_cache_counts_t by_address[LC3_MEMORY_MAX];
+};
+
+// Parse "size=256,line=4,ways=2,policy=lru"; missing keys keep the
+// defaults of 256 words, 4-word lines, 2 ways and LRU. Returns 0 on success,
+// 1 on a malformed or inconsistent spec.
+int vm_cache_parse(const char* spec, vm_cache_config_t* config);
+
+// Returns NULL if out of memory; config must be valid (see vm_cache_parse)
+vm_cache_t* vm_cache_create(const vm_cache_config_t* config);
+void vm_cache_destroy(vm_cache_t* cache);
+
+// Look address up, filling its line on a miss
+void vm_cache_access(vm_cache_t* cache, uint16_t address);
+
+// Give the command-line runners these caches (NULL for none) on every VM
+void vm_cache_configure(const vm_cache_config_t* icache,
+                        const vm_cache_config_t* dcache);
+// Attach the configured caches to each VM. Does nothing when none is set.
+void vm_cache_attach(vm_t* const* vms, int count);
+// Report on stderr and remove the caches
+void vm_cache_detach(void);
+
+// Write totals and the counts of each label of debug (which may be NULL)
+void vm_cache_report(FILE* out, const char* name, const vm_cache_t* cache,
+                     const debug_info_t* debug);
+
+// Feed the data addresses of a load or store about to execute to
+// vm->dcache, before it changes the registers they come from
+static inline void vm_cache_data(vm_t* vm, uint16_t instr) {
+  uint16_t pc = vm->reg[LC3_R_PC];
+  uint16_t address;
+  switch (instr >> 12) {
+    case LC3_OP_LD:
+    case LC3_OP_ST:
+      address = pc + lc3_pc_offset9(instr);
+      break;
+    case LC3_OP_LDR:
+    case LC3_OP_STR:
+      address = vm->reg[lc3_r1(instr)] + lc3_offset6(instr);
+      break;
+    case LC3_OP_LDI:
+    case LC3_OP_STI:
+      // The pointer, then the word it points to
+      address = pc + lc3_pc_offset9(instr);
+      if (address >= LC3_MR_KBSR) return;
+      vm_cache_access(vm->dcache, address);
+      address = __atomic_load_n(&vm->memory[address], __ATOMIC_ACQUIRE);
+      break;
+    default:
+      return;
+  }
+  if (address < LC3_MR_KBSR) vm_cache_access(vm->dcache, address);
+}
+
+#endif  // VM_CACHE_H
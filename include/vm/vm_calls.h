@@ -0,0 +1,41 @@
+#ifndef VM_CALLS_H
+#define VM_CALLS_H
+
+#include <stdint.h>
+
+// Shadow call stack for the profiles on the instrumented interpreter loop
+// (vm_cycles.h, vm_profile.h). A JSR, JSRR or a TRAP into memory pushes a
+// frame. A JMP (RET, normally) or an RTI to the return address of a frame
+// on the stack pops it along with every frame above it, so routines that
+// return past their caller or never return do not leave the stack out of
+// step; any other JMP or RTI is just a jump. Interrupt handlers push no
+// frame and are counted in the frame they interrupt.
+
+#define VM_CALLS_MAX_DEPTH 1024
+
+typedef struct {
+  // return_to[0] belongs to the program itself, which never returns
+  uint16_t return_to[VM_CALLS_MAX_DEPTH];
+  int depth;
+  uint64_t dropped;  // Calls not tracked for want of frames
+} vm_calls_t;
+
+// What an instruction did to the stack
+typedef enum {
+  VM_CALLS_NONE,
+  VM_CALLS_PUSH,  // A call to next: the frame at depth - 1
+  VM_CALLS_POP,   // A return: the frames from the old depth down were closed
+} vm_calls_change_t;
+
+// An empty stack but for the program's frame
+void vm_calls_init(vm_calls_t* calls);
+
+// Follow the instruction at pc that just ran; next is the PC it left
+vm_calls_change_t vm_calls_step(vm_calls_t* calls, uint16_t pc,
+                                uint16_t instr, uint16_t next);
+
+// Take back the frame just pushed when its owner cannot track it. Its
+// return then passes for a jump.
+void vm_calls_drop(vm_calls_t* calls);
+
+#endif  // VM_CALLS_H
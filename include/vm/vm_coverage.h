@@ -0,0 +1,41 @@
+#ifndef VM_COVERAGE_H
+#define VM_COVERAGE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "../lc3/debug.h"
+#include "vm.h"
+
+// Code coverage. Every VM sets a bit in vm->coverage for each address it
+// executes an instruction from, always, with an OR that needs no branch.
+// Reports map those bits to source lines through the debug info the VM
+// loads with the program (see lc3/debug.h).
+
+// True when an instruction at address has been executed
+static inline bool vm_coverage_hit(const vm_t* vm, uint16_t address) {
+  return vm->coverage[address >> 3] & (1 << (address & 7));
+}
+
+// Mark length addresses from start executed, for recognized loops that run
+// as one native operation
+void vm_coverage_mark(vm_t* vm, uint16_t start, uint16_t length);
+
+// Have the command-line runners write an lcov tracefile to path when the
+// program stops; NULL turns reports off
+void vm_coverage_configure(const char* path);
+
+// Report on vms until vm_coverage_detach, with the source lines of the
+// first VM's debug info. Does nothing when reports are off.
+void vm_coverage_attach(vm_t* const* vms, int count);
+
+// Write the report and forget the VMs
+void vm_coverage_detach(void);
+
+// Write an lcov tracefile record for each source file of debug, with a
+// line counted as hit when any of its instruction words was executed by
+// any of vms. Returns 0 on success, 1 on failure.
+int vm_coverage_write_lcov(FILE* out, vm_t* const* vms, int count,
+                           const debug_info_t* debug);
+
+#endif  // VM_COVERAGE_H
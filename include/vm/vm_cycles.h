@@ -0,0 +1,77 @@
+#ifndef VM_CYCLES_H
+#define VM_CYCLES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+#include "vm_calls.h"
+
+// Estimated cycles. A VM with a cycle profile attached runs on the
+// instrumented interpreter loop (see vm_execute), which charges every
+// instruction its opcode's cost plus extras for data accesses, the pointer
+// word of LDI and STI, and taken branches. Cycles are totaled for each
+// subroutine, as the frames of a shadow call stack (vm_calls.h) open and
+// close.
+//
+// The LC-3 defines no timing, so the default costs are only a rough model
+// of its microarchitecture: 1 per instruction, 2 for JSR and TRAP, 3 for
+// RTI, 2 per data word, 1 for the indirection and 1 for a taken branch.
+
+typedef struct {
+  uint16_t op[16];    // By opcode
+  uint16_t memory;    // Each data word read or written
+  uint16_t indirect;  // On top of LDI and STI's two data words
+  uint16_t taken;     // On top of a BR that branches
+} vm_cycles_config_t;
+
+typedef struct {
+  uint16_t entry;
+  uint64_t start;  // total when the frame opened
+} vm_cycles_frame_t;
+
+typedef struct {
+  uint64_t calls;
+  uint64_t inclusive;  // Including the routines it called
+  uint64_t exclusive;  // In the routine's own instructions
+} vm_cycles_routine_t;
+
+struct vm_cycles {
+  vm_cycles_config_t config;
+  uint64_t total;
+  vm_calls_t calls;
+  // The routine of each frame on calls; frames[0] is the program itself
+  vm_cycles_frame_t frames[VM_CALLS_MAX_DEPTH];
+  // Open frames of each entry, so recursion counts inclusive cycles once
+  uint32_t active[LC3_MEMORY_MAX];
+  vm_cycles_routine_t routines[LC3_MEMORY_MAX];  // By entry address
+};
+
+// Parse "ldi=2,memory=3,taken=2": costs for opcodes by mnemonic and for the
+// extras by name, over the defaults. Returns 0 on success, 1 otherwise.
+int vm_cycles_parse(const char* spec, vm_cycles_config_t* config);
+
+// A profile of a program starting at entry. Returns NULL if out of memory.
+vm_cycles_t* vm_cycles_create(const vm_cycles_config_t* config,
+                              uint16_t entry);
+void vm_cycles_destroy(vm_cycles_t* cycles);
+
+// Charge the instruction at pc that just ran and follow calls and returns
+void vm_cycles_step(vm_t* vm, uint16_t pc, uint16_t instr);
+
+// Close every open frame, the program's included, as if it returned
+void vm_cycles_finish(vm_cycles_t* cycles);
+
+// Profile the command-line runners' VMs with config, or not when NULL
+void vm_cycles_configure(const vm_cycles_config_t* config);
+// Attach a profile to each VM. Does nothing when none is configured.
+void vm_cycles_attach(vm_t* const* vms, int count);
+// Report on stderr and remove the profiles
+void vm_cycles_detach(void);
+
+// Write the routines of a finished profile, most inclusive cycles first,
+// named from debug (which may be NULL). Returns 0 on success, 1 on failure.
+int vm_cycles_report(FILE* out, const vm_cycles_t* cycles,
+                     const debug_info_t* debug);
+
+#endif  // VM_CYCLES_H
@@ -0,0 +1,23 @@
+#ifndef VM_DEVICE_H
+#define VM_DEVICE_H
+
+#include "vm.h"
+
+// Interrupt priorities of the devices
+#define VM_KEYBOARD_PRIORITY 4
+#define VM_TIMER_PRIORITY 5
+
+// How often the keyboard is polled while its interrupt is enabled
+#define VM_KEYBOARD_POLL_INTERVAL 1024
+// Instructions the display takes to show one character
+#define VM_DISPLAY_DELAY 16
+
+// Put the device registers in their reset state and clear the event queue
+void vm_device_reset(vm_t* vm);
+
+// Handle the device events that are due, then raise the highest priority
+// interrupt the processor accepts. vm_execute calls this when the event
+// countdown runs out.
+void vm_device_update(vm_t* vm);
+
+#endif  // VM_DEVICE_H
@@ -0,0 +1,34 @@
+#ifndef VM_EVENT_H
+#define VM_EVENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+// Empty the queue and restart the instruction count at 0
+void vm_event_reset(vm_t* vm);
+
+// Instructions executed since the reset
+uint64_t vm_event_now(const vm_t* vm);
+
+// Queue an event delay instructions from now, replacing any pending event
+// of the same kind
+void vm_event_schedule(vm_t* vm, vm_event_kind_t kind, uint64_t delay);
+
+// Drop the pending event of kind, if any
+void vm_event_cancel(vm_t* vm, vm_event_kind_t kind);
+
+// Whether an event of kind is queued
+bool vm_event_pending(const vm_t* vm, vm_event_kind_t kind);
+
+// Take the earliest event that is due by now. Returns false if none is.
+bool vm_event_pop_due(vm_t* vm, vm_event_kind_t* kind);
+
+// Point the countdown at the earliest pending event
+void vm_event_rearm(vm_t* vm);
+
+// Make vm_execute look at the devices before the next instruction
+void vm_event_wake(vm_t* vm);
+
+#endif  // VM_EVENT_H
@@ -3,6 +3,9 @@
 
 #include "vm.h"
 
+// Set the condition codes from the value of register reg
+void vm_update_flags(vm_t* vm, uint16_t reg);
+
 void vm_exec_add(vm_t* vm, uint16_t instr);
 void vm_exec_and(vm_t* vm, uint16_t instr);
 void vm_exec_not(vm_t* vm, uint16_t instr);
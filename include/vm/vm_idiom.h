@@ -0,0 +1,25 @@
+#ifndef VM_IDIOM_H
+#define VM_IDIOM_H
+
+#include <stdbool.h>
+
+#include "vm.h"
+
+// Find the loops in memory that have a native equivalent, replacing the
+// results of any earlier scan. The loaders call this once the program is in
+// memory.
+void vm_idiom_scan(vm_t* vm);
+
+// Install the results of an earlier scan of the same program instead of
+// scanning again. The VM must have no recognized loops (see vm_reset).
+void vm_idiom_restore(vm_t* vm, const vm_idiom_t* idioms, int count);
+
+// Run the loop whose head is at PC as one operation, leaving registers,
+// flags and memory as the interpreted loop would. Returns false without
+// changing anything when the loop has to be interpreted: its words changed
+// since the scan (the idiom is then dropped), its inputs are outside what
+// the native version covers, or it would run past the next device event.
+// The instructions the loop stands for count toward the event countdown.
+bool vm_idiom_run(vm_t* vm, vm_idiom_t* idiom);
+
+#endif  // VM_IDIOM_H
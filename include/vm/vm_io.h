@@ -0,0 +1,42 @@
+#ifndef VM_IO_H
+#define VM_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+// vm_io_getc results besides a byte
+#define VM_IO_EOF (-1)
+#define VM_IO_EMPTY (-2)  // Buffered and nothing to read yet
+
+// Unbuffered console on stdin and stdout
+void vm_io_init(vm_t* vm);
+// Switch to buffered input and output; see vm_io_t
+void vm_io_init_buffered(vm_t* vm);
+// Empty both buffers, keeping their memory, and go back to stdin and stdout
+void vm_io_reset(vm_t* vm);
+void vm_io_free(vm_t* vm);
+
+// Append bytes to the input buffer. Returns 0 on success, 1 if out of
+// memory.
+int vm_io_feed(vm_t* vm, const void* data, size_t size);
+// Mark the end of input; reads past the buffered bytes return VM_IO_EOF
+void vm_io_close_input(vm_t* vm);
+
+// Next input byte, VM_IO_EOF, or VM_IO_EMPTY when a buffered channel has to
+// wait for more. Unbuffered channels block on stdin.
+int vm_io_getc(vm_t* vm);
+// Whether vm_io_getc would return without blocking or VM_IO_EMPTY
+bool vm_io_key_ready(vm_t* vm);
+
+// Whether output traps may write; false once a buffered channel holds
+// high_water bytes
+bool vm_io_can_write(const vm_t* vm);
+void vm_io_putc(vm_t* vm, char c);
+// End of one output trap or DDR write; stdout is flushed, buffers are not
+void vm_io_flush(vm_t* vm);
+// Drop the first count bytes of buffered output once the owner wrote them
+void vm_io_consume_output(vm_t* vm, size_t count);
+
+#endif  // VM_IO_H
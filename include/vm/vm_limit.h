@@ -0,0 +1,41 @@
+#ifndef VM_LIMIT_H
+#define VM_LIMIT_H
+
+#include "vm.h"
+
+// How often the watchdog reads the clock, in instructions
+#define VM_WATCHDOG_INTERVAL 65536
+
+// Exit codes of the command-line runners
+#define VM_EXIT_HALT 0
+#define VM_EXIT_ERROR 1
+#define VM_EXIT_BUDGET 2
+#define VM_EXIT_TIMEOUT 3
+#define VM_EXIT_LOOP 4
+
+// Take the limits from LC3_MAX_INSTRUCTIONS, LC3_TIMEOUT_MS and
+// LC3_DETECT_LOOPS. Called by vm_reset.
+void vm_limit_reset(vm_t* vm);
+
+// Replace the limits and restart the instruction budget and the clock.
+// The budget and the watchdog are device events, so they cost nothing
+// between events.
+void vm_limit_set(vm_t* vm, const vm_limits_t* limits);
+
+// Start the clock on the first vm_execute since the limits were set
+void vm_limit_start(vm_t* vm);
+
+// Handle VM_EVENT_BUDGET or VM_EVENT_WATCHDOG
+void vm_limit_event(vm_t* vm, vm_event_kind_t kind);
+
+// Called after every taken branch while limits.detect_loops is set. Stops
+// the VM with VM_STOP_LOOP when a branch lands on the PC of the previous
+// taken branch with the same registers and PSR, and nothing else can have
+// changed: no store, device access, trap or interrupt in between, one hart,
+// and no keyboard or timer interrupt that could still arrive.
+void vm_limit_branch(vm_t* vm);
+
+// Exit code for a run that stopped; result is what vm_execute returned
+int vm_limit_exit_code(const vm_t* vm, int result);
+
+#endif  // VM_LIMIT_H
@@ -0,0 +1,35 @@
+#ifndef VM_OS_H
+#define VM_OS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+// Put the PSR and stacks in their reset state: user mode, priority 0, an
+// empty supervisor stack at LC3_SSP_START and no OS loaded
+void vm_os_reset(vm_t* vm);
+
+// Load an OS image and remember its trap vector table as the stock one
+int vm_os_load(vm_t* vm, const char* filename);
+
+// Send TRAP vector through the trap vector table when the entry points at
+// LC-3 code that should run: the entry was changed from the stock OS one,
+// or no native version exists, or fast traps are off. Returns false when
+// the TRAP should run natively instead.
+bool vm_os_trap(vm_t* vm, uint8_t vector);
+
+// Start the handler for exception vector from the interrupt vector table.
+// Returns false if the table has no handler for it.
+bool vm_os_exception(vm_t* vm, uint8_t vector);
+
+// Start the handler for a device interrupt and raise the processor priority
+// to the device's. Returns false if the table has no handler for it.
+bool vm_os_interrupt(vm_t* vm, uint8_t vector, int priority);
+
+// Return from a trap or interrupt handler; in user mode this raises a
+// privilege exception instead. Returns false if that exception has no
+// handler.
+bool vm_os_rti(vm_t* vm);
+
+#endif  // VM_OS_H
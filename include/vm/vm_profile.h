@@ -0,0 +1,55 @@
+#ifndef VM_PROFILE_H
+#define VM_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+#include "vm_calls.h"
+
+// Call-graph profile. A VM with a profile attached runs on the instrumented
+// interpreter loop (see vm_execute) and follows calls and returns on a
+// shadow call stack (vm_calls.h). Each instruction is counted in the call
+// path it ran on, a node of a tree of the paths seen so far.
+
+typedef struct {
+  uint16_t entry;
+  int parent;   // -1 for the program itself
+  int child;    // First routine called from this path, or -1
+  int sibling;  // Next routine called from the parent's path, or -1
+  uint64_t calls;
+  uint64_t instructions;  // Run in the routine itself on this path
+} vm_profile_node_t;
+
+struct vm_profile {
+  vm_profile_node_t* nodes;  // nodes[0] is the program
+  int node_count;
+  int node_capacity;
+  vm_calls_t calls;
+  int path[VM_CALLS_MAX_DEPTH];  // The node of each frame on calls
+};
+
+// A profile of a program starting at entry. Returns NULL if out of memory.
+vm_profile_t* vm_profile_create(uint16_t entry);
+void vm_profile_destroy(vm_profile_t* profile);
+
+// Count the instruction at pc that just ran and follow calls and returns
+void vm_profile_step(vm_t* vm, uint16_t pc, uint16_t instr);
+
+// Make the command-line runners write their VMs' profile to path at exit,
+// or not when it is NULL
+void vm_profile_configure(const char* path);
+// Attach a profile to each VM. Does nothing when no path is set.
+void vm_profile_attach(vm_t* const* vms, int count);
+// Write the profiles and remove them
+void vm_profile_detach(void);
+
+// Write one line per call path, "MAIN;WORK;LEAF 500", with the instructions
+// run in the path's last routine itself; flame graph tools add them up into
+// inclusive counts. Routines are named from debug (which may be NULL) and
+// each path starts with prefix and ';' unless prefix is NULL. Returns 0 on
+// success, 1 on failure.
+int vm_profile_write_folded(FILE* out, const vm_profile_t* profile,
+                            const debug_info_t* debug, const char* prefix);
+
+#endif  // VM_PROFILE_H
@@ -0,0 +1,90 @@
+#ifndef VM_SERVER_H
+#define VM_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Program execution service on a Unix socket. A client sends requests and
+// reads one response for each, on as many connections as it likes:
+//
+//   request   vm_server_request_t, image_size bytes of object file (legacy
+//             or sparse image), input_size bytes of input
+//   response  vm_server_response_t, output_size bytes of output
+//
+// Header fields are in host byte order since both ends share the machine.
+#define VM_SERVER_REQUEST_MAGIC "LC3Q"
+#define VM_SERVER_RESPONSE_MAGIC "LC3A"
+
+#define VM_SERVER_MAX_IMAGE (1 << 20)
+#define VM_SERVER_MAX_INPUT (1 << 20)
+#define VM_SERVER_DEFAULT_INSTRUCTIONS 100000000ULL
+#define VM_SERVER_DEFAULT_OUTPUT (1 << 20)
+// Decoded images each worker keeps, least recently used evicted first
+#define VM_SERVER_CACHE_SIZE 64
+
+typedef enum {
+  VM_SERVER_HALT,               // The program halted
+  VM_SERVER_ERROR,              // Unknown opcode or trap
+  VM_SERVER_INSTRUCTION_LIMIT,  // max_instructions ran out
+  VM_SERVER_OUTPUT_LIMIT,       // The program wrote max_output bytes
+  VM_SERVER_UNKNOWN_IMAGE,      // Nothing cached under key; send the image
+  VM_SERVER_BAD_REQUEST,        // Malformed request or image
+  VM_SERVER_TIMEOUT,            // max_ms passed
+  VM_SERVER_LOOP,               // The program would never stop
+} vm_server_status_t;
+
+// Request flags
+enum {
+  VM_SERVER_DETECT_LOOPS = 1 << 0  // Stop tight infinite loops early
+};
+
+// Response flags
+enum {
+  VM_SERVER_CACHE_HIT = 1 << 0  // The image was already decoded
+};
+
+typedef struct {
+  char magic[4];
+  uint32_t image_size;        // 0 to run the image cached under key
+  uint64_t key;               // vm_server_key of the image
+  uint64_t max_instructions;  // 0 for VM_SERVER_DEFAULT_INSTRUCTIONS
+  uint32_t max_output;        // 0 for VM_SERVER_DEFAULT_OUTPUT
+  uint32_t input_size;        // GETC returns xFFFF after the last byte
+  uint32_t max_ms;            // Wall-clock limit on the run; 0 for none
+  uint32_t flags;
+} vm_server_request_t;
+
+typedef struct {
+  char magic[4];
+  uint32_t status;  // vm_server_status_t
+  uint64_t key;
+  uint64_t instructions;  // Executed, counting recognized loops in full
+  uint64_t load_ns;       // Decoding (on a miss) and loading the image
+  uint64_t run_ns;
+  uint32_t output_size;
+  uint32_t flags;
+} vm_server_response_t;
+
+// Cache key of an object file's bytes
+uint64_t vm_server_key(const void* image, size_t size);
+
+// Listen on socket_path and fork worker_count workers (0 for one per online
+// CPU) that take connections from it. Each worker keeps one VM that it
+// resets between requests, and its own image cache, so a client that sends
+// only a key can get VM_SERVER_UNKNOWN_IMAGE on a new connection. Dead
+// workers are replaced. Returns 0 after SIGINT or SIGTERM, 1 on failure.
+int vm_server_serve(const char* socket_path, int worker_count);
+
+// Send one request on a connected socket and read its response. The output
+// is returned in a malloc'd buffer the caller frees. Returns 0 on success,
+// 1 if the connection failed.
+int vm_server_call(int fd, const vm_server_request_t* request,
+                   const void* image, const void* input,
+                   vm_server_response_t* response, uint8_t** output);
+
+// Run a program file on the server at socket_path with stdin as its input
+// and print its output. The image is only sent if the server does not have
+// it cached. Returns the response status, or -1 if the request failed.
+int vm_server_request(const char* socket_path, const char* filename);
+
+#endif  // VM_SERVER_H
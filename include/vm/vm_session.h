@@ -0,0 +1,53 @@
+#ifndef VM_SESSION_H
+#define VM_SESSION_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+// Instructions a session runs before the next one gets a turn
+#define VM_SESSION_QUANTUM 10000
+// Input is not read from a session's fd while this much is unread
+#define VM_SESSION_INPUT_MAX 4096
+
+typedef struct vm_loop vm_loop_t;
+
+// Builds the VM for a connection accepted by vm_loop_listen
+typedef vm_t* (*vm_session_create_fn)(void* arg);
+
+// An epoll event loop that runs many VMs on one thread. Each VM is a
+// session with buffered console I/O (see vm_io_t) tied to an input and an
+// output fd. A session runs for a quantum at a time, stops when GETC or IN
+// finds no input or when its output backs up, and is resumed once its fd
+// is ready. The loop makes fds non-blocking; writes to a closed pipe raise
+// SIGPIPE, so callers ignore it.
+vm_loop_t* vm_loop_create(uint64_t quantum);
+// Closes every remaining session
+void vm_loop_destroy(vm_loop_t* loop);
+
+// Run vm as a session reading in_fd and writing out_fd, which may be the
+// same socket. On success the loop owns vm and both fds; it closes them once
+// the program stopped and its output was written, or the peer went away.
+// Returns 0 on success, 1 on failure.
+int vm_loop_add(vm_loop_t* loop, vm_t* vm, int in_fd, int out_fd);
+
+// Accept connections on a non-blocking listening socket and start a session
+// on each with a VM from create. Several loops may share one socket.
+// Returns 0 on success, 1 on failure.
+int vm_loop_listen(vm_loop_t* loop, int listen_fd, vm_session_create_fn create,
+                   void* arg);
+
+// Run until no session is left and nothing is listening. Returns 0, or 1 if
+// waiting for events failed.
+int vm_loop_run(vm_loop_t* loop);
+
+// Sessions whose program stopped on an unknown opcode or trap
+int vm_loop_failures(const vm_loop_t* loop);
+
+// Serve a program on a Unix socket: every connection gets a fresh copy of
+// it as its own session. loop_count threads each run a loop; 0 uses one per
+// online CPU. Only returns on failure.
+int vm_session_serve(const char* socket_path, const char* filename,
+                     int loop_count);
+
+#endif  // VM_SESSION_H
@@ -0,0 +1,36 @@
+#ifndef VM_SMP_H
+#define VM_SMP_H
+
+#include <stdint.h>
+
+#include "vm.h"
+
+#define VM_SMP_MAX_HARTS 64
+// Each hart's supervisor stack starts this far below the previous one's
+#define VM_SMP_STACK_SIZE 0x0100
+
+// Harts sharing one memory. Each hart is a VM with its own registers, PSR,
+// device registers and event queue.
+typedef struct {
+  uint16_t* memory;
+  vm_t* harts[VM_SMP_MAX_HARTS];
+  int hart_count;
+  int results[VM_SMP_MAX_HARTS];
+} vm_smp_t;
+
+vm_smp_t* vm_smp_create(int hart_count);
+void vm_smp_destroy(vm_smp_t* smp);
+
+// Load a program into the shared memory
+int vm_smp_load_file(vm_smp_t* smp, const char* filename);
+
+// Run every hart from x3000 until all of them stop. With quantum 0 each
+// hart runs on its own thread. Otherwise the calling thread runs the harts
+// in turn for quantum instructions each, which gives the same interleaving
+// on every run. Returns 0 if every hart halted normally, otherwise the
+// first failing hart's VM_EXIT_* code.
+int vm_smp_execute(vm_smp_t* smp, uint64_t quantum);
+
+int vm_smp_run(const char* filename, int hart_count, uint64_t quantum);
+
+#endif  // VM_SMP_H
@@ -0,0 +1,44 @@
+#ifndef VM_STATS_H
+#define VM_STATS_H
+
+#include <stdio.h>
+
+#include "vm.h"
+
+// How often a VM with a statistics file checks for SIGUSR1, in instructions
+#define VM_STATS_POLL_INTERVAL 65536
+
+typedef enum {
+  VM_STATS_OFF,
+  VM_STATS_TEXT,        // Aligned table for people
+  VM_STATS_JSON,        // One object per hart
+  VM_STATS_PROMETHEUS,  // Text exposition format
+} vm_stats_format_t;
+
+// Parse "text", "json" or "prometheus". Returns 0 on success, 1 otherwise.
+int vm_stats_parse_format(const char* name, vm_stats_format_t* format);
+
+// Choose how the command-line runners report. With a path the report goes
+// to that file, replaced atomically, at exit and whenever the process gets
+// SIGUSR1; otherwise it goes to stderr at exit. A path without a format
+// reports text.
+void vm_stats_configure(vm_stats_format_t format, const char* path);
+
+// Report on vms until vm_stats_detach. With a statistics file this installs
+// the SIGUSR1 handler and schedules VM_EVENT_STATS on every VM, so polling
+// costs nothing between events. Does nothing when reporting is off.
+void vm_stats_attach(vm_t* const* vms, int count);
+
+// Write the final report and forget the VMs
+void vm_stats_detach(void);
+
+// Handle VM_EVENT_STATS: write the report if SIGUSR1 arrived since the last
+// one. Counters of harts on other threads are read while they run, so such
+// a report is a close snapshot rather than an exact one.
+void vm_stats_event(vm_t* vm);
+
+// Write a report on vms to out. Returns 0 on success, 1 on failure.
+int vm_stats_write(FILE* out, vm_t* const* vms, int count,
+                   vm_stats_format_t format);
+
+#endif  // VM_STATS_H
@@ -0,0 +1,28 @@
+#ifndef VM_TRAP_H
+#define VM_TRAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+// Install handler for vector; NULL removes it. The standard vectors and
+// HASTRAP are built in and cannot be replaced.
+void vm_trap_register(vm_t* vm, uint8_t vector, vm_trap_fn handler);
+
+// Install the native extension traps (MUL, DIVMOD, MEMCPY, MEMSET, ADD32,
+// CAS)
+void vm_trap_register_extensions(vm_t* vm);
+
+// True if TRAP vector is handled by this VM
+bool vm_trap_available(const vm_t* vm, uint8_t vector);
+
+void vm_trap_mul(vm_t* vm);
+void vm_trap_divmod(vm_t* vm);
+void vm_trap_memcpy(vm_t* vm);
+void vm_trap_memset(vm_t* vm);
+void vm_trap_add32(vm_t* vm);
+// Atomic on memory shared with other harts
+void vm_trap_cas(vm_t* vm);
+
+#endif  // VM_TRAP_H
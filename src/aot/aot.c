@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/aot/aot.h"
+
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "../../include/lc3/decode.h"
+#include "../../include/lc3/lc3.h"
+#include "../../include/vm/vm.h"
+
+extern char** environ;
+
+// Memory runs separated by fewer zero words than this share one segment
+#define AOT_ZERO_GAP 8
+
+typedef struct {
+  const uint16_t* memory;
+  uint8_t code[LC3_MEMORY_MAX];    // Reachable instruction words
+  uint8_t leader[LC3_MEMORY_MAX];  // First word of a basic block
+  uint16_t stack[LC3_MEMORY_MAX];  // Leaders not walked yet
+  int stack_count;
+} aot_t;
+
+// Condition code the VM would set for value
+static int aot_condition(uint16_t value) {
+  if (value == 0) return LC3_FL_ZRO;
+  return value >> 15 ? LC3_FL_NEG : LC3_FL_POS;
+}
+
+// True for the traps the runtime implements, except HALT
+static bool aot_trap_returns(uint16_t vector) {
+  return (vector >= LC3_TRAP_GETC && vector < LC3_TRAP_HALT) ||
+         (vector >= LC3_TRAP_HASTRAP && vector <= LC3_TRAP_CAS);
+}
+
+static void aot_add_leader(aot_t* aot, uint16_t address) {
+  if (aot->leader[address]) return;
+  aot->leader[address] = 1;
+  aot->stack[aot->stack_count++] = address;
+}
+
+// Add the blocks instr at pc can transfer to. Returns true if instr ends its
+// block, false if execution simply continues at pc + 1.
+static bool aot_add_successors(aot_t* aot, uint16_t pc, uint16_t instr) {
+  uint16_t next = pc + 1;
+  switch (instr >> 12) {
+    case LC3_OP_BR: {
+      uint16_t condition = lc3_r0(instr);
+      if (condition == 0) return false;  // Never taken
+      aot_add_leader(aot, next + lc3_pc_offset9(instr));
+      if (condition != 0x7) aot_add_leader(aot, next);
+      return true;
+    }
+    case LC3_OP_JSR:
+      if (instr & 0x0800) {
+        aot_add_leader(aot, next + lc3_pc_offset11(instr));
+      }
+      aot_add_leader(aot, next);  // Where RET comes back to
+      return true;
+    case LC3_OP_TRAP:
+      return !aot_trap_returns(lc3_trap_vect(instr));
+    case LC3_OP_JMP:
+    case LC3_OP_RTI:
+    case LC3_OP_RES:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Find every word reachable from entry without an indirect jump, and where
+// each basic block starts
+static void aot_discover(aot_t* aot, uint16_t entry) {
+  aot_add_leader(aot, entry);
+  while (aot->stack_count > 0) {
+    uint16_t pc = aot->stack[--aot->stack_count];
+    while (!aot->code[pc]) {
+      aot->code[pc] = 1;
+      if (aot_add_successors(aot, pc, aot->memory[pc])) break;
+      pc++;
+    }
+  }
+}
+
+// Emit C for the instruction at pc. Returns true if the emitted code leaves
+// the block on every path.
+static bool aot_emit_instruction(FILE* out, uint16_t pc, uint16_t instr) {
+  uint16_t next = pc + 1;
+  int dr = lc3_r0(instr);
+  int sr = lc3_r1(instr);
+  uint16_t pc9 = next + lc3_pc_offset9(instr);
+  uint16_t offset6 = lc3_offset6(instr);
+
+  fprintf(out, "  /* x%04X */ ", pc);
+  switch (instr >> 12) {
+    case LC3_OP_ADD:
+    case LC3_OP_AND: {
+      const char* op = instr >> 12 == LC3_OP_ADD ? "+" : "&";
+      if (instr & 0x20) {
+        fprintf(out, "R[%d] = (uint16_t)(R[%d] %s 0x%04X); SETCC(R[%d]);\n",
+                dr, sr, op, lc3_imm5(instr), dr);
+      } else {
+        fprintf(out, "R[%d] = (uint16_t)(R[%d] %s R[%d]); SETCC(R[%d]);\n",
+                dr, sr, op, instr & 0x7, dr);
+      }
+      return false;
+    }
+    case LC3_OP_NOT:
+      fprintf(out, "R[%d] = (uint16_t)~R[%d]; SETCC(R[%d]);\n", dr, sr, dr);
+      return false;
+    case LC3_OP_BR: {
+      int condition = lc3_r0(instr);
+      if (condition == 0) {
+        fprintf(out, "/* BR never taken */\n");
+        return false;
+      }
+      if (condition == 0x7) {
+        fprintf(out, "return 0x%04X;\n", pc9);
+      } else {
+        fprintf(out, "if (COND & %d) return 0x%04X;\n  return 0x%04X;\n",
+                condition, pc9, next);
+      }
+      return true;
+    }
+    case LC3_OP_JMP:
+      fprintf(out, "{ uint16_t t = R[%d]; SETCC(t); return t; }\n", sr);
+      return true;
+    case LC3_OP_JSR:
+      // R7 is written before a JSRR base register is read, as in the VM
+      if (instr & 0x0800) {
+        uint16_t target = next + lc3_pc_offset11(instr);
+        fprintf(out, "R[7] = 0x%04X; COND = %d; return 0x%04X;\n", next,
+                aot_condition(target), target);
+      } else {
+        fprintf(out,
+                "R[7] = 0x%04X; { uint16_t t = R[%d]; SETCC(t); return t; }\n",
+                next, sr);
+      }
+      return true;
+    // Loads that may reach a device register go through load()
+    case LC3_OP_LD:
+      fprintf(out,
+              pc9 >= LC3_MR_KBSR ? "R[%d] = load(0x%04X); SETCC(R[%d]);\n"
+                                 : "R[%d] = M[0x%04X]; SETCC(R[%d]);\n",
+              dr, pc9, dr);
+      return false;
+    case LC3_OP_LDI:
+      fprintf(out, "R[%d] = load(load(0x%04X)); SETCC(R[%d]);\n", dr, pc9,
+              dr);
+      return false;
+    case LC3_OP_LDR:
+      fprintf(out, "R[%d] = load((uint16_t)(R[%d] + 0x%04X)); SETCC(R[%d]);\n",
+              dr, sr, offset6, dr);
+      return false;
+    case LC3_OP_LEA:
+      fprintf(out, "R[%d] = 0x%04X; COND = %d;\n", dr, pc9,
+              aot_condition(pc9));
+      return false;
+    // A store into translated code leaves the block so the dispatcher can
+    // interpret the overwritten words
+    case LC3_OP_ST:
+      fprintf(out, "SETCC(R[%d]); if (store(0x%04X, R[%d])) return 0x%04X;\n",
+              dr, pc9, dr, next);
+      return false;
+    case LC3_OP_STI:
+      fprintf(out,
+              "SETCC(R[%d]); if (store(load(0x%04X), R[%d])) return 0x%04X;\n",
+              dr, pc9, dr, next);
+      return false;
+    case LC3_OP_STR:
+      fprintf(out,
+              "SETCC(R[%d]); if (store((uint16_t)(R[%d] + 0x%04X), R[%d])) "
+              "return 0x%04X;\n",
+              dr, sr, offset6, dr, next);
+      return false;
+    case LC3_OP_TRAP: {
+      uint16_t vector = lc3_trap_vect(instr);
+      fprintf(out, "trap(0x%02X);", vector);
+      if (aot_trap_returns(vector)) {
+        fprintf(out, "\n");
+        return false;
+      }
+      fprintf(out, " return 0x%04X;\n", next);
+      return true;
+    }
+    default:
+      fprintf(out, "return unknown(0x%X);\n", instr >> 12);
+      return true;
+  }
+}
+
+// Emit the function for the block starting at start. Returns its length.
+static uint16_t aot_emit_block(const aot_t* aot, FILE* out, uint16_t start) {
+  fprintf(out, "\nstatic uint16_t block_%04X(void) {\n", start);
+  uint16_t pc = start;
+  uint16_t length = 0;
+  for (;;) {
+    length++;
+    if (aot_emit_instruction(out, pc, aot->memory[pc])) break;
+    pc++;
+    if (!aot->code[pc] || aot->leader[pc] || pc == start) {
+      fprintf(out, "  return 0x%04X;\n", pc);
+      break;
+    }
+  }
+  fprintf(out, "}\n");
+  return length;
+}
+
+// Find the next run of memory at or after *address, ending before a gap of
+// AOT_ZERO_GAP zero words. Returns false when the rest of memory is zero.
+static bool aot_next_segment(const uint16_t* memory, int* address, int* end) {
+  while (*address < LC3_MEMORY_MAX && memory[*address] == 0) (*address)++;
+  if (*address == LC3_MEMORY_MAX) return false;
+
+  int zeros = 0;
+  *end = *address;
+  while (*end < LC3_MEMORY_MAX && zeros < AOT_ZERO_GAP) {
+    zeros = memory[*end] == 0 ? zeros + 1 : 0;
+    (*end)++;
+  }
+  *end -= zeros;
+  return true;
+}
+
+// Emit the initial memory as runs of words; long zero gaps are left out
+static void aot_emit_memory(const uint16_t* memory, FILE* out) {
+  int address = 0;
+  int end;
+  while (aot_next_segment(memory, &address, &end)) {
+    fprintf(out, "\nstatic const uint16_t segment_%04X[] = {", address);
+    for (int i = address; i < end; i++) {
+      fprintf(out, "%s0x%04X,", (i - address) % 8 == 0 ? "\n    " : " ",
+              memory[i]);
+    }
+    fprintf(out, "\n};\n");
+    address = end;
+  }
+
+  fprintf(out, "\nstatic void load_memory(void) {\n");
+  address = 0;
+  while (aot_next_segment(memory, &address, &end)) {
+    fprintf(out, "  for (int i = 0; i < %d; i++) M[0x%04X + i] = segment_%04X[i];\n",
+            end - address, address, address);
+    address = end;
+  }
+  fprintf(out, "}\n");
+}
+
+int aot_write_c(const uint16_t* memory, uint16_t entry, const char* filename) {
+  aot_t* aot = calloc(1, sizeof(aot_t));
+  FILE* out = aot ? fopen(filename, "w") : NULL;
+  if (!out) {
+    fprintf(stderr, "Error: Could not write %s\n", filename);
+    free(aot);
+    return 1;
+  }
+  aot->memory = memory;
+  aot_discover(aot, entry);
+
+  for (int i = 0; aot_runtime_source[i]; i++) {
+    fprintf(out, "%s\n", aot_runtime_source[i]);
+  }
+  aot_emit_memory(memory, out);
+
+  uint16_t* lengths = calloc(LC3_MEMORY_MAX, sizeof(uint16_t));
+  int block_count = 0;
+  for (int pc = 0; lengths && pc < LC3_MEMORY_MAX; pc++) {
+    if (!aot->leader[pc] || !aot->code[pc]) continue;
+    lengths[pc] = aot_emit_block(aot, out, (uint16_t)pc);
+    block_count++;
+  }
+
+  fprintf(out, "\nstatic uint16_t dispatch(uint16_t pc) {\n");
+  fprintf(out, "  if (dirty[pc]) return interpret(pc);\n");
+  fprintf(out, "  switch (pc) {\n");
+  for (int pc = 0; lengths && pc < LC3_MEMORY_MAX; pc++) {
+    if (lengths[pc] == 0) continue;
+    fprintf(out, "    case 0x%04X: return block_%04X();\n", pc, pc);
+  }
+  fprintf(out, "    default: return interpret(pc);\n  }\n}\n");
+
+  fprintf(out, "\nint main(void) {\n  load_memory();\n  reset_devices();\n");
+  for (int pc = 0; lengths && pc < LC3_MEMORY_MAX; pc++) {
+    if (lengths[pc] == 0) continue;
+    fprintf(out, "  mark_block(0x%04X, %u);\n", pc, lengths[pc]);
+  }
+  fprintf(out,
+          "  uint16_t pc = 0x%04X;\n"
+          "  while (running) pc = dispatch(pc);\n"
+          "  return status;\n}\n",
+          entry);
+
+  bool failed = !lengths || ferror(out);
+  failed |= fclose(out) != 0;
+  free(lengths);
+  free(aot);
+  if (failed) {
+    fprintf(stderr, "Error: Could not write %s\n", filename);
+    return 1;
+  }
+  printf("Translated %d blocks to %s\n", block_count, filename);
+  return 0;
+}
+
+int aot_compile(const char* c_filename, const char* output_filename) {
+  const char* cc = getenv("CC");
+  if (!cc || !*cc) cc = "cc";
+
+  char* argv[] = {(char*)cc, "-O2", "-o", (char*)output_filename,
+                  (char*)c_filename, NULL};
+  pid_t pid;
+  if (posix_spawnp(&pid, cc, NULL, NULL, argv, environ) != 0) {
+    fprintf(stderr, "Error: Could not run %s\n", cc);
+    return 1;
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "Error: %s failed to compile %s\n", cc, c_filename);
+    return 1;
+  }
+  return 0;
+}
+
+int aot_run(const char* input_filename, const char* output_filename) {
+  vm_t* vm = vm_create();
+  if (!vm || vm_load_file(vm, input_filename) != 0) {
+    fprintf(stderr, "Error: Could not load %s\n", input_filename);
+    vm_destroy(vm);
+    return 1;
+  }
+
+  // Without a .c output the C goes to a temporary file next to it
+  size_t length = strlen(output_filename);
+  bool c_only = length > 2 && strcmp(output_filename + length - 2, ".c") == 0;
+  char* c_filename = malloc(length + 3);
+  if (!c_filename) {
+    vm_destroy(vm);
+    return 1;
+  }
+  snprintf(c_filename, length + 3, "%s%s", output_filename, c_only ? "" : ".c");
+
+  // Execution starts at LC3_PC_START whatever the image's origin, as in the VM
+  int result = aot_write_c(vm->memory, LC3_PC_START, c_filename);
+  vm_destroy(vm);
+  if (result == 0 && !c_only) {
+    result = aot_compile(c_filename, output_filename);
+    remove(c_filename);
+  }
+  free(c_filename);
+  return result;
+}
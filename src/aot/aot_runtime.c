@@ -0,0 +1,295 @@
+#include "../../include/aot/aot.h"
+
+#include <stddef.h>
+
+// Runtime written ahead of the translated blocks in every generated program.
+// It mirrors src/vm/vm.c and src/vm/vm_exec.c, including their flag quirks
+// (JMP, JSR and ST update the condition codes), and interprets any code the
+// translator did not see or that the program has overwritten. Loads and
+// stores at xFE00 and above go to the device registers of
+// src/vm/vm_device.c; output is written at once, so DSR is always ready, and
+// a translated program takes no interrupts.
+const char* const aot_runtime_source[] = {
+    "/* LC-3 ahead-of-time runtime: machine state, traps and an",
+    "   interpreter for code that was not translated or was overwritten */",
+    "#define _POSIX_C_SOURCE 200809L",
+    "#include <stdint.h>",
+    "#include <stdio.h>",
+    "#include <sys/select.h>",
+    "#include <unistd.h>",
+    "",
+    "static uint16_t M[65536];",
+    "static uint16_t R[8];",
+    "static uint16_t COND = 2;",
+    "static int running = 1;",
+    "static int status = 0;",
+    "",
+    "/* Translated words and the start of the block holding each one */",
+    "static uint8_t code[65536];",
+    "static uint16_t block_of[65536];",
+    "/* Blocks whose words were overwritten; interpreted from then on */",
+    "static uint8_t dirty[65536];",
+    "",
+    "#define CC(v) ((v) == 0 ? 2 : ((v) >> 15) ? 4 : 1)",
+    "#define SETCC(v) (COND = CC(v))",
+    "#define SEXT(v, bits)                                    \\",
+    "  ((uint16_t)(((v) & (1 << ((bits) - 1))) ? (v) | ~((1 << (bits)) - 1) \\",
+    "                                         : (v)))",
+    "",
+    "static void mark_block(uint16_t start, uint16_t length) {",
+    "  for (uint16_t i = 0; i < length; i++) {",
+    "    code[(uint16_t)(start + i)] = 1;",
+    "    block_of[(uint16_t)(start + i)] = start;",
+    "  }",
+    "}",
+    "",
+    "/* Device registers live in M[] from xFE00 up, as in the VM */",
+    "#define KBSR 0xFE00",
+    "#define KBDR 0xFE02",
+    "#define DSR 0xFE04",
+    "#define DDR 0xFE06",
+    "#define TMR 0xFE08",
+    "#define HARTID 0xFE10",
+    "#define HARTS 0xFE12",
+    "#define PSR 0xFFFC",
+    "#define MCR 0xFFFE",
+    "#define READY 0x8000",
+    "#define IE 0x4000",
+    "static uint16_t psr = 0x8000; /* User mode, priority 0 */",
+    "",
+    "static void reset_devices(void) {",
+    "  for (uint32_t a = KBSR; a < 65536; a++) M[a] = 0;",
+    "  M[DSR] = READY;",
+    "  M[MCR] = READY;",
+    "}",
+    "",
+    "/* Read a waiting key into KBDR, where it stays until KBDR is read */",
+    "static void poll_keyboard(void) {",
+    "  if (M[KBSR] & READY) return;",
+    "  fd_set fds;",
+    "  FD_ZERO(&fds);",
+    "  FD_SET(STDIN_FILENO, &fds);",
+    "  struct timeval timeout = {0, 0};",
+    "  if (select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout) > 0) {",
+    "    M[KBDR] = (uint16_t)getchar();",
+    "    M[KBSR] |= READY;",
+    "  }",
+    "}",
+    "",
+    "static uint16_t device_read(uint16_t address) {",
+    "  switch (address) {",
+    "    case KBSR:",
+    "      poll_keyboard();",
+    "      return M[KBSR];",
+    "    case KBDR:",
+    "      M[KBSR] &= ~READY;",
+    "      return M[KBDR];",
+    "    case PSR:",
+    "      return psr | COND;",
+    "    case HARTID:",
+    "      return 0;",
+    "    case HARTS:",
+    "      return 1;",
+    "    default:",
+    "      return M[address];",
+    "  }",
+    "}",
+    "",
+    "static void device_write(uint16_t address, uint16_t value) {",
+    "  switch (address) {",
+    "    case KBSR:",
+    "      value = (M[KBSR] & READY) | (value & IE);",
+    "      break;",
+    "    case DDR:",
+    "      putchar((char)value);",
+    "      fflush(stdout);",
+    "      break;",
+    "    case TMR:",
+    "      value &= READY | IE;",
+    "      break;",
+    "    case PSR:",
+    "      psr = value & 0x8700;",
+    "      COND = value & 7;",
+    "      break;",
+    "    case MCR:",
+    "      if (!(value & READY)) running = 0;",
+    "      break;",
+    "  }",
+    "  M[address] = value;",
+    "}",
+    "",
+    "static inline uint16_t load(uint16_t address) {",
+    "  return address >= KBSR ? device_read(address) : M[address];",
+    "}",
+    "",
+    "/* Store a word; returns 1 when it overwrote translated code */",
+    "static int store(uint16_t address, uint16_t value) {",
+    "  if (address >= KBSR) {",
+    "    device_write(address, value);",
+    "    return !running; /* Cleared MCR stops at this instruction */",
+    "  }",
+    "  M[address] = value;",
+    "  if (!code[address]) return 0;",
+    "  dirty[block_of[address]] = 1;",
+    "  return 1;",
+    "}",
+    "",
+    "/* Store a 32-bit result in R1:R0 */",
+    "static void pair(uint32_t value) {",
+    "  R[0] = value & 0xFFFF;",
+    "  R[1] = value >> 16;",
+    "  COND = value == 0 ? 2 : (value >> 31) ? 4 : 1;",
+    "}",
+    "",
+    "static void trap(uint16_t vector) {",
+    "  switch (vector) {",
+    "    case 0x20:",
+    "      R[0] = (uint16_t)getchar();",
+    "      break;",
+    "    case 0x21:",
+    "      putchar((char)R[0]);",
+    "      fflush(stdout);",
+    "      break;",
+    "    case 0x22:",
+    "      for (uint16_t a = R[0]; (char)M[a] != 0; a++) putchar((char)M[a]);",
+    "      fflush(stdout);",
+    "      break;",
+    "    case 0x23:",
+    "      R[0] = (uint16_t)getchar();",
+    "      putchar((char)R[0]);",
+    "      fflush(stdout);",
+    "      break;",
+    "    case 0x24:",
+    "      for (uint16_t a = R[0]; M[a] != 0; a++) {",
+    "        putchar((char)(M[a] & 0xFF));",
+    "        if (M[a] >> 8) putchar((char)(M[a] >> 8));",
+    "      }",
+    "      fflush(stdout);",
+    "      break;",
+    "    case 0x25:",
+    "      running = 0;",
+    "      break;",
+    "    case 0x30: /* HASTRAP */",
+    "      R[0] = (R[0] >= 0x20 && R[0] <= 0x25) ||",
+    "             (R[0] >= 0x30 && R[0] <= 0x36);",
+    "      SETCC(R[0]);",
+    "      break;",
+    "    case 0x31: /* MUL */",
+    "      pair((uint32_t)((int32_t)(int16_t)R[0] * (int16_t)R[1]));",
+    "      break;",
+    "    case 0x32: { /* DIVMOD */",
+    "      int32_t x = (int16_t)R[0], y = (int16_t)R[1];",
+    "      R[0] = (uint16_t)(y ? x / y : 0);",
+    "      R[1] = (uint16_t)(y ? x % y : x);",
+    "      SETCC(R[0]);",
+    "      break;",
+    "    }",
+    "    case 0x33: /* MEMCPY; word by word, so devices see each access */",
+    "      if ((uint16_t)(R[0] - R[1]) < R[2]) {",
+    "        for (uint32_t i = R[2]; i-- > 0;)",
+    "          store((uint16_t)(R[0] + i), load((uint16_t)(R[1] + i)));",
+    "      } else {",
+    "        for (uint32_t i = 0; i < R[2]; i++)",
+    "          store((uint16_t)(R[0] + i), load((uint16_t)(R[1] + i)));",
+    "      }",
+    "      break;",
+    "    case 0x34: /* MEMSET */",
+    "      for (uint32_t i = 0; i < R[2]; i++)",
+    "        store((uint16_t)(R[0] + i), R[1]);",
+    "      break;",
+    "    case 0x35: /* ADD32 */",
+    "      pair(((uint32_t)R[1] << 16 | R[0]) +",
+    "           ((uint32_t)R[3] << 16 | R[2]));",
+    "      break;",
+    "    case 0x36: { /* CAS; a translated program is a single hart */",
+    "      uint16_t old = M[R[0]];",
+    "      if (old == R[1]) store(R[0], R[2]);",
+    "      R[0] = old == R[1];",
+    "      R[1] = old;",
+    "      SETCC(R[0]);",
+    "      break;",
+    "    }",
+    "    default:",
+    "      printf(\"Unknown trap: 0x%02X\\n\", vector);",
+    "      running = 0;",
+    "      break;",
+    "  }",
+    "}",
+    "",
+    "static uint16_t unknown(uint16_t op) {",
+    "  printf(\"> Unknown opcode: 0x%04X\\n\", op);",
+    "  running = 0;",
+    "  status = 1;",
+    "  return 0;",
+    "}",
+    "",
+    "/* Execute one instruction at pc; returns the next pc */",
+    "static uint16_t interpret(uint16_t pc) {",
+    "  uint16_t instr = load(pc++);",
+    "  uint16_t dr = (instr >> 9) & 7;",
+    "  uint16_t sr = (instr >> 6) & 7;",
+    "  uint16_t pc9 = (uint16_t)(pc + SEXT(instr & 0x1FF, 9));",
+    "  uint16_t base6 = (uint16_t)(R[sr] + SEXT(instr & 0x3F, 6));",
+    "  uint16_t operand =",
+    "      (instr & 0x20) ? SEXT(instr & 0x1F, 5) : R[instr & 7];",
+    "  switch (instr >> 12) {",
+    "    case 0x1:",
+    "      R[dr] = (uint16_t)(R[sr] + operand);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x5:",
+    "      R[dr] = R[sr] & operand;",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x9:",
+    "      R[dr] = (uint16_t)~R[sr];",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x0:",
+    "      return (((instr >> 9) & 7) & COND) ? pc9 : pc;",
+    "    case 0xC:",
+    "      pc = R[sr];",
+    "      SETCC(pc);",
+    "      return pc;",
+    "    case 0x4:",
+    "      R[7] = pc;",
+    "      pc = (instr & 0x800) ? (uint16_t)(pc + SEXT(instr & 0x7FF, 11))",
+    "                           : R[sr];",
+    "      SETCC(pc);",
+    "      return pc;",
+    "    case 0x2:",
+    "      R[dr] = load(pc9);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0xA:",
+    "      R[dr] = load(load(pc9));",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x6:",
+    "      R[dr] = load(base6);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0xE:",
+    "      R[dr] = pc9;",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x3:",
+    "      store(pc9, R[dr]);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0xB:",
+    "      store(load(pc9), R[dr]);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0x7:",
+    "      store(base6, R[dr]);",
+    "      SETCC(R[dr]);",
+    "      return pc;",
+    "    case 0xF:",
+    "      trap(instr & 0xFF);",
+    "      return pc;",
+    "    default:",
+    "      return unknown(instr >> 12);",
+    "  }",
+    "}",
+    NULL};
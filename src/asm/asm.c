@@ -1,27 +1,191 @@
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-#include "../../include/asm/program.h"
+#include "../../include/asm/asm.h"
+#include "../../include/asm/module.h"
+#include "../../include/asm/optimize.h"
 #include "../../include/asm/symbol.h"
+#include "../../include/util/file.h"
 
-int asm_symbol_run(const char* input_filename, const char* output_filename) {
-  printf("Parsing symbols...\n");
-  symbol_table_t* symbols = symbol_parse_file(input_filename);
-  symbol_table_write_file(symbols, output_filename);
+// Write the debug info next to the symbol file, as <name>.dbg
+static int asm_write_debug(const program_t* program,
+                           const symbol_table_t* symbols,
+                           const char* input_filename,
+                           const char* symbols_filename, asm_log_t* log) {
+  char* debug_filename =
+      file_change_extension(symbols_filename, DEBUG_EXTENSION);
+  debug_info_t* info = program_debug_info(program, symbols, input_filename);
+  int result = 0;
+  if (!debug_filename || !info ||
+      debug_info_write_file(info, debug_filename) != 0) {
+    result = 1;
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write debug info %s\n",
+            debug_filename ? debug_filename : symbols_filename);
+  }
+  debug_info_destroy(info);
+  free(debug_filename);
+  return result;
+}
+
+int asm_symbol_run(const char* input_filename, const char* output_filename,
+                   asm_cache_t* cache, const asm_options_t* options,
+                   asm_log_t* log) {
+  symbol_table_t* symbols = NULL;
+  program_t* program =
+      asm_assemble(input_filename, cache, options, &symbols, log);
+  if (!program) return 1;
+
+  int result = symbol_table_write_file(symbols, output_filename, log);
+  if (result == 0) {
+    result = asm_write_debug(program, symbols, input_filename,
+                             output_filename, log);
+  }
   symbol_table_destroy(symbols);
-  return 0;
+  program_destroy(program);
+  return result;
+}
+
+// Find the lines that need their long form by laying the file out until no
+// more lines are added. Rounds report to a scratch log; the caller's final
+// pass reports the diagnostics once.
+static void asm_relax(const char* input_filename, relax_set_t* relax) {
+  asm_log_t scratch;
+  asm_log_init(&scratch, true, true);
+  for (;;) {
+    int count = relax->count;
+    symbol_table_t* symbols = symbol_parse_file(input_filename, relax, &scratch);
+    program_t* program =
+        symbols ? program_create(input_filename, symbols, relax, &scratch)
+                : NULL;
+    program_destroy(program);
+    symbol_table_destroy(symbols);
+    if (!program || relax->count == count) break;
+  }
+  asm_log_free(&scratch);
+}
+
+program_t* asm_assemble(const char* input_filename, asm_cache_t* cache,
+                        const asm_options_t* options,
+                        symbol_table_t** symbols_out, asm_log_t* log) {
+  asm_options_t defaults = {0};
+  if (!options) options = &defaults;
+
+  // Diagnostics are counted even when the caller prints to the console
+  asm_log_t console_log;
+  if (!log) {
+    asm_log_init(&console_log, false, false);
+    log = &console_log;
+  }
+
+  // A cache hit skips both parsing passes
+  uint64_t key = 0;
+  bool cacheable = cache && asm_cache_key_file(input_filename, &key) == 0;
+  if (options->optimize) {
+    // Optimized and plain builds of one source are separate entries
+    uint8_t optimize = 1;
+    key = asm_cache_hash_update(key, &optimize, sizeof(optimize));
+  }
+  if (cacheable) {
+    program_t* program = asm_cache_lookup(cache, key, symbols_out);
+    if (program) {
+      asm_log(log, ASM_LOG_INFO, "Using cached assembly...\n");
+      return program;
+    }
+  }
+
+  int diagnostics = log->warning_count + log->error_count;
+  int errors = log->error_count;
+
+  relax_set_t relax = {.count = 0};
+  asm_relax(input_filename, &relax);
+  if (relax.count > 0) {
+    asm_log(log, ASM_LOG_INFO, "Relaxed %d out-of-range instructions\n",
+            relax.count);
+  }
+
+  asm_log(log, ASM_LOG_INFO, "Parsing symbols...\n");
+  symbol_table_t* symbols = symbol_parse_file(input_filename, &relax, log);
+  if (!symbols) return NULL;
+
+  asm_log(log, ASM_LOG_INFO, "Parsing instructions...\n");
+  program_t* program = program_create(input_filename, symbols, &relax, log);
+  if (program && options->optimize) {
+    asm_log(log, ASM_LOG_INFO, "Optimizing...\n");
+    optimize_stats_t stats;
+    optimize_program(program, symbols, &stats, log);
+  }
+
+  // A line that failed to assemble would only be a zero word in the output
+  if (program && log->error_count > errors) {
+    program_destroy(program);
+    program = NULL;
+  }
+
+  // Only clean assemblies are cached so a hit never hides a warning. The
+  // cache is best effort; a failed store only costs the next run a parse.
+  bool clean = log->warning_count + log->error_count == diagnostics;
+  if (program && cacheable && clean) {
+    asm_cache_store(cache, key, program, symbols);
+  }
+
+  if (program && symbols_out) {
+    *symbols_out = symbols;
+  } else {
+    symbol_table_destroy(symbols);
+  }
+  return program;
+}
+
+int asm_run(const char* input_filename, const char* output_filename,
+            const char* symbols_filename, asm_cache_t* cache,
+            const asm_options_t* options, asm_log_t* log) {
+  symbol_table_t* symbols = NULL;
+  program_t* program =
+      asm_assemble(input_filename, cache, options,
+                   symbols_filename ? &symbols : NULL, log);
+  if (!program) return 1;
+
+  asm_log(log, ASM_LOG_INFO, "Writing to file...\n");
+  bool native = options && options->native;
+  int result = program_write_file(program, output_filename, native, log);
+  if (result == 0 && symbols_filename) {
+    result = symbol_table_write_file(symbols, symbols_filename, log);
+  }
+  if (result == 0 && symbols_filename) {
+    result = asm_write_debug(program, symbols, input_filename,
+                             symbols_filename, log);
+  }
+
+  symbol_table_destroy(symbols);
+  program_destroy(program);
+  return result;
 }
 
-int asm_run(const char* input_filename, const char* output_filename) {
-  printf("Parsing symbols...\n");
-  symbol_table_t* symbols = symbol_parse_file(input_filename);
+int asm_module_run(const char* input_filename, const char* output_filename,
+                   asm_cache_t* cache, const asm_options_t* options,
+                   asm_log_t* log) {
+  asm_log_t console_log;
+  if (!log) {
+    asm_log_init(&console_log, false, false);
+    log = &console_log;
+  }
 
-  printf("Parsing instructions...\n");
-  program_t* program = program_create(input_filename, symbols);
+  // Unlike an image, a module is not written when any line failed to
+  // assemble, since a missing symbol there is usually a missing .EXTERN
+  int diagnostics = log->warning_count + log->error_count;
+  symbol_table_t* symbols = NULL;
+  program_t* program =
+      asm_assemble(input_filename, cache, options, &symbols, log);
+  if (!program) return 1;
 
-  printf("Writing to file...\n");
-  program_write_file(program, output_filename);
+  int result = 1;
+  if (log->warning_count + log->error_count == diagnostics) {
+    asm_log(log, ASM_LOG_INFO, "Writing module...\n");
+    result = module_write_file(program, symbols, output_filename, log);
+  }
 
   symbol_table_destroy(symbols);
   program_destroy(program);
-  return 0;
+  return result;
 }
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/batch.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../include/asm/asm.h"
+#include "../../include/util/file.h"
+
+typedef struct {
+  asm_batch_t* batch;
+  asm_cache_t* cache;
+  atomic_int next_job;
+} asm_batch_queue_t;
+
+asm_batch_t* asm_batch_create(void) {
+  asm_batch_t* batch = malloc(sizeof(asm_batch_t));
+  if (!batch) return NULL;
+  batch->jobs = NULL;
+  batch->job_count = 0;
+  batch->job_capacity = 0;
+  batch->options = (asm_options_t){0};
+  return batch;
+}
+
+void asm_batch_destroy(asm_batch_t* batch) {
+  if (!batch) return;
+  for (int i = 0; i < batch->job_count; i++) {
+    free(batch->jobs[i].input_filename);
+    free(batch->jobs[i].obj_filename);
+    free(batch->jobs[i].sym_filename);
+    asm_log_free(&batch->jobs[i].log);
+  }
+  free(batch->jobs);
+  free(batch);
+}
+
+static int asm_batch_add_file(asm_batch_t* batch, const char* filename) {
+  if (batch->job_count == batch->job_capacity) {
+    int capacity = batch->job_capacity ? batch->job_capacity * 2 : 16;
+    asm_job_t* grown = realloc(batch->jobs, capacity * sizeof(asm_job_t));
+    if (!grown) return -1;
+    batch->jobs = grown;
+    batch->job_capacity = capacity;
+  }
+
+  asm_job_t* job = &batch->jobs[batch->job_count];
+  job->input_filename = strdup(filename);
+  job->obj_filename = file_change_extension(filename, ".obj");
+  job->sym_filename = file_change_extension(filename, ".sym");
+  job->result = 0;
+  asm_log_init(&job->log, true, true);
+  if (!job->input_filename || !job->obj_filename || !job->sym_filename) {
+    free(job->input_filename);
+    free(job->obj_filename);
+    free(job->sym_filename);
+    return -1;
+  }
+
+  batch->job_count++;
+  return 1;
+}
+
+static int asm_batch_compare_names(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int asm_batch_add_directory(asm_batch_t* batch, const char* path) {
+  DIR* dir = opendir(path);
+  if (!dir) return -1;
+
+  // Collect and sort entries so jobs (and their reports) have a stable order
+  char** names = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  struct dirent* dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    if (dirent->d_name[0] == '.') continue;
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      char** grown = realloc(names, capacity * sizeof(char*));
+      if (!grown) break;
+      names = grown;
+    }
+    names[count] = strdup(dirent->d_name);
+    if (names[count]) count++;
+  }
+  closedir(dir);
+  qsort(names, count, sizeof(char*), asm_batch_compare_names);
+
+  int added = 0;
+  size_t path_len = strlen(path);
+  for (size_t i = 0; i < count; i++) {
+    char* child = malloc(path_len + strlen(names[i]) + 2);
+    if (child) {
+      sprintf(child, "%s%s%s", path,
+              path_len && path[path_len - 1] == '/' ? "" : "/", names[i]);
+
+      struct stat st;
+      size_t name_len = strlen(names[i]);
+      if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+        int result = asm_batch_add_directory(batch, child);
+        if (result > 0) added += result;
+      } else if (name_len > 4 &&
+                 strcmp(names[i] + name_len - 4, ".asm") == 0) {
+        if (asm_batch_add_file(batch, child) > 0) added++;
+      }
+      free(child);
+    }
+    free(names[i]);
+  }
+  free(names);
+  return added;
+}
+
+int asm_batch_add_path(asm_batch_t* batch, const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    // Let the job report the missing file alongside the others
+    return asm_batch_add_file(batch, path);
+  }
+  if (S_ISDIR(st.st_mode)) return asm_batch_add_directory(batch, path);
+  return asm_batch_add_file(batch, path);
+}
+
+static void* asm_batch_worker(void* arg) {
+  asm_batch_queue_t* queue = arg;
+  for (;;) {
+    int index = atomic_fetch_add(&queue->next_job, 1);
+    if (index >= queue->batch->job_count) break;
+
+    asm_job_t* job = &queue->batch->jobs[index];
+    job->result = asm_run(job->input_filename, job->obj_filename,
+                          job->sym_filename, queue->cache,
+                          &queue->batch->options,
+                          &job->log);
+    if (job->log.error_count > 0) job->result = 1;
+  }
+  return NULL;
+}
+
+int asm_batch_run(asm_batch_t* batch, int thread_count, asm_cache_t* cache) {
+  if (thread_count <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cpus > 0 ? (int)cpus : 1;
+  }
+  if (thread_count > batch->job_count) thread_count = batch->job_count;
+
+  asm_batch_queue_t queue;
+  queue.batch = batch;
+  queue.cache = cache;
+  atomic_init(&queue.next_job, 0);
+
+  // The calling thread is one of the workers
+  pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+  int started = 0;
+  for (int i = 1; threads && i < thread_count; i++) {
+    if (pthread_create(&threads[started], NULL, asm_batch_worker, &queue) != 0)
+      break;
+    started++;
+  }
+  asm_batch_worker(&queue);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+
+  int failed = 0;
+  for (int i = 0; i < batch->job_count; i++) {
+    if (batch->jobs[i].result != 0) failed++;
+  }
+  return failed;
+}
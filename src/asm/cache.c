@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../../include/util/file.h"
+
+// Bump whenever the assembler output or program_t/symbol_table_t layout
+// changes so stale entries are never reused
+#define ASM_CACHE_VERSION 7
+#define ASM_CACHE_MAGIC "LC3C"
+#define ASM_CACHE_SUFFIX ".lc3c"
+// Temporary files older than this belong to a writer that died mid-store
+#define ASM_CACHE_STALE_TEMP_SECONDS 3600
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t program_size;
+  uint32_t symbols_size;
+  uint64_t checksum;
+} asm_cache_header_t;
+
+typedef struct {
+  char name[256];
+  time_t mtime;
+  off_t size;
+} asm_cache_entry_t;
+
+uint64_t asm_cache_hash_update(uint64_t hash, const void* data,
+                               size_t size) {
+  const unsigned char* p = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+uint64_t asm_cache_hash(const void* data, size_t size) {
+  return asm_cache_hash_update(FNV_OFFSET_BASIS, data, size);
+}
+
+// Create dir and any missing parents
+static int asm_cache_make_dirs(const char* dir) {
+  char path[ASM_CACHE_PATH_MAX];
+  size_t len = strlen(dir);
+  if (len == 0 || len >= sizeof(path)) return -1;
+  memcpy(path, dir, len + 1);
+
+  for (char* p = path + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    *p = '/';
+  }
+  if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+  return 0;
+}
+
+asm_cache_t* asm_cache_open(const char* dir, uint64_t max_bytes) {
+  if (asm_cache_make_dirs(dir) != 0) return NULL;
+
+  asm_cache_t* cache = malloc(sizeof(asm_cache_t));
+  if (!cache) return NULL;
+  snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+  cache->max_bytes = max_bytes;
+  return cache;
+}
+
+asm_cache_t* asm_cache_open_default(void) {
+  if (getenv("LC3_NO_CACHE")) return NULL;
+
+  char dir[ASM_CACHE_PATH_MAX];
+  const char* env_dir = getenv("LC3_CACHE_DIR");
+  const char* xdg_dir = getenv("XDG_CACHE_HOME");
+  const char* home_dir = getenv("HOME");
+  if (env_dir && *env_dir) {
+    snprintf(dir, sizeof(dir), "%s", env_dir);
+  } else if (xdg_dir && *xdg_dir) {
+    snprintf(dir, sizeof(dir), "%s/lc3", xdg_dir);
+  } else if (home_dir && *home_dir) {
+    snprintf(dir, sizeof(dir), "%s/.cache/lc3", home_dir);
+  } else {
+    return NULL;
+  }
+
+  uint64_t max_bytes = ASM_CACHE_DEFAULT_MAX_BYTES;
+  const char* env_max = getenv("LC3_CACHE_MAX_BYTES");
+  if (env_max && *env_max) {
+    max_bytes = strtoull(env_max, NULL, 10);
+  }
+
+  return asm_cache_open(dir, max_bytes);
+}
+
+void asm_cache_close(asm_cache_t* cache) { free(cache); }
+
+int asm_cache_key_file(const char* filename, uint64_t* key) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) return 1;
+
+  uint32_t version = ASM_CACHE_VERSION;
+  uint64_t hash = asm_cache_hash(&version, sizeof(version));
+
+  char buffer[8192];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    hash = asm_cache_hash_update(hash, buffer, read);
+  }
+
+  int result = ferror(file) ? 1 : 0;
+  fclose(file);
+  *key = hash;
+  return result;
+}
+
+static void asm_cache_entry_path(asm_cache_t* cache, uint64_t key, char* path,
+                                 size_t size) {
+  snprintf(path, size, "%s/%016llx" ASM_CACHE_SUFFIX, cache->dir,
+           (unsigned long long)key);
+}
+
+program_t* asm_cache_lookup(asm_cache_t* cache, uint64_t key,
+                            symbol_table_t** symbols) {
+  char path[ASM_CACHE_PATH_MAX + 32];
+  asm_cache_entry_path(cache, key, path, sizeof(path));
+
+  FILE* file = fopen(path, "rb");
+  if (!file) return NULL;
+
+  asm_cache_header_t header;
+  program_t* program = malloc(sizeof(program_t));
+  symbol_table_t* table = symbol_table_create();
+  bool valid = program && table &&
+               fread(&header, sizeof(header), 1, file) == 1 &&
+               memcmp(header.magic, ASM_CACHE_MAGIC, 4) == 0 &&
+               header.version == ASM_CACHE_VERSION && header.key == key &&
+               header.program_size == sizeof(program_t) &&
+               header.symbols_size == sizeof(symbol_table_t) &&
+               fread(program, sizeof(program_t), 1, file) == 1 &&
+               fread(table, sizeof(symbol_table_t), 1, file) == 1;
+  fclose(file);
+
+  if (valid) {
+    uint64_t checksum = asm_cache_hash(program, sizeof(program_t));
+    checksum = asm_cache_hash_update(checksum, table, sizeof(symbol_table_t));
+    valid = checksum == header.checksum;
+  }
+
+  if (!valid) {
+    program_destroy(program);
+    symbol_table_destroy(table);
+    return NULL;
+  }
+
+  // Refresh the entry's age for least-recently-used eviction
+  utimensat(AT_FDCWD, path, NULL, 0);
+
+  if (symbols) {
+    *symbols = table;
+  } else {
+    symbol_table_destroy(table);
+  }
+  return program;
+}
+
+int asm_cache_store(asm_cache_t* cache, uint64_t key, program_t* program,
+                    symbol_table_t* symbols) {
+  size_t size =
+      sizeof(asm_cache_header_t) + sizeof(program_t) + sizeof(symbol_table_t);
+  unsigned char* buffer = calloc(1, size);
+  if (!buffer) return 1;
+
+  asm_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ASM_CACHE_MAGIC, 4);
+  header.version = ASM_CACHE_VERSION;
+  header.key = key;
+  header.program_size = sizeof(program_t);
+  header.symbols_size = sizeof(symbol_table_t);
+
+  // Only the used prefix of each table is copied; the rest stays zeroed so
+  // identical programs produce identical entries
+  unsigned char* payload = buffer + sizeof(header);
+  program_t* program_copy = (program_t*)payload;
+  program_copy->origin = program->origin;
+  program_copy->instruction_count = program->instruction_count;
+  memcpy(program_copy->instructions, program->instructions,
+         program->instruction_count * sizeof(instruction_t));
+  program_copy->section_count = program->section_count;
+  memcpy(program_copy->sections, program->sections,
+         program->section_count * sizeof(section_t));
+  program_copy->relocation_count = program->relocation_count;
+  memcpy(program_copy->relocations, program->relocations,
+         program->relocation_count * sizeof(relocation_t));
+  if (symbols) {
+    symbol_table_t* symbols_copy =
+        (symbol_table_t*)(payload + sizeof(program_t));
+    symbols_copy->symbol_count = symbols->symbol_count;
+    memcpy(symbols_copy->symbols, symbols->symbols,
+           symbols->symbol_count * sizeof(symbol_t));
+  }
+  header.checksum =
+      asm_cache_hash(payload, sizeof(program_t) + sizeof(symbol_table_t));
+  memcpy(buffer, &header, sizeof(header));
+
+  char path[ASM_CACHE_PATH_MAX + 32];
+  asm_cache_entry_path(cache, key, path, sizeof(path));
+  int result = file_write_atomic(path, buffer, size) == 0 ? 0 : 1;
+  free(buffer);
+
+  asm_cache_evict(cache);
+  return result;
+}
+
+static int asm_cache_entry_compare(const void* a, const void* b) {
+  const asm_cache_entry_t* entry_a = a;
+  const asm_cache_entry_t* entry_b = b;
+  if (entry_a->mtime != entry_b->mtime) {
+    return entry_a->mtime < entry_b->mtime ? -1 : 1;
+  }
+  return strcmp(entry_a->name, entry_b->name);
+}
+
+void asm_cache_evict(asm_cache_t* cache) {
+  DIR* dir = opendir(cache->dir);
+  if (!dir) return;
+
+  asm_cache_entry_t* entries = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  uint64_t total = 0;
+  time_t now = time(NULL);
+
+  struct dirent* dirent;
+  while ((dirent = readdir(dir)) != NULL) {
+    const char* suffix = strstr(dirent->d_name, ASM_CACHE_SUFFIX);
+    if (!suffix) continue;
+
+    char path[ASM_CACHE_PATH_MAX + 256];
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, dirent->d_name);
+    struct stat st;
+    if (stat(path, &st) != 0) continue;  // Removed by another process
+
+    // In-flight temporary files are left alone unless clearly abandoned
+    if (strcmp(suffix, ASM_CACHE_SUFFIX) != 0) {
+      if (now - st.st_mtime > ASM_CACHE_STALE_TEMP_SECONDS) unlink(path);
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      asm_cache_entry_t* grown =
+          realloc(entries, capacity * sizeof(asm_cache_entry_t));
+      if (!grown) break;
+      entries = grown;
+    }
+    snprintf(entries[count].name, sizeof(entries[count].name), "%s",
+             dirent->d_name);
+    entries[count].mtime = st.st_mtime;
+    entries[count].size = st.st_size;
+    total += (uint64_t)st.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  if (total > cache->max_bytes) {
+    qsort(entries, count, sizeof(asm_cache_entry_t), asm_cache_entry_compare);
+    for (size_t i = 0; i < count && total > cache->max_bytes; i++) {
+      char path[ASM_CACHE_PATH_MAX + 256];
+      snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+      // Another process may have evicted it already; either way it is gone
+      unlink(path);
+      total -= (uint64_t)entries[i].size;
+    }
+  }
+
+  free(entries);
+}
@@ -0,0 +1,257 @@
+#include "../../include/asm/disasm.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/lc3/decode.h"
+#include "../../include/lc3/image.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/file.h"
+
+// Width of the address and word columns, "x3000  2202  "
+#define DISASM_PREFIX 13
+
+static const char* const disasm_opcode_names[16] = {
+    "BR",  "ADD", "LD",  "ST",  "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP",
+};
+
+struct disasm {
+  const lc3_decoded_t* decoded;
+  symbol_table_t symbols;
+  // Index into symbols of the first label at each address, or -1
+  int16_t labels[LC3_MEMORY_MAX];
+  int label_width;  // Of the label column; 0 without labels
+};
+
+disasm_t* disasm_create(const symbol_table_t* symbols) {
+  disasm_t* disasm = malloc(sizeof(disasm_t));
+  if (!disasm) return NULL;
+  disasm->decoded = lc3_decode_table();
+  disasm->symbols.symbol_count = 0;
+  if (symbols) disasm->symbols = *symbols;
+  memset(disasm->labels, 0xFF, sizeof(disasm->labels));
+  disasm->label_width = 0;
+  for (int i = 0; i < disasm->symbols.symbol_count; i++) {
+    const symbol_t* symbol = &disasm->symbols.symbols[i];
+    if (symbol->section == SYMBOL_NO_SECTION) continue;
+    if (disasm->labels[symbol->address] < 0) {
+      disasm->labels[symbol->address] = (int16_t)i;
+    }
+    int width = (int)strlen(symbol->name) + 2;
+    if (width > disasm->label_width) disasm->label_width = width;
+  }
+  return disasm;
+}
+
+void disasm_destroy(disasm_t* disasm) { free(disasm); }
+
+static const char* disasm_label(const disasm_t* disasm, uint16_t address) {
+  int index = disasm->labels[address];
+  return index < 0 ? NULL : disasm->symbols.symbols[index].name;
+}
+
+// Trap aliases the assembler accepts, or NULL
+static const char* disasm_trap_name(int vect) {
+  switch (vect) {
+    case LC3_TRAP_GETC:
+      return "GETC";
+    case LC3_TRAP_OUT:
+      return "OUT";
+    case LC3_TRAP_PUTS:
+      return "PUTS";
+    case LC3_TRAP_IN:
+      return "IN";
+    case LC3_TRAP_PUTSP:
+      return "PUTSP";
+    case LC3_TRAP_HALT:
+      return "HALT";
+    case LC3_TRAP_HASTRAP:
+      return "HASTRAP";
+    case LC3_TRAP_MUL:
+      return "MUL";
+    case LC3_TRAP_DIVMOD:
+      return "DIVMOD";
+    case LC3_TRAP_MEMCPY:
+      return "MEMCPY";
+    case LC3_TRAP_MEMSET:
+      return "MEMSET";
+    case LC3_TRAP_ADD32:
+      return "ADD32";
+    case LC3_TRAP_CAS:
+      return "CAS";
+    default:
+      return NULL;
+  }
+}
+
+char* disasm_word(const disasm_t* disasm, uint16_t address, uint16_t word,
+                  char* buffer, size_t size) {
+  const lc3_decoded_t* d = &disasm->decoded[word];
+  const char* name = disasm_opcode_names[d->op];
+
+  // Where a PC-relative operand points
+  uint16_t target = (uint16_t)(address + 1 + d->imm);
+  char target_name[8];
+  const char* label = disasm_label(disasm, target);
+  if (!label) {
+    snprintf(target_name, sizeof(target_name), "x%04X", target);
+    label = target_name;
+  }
+
+  switch (d->format) {
+    case LC3_FORMAT_REG3:
+      snprintf(buffer, size, "%s R%d, R%d, R%d", name, d->r0, d->r1, d->r2);
+      break;
+    case LC3_FORMAT_REG2_IMM:
+      snprintf(buffer, size, "%s R%d, R%d, #%d", name, d->r0, d->r1, d->imm);
+      break;
+    case LC3_FORMAT_REG2:
+      snprintf(buffer, size, "%s R%d, R%d", name, d->r0, d->r1);
+      break;
+    case LC3_FORMAT_REG_PC:
+      snprintf(buffer, size, "%s R%d, %s", name, d->r0, label);
+      break;
+    case LC3_FORMAT_BRANCH:
+      snprintf(buffer, size, "BR%s%s%s %s", d->r0 & LC3_FL_NEG ? "n" : "",
+               d->r0 & LC3_FL_ZRO ? "z" : "", d->r0 & LC3_FL_POS ? "p" : "",
+               label);
+      break;
+    case LC3_FORMAT_PC:
+      snprintf(buffer, size, "JSR %s", label);
+      break;
+    case LC3_FORMAT_BASE:
+      snprintf(buffer, size, "%s R%d", d->op == LC3_OP_JSR ? "JSRR" : "JMP",
+               d->r1);
+      break;
+    case LC3_FORMAT_NONE:
+      snprintf(buffer, size, "%s", d->op == LC3_OP_JMP ? "RET" : "RTI");
+      break;
+    case LC3_FORMAT_TRAP: {
+      const char* alias = disasm_trap_name(d->imm);
+      if (alias) {
+        snprintf(buffer, size, "%s", alias);
+      } else {
+        snprintf(buffer, size, "TRAP x%02X", d->imm);
+      }
+    } break;
+    default:
+      snprintf(buffer, size, ".FILL x%04X", word);
+      break;
+  }
+  return buffer;
+}
+
+// Start a listing line: address, word and label column
+static void disasm_line_start(const disasm_t* disasm, FILE* out,
+                              uint16_t address, const char* word) {
+  const char* label = disasm_label(disasm, address);
+  fprintf(out, "x%04X  %s  %-*s", address, word, disasm->label_width,
+          label ? label : "");
+}
+
+int disasm_write(const disasm_t* disasm, FILE* out, uint16_t origin,
+                 const uint16_t* words, size_t count) {
+  char text[96];
+  for (size_t i = 0; i < count; i++) {
+    uint16_t address = (uint16_t)(origin + i);
+    char word[8];
+    snprintf(word, sizeof(word), "%04X", words[i]);
+    disasm_line_start(disasm, out, address, word);
+    fputs(disasm_word(disasm, address, words[i], text, sizeof(text)), out);
+    fputc('\n', out);
+  }
+  return ferror(out) ? 1 : 0;
+}
+
+// List the segments of a sparse image. Zero segments are one .BLKW line.
+static int disasm_image(const disasm_t* disasm, FILE* out,
+                        const char* filename) {
+  image_t image;
+  if (image_open(filename, &image) != 0) {
+    fprintf(stderr, "Error: %s is not a valid LC-3 image\n", filename);
+    return 1;
+  }
+  uint16_t* words = malloc(LC3_MEMORY_MAX * sizeof(uint16_t));
+  int result = words ? 0 : 1;
+  bool native = image_is_native(&image);
+  for (int i = 0; result == 0 && i < image.segment_count; i++) {
+    image_segment_t segment;
+    image_get_segment(&image, i, &segment);
+    fprintf(out, "%*s.ORIG x%04X\n", DISASM_PREFIX + disasm->label_width, "",
+            segment.address);
+    if (segment.flags & IMAGE_SEGMENT_ZERO) {
+      disasm_line_start(disasm, out, segment.address, "....");
+      fprintf(out, ".BLKW #%u\n", segment.length);
+      continue;
+    }
+    if (native) {
+      memcpy(words, segment.words, segment.length * sizeof(uint16_t));
+    } else {
+      swap16_copy(words, segment.words, segment.length);
+    }
+    result = disasm_write(disasm, out, segment.address, words, segment.length);
+  }
+  free(words);
+  image_close(&image);
+  return result;
+}
+
+// List a legacy object file: its origin, then words up to the end of memory
+static int disasm_object(const disasm_t* disasm, FILE* out, FILE* file) {
+  uint16_t origin;
+  if (fread(&origin, sizeof(origin), 1, file) != 1) return 1;
+  origin = swap16(origin);
+
+  uint16_t* words = malloc(LC3_MEMORY_MAX * sizeof(uint16_t));
+  if (!words) return 1;
+  size_t count =
+      fread(words, sizeof(uint16_t), LC3_MEMORY_MAX - origin, file);
+  swap16_copy(words, words, count);
+  fprintf(out, "%*s.ORIG x%04X\n", DISASM_PREFIX + disasm->label_width, "",
+          origin);
+  int result = disasm_write(disasm, out, origin, words, count);
+  free(words);
+  return result;
+}
+
+int disasm_file(FILE* out, const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) {
+    fprintf(stderr, "Error: Could not open %s\n", filename);
+    return 1;
+  }
+
+  char* symbol_filename = file_change_extension(filename, ".sym");
+  symbol_table_t* symbols =
+      symbol_filename ? symbol_table_read_file(symbol_filename) : NULL;
+  free(symbol_filename);
+  disasm_t* disasm = disasm_create(symbols);
+  symbol_table_destroy(symbols);
+  if (!disasm) {
+    fclose(file);
+    return 1;
+  }
+
+  // Told apart by their magic as in the loader
+  char magic[4];
+  bool has_magic = fread(magic, 1, sizeof(magic), file) == sizeof(magic);
+  int result;
+  if (has_magic && memcmp(magic, LC3_MODULE_MAGIC, sizeof(magic)) == 0) {
+    fprintf(stderr, "Error: %s is a relocatable module; link it first\n",
+            filename);
+    result = 1;
+  } else if (has_magic && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0) {
+    result = disasm_image(disasm, out, filename);
+  } else {
+    rewind(file);
+    result = disasm_object(disasm, out, file);
+  }
+  if (result == 0) {
+    fprintf(out, "%*s.END\n", DISASM_PREFIX + disasm->label_width, "");
+  }
+  fclose(file);
+  disasm_destroy(disasm);
+  return result;
+}
@@ -0,0 +1,273 @@
+#include "../../include/asm/linker.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/asm/module.h"
+#include "../../include/lc3/lc3.h"
+#include "../../include/util/file.h"
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+typedef struct {
+  const char* filename;
+  program_t* program;
+  symbol_table_t* symbols;
+  uint16_t bases[MAX_SECTIONS];  // Linked address of each section
+} linker_module_t;
+
+// Open-addressing hash index of exported symbols; an entry with a NULL name
+// is empty
+typedef struct {
+  const char* name;
+  uint16_t address;
+  const char* filename;
+} linker_export_t;
+
+typedef struct {
+  linker_export_t* entries;
+  size_t capacity;  // Always a power of two
+} linker_index_t;
+
+static uint64_t linker_hash(const char* name) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+    hash ^= *p;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// Returns the slot holding name, or the empty slot where it belongs
+static linker_export_t* linker_index_slot(linker_index_t* index,
+                                          const char* name) {
+  size_t mask = index->capacity - 1;
+  for (size_t i = linker_hash(name) & mask;; i = (i + 1) & mask) {
+    linker_export_t* entry = &index->entries[i];
+    if (!entry->name || strcmp(entry->name, name) == 0) return entry;
+  }
+}
+
+// Linked address of a symbol defined in module
+static uint16_t linker_symbol_address(linker_module_t* module,
+                                      symbol_t* symbol) {
+  section_t* section = &module->program->sections[symbol->section];
+  return module->bases[symbol->section] + (symbol->address - section->origin);
+}
+
+// Section of module holding instruction, or -1
+static int linker_section_of(linker_module_t* module, int instruction) {
+  program_t* program = module->program;
+  for (int i = 0; i < program->section_count; i++) {
+    section_t* section = &program->sections[i];
+    if (instruction >= section->first_instruction &&
+        instruction < section->first_instruction + section->length) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Patch one relocation into the linked image. Returns 0, or 1 on error.
+static int linker_apply(linker_module_t* module, relocation_t* relocation,
+                        linker_index_t* index, uint16_t* image,
+                        uint16_t start, asm_log_t* log) {
+  symbol_t* symbol = &module->symbols->symbols[relocation->symbol];
+  uint16_t target;
+  if (symbol->section != SYMBOL_NO_SECTION) {
+    target = linker_symbol_address(module, symbol);
+  } else {
+    linker_export_t* export = linker_index_slot(index, symbol->name);
+    if (!export->name) {
+      asm_log(log, ASM_LOG_ERROR, "Error: Undefined symbol '%s' in %s\n",
+              symbol->name, module->filename);
+      return 1;
+    }
+    target = export->address;
+  }
+
+  int section_index = linker_section_of(module, relocation->instruction);
+  section_t* section = &module->program->sections[section_index];
+  uint16_t address = module->bases[section_index] +
+                     (relocation->instruction - section->first_instruction);
+  uint16_t* word = &image[address - start];
+
+  if (relocation->type == RELOC_ABS16) {
+    *word = target;
+    return 0;
+  }
+
+  int bits = relocation->type == RELOC_PC_OFFSET11 ? 11 : 9;
+  int offset = (int)target - (int)(address + 1);
+  if (offset < -(1 << (bits - 1)) || offset >= (1 << (bits - 1))) {
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: '%s' is out of range of the reference at x%04X in %s\n",
+            symbol->name, address, module->filename);
+    return 1;
+  }
+  uint16_t mask = (uint16_t)((1 << bits) - 1);
+  *word = (*word & ~mask) | (offset & mask);
+  return 0;
+}
+
+static int linker_write_symbols(linker_module_t* modules, int module_count,
+                                const char* filename, asm_log_t* log) {
+  FILE* file = fopen(filename, "w");
+  if (file == NULL) {
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: Could not open file %s to write symbols\n", filename);
+    return 1;
+  }
+  for (int i = 0; i < module_count; i++) {
+    symbol_table_t* symbols = modules[i].symbols;
+    for (int j = 0; j < symbols->symbol_count; j++) {
+      symbol_t* symbol = &symbols->symbols[j];
+      if (symbol->section == SYMBOL_NO_SECTION) continue;
+      fprintf(file, "%s\t%d\n", symbol->name,
+              linker_symbol_address(&modules[i], symbol));
+    }
+  }
+  if (fclose(file) != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write symbols to %s\n",
+            filename);
+    return 1;
+  }
+  return 0;
+}
+
+static int linker_link(linker_module_t* modules, int module_count,
+                       const char* output_filename, bool native,
+                       asm_log_t* log) {
+  // Lay sections out back to back after the first module's first section
+  uint16_t start = LC3_PC_START;
+  if (modules[0].program->section_count > 0) {
+    start = modules[0].program->sections[0].origin;
+  }
+  uint32_t next = start;
+  size_t export_count = 0;
+  for (int i = 0; i < module_count; i++) {
+    program_t* program = modules[i].program;
+    for (int j = 0; j < program->section_count; j++) {
+      modules[i].bases[j] = (uint16_t)next;
+      next += program->sections[j].length;
+    }
+    for (int j = 0; j < modules[i].symbols->symbol_count; j++) {
+      if (modules[i].symbols->symbols[j].flags & SYMBOL_GLOBAL) export_count++;
+    }
+  }
+  if (next > LC3_MEMORY_MAX) {
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: Linked program does not fit in memory (%u words from "
+            "x%04X)\n",
+            (unsigned)(next - start), start);
+    return 1;
+  }
+  size_t total = next - start;
+
+  linker_index_t index = {NULL, 16};
+  while (index.capacity < export_count * 2) index.capacity *= 2;
+  index.entries = calloc(index.capacity, sizeof(linker_export_t));
+  // One extra word keeps the allocation non-empty for empty programs
+  uint16_t* image = calloc(total + 1, sizeof(uint16_t));
+  if (!index.entries || !image) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory\n");
+    free(index.entries);
+    free(image);
+    return 1;
+  }
+
+  int errors = 0;
+  for (int i = 0; i < module_count; i++) {
+    symbol_table_t* symbols = modules[i].symbols;
+    for (int j = 0; j < symbols->symbol_count; j++) {
+      symbol_t* symbol = &symbols->symbols[j];
+      if (!(symbol->flags & SYMBOL_GLOBAL) ||
+          symbol->section == SYMBOL_NO_SECTION) {
+        continue;
+      }
+      linker_export_t* export = linker_index_slot(&index, symbol->name);
+      if (export->name) {
+        asm_log(log, ASM_LOG_ERROR,
+                "Error: Symbol '%s' is defined in both %s and %s\n",
+                symbol->name, export->filename, modules[i].filename);
+        errors++;
+        continue;
+      }
+      export->name = symbol->name;
+      export->address = linker_symbol_address(&modules[i], symbol);
+      export->filename = modules[i].filename;
+    }
+  }
+
+  for (int i = 0; i < module_count; i++) {
+    program_t* program = modules[i].program;
+    for (int j = 0; j < program->section_count; j++) {
+      section_t* section = &program->sections[j];
+      for (int k = 0; k < section->length; k++) {
+        image[modules[i].bases[j] - start + k] =
+            program->instructions[section->first_instruction + k].instruction;
+      }
+    }
+    for (int j = 0; j < program->relocation_count; j++) {
+      errors += linker_apply(&modules[i], &program->relocations[j], &index,
+                             image, start, log);
+    }
+  }
+
+  int result = errors > 0 ? 1 : 0;
+  if (result == 0) {
+    result = program_write_image(output_filename, start, image, total, native,
+                                 log);
+  }
+  if (result == 0) {
+    char* symbols_filename = file_change_extension(output_filename, ".sym");
+    result = symbols_filename ? linker_write_symbols(modules, module_count,
+                                                     symbols_filename, log)
+                              : 1;
+    free(symbols_filename);
+  }
+  if (result == 0) {
+    asm_log(log, ASM_LOG_INFO, "Linked %d modules into %s (%zu words at x%04X)\n",
+            module_count, output_filename, total, start);
+  }
+
+  free(index.entries);
+  free(image);
+  return result;
+}
+
+int linker_run(int input_count, char* input_filenames[],
+               const char* output_filename, bool native, asm_log_t* log) {
+  if (input_count <= 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: No modules to link\n");
+    return 1;
+  }
+
+  linker_module_t* modules = calloc(input_count, sizeof(linker_module_t));
+  if (!modules) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory\n");
+    return 1;
+  }
+
+  int result = 0;
+  for (int i = 0; i < input_count && result == 0; i++) {
+    modules[i].filename = input_filenames[i];
+    result = module_read_file(input_filenames[i], &modules[i].program,
+                              &modules[i].symbols, log);
+  }
+
+  if (result == 0) {
+    result = linker_link(modules, input_count, output_filename, native, log);
+  }
+
+  for (int i = 0; i < input_count; i++) {
+    program_destroy(modules[i].program);
+    symbol_table_destroy(modules[i].symbols);
+  }
+  free(modules);
+  return result;
+}
@@ -0,0 +1,58 @@
+#include "../../include/asm/log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void asm_log_init(asm_log_t* log, bool buffered, bool quiet) {
+  memset(log, 0, sizeof(asm_log_t));
+  log->buffered = buffered;
+  log->quiet = quiet;
+}
+
+void asm_log_free(asm_log_t* log) {
+  free(log->buffer);
+  log->buffer = NULL;
+  log->length = 0;
+  log->capacity = 0;
+}
+
+static void asm_log_append(asm_log_t* log, const char* format, va_list args) {
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int needed = vsnprintf(NULL, 0, format, args_copy);
+  va_end(args_copy);
+  if (needed < 0) return;
+
+  size_t required = log->length + (size_t)needed + 1;
+  if (required > log->capacity) {
+    size_t capacity = log->capacity ? log->capacity : 256;
+    while (capacity < required) capacity *= 2;
+    char* grown = realloc(log->buffer, capacity);
+    if (!grown) return;
+    log->buffer = grown;
+    log->capacity = capacity;
+  }
+
+  vsnprintf(log->buffer + log->length, log->capacity - log->length, format,
+            args);
+  log->length += (size_t)needed;
+}
+
+void asm_log(asm_log_t* log, asm_log_level_t level, const char* format, ...) {
+  if (log) {
+    if (level == ASM_LOG_WARNING) log->warning_count++;
+    if (level == ASM_LOG_ERROR) log->error_count++;
+    if (level == ASM_LOG_INFO && log->quiet) return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  if (log && log->buffered) {
+    asm_log_append(log, format, args);
+  } else {
+    vfprintf(level == ASM_LOG_ERROR ? stderr : stdout, format, args);
+  }
+  va_end(args);
+}
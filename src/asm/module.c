@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/module.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/lc3/lc3.h"
+#include "../../include/util/file.h"
+
+#define MODULE_HEADER_WORDS 8
+#define MODULE_SECTION_WORDS 3
+#define MODULE_SYMBOL_WORDS 4
+#define MODULE_RELOCATION_WORDS 4
+
+// Big-endian byte buffer that module files are built in and parsed from
+typedef struct {
+  unsigned char* data;
+  size_t size;
+  size_t position;
+} module_buffer_t;
+
+static void module_put16(module_buffer_t* buffer, uint16_t value) {
+  buffer->data[buffer->position++] = value >> 8;
+  buffer->data[buffer->position++] = value & 0xFF;
+}
+
+static bool module_get16(module_buffer_t* buffer, uint16_t* value) {
+  if (buffer->size - buffer->position < 2) return false;
+  *value = (uint16_t)(buffer->data[buffer->position] << 8 |
+                      buffer->data[buffer->position + 1]);
+  buffer->position += 2;
+  return true;
+}
+
+// Index of the section holding instruction, or -1
+static int module_section_of(program_t* program, int instruction) {
+  for (int i = 0; i < program->section_count; i++) {
+    section_t* section = &program->sections[i];
+    if (instruction >= section->first_instruction &&
+        instruction < section->first_instruction + section->instruction_count) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int module_write_file(program_t* program, symbol_table_t* symbols,
+                      const char* filename, asm_log_t* log) {
+  size_t strings_size = 0;
+  for (int i = 0; i < symbols->symbol_count; i++) {
+    strings_size += strlen(symbols->symbols[i].name) + 1;
+  }
+  strings_size += strings_size % 2;
+
+  size_t word_count = MODULE_HEADER_WORDS +
+                      symbols->symbol_count * MODULE_SYMBOL_WORDS +
+                      program->relocation_count * MODULE_RELOCATION_WORDS;
+  for (int i = 0; i < program->section_count; i++) {
+    word_count += MODULE_SECTION_WORDS + program->sections[i].length;
+  }
+
+  module_buffer_t buffer = {NULL, word_count * 2 + strings_size, 0};
+  buffer.data = calloc(1, buffer.size);
+  if (!buffer.data) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory writing %s\n", filename);
+    return 1;
+  }
+
+  memcpy(buffer.data, LC3_MODULE_MAGIC, 4);
+  buffer.position = 4;
+  module_put16(&buffer, MODULE_VERSION);
+  module_put16(&buffer, program->section_count);
+  module_put16(&buffer, symbols->symbol_count);
+  module_put16(&buffer, program->relocation_count);
+  module_put16(&buffer, strings_size);
+  module_put16(&buffer, 0);  // Reserved
+
+  // Sections, each followed by its zero-padded words
+  for (int i = 0; i < program->section_count; i++) {
+    section_t* section = &program->sections[i];
+    module_put16(&buffer, section->origin);
+    module_put16(&buffer, section->length);
+    module_put16(&buffer, 0);  // Flags
+
+    size_t words_start = buffer.position;
+    buffer.position += section->length * 2;
+    for (int j = 0; j < section->instruction_count; j++) {
+      instruction_t* instruction =
+          &program->instructions[section->first_instruction + j];
+      size_t offset = (uint16_t)(instruction->address - section->origin);
+      if (offset >= section->length) continue;
+      size_t saved_position = buffer.position;
+      buffer.position = words_start + offset * 2;
+      module_put16(&buffer, instruction->instruction);
+      buffer.position = saved_position;
+    }
+  }
+
+  uint16_t name_offset = 0;
+  for (int i = 0; i < symbols->symbol_count; i++) {
+    symbol_t* symbol = &symbols->symbols[i];
+    bool defined = symbol->section >= 0 &&
+                   symbol->section < program->section_count;
+    module_put16(&buffer, name_offset);
+    module_put16(&buffer, defined ? symbol->section : MODULE_NO_SECTION);
+    module_put16(&buffer,
+                 defined ? symbol->address -
+                               program->sections[symbol->section].origin
+                         : 0);
+    module_put16(&buffer, symbol->flags);
+    name_offset += strlen(symbol->name) + 1;
+  }
+
+  for (int i = 0; i < program->relocation_count; i++) {
+    relocation_t* relocation = &program->relocations[i];
+    int section = module_section_of(program, relocation->instruction);
+    if (section < 0) {
+      asm_log(log, ASM_LOG_ERROR, "Error: Relocation outside any section\n");
+      free(buffer.data);
+      return 1;
+    }
+    module_put16(&buffer, section);
+    module_put16(&buffer,
+                 program->instructions[relocation->instruction].address -
+                     program->sections[section].origin);
+    module_put16(&buffer, relocation->type);
+    module_put16(&buffer, relocation->symbol);
+  }
+
+  for (int i = 0; i < symbols->symbol_count; i++) {
+    size_t length = strlen(symbols->symbols[i].name) + 1;
+    memcpy(buffer.data + buffer.position, symbols->symbols[i].name, length);
+    buffer.position += length;
+  }
+
+  int result = file_write_atomic(filename, buffer.data, buffer.size);
+  free(buffer.data);
+  if (result != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write output file %s: %s\n",
+            filename, strerror(errno));
+    return 1;
+  }
+
+  asm_log(log, ASM_LOG_INFO,
+          "Generated %s with %d sections, %d symbols and %d relocations\n",
+          filename, program->section_count, symbols->symbol_count,
+          program->relocation_count);
+  return 0;
+}
+
+// Read the whole of filename into buffer
+static int module_read_bytes(const char* filename, module_buffer_t* buffer) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) return 1;
+
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+  if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+    fclose(file);
+    return 1;
+  }
+
+  buffer->data = malloc(size > 0 ? (size_t)size : 1);
+  buffer->size = (size_t)size;
+  buffer->position = 0;
+  bool read_ok = buffer->data &&
+                 fread(buffer->data, 1, buffer->size, file) == buffer->size;
+  fclose(file);
+  if (!read_ok) {
+    free(buffer->data);
+    return 1;
+  }
+  return 0;
+}
+
+// Decode a module image; false if it is truncated or inconsistent
+static bool module_parse(module_buffer_t* buffer, program_t* program,
+                         symbol_table_t* symbols) {
+  uint16_t version, section_count, symbol_count, relocation_count,
+      strings_size, reserved;
+  if (buffer->size < 4 || memcmp(buffer->data, LC3_MODULE_MAGIC, 4) != 0) {
+    return false;
+  }
+  buffer->position = 4;
+  if (!module_get16(buffer, &version) ||
+      !module_get16(buffer, &section_count) ||
+      !module_get16(buffer, &symbol_count) ||
+      !module_get16(buffer, &relocation_count) ||
+      !module_get16(buffer, &strings_size) ||
+      !module_get16(buffer, &reserved)) {
+    return false;
+  }
+  if (version != MODULE_VERSION || section_count > MAX_SECTIONS ||
+      symbol_count > MAX_SYMBOLS || relocation_count > MAX_RELOCATIONS) {
+    return false;
+  }
+
+  for (int i = 0; i < section_count; i++) {
+    section_t* section = &program->sections[program->section_count++];
+    uint16_t flags;
+    if (!module_get16(buffer, &section->origin) ||
+        !module_get16(buffer, &section->length) ||
+        !module_get16(buffer, &flags)) {
+      return false;
+    }
+    if (program->instruction_count + section->length > MAX_INSTRUCTIONS) {
+      return false;
+    }
+
+    // Words become consecutive instructions, so the section length is also
+    // its instruction count
+    section->first_instruction = program->instruction_count;
+    section->instruction_count = 0;
+    for (int j = 0; j < section->length; j++) {
+      uint16_t word;
+      if (!module_get16(buffer, &word)) return false;
+      program_add_instruction(program, word, section->origin + j);
+    }
+  }
+  if (section_count > 0) program->origin = program->sections[0].origin;
+
+  uint16_t name_offsets[MAX_SYMBOLS];
+  for (int i = 0; i < symbol_count; i++) {
+    uint16_t section, offset, flags;
+    if (!module_get16(buffer, &name_offsets[i]) ||
+        !module_get16(buffer, &section) || !module_get16(buffer, &offset) ||
+        !module_get16(buffer, &flags)) {
+      return false;
+    }
+    if (section != MODULE_NO_SECTION && section >= section_count) return false;
+
+    symbol_t* symbol = &symbols->symbols[symbols->symbol_count++];
+    symbol->section =
+        section == MODULE_NO_SECTION ? SYMBOL_NO_SECTION : (int16_t)section;
+    symbol->address = section == MODULE_NO_SECTION
+                          ? 0
+                          : program->sections[section].origin + offset;
+    symbol->flags = (uint8_t)flags;
+  }
+
+  for (int i = 0; i < relocation_count; i++) {
+    uint16_t section, offset, type, symbol;
+    if (!module_get16(buffer, &section) || !module_get16(buffer, &offset) ||
+        !module_get16(buffer, &type) || !module_get16(buffer, &symbol)) {
+      return false;
+    }
+    if (section >= section_count ||
+        offset >= program->sections[section].length || type > RELOC_ABS16 ||
+        symbol >= symbol_count) {
+      return false;
+    }
+    program_add_relocation(program,
+                           program->sections[section].first_instruction +
+                               offset,
+                           symbol, (uint8_t)type, false);
+  }
+
+  // Names must be NUL-terminated inside the string table
+  if (buffer->size - buffer->position < strings_size) return false;
+  const char* strings = (const char*)buffer->data + buffer->position;
+  for (int i = 0; i < symbol_count; i++) {
+    if (name_offsets[i] >= strings_size) return false;
+    const char* name = strings + name_offsets[i];
+    size_t available = strings_size - name_offsets[i];
+    size_t length = strnlen(name, available);
+    if (length == available ||
+        length >= sizeof(symbols->symbols[i].name)) {
+      return false;
+    }
+    memcpy(symbols->symbols[i].name, name, length + 1);
+  }
+  return true;
+}
+
+int module_read_file(const char* filename, program_t** program,
+                     symbol_table_t** symbols, asm_log_t* log) {
+  module_buffer_t buffer;
+  if (module_read_bytes(filename, &buffer) != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not read module %s\n", filename);
+    return 1;
+  }
+
+  program_t* module_program = calloc(1, sizeof(program_t));
+  symbol_table_t* module_symbols = symbol_table_create();
+  if (module_program) module_program->origin = LC3_PC_START;
+  bool valid = module_program && module_symbols &&
+               module_parse(&buffer, module_program, module_symbols);
+  free(buffer.data);
+
+  if (!valid) {
+    asm_log(log, ASM_LOG_ERROR, "Error: %s is not a valid LC-3 module\n",
+            filename);
+    program_destroy(module_program);
+    symbol_table_destroy(module_symbols);
+    return 1;
+  }
+
+  *program = module_program;
+  *symbols = module_symbols;
+  return 0;
+}
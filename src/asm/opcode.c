@@ -0,0 +1,45 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/opcode.h"
+
+#include <ctype.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+static const char* const opcode_mnemonics[] = {
+    "ADD",  "AND",  "NOT",  "LD",   "LDI",     "LDR",     "LEA",   "ST",
+    "STI",  "STR",  "JMP",  "JSR",  "JSRR",    "RET",     "RTI",   "TRAP",
+    "GETC", "OUT",  "PUTS", "IN",   "PUTSP",   "HALT",    ".ORIG", ".END",
+    ".FILL", ".BLKW", ".STRINGZ", ".GLOBAL", ".EXTERN",
+    // Extension traps (see lc3/lc3.h)
+    "HASTRAP", "MUL", "DIVMOD", "MEMCPY", "MEMSET", "ADD32",
+    "CAS",     NULL};
+
+bool opcode_is_branch(const char* token) {
+  if (toupper((unsigned char)token[0]) != 'B' ||
+      toupper((unsigned char)token[1]) != 'R') {
+    return false;
+  }
+  for (const char* p = token + 2; *p; p++) {
+    char c = (char)tolower((unsigned char)*p);
+    if (c != 'n' && c != 'z' && c != 'p') return false;
+  }
+  return true;
+}
+
+bool opcode_is_unconditional_branch(const char* token) {
+  if (!opcode_is_branch(token)) return false;
+  const char* conditions = token + 2;
+  return *conditions == '\0' ||
+         (strpbrk(conditions, "nN") && strpbrk(conditions, "zZ") &&
+          strpbrk(conditions, "pP"));
+}
+
+bool opcode_is_mnemonic(const char* token) {
+  if (opcode_is_branch(token)) return true;
+  for (int i = 0; opcode_mnemonics[i]; i++) {
+    if (strcasecmp(token, opcode_mnemonics[i]) == 0) return true;
+  }
+  return false;
+}
@@ -0,0 +1,400 @@
+#include "../../include/asm/optimize.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/lc3/decode.h"
+#include "../../include/lc3/lc3.h"
+
+// Longest chain of unconditional branches followed when threading one branch
+#define OPTIMIZE_MAX_THREAD_DEPTH 8
+
+typedef struct {
+  program_t* program;
+  symbol_table_t* symbols;
+  bool removed[MAX_INSTRUCTIONS];
+  int relocation_of[MAX_INSTRUCTIONS];  // Relocation index, or -1
+  int index_of[LC3_MEMORY_MAX];         // Instruction at each address, or -1
+  uint8_t referenced[LC3_MEMORY_MAX / 8];
+} optimize_t;
+
+static int sign_extend(int value, int bits) {
+  int sign = 1 << (bits - 1);
+  return (value & (sign - 1)) - (value & sign);
+}
+
+static bool offset_fits(int offset, int bits) {
+  return offset >= -(1 << (bits - 1)) && offset < (1 << (bits - 1));
+}
+
+// Width of the PC-relative operand of an instruction word, or 0
+static int pc_offset_bits(const instruction_t* instruction) {
+  if (instruction->kind != INSTRUCTION_CODE) return 0;
+  uint16_t word = instruction->instruction;
+  switch (word >> 12) {
+    case LC3_OP_BR:
+    case LC3_OP_LD:
+    case LC3_OP_ST:
+    case LC3_OP_LDI:
+    case LC3_OP_STI:
+    case LC3_OP_LEA:
+      return 9;
+    case LC3_OP_JSR:
+      return (word & 0x0800) ? 11 : 0;  // JSRR has no offset
+    default:
+      return 0;
+  }
+}
+
+static uint16_t pc_target(const instruction_t* instruction, int bits) {
+  int offset = sign_extend(instruction->instruction, bits);
+  return (uint16_t)(instruction->address + 1 + offset);
+}
+
+static uint16_t with_offset(uint16_t word, int bits, int offset) {
+  uint16_t mask = (uint16_t)((1 << bits) - 1);
+  return (uint16_t)((word & ~mask) | (offset & mask));
+}
+
+static bool is_code(optimize_t* opt, int index, int opcode) {
+  instruction_t* instruction = &opt->program->instructions[index];
+  return !opt->removed[index] && instruction->kind == INSTRUCTION_CODE &&
+         instruction->instruction >> 12 == opcode;
+}
+
+// HALT, JMP/RET and BRnzp never fall through to the next word
+static bool is_unconditional(const instruction_t* instruction) {
+  uint16_t word = instruction->instruction;
+  if (instruction->kind != INSTRUCTION_CODE) return false;
+  return (word >> 12 == LC3_OP_BR && (word & 0x0E00) == 0x0E00) ||
+         word >> 12 == LC3_OP_JMP || word == 0xF025;
+}
+
+static bool is_referenced(optimize_t* opt, uint16_t address) {
+  return opt->referenced[address / 8] & (1 << (address % 8));
+}
+
+static void mark_referenced(optimize_t* opt, uint16_t address) {
+  opt->referenced[address / 8] |= (uint8_t)(1 << (address % 8));
+}
+
+// Labels and the targets of surviving PC-relative operands
+static void find_references(optimize_t* opt) {
+  memset(opt->referenced, 0, sizeof(opt->referenced));
+  for (int i = 0; i < opt->symbols->symbol_count; i++) {
+    if (opt->symbols->symbols[i].section != SYMBOL_NO_SECTION) {
+      mark_referenced(opt, opt->symbols->symbols[i].address);
+    }
+  }
+
+  program_t* program = opt->program;
+  for (int i = 0; i < program->instruction_count; i++) {
+    int bits = pc_offset_bits(&program->instructions[i]);
+    if (opt->removed[i] || bits == 0 || opt->relocation_of[i] >= 0) continue;
+    mark_referenced(opt, pc_target(&program->instructions[i], bits));
+  }
+}
+
+// The next surviving instruction if it directly follows index in memory once
+// removed words are squeezed out, or -1
+static int next_instruction(optimize_t* opt, int index) {
+  program_t* program = opt->program;
+  int next = index + 1;
+  while (next < program->instruction_count &&
+         program->instructions[next].address ==
+             program->instructions[next - 1].address + 1) {
+    if (!opt->removed[next]) return next;
+    next++;
+  }
+  return -1;
+}
+
+// True if word sets all of register reg (and the condition codes) without
+// reading reg first
+static bool overwrites(uint16_t word, int reg) {
+  int dr = lc3_r0(word);
+  int sr1 = lc3_r1(word);
+  bool immediate = word & LC3_IMM_MODE;
+  if (dr != reg) return false;
+  switch (word >> 12) {
+    case LC3_OP_ADD:
+    case LC3_OP_AND:
+      return sr1 != reg && (immediate || lc3_r2(word) != reg);
+    case LC3_OP_NOT:
+    case LC3_OP_LDR:
+      return sr1 != reg;
+    case LC3_OP_LD:
+    case LC3_OP_LDI:
+    case LC3_OP_LEA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Retarget branches to an unconditional BR at that BR's own target
+static bool thread_branches(optimize_t* opt, optimize_stats_t* stats) {
+  program_t* program = opt->program;
+  bool changed = false;
+  for (int i = 0; i < program->instruction_count; i++) {
+    if (!is_code(opt, i, LC3_OP_BR) || opt->relocation_of[i] >= 0) continue;
+    instruction_t* branch = &program->instructions[i];
+    uint16_t target = pc_target(branch, 9);
+
+    int depth = 0;
+    int hop = opt->index_of[target];
+    while (depth < OPTIMIZE_MAX_THREAD_DEPTH && hop >= 0 && hop != i &&
+           is_code(opt, hop, LC3_OP_BR) && opt->relocation_of[hop] < 0 &&
+           is_unconditional(&program->instructions[hop])) {
+      uint16_t next_target = pc_target(&program->instructions[hop], 9);
+      if (next_target == target) break;  // Branch to itself
+      target = next_target;
+      hop = opt->index_of[target];
+      depth++;
+    }
+
+    int offset = (int)target - (int)(branch->address + 1);
+    if (depth > 0 && offset_fits(offset, 9)) {
+      branch->instruction = with_offset(branch->instruction, 9, offset);
+      stats->threaded_branches++;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Drop AND Rx,Ry,#0 when the next instruction overwrites Rx anyway
+static bool remove_redundant_clears(optimize_t* opt, optimize_stats_t* stats) {
+  program_t* program = opt->program;
+  bool changed = false;
+  for (int i = 0; i < program->instruction_count; i++) {
+    uint16_t word = program->instructions[i].instruction;
+    if (!is_code(opt, i, LC3_OP_AND) || (word & 0x3F) != 0x20) continue;
+
+    int next = next_instruction(opt, i);
+    if (next >= 0 && program->instructions[next].kind == INSTRUCTION_CODE &&
+        overwrites(program->instructions[next].instruction, (word >> 9) & 7)) {
+      opt->removed[i] = true;
+      stats->redundant_clears++;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Merge ADD Rx,Rx,#a; ADD Rx,Rx,#b into ADD Rx,Rx,#(a+b) when it fits imm5
+// and nothing jumps to the second ADD
+static bool fold_adds(optimize_t* opt, optimize_stats_t* stats) {
+  program_t* program = opt->program;
+  bool changed = false;
+  for (int i = 0; i < program->instruction_count; i++) {
+    uint16_t first = program->instructions[i].instruction;
+    int reg = lc3_r0(first);
+    if (!is_code(opt, i, LC3_OP_ADD) || !(first & LC3_IMM_MODE) ||
+        lc3_r1(first) != reg) {
+      continue;
+    }
+
+    int next = next_instruction(opt, i);
+    if (next < 0 || !is_code(opt, next, LC3_OP_ADD) ||
+        is_referenced(opt, program->instructions[next].address)) {
+      continue;
+    }
+    uint16_t second = program->instructions[next].instruction;
+    if (second >> 6 != first >> 6 || !(second & 0x20)) continue;
+
+    int sum = sign_extend(first, 5) + sign_extend(second, 5);
+    if (!offset_fits(sum, 5)) continue;
+    program->instructions[i].instruction = with_offset(first, 5, sum);
+    opt->removed[next] = true;
+    stats->folded_adds++;
+    changed = true;
+  }
+  return changed;
+}
+
+// Drop code after an unconditional transfer up to the next referenced word
+static bool remove_unreachable(optimize_t* opt, optimize_stats_t* stats) {
+  program_t* program = opt->program;
+  bool changed = false;
+  for (int i = 0; i < program->instruction_count; i++) {
+    if (opt->removed[i] || !is_unconditional(&program->instructions[i])) {
+      continue;
+    }
+    for (int j = i + 1; j < program->instruction_count; j++) {
+      instruction_t* instruction = &program->instructions[j];
+      if (instruction->address != program->instructions[j - 1].address + 1 ||
+          instruction->kind != INSTRUCTION_CODE ||
+          is_referenced(opt, instruction->address)) {
+        break;
+      }
+      if (!opt->removed[j]) {
+        opt->removed[j] = true;
+        stats->unreachable_words++;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+// Where an address ends up once removed words are squeezed out of its
+// section. Addresses outside every section do not move.
+static uint16_t map_address(optimize_t* opt, uint16_t address) {
+  program_t* program = opt->program;
+  section_t* section = NULL;
+  for (int i = 0; i < program->section_count && !section; i++) {
+    section_t* candidate = &program->sections[i];
+    if (address >= candidate->origin &&
+        address < candidate->origin + candidate->length) {
+      section = candidate;
+    }
+  }
+  // A label just past the end of a section belongs to that section
+  for (int i = 0; i < program->section_count && !section; i++) {
+    if (address == program->sections[i].origin + program->sections[i].length) {
+      section = &program->sections[i];
+    }
+  }
+  if (!section) return address;
+
+  int removed = 0;
+  int end = section->first_instruction + section->instruction_count;
+  for (int i = section->first_instruction; i < end; i++) {
+    if (opt->removed[i] && program->instructions[i].address < address) {
+      removed++;
+    }
+  }
+  return (uint16_t)(address - removed);
+}
+
+// Build the compacted program and symbols into the given copies. Returns 0,
+// or 1 if an operand no longer reaches its target.
+static int compact(optimize_t* opt, program_t* out, symbol_table_t* symbols) {
+  program_t* program = opt->program;
+
+  for (int i = 0; i < symbols->symbol_count; i++) {
+    if (symbols->symbols[i].section != SYMBOL_NO_SECTION) {
+      symbols->symbols[i].address =
+          map_address(opt, symbols->symbols[i].address);
+    }
+  }
+
+  int new_index[MAX_INSTRUCTIONS];
+  out->instruction_count = 0;
+  for (int s = 0; s < program->section_count; s++) {
+    section_t* section = &out->sections[s];
+    int first = section->first_instruction;
+    int end = first + section->instruction_count;
+    section->first_instruction = out->instruction_count;
+    for (int i = first; i < end; i++) {
+      if (opt->removed[i]) {
+        section->length--;
+        continue;
+      }
+      new_index[i] = out->instruction_count;
+      instruction_t* instruction = &out->instructions[out->instruction_count++];
+      *instruction = program->instructions[i];
+      instruction->address = map_address(opt, instruction->address);
+    }
+    section->instruction_count = out->instruction_count -
+                                 section->first_instruction;
+  }
+
+  // Re-encode PC-relative operands against the new layout
+  for (int i = 0; i < program->instruction_count; i++) {
+    int bits = pc_offset_bits(&program->instructions[i]);
+    if (opt->removed[i] || bits == 0) continue;
+    int relocation = opt->relocation_of[i];
+    if (relocation >= 0 && !program->relocations[relocation].applied) continue;
+
+    uint16_t target =
+        relocation >= 0
+            ? symbols->symbols[program->relocations[relocation].symbol].address
+            : map_address(opt, pc_target(&program->instructions[i], bits));
+    instruction_t* instruction = &out->instructions[new_index[i]];
+    int offset = (int)target - (int)(instruction->address + 1);
+    if (!offset_fits(offset, bits)) return 1;
+    instruction->instruction = with_offset(instruction->instruction, bits,
+                                           offset);
+  }
+
+  out->relocation_count = 0;
+  for (int i = 0; i < program->relocation_count; i++) {
+    relocation_t relocation = program->relocations[i];
+    if (opt->removed[relocation.instruction]) continue;
+    relocation.instruction = new_index[relocation.instruction];
+    if (relocation.type == RELOC_ABS16 && relocation.applied) {
+      out->instructions[relocation.instruction].instruction =
+          symbols->symbols[relocation.symbol].address;
+    }
+    out->relocations[out->relocation_count++] = relocation;
+  }
+  return 0;
+}
+
+int optimize_program(program_t* program, symbol_table_t* symbols,
+                     optimize_stats_t* stats, asm_log_t* log) {
+  memset(stats, 0, sizeof(*stats));
+  // Programs without sections were not built by program_create
+  if (program->section_count == 0) return 0;
+
+  optimize_t* opt = calloc(1, sizeof(optimize_t));
+  program_t* out = malloc(sizeof(program_t));
+  symbol_table_t* out_symbols = malloc(sizeof(symbol_table_t));
+  if (!opt || !out || !out_symbols) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory optimizing\n");
+    free(opt);
+    free(out);
+    free(out_symbols);
+    return 1;
+  }
+
+  opt->program = program;
+  opt->symbols = symbols;
+  for (int i = 0; i < LC3_MEMORY_MAX; i++) opt->index_of[i] = -1;
+  for (int i = 0; i < program->instruction_count; i++) {
+    opt->relocation_of[i] = -1;
+    opt->index_of[program->instructions[i].address] = i;
+  }
+  for (int i = 0; i < program->relocation_count; i++) {
+    opt->relocation_of[program->relocations[i].instruction] = i;
+  }
+
+  // Retargeting only adds references, so refresh them before the rules that
+  // depend on a word being unreferenced. Dead code goes first so it is not
+  // counted as folded as well.
+  bool changed = true;
+  while (changed) {
+    changed = thread_branches(opt, stats);
+    find_references(opt);
+    changed |= remove_unreachable(opt, stats);
+    changed |= remove_redundant_clears(opt, stats);
+    changed |= fold_adds(opt, stats);
+  }
+
+  memcpy(out, program, sizeof(program_t));
+  memcpy(out_symbols, symbols, sizeof(symbol_table_t));
+  int result = compact(opt, out, out_symbols);
+  if (result == 0) {
+    memcpy(program, out, sizeof(program_t));
+    memcpy(symbols, out_symbols, sizeof(symbol_table_t));
+    asm_log(log, ASM_LOG_INFO,
+            "Optimizer: %d redundant clears, %d folded ADDs, %d threaded "
+            "branches, %d unreachable words removed\n",
+            stats->redundant_clears, stats->folded_adds,
+            stats->threaded_branches, stats->unreachable_words);
+  } else {
+    memset(stats, 0, sizeof(*stats));
+    asm_log(log, ASM_LOG_WARNING,
+            "Warning: Optimized layout puts an operand out of range; "
+            "keeping the unoptimized program\n");
+  }
+
+  free(opt);
+  free(out);
+  free(out_symbols);
+  return result;
+}
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/pool.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../../include/asm/opcode.h"
+#include "../../include/asm/program.h"
+
+// Largest forward offset of a 9-bit PC-relative operand
+#define POOL_REACH 255
+
+void pool_init(literal_pool_t* pool) {
+  pool->literal_count = 0;
+  pool->user_count = 0;
+  pool->first_user = 0;
+}
+
+// Copy the first token of text (up to a separator or comment) into token
+static size_t pool_token(const char* text, char* token, size_t size) {
+  size_t length = strcspn(text, " \t\r,;");
+  if (length >= size) length = 0;
+  memcpy(token, text, length);
+  token[length] = '\0';
+  return length;
+}
+
+bool pool_literal(const char* text, char literal[MAX_LITERAL_LENGTH]) {
+  char mnemonic[8];
+  pool_token(text, mnemonic, sizeof(mnemonic));
+  if (strcasecmp(mnemonic, "LD") != 0 && strcasecmp(mnemonic, "LDI") != 0) {
+    return false;
+  }
+
+  const char* equals = strchr(text, '=');
+  const char* comment = strchr(text, ';');
+  if (!equals || (comment && comment < equals)) return false;
+  return pool_token(equals + 1, literal, MAX_LITERAL_LENGTH) > 0;
+}
+
+bool pool_is_barrier(const char* text) {
+  char mnemonic[8];
+  pool_token(text, mnemonic, sizeof(mnemonic));
+  return opcode_is_unconditional_branch(mnemonic) ||
+         strcasecmp(mnemonic, "HALT") == 0 ||
+         strcasecmp(mnemonic, "RET") == 0 ||
+         strcasecmp(mnemonic, "JMP") == 0 || strcasecmp(mnemonic, "RTI") == 0;
+}
+
+static bool pool_is_number(const char* literal) {
+  if (*literal == '#' || *literal == '-' || isdigit((unsigned char)*literal)) {
+    return true;
+  }
+  return (*literal == 'x' || *literal == 'X') &&
+         isxdigit((unsigned char)literal[1]);
+}
+
+// Index of a literal equal to literal (#16 and x10 are equal), or -1
+static int pool_find(const literal_pool_t* pool, const char* literal) {
+  bool number = pool_is_number(literal);
+  uint16_t value = number ? (uint16_t)parse_number(literal) : 0;
+  for (int i = 0; i < pool->literal_count; i++) {
+    const char* other = pool->literals[i];
+    if (number ? pool_is_number(other) && (uint16_t)parse_number(other) == value
+               : strcmp(other, literal) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool pool_must_flush(const literal_pool_t* pool, uint16_t address, int size,
+                     const char* literal) {
+  if (pool->literal_count == 0) return false;
+
+  int count = pool->literal_count;
+  if (literal && pool_find(pool, literal) < 0) count++;
+  if (count > MAX_POOL_LITERALS || pool->user_count == MAX_POOL_USERS) {
+    return true;
+  }
+
+  // Keep the pool placeable behind a branch right after this line: its last
+  // word must stay within reach of the first user
+  int last = address + size + count;
+  return last - (pool->first_user + 1) > POOL_REACH;
+}
+
+int pool_add(literal_pool_t* pool, const char* literal, uint16_t address,
+             int instruction) {
+  if (pool->user_count == MAX_POOL_USERS) return -1;
+
+  int index = pool_find(pool, literal);
+  if (index < 0) {
+    if (pool->literal_count == MAX_POOL_LITERALS) return -1;
+    index = pool->literal_count++;
+    snprintf(pool->literals[index], MAX_LITERAL_LENGTH, "%s", literal);
+  }
+  if (pool->user_count == 0) pool->first_user = address;
+
+  pool->users[pool->user_count] = instruction;
+  pool->user_literals[pool->user_count] = index;
+  pool->user_count++;
+  return index;
+}
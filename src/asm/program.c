@@ -1,23 +1,71 @@
+#define _XOPEN_SOURCE 700  // realpath
+
 #include "../../include/asm/program.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#define swap16(val) ((val << 8) | (val >> 8))
+#include <strings.h>
+
+#include "../../include/asm/opcode.h"
+#include "../../include/asm/pool.h"
+#include "../../include/lc3/decode.h"
+#include "../../include/lc3/image.h"
+#include "../../include/lc3/lc3.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/file.h"
+
+// State shared by the parse functions while assembling one line
+typedef struct {
+  program_t* program;
+  symbol_table_t* symbols;
+  asm_log_t* log;
+  relax_set_t* relax;  // May be NULL to leave out-of-range lines unassembled
+  uint16_t address;    // Address of the line being assembled
+  int section;         // Index of the current .ORIG block
+  int line;            // Source line number
+  bool out_of_range;   // A label operand of this line is too far away
+  literal_pool_t pool;  // Literals not placed yet
+} parse_context_t;
 
 void program_add_instruction(program_t* program, uint16_t instruction,
                              uint16_t address) {
   if (program->instruction_count < MAX_INSTRUCTIONS) {
     program->instructions[program->instruction_count].address = address;
     program->instructions[program->instruction_count].instruction = instruction;
+    program->instructions[program->instruction_count].line = 0;
+    program->instructions[program->instruction_count].kind = INSTRUCTION_CODE;
     program->instruction_count++;
+    if (program->section_count > 0) {
+      program->sections[program->section_count - 1].instruction_count++;
+    }
   }
 }
 
+void program_add_data(program_t* program, uint16_t word, uint16_t address) {
+  int index = program->instruction_count;
+  program_add_instruction(program, word, address);
+  if (index < program->instruction_count) {
+    program->instructions[index].kind = INSTRUCTION_DATA;
+  }
+}
+
+int program_add_relocation(program_t* program, int instruction, int symbol,
+                           uint8_t type, bool applied) {
+  if (program->relocation_count >= MAX_RELOCATIONS) return -1;
+
+  relocation_t* relocation = &program->relocations[program->relocation_count];
+  relocation->instruction = instruction;
+  relocation->symbol = symbol;
+  relocation->type = type;
+  relocation->applied = applied;
+  return program->relocation_count++;
+}
+
 // Parse a number from a string (supports #decimal, x/Xhex, and decimal)
 int parse_number(const char* str) {
   if (!str) return 0;
@@ -64,14 +112,14 @@ uint16_t parse_add(char* tokens[], int token_count) {
 
   if (dr == -1 || sr1 == -1) return 0;
 
-  uint16_t instruction = 0x1000 | (dr << 9) | (sr1 << 6);
+  uint16_t instruction = lc3_encode(LC3_OP_ADD, dr, sr1);
 
   // Check if third operand is register or immediate
   if (tokens[3][0] == '#') {
     // Immediate mode
     int imm = parse_number(tokens[3]);
     if (imm < -16 || imm > 15) return 0;  // 5-bit signed immediate
-    instruction |= 0x20 | (imm & 0x1F);
+    instruction |= LC3_IMM_MODE | lc3_field(imm, 5);
   } else {
     // Register mode
     int sr2 = get_register_number(tokens[3]);
@@ -91,14 +139,14 @@ uint16_t parse_and(char* tokens[], int token_count) {
 
   if (dr == -1 || sr1 == -1) return 0;
 
-  uint16_t instruction = 0x5000 | (dr << 9) | (sr1 << 6);
+  uint16_t instruction = lc3_encode(LC3_OP_AND, dr, sr1);
 
   // Check if third operand is register or immediate
   if (tokens[3][0] == '#') {
     // Immediate mode
     int imm = parse_number(tokens[3]);
     if (imm < -16 || imm > 15) return 0;  // 5-bit signed immediate
-    instruction |= 0x20 | (imm & 0x1F);
+    instruction |= LC3_IMM_MODE | lc3_field(imm, 5);
   } else {
     // Register mode
     int sr2 = get_register_number(tokens[3]);
@@ -118,147 +166,187 @@ uint16_t parse_not(char* tokens[], int token_count) {
 
   if (dr == -1 || sr == -1) return 0;
 
-  return 0x9000 | (dr << 9) | (sr << 6) | 0x3F;
+  return lc3_encode(LC3_OP_NOT, dr, sr) | LC3_NOT_BITS;
 }
 
-// Parse BR instruction with symbol resolution
-uint16_t parse_br(char* tokens[], int token_count, symbol_table_t* symbols,
-                  uint16_t current_address) {
-  if (token_count < 2) return 0;
+// True for operands written as numbers (#10, x1F, -3) rather than labels
+static bool is_number_literal(const char* str) {
+  if (*str == '#' || *str == '-' || isdigit((unsigned char)*str)) return true;
+  return (*str == 'x' || *str == 'X') && isxdigit((unsigned char)str[1]);
+}
+
+static bool offset_fits(int offset, int bits) {
+  return offset >= -(1 << (bits - 1)) && offset < (1 << (bits - 1));
+}
 
-  // Default to unconditional branch (BRnzp)
-  uint16_t condition = 0x0E00;  // n=1, z=1, p=1
-
-  // Check for specific branch conditions
-  char* opcode = tokens[0];
-  if (strcmp(opcode, "BRn") == 0 || strcmp(opcode, "brn") == 0) {
-    condition = 0x0800;  // n=1
-  } else if (strcmp(opcode, "BRz") == 0 || strcmp(opcode, "brz") == 0) {
-    condition = 0x0400;  // z=1
-  } else if (strcmp(opcode, "BRp") == 0 || strcmp(opcode, "brp") == 0) {
-    condition = 0x0200;  // p=1
-  } else if (strcmp(opcode, "BRzp") == 0 || strcmp(opcode, "brzp") == 0) {
-    condition = 0x0600;  // z=1, p=1
-  } else if (strcmp(opcode, "BRnp") == 0 || strcmp(opcode, "brnp") == 0) {
-    condition = 0x0A00;  // n=1, p=1
-  } else if (strcmp(opcode, "BRnz") == 0 || strcmp(opcode, "brnz") == 0) {
-    condition = 0x0C00;  // n=1, z=1
+// Resolve a PC-relative operand (label or literal offset) of the instruction
+// at ctx->address. References that leave the current section, or name a
+// .EXTERN symbol, are recorded as relocations so the linker can re-resolve
+// them; they are pre-applied when the .ORIG layout already reaches.
+static bool parse_pc_offset(parse_context_t* ctx, const char* operand,
+                            int bits, uint8_t type, int* offset) {
+  if (!ctx->symbols || is_number_literal(operand)) {
+    *offset = parse_number(operand);
+    return offset_fits(*offset, bits);
   }
 
-  int offset = 0;
+  int index = symbol_table_find(ctx->symbols, operand);
+  if (index < 0) {
+    asm_log(ctx->log, ASM_LOG_WARNING, "Warning: Symbol '%s' not found\n",
+            operand);
+    return false;
+  }
 
-  // Try to resolve as symbol first
-  if (symbols && tokens[1][0] != '#' && tokens[1][0] != 'x' &&
-      tokens[1][0] != 'X') {
-    uint16_t symbol_address = symbol_table_find_address(symbols, tokens[1]);
-    if (symbol_address != (uint16_t)-1) {
-      // Calculate PC-relative offset (target - (current_address + 1))
-      offset = (int)symbol_address - (int)(current_address + 1);
-    } else {
-      printf("Warning: Symbol '%s' not found\n", tokens[1]);
-      return 0;
-    }
-  } else {
-    // Handle immediate offsets
-    offset = parse_number(tokens[1]);
+  symbol_t* symbol = &ctx->symbols->symbols[index];
+  bool defined = symbol->section != SYMBOL_NO_SECTION;
+  // Calculate PC-relative offset (target - (current_address + 1))
+  *offset = defined ? (int)symbol->address - (int)(ctx->address + 1) : 0;
+  bool in_range = offset_fits(*offset, bits);
+  if (symbol->section == ctx->section) {
+    if (!in_range) ctx->out_of_range = true;
+    return in_range;
   }
 
-  if (offset < -256 || offset > 255) return 0;  // 9-bit signed offset
+  if (!in_range) *offset = 0;
+  if (program_add_relocation(ctx->program, ctx->program->instruction_count,
+                             index, type, defined && in_range) < 0) {
+    asm_log(ctx->log, ASM_LOG_ERROR, "Error: Too many relocations (max %d)\n",
+            MAX_RELOCATIONS);
+    return false;
+  }
+  return true;
+}
 
-  return 0x0000 | condition | (offset & 0x1FF);
+// Condition bits of a BR mnemonic, or 0 if it is malformed. The letters
+// follow BR in any case; none means BRnzp.
+static uint16_t parse_condition(const char* mnemonic) {
+  uint16_t condition = 0;
+  for (const char* p = mnemonic + 2; *p; p++) {
+    switch (toupper((unsigned char)*p)) {
+      case 'N':
+        condition |= LC3_FL_NEG << LC3_R0_SHIFT;
+        break;
+      case 'Z':
+        condition |= LC3_FL_ZRO << LC3_R0_SHIFT;
+        break;
+      case 'P':
+        condition |= LC3_FL_POS << LC3_R0_SHIFT;
+        break;
+      default:
+        return 0;
+    }
+  }
+  if (condition == 0) condition = 0x7 << LC3_R0_SHIFT;  // n=1, z=1, p=1
+  return condition;
 }
 
-// Parse LEA instruction with symbol resolution
-uint16_t parse_lea(char* tokens[], int token_count, symbol_table_t* symbols,
-                   uint16_t current_address) {
-  if (token_count < 3) return 0;
+// Find a BRnzp to label already assembled in this section within reach of
+// a branch at ctx->address, so a far branch can hop through it instead of
+// taking its long form. Sets offset to reach it; returns false if none.
+static bool parse_branch_island(parse_context_t* ctx, const char* label,
+                                int* offset) {
+  int index = symbol_table_find(ctx->symbols, label);
+  program_t* program = ctx->program;
+  if (index < 0 || program->section_count == 0) return false;
+
+  uint16_t target = ctx->symbols->symbols[index].address;
+  section_t* section = &program->sections[program->section_count - 1];
+  for (int i = program->instruction_count - 1;
+       i >= section->first_instruction; i--) {
+    instruction_t* island = &program->instructions[i];
+    int island_offset = (int)island->address - (int)(ctx->address + 1);
+    if (!offset_fits(island_offset, 9)) break;
+
+    uint16_t word = island->instruction;
+    if (island->kind == INSTRUCTION_CODE && (word & 0xFE00) == 0x0E00 &&
+        (uint16_t)(island->address + 1 + lc3_pc_offset9(word)) == target) {
+      *offset = island_offset;
+      return true;
+    }
+  }
+  return false;
+}
 
-  int dr = get_register_number(tokens[1]);
-  if (dr == -1) return 0;
+// Parse BR instruction with symbol resolution
+uint16_t parse_br(parse_context_t* ctx, char* tokens[], int token_count) {
+  if (token_count < 2) return 0;
 
-  int offset = 0;
+  uint16_t condition = parse_condition(tokens[0]);
+  if (condition == 0) return 0;
 
-  // Try to resolve as symbol first
-  if (symbols && tokens[2][0] != '#' && tokens[2][0] != 'x' &&
-      tokens[2][0] != 'X') {
-    uint16_t symbol_address = symbol_table_find_address(symbols, tokens[2]);
-    if (symbol_address != (uint16_t)-1) {
-      // Calculate PC-relative offset (target - (current_address + 1))
-      offset = (int)symbol_address - (int)(current_address + 1);
-    } else {
-      printf("Warning: Symbol '%s' not found\n", tokens[2]);
+  int offset = 0;
+  if (!parse_pc_offset(ctx, tokens[1], 9, RELOC_PC_OFFSET9, &offset)) {
+    if (!ctx->out_of_range ||
+        !parse_branch_island(ctx, tokens[1], &offset)) {
       return 0;
     }
-  } else {
-    // Handle immediate offsets
-    offset = parse_number(tokens[2]);
+    ctx->out_of_range = false;
   }
 
-  if (offset < -256 || offset > 255) return 0;  // 9-bit signed offset
-
-  return 0xE000 | (dr << 9) | (offset & 0x1FF);
+  return lc3_encode(LC3_OP_BR, 0, 0) | condition | lc3_field(offset, 9);
 }
 
-// Parse LD instruction with symbol resolution
-uint16_t parse_ld(char* tokens[], int token_count, symbol_table_t* symbols,
-                  uint16_t current_address) {
+// Parse LD, LDI, LEA, ST and STI: register plus 9-bit PC-relative operand
+uint16_t parse_pc_relative(parse_context_t* ctx, char* tokens[],
+                           int token_count, int op) {
   if (token_count < 3) return 0;
 
-  int dr = get_register_number(tokens[1]);
-  if (dr == -1) return 0;
-
-  int offset = 0;
+  int reg = get_register_number(tokens[1]);
+  if (reg == -1) return 0;
 
-  // Try to resolve as symbol first
-  if (symbols && tokens[2][0] != '#' && tokens[2][0] != 'x' &&
-      tokens[2][0] != 'X') {
-    uint16_t symbol_address = symbol_table_find_address(symbols, tokens[2]);
-    if (symbol_address != (uint16_t)-1) {
-      // Calculate PC-relative offset (target - (current_address + 1))
-      offset = (int)symbol_address - (int)(current_address + 1);
-    } else {
-      printf("Warning: Symbol '%s' not found\n", tokens[2]);
+  // LD and LDI take =value and =label literals; the offset is filled in when
+  // the literal's pool is placed
+  if (tokens[2][0] == '=') {
+    if ((op != LC3_OP_LD && op != LC3_OP_LDI) || tokens[2][1] == '\0' ||
+        pool_add(&ctx->pool, tokens[2] + 1, ctx->address,
+                 ctx->program->instruction_count) < 0) {
       return 0;
     }
-  } else {
-    // Handle immediate offsets
-    offset = parse_number(tokens[2]);
+    return lc3_encode(op, reg, 0);
   }
 
-  if (offset < -256 || offset > 255) return 0;  // 9-bit signed offset
+  int offset = 0;
+  if (!parse_pc_offset(ctx, tokens[2], 9, RELOC_PC_OFFSET9, &offset)) {
+    return 0;
+  }
 
-  return 0x2000 | (dr << 9) | (offset & 0x1FF);
+  return lc3_encode(op, reg, 0) | lc3_field(offset, 9);
 }
 
-// Parse ST instruction with symbol resolution
-uint16_t parse_st(char* tokens[], int token_count, symbol_table_t* symbols,
-                  uint16_t current_address) {
-  if (token_count < 3) return 0;
-
-  int sr = get_register_number(tokens[1]);
-  if (sr == -1) return 0;
+// Parse JSR instruction with symbol resolution
+uint16_t parse_jsr(parse_context_t* ctx, char* tokens[], int token_count) {
+  if (token_count < 2) return 0;
 
   int offset = 0;
-
-  // Try to resolve as symbol first
-  if (symbols && tokens[2][0] != '#' && tokens[2][0] != 'x' &&
-      tokens[2][0] != 'X') {
-    uint16_t symbol_address = symbol_table_find_address(symbols, tokens[2]);
-    if (symbol_address != (uint16_t)-1) {
-      // Calculate PC-relative offset (target - (current_address + 1))
-      offset = (int)symbol_address - (int)(current_address + 1);
-    } else {
-      printf("Warning: Symbol '%s' not found\n", tokens[2]);
-      return 0;
-    }
-  } else {
-    // Handle immediate offsets
-    offset = parse_number(tokens[2]);
+  if (!parse_pc_offset(ctx, tokens[1], 11, RELOC_PC_OFFSET11, &offset)) {
+    return 0;
   }
 
-  if (offset < -256 || offset > 255) return 0;  // 9-bit signed offset
+  return lc3_encode(LC3_OP_JSR, 0, 0) | LC3_JSR_LONG | lc3_field(offset, 11);
+}
 
-  return 0x3000 | (sr << 9) | (offset & 0x1FF);
+// Parse JMP and JSRR: a single base register
+uint16_t parse_base_register(char* tokens[], int token_count, int op) {
+  if (token_count < 2) return 0;
+
+  int base_r = get_register_number(tokens[1]);
+  if (base_r == -1) return 0;
+
+  return lc3_encode(op, 0, base_r);
+}
+
+// Parse LDR and STR: register, base register and 6-bit offset
+uint16_t parse_base_offset(char* tokens[], int token_count, int op) {
+  if (token_count < 4) return 0;
+
+  int reg = get_register_number(tokens[1]);
+  int base_r = get_register_number(tokens[2]);
+  if (reg == -1 || base_r == -1) return 0;
+
+  int offset = parse_number(tokens[3]);
+  if (!offset_fits(offset, 6)) return 0;  // 6-bit signed offset
+
+  return lc3_encode(op, reg, base_r) | lc3_field(offset, 6);
 }
 
 // Parse TRAP instruction
@@ -268,12 +356,11 @@ uint16_t parse_trap(char* tokens[], int token_count) {
   int trap_vector = parse_number(tokens[1]);
   if (trap_vector < 0 || trap_vector > 255) return 0;
 
-  return 0xF000 | (trap_vector & 0xFF);
+  return lc3_encode_trap(trap_vector);
 }
 
 // Parse a single instruction line with symbol resolution
-uint16_t parse_instruction(char* line, symbol_table_t* symbols,
-                           uint16_t current_address) {
+uint16_t parse_instruction(parse_context_t* ctx, char* line) {
   char* tokens[10];
   int token_count = 0;
 
@@ -283,10 +370,12 @@ uint16_t parse_instruction(char* line, symbol_table_t* symbols,
   line_copy[MAX_LINE_LENGTH - 1] = '\0';
 
   // Tokenize the line
-  char* token = strtok(line_copy, " \t,");
+  // strtok_r keeps the tokenizer state local so jobs can run concurrently
+  char* save_ptr = NULL;
+  char* token = strtok_r(line_copy, " \t,", &save_ptr);
   while (token && token_count < 10) {
     tokens[token_count++] = token;
-    token = strtok(NULL, " \t,");  // Pass NULL for subsequent calls
+    token = strtok_r(NULL, " \t,", &save_ptr);  // NULL continues the line
   }
 
   if (token_count == 0) return 0;
@@ -302,23 +391,59 @@ uint16_t parse_instruction(char* line, symbol_table_t* symbols,
   } else if (strcmp(tokens[0], "NOT") == 0) {
     return parse_not(tokens, token_count);
   } else if (strcmp(tokens[0], "LEA") == 0) {
-    return parse_lea(tokens, token_count, symbols, current_address);
+    return parse_pc_relative(ctx, tokens, token_count, LC3_OP_LEA);
   } else if (strcmp(tokens[0], "LD") == 0) {
-    return parse_ld(tokens, token_count, symbols, current_address);
+    return parse_pc_relative(ctx, tokens, token_count, LC3_OP_LD);
+  } else if (strcmp(tokens[0], "LDI") == 0) {
+    return parse_pc_relative(ctx, tokens, token_count, LC3_OP_LDI);
   } else if (strcmp(tokens[0], "ST") == 0) {
-    return parse_st(tokens, token_count, symbols, current_address);
+    return parse_pc_relative(ctx, tokens, token_count, LC3_OP_ST);
+  } else if (strcmp(tokens[0], "STI") == 0) {
+    return parse_pc_relative(ctx, tokens, token_count, LC3_OP_STI);
+  } else if (strcmp(tokens[0], "LDR") == 0) {
+    return parse_base_offset(tokens, token_count, LC3_OP_LDR);
+  } else if (strcmp(tokens[0], "STR") == 0) {
+    return parse_base_offset(tokens, token_count, LC3_OP_STR);
+  } else if (strcmp(tokens[0], "JSR") == 0) {
+    return parse_jsr(ctx, tokens, token_count);
+  } else if (strcmp(tokens[0], "JSRR") == 0) {
+    return parse_base_register(tokens, token_count, LC3_OP_JSR);
+  } else if (strcmp(tokens[0], "JMP") == 0) {
+    return parse_base_register(tokens, token_count, LC3_OP_JMP);
+  } else if (strcmp(tokens[0], "RET") == 0) {
+    return lc3_encode(LC3_OP_JMP, 0, LC3_R_R7);
+  } else if (strcmp(tokens[0], "RTI") == 0) {
+    return lc3_encode(LC3_OP_RTI, 0, 0);
   } else if (strcmp(tokens[0], "TRAP") == 0) {
     return parse_trap(tokens, token_count);
-  } else if (strncmp(tokens[0], "BR", 2) == 0) {
-    return parse_br(tokens, token_count, symbols, current_address);
+  } else if (opcode_is_branch(tokens[0])) {
+    return parse_br(ctx, tokens, token_count);
   } else if (strcmp(tokens[0], "HALT") == 0) {
-    return 0xF025;  // TRAP x25
+    return lc3_encode_trap(LC3_TRAP_HALT);
   } else if (strcmp(tokens[0], "PUTS") == 0) {
-    return 0xF022;  // TRAP x22
+    return lc3_encode_trap(LC3_TRAP_PUTS);
   } else if (strcmp(tokens[0], "GETC") == 0) {
-    return 0xF020;  // TRAP x20
+    return lc3_encode_trap(LC3_TRAP_GETC);
   } else if (strcmp(tokens[0], "OUT") == 0) {
-    return 0xF021;  // TRAP x21
+    return lc3_encode_trap(LC3_TRAP_OUT);
+  } else if (strcmp(tokens[0], "IN") == 0) {
+    return lc3_encode_trap(LC3_TRAP_IN);
+  } else if (strcmp(tokens[0], "PUTSP") == 0) {
+    return lc3_encode_trap(LC3_TRAP_PUTSP);
+  } else if (strcmp(tokens[0], "HASTRAP") == 0) {
+    return lc3_encode_trap(LC3_TRAP_HASTRAP);
+  } else if (strcmp(tokens[0], "MUL") == 0) {
+    return lc3_encode_trap(LC3_TRAP_MUL);
+  } else if (strcmp(tokens[0], "DIVMOD") == 0) {
+    return lc3_encode_trap(LC3_TRAP_DIVMOD);
+  } else if (strcmp(tokens[0], "MEMCPY") == 0) {
+    return lc3_encode_trap(LC3_TRAP_MEMCPY);
+  } else if (strcmp(tokens[0], "MEMSET") == 0) {
+    return lc3_encode_trap(LC3_TRAP_MEMSET);
+  } else if (strcmp(tokens[0], "ADD32") == 0) {
+    return lc3_encode_trap(LC3_TRAP_ADD32);
+  } else if (strcmp(tokens[0], "CAS") == 0) {
+    return lc3_encode_trap(LC3_TRAP_CAS);
   }
 
   return 0;  // Unknown instruction
@@ -334,75 +459,135 @@ int parse_instruction_lines(char* first_line, char* buffer,
   return 1;  // One line consumed
 }
 
-// Parse and add instruction to program
-int parse_and_add_instruction(char* line, program_t* program,
-                              symbol_table_t* symbols,
-                              uint16_t current_address) {
-  if (!line || strlen(line) == 0) return 0;
+// Parse .FILL: a number, or a label whose address is stored
+static uint16_t parse_fill(parse_context_t* ctx, const char* value_str) {
+  if (!ctx->symbols || is_number_literal(value_str)) {
+    return (uint16_t)parse_number(value_str);
+  }
 
-  // Make a copy of the line to work with
+  int index = symbol_table_find(ctx->symbols, value_str);
+  if (index < 0) {
+    asm_log(ctx->log, ASM_LOG_WARNING, "Warning: Symbol '%s' not found\n",
+            value_str);
+    return 0;
+  }
+
+  // Absolute addresses always depend on the layout, so are always relocated
+  symbol_t* symbol = &ctx->symbols->symbols[index];
+  bool defined = symbol->section != SYMBOL_NO_SECTION;
+  if (program_add_relocation(ctx->program, ctx->program->instruction_count,
+                             index, RELOC_ABS16, defined) < 0) {
+    asm_log(ctx->log, ASM_LOG_ERROR, "Error: Too many relocations (max %d)\n",
+            MAX_RELOCATIONS);
+  }
+  return defined ? symbol->address : 0;
+}
+
+// Assemble the long form of a relaxed line (see asm/relax.h): the short
+// instructions followed by the target's address as a .FILL-style literal.
+// Returns size, the number of words the symbol pass reserved.
+static int parse_relaxed(parse_context_t* ctx, const char* text, int size) {
   char line_copy[MAX_LINE_LENGTH];
-  strncpy(line_copy, line, MAX_LINE_LENGTH - 1);
+  strncpy(line_copy, text, MAX_LINE_LENGTH - 1);
   line_copy[MAX_LINE_LENGTH - 1] = '\0';
 
-  // Trim leading whitespace
-  char* trimmed = line_copy;
-  while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
+  char* tokens[3];
+  int token_count = 0;
+  char* save_ptr = NULL;
+  char* token = strtok_r(line_copy, " \t,", &save_ptr);
+  while (token && token_count < 3) {
+    tokens[token_count++] = token;
+    token = strtok_r(NULL, " \t,", &save_ptr);
+  }
 
-  // Skip empty lines
-  if (*trimmed == '\0') return 0;
+  uint16_t words[4];
+  int count = 0;
+  if (token_count == 2 && opcode_is_branch(tokens[0])) {
+    uint16_t condition = parse_condition(tokens[0]);
+    // Skip the trampoline when the original branch would not be taken
+    if (size == 4) words[count++] = (~condition & 0x0E00) | 3;
+    words[count++] = 0x2E01;  // LD R7, #1
+    words[count++] = 0xC1C0;  // JMP R7
+  } else if (token_count == 3 && get_register_number(tokens[1]) >= 0) {
+    uint16_t reg = (uint16_t)get_register_number(tokens[1]);
+    if (strcasecmp(tokens[0], "LD") == 0) {
+      words[count++] = 0xA000 | reg << 9 | 1;  // LDI reg, #1
+    } else if (strcasecmp(tokens[0], "ST") == 0) {
+      words[count++] = 0xB000 | reg << 9 | 1;  // STI reg, #1
+    } else if (strcasecmp(tokens[0], "LEA") == 0) {
+      words[count++] = 0x2000 | reg << 9 | 1;  // LD reg, #1
+    } else {
+      words[count++] = 0xA000 | reg << 9 | 2;         // LDI reg, #2
+      words[count++] = 0x6000 | reg << 9 | reg << 6;  // LDR reg, reg, #0
+    }
+    words[count++] = 0x0E01;  // BRnzp #1 over the literal
+  }
 
-  // Handle labels - check if line starts with a label
-  char* space_pos = trimmed;
-  while (*space_pos && *space_pos != ' ' && *space_pos != '\t') space_pos++;
+  if (count + 1 != size) {
+    asm_log(ctx->log, ASM_LOG_ERROR,
+            "Error: Could not assemble '%s' on line %d\n", text, ctx->line);
+    return size;
+  }
+  if (opcode_is_branch(tokens[0])) {
+    asm_log(ctx->log, ASM_LOG_WARNING,
+            "Warning: Far branch '%s' on line %d overwrites R7\n", text,
+            ctx->line);
+  }
 
-  // If there's something after the first token, it might be a label +
-  // instruction
-  if (*space_pos != '\0') {
-    // Check if first token is a label (not a known instruction)
-    char saved_char = *space_pos;
-    *space_pos = '\0';
-
-    // Convert first token to uppercase for comparison
-    char temp_token[64];
-    strncpy(temp_token, trimmed, 63);
-    temp_token[63] = '\0';
-    for (char* p = temp_token; *p; p++) *p = toupper(*p);
-
-    // Check if it's a known instruction
-    bool is_instruction =
-        (strcmp(temp_token, "ADD") == 0 || strcmp(temp_token, "AND") == 0 ||
-         strcmp(temp_token, "NOT") == 0 || strcmp(temp_token, "LEA") == 0 ||
-         strcmp(temp_token, "LD") == 0 || strcmp(temp_token, "ST") == 0 ||
-         strcmp(temp_token, "TRAP") == 0 || strcmp(temp_token, "HALT") == 0 ||
-         strcmp(temp_token, "PUTS") == 0 || strcmp(temp_token, "GETC") == 0 ||
-         strcmp(temp_token, "OUT") == 0 || strcmp(temp_token, "JMP") == 0 ||
-         strcmp(temp_token, "JSR") == 0 || strcmp(temp_token, "RET") == 0 ||
-         strncmp(temp_token, "BR", 2) == 0 ||
-         strncmp(temp_token, ".FILL", 5) == 0 ||
-         strncmp(temp_token, ".STRINGZ", 8) == 0 ||
-         strncmp(temp_token, ".BLKW", 5) == 0);
-
-    *space_pos = saved_char;
-
-    if (!is_instruction) {
-      // This is a label, skip to the instruction part
-      while (*space_pos == ' ' || *space_pos == '\t') space_pos++;
-      trimmed = space_pos;
-    }
+  for (int i = 0; i < count; i++) {
+    program_add_instruction(ctx->program, words[i], ctx->address + i);
   }
+  uint16_t literal = parse_fill(ctx, tokens[token_count - 1]);
+  program_add_data(ctx->program, literal, ctx->address + count);
+  return size;
+}
+
+// Place the pending literals at address, behind a BRnzp over them when
+// branch is set, and point their users at them. Returns the words used.
+static int program_place_pool(parse_context_t* ctx, uint16_t address,
+                              bool branch) {
+  literal_pool_t* pool = &ctx->pool;
+  if (pool->literal_count == 0) return 0;
+
+  program_t* program = ctx->program;
+  uint16_t base = branch ? address + 1 : address;
+  if (branch) {
+    program_add_instruction(program, 0x0E00 | pool->literal_count, address);
+  }
+  for (int i = 0; i < pool->literal_count; i++) {
+    uint16_t value = parse_fill(ctx, pool->literals[i]);
+    program_add_data(program, value, base + i);
+  }
+
+  for (int i = 0; i < pool->user_count; i++) {
+    if (pool->users[i] >= program->instruction_count) continue;
+    instruction_t* user = &program->instructions[pool->users[i]];
+    int offset = base + pool->user_literals[i] - (user->address + 1);
+    user->instruction = (user->instruction & 0xFE00) | (offset & 0x1FF);
+  }
+
+  int words = base - address + pool->literal_count;
+  pool_init(pool);
+  return words;
+}
+
+// Assemble one directive or instruction (without its label) at
+// ctx->address. Returns the number of words it occupies.
+static int parse_statement(parse_context_t* ctx, char* trimmed) {
+  program_t* program = ctx->program;
+  uint16_t current_address = ctx->address;
 
   // Handle pseudo-ops
-  if (strncmp(trimmed, ".FILL", 5) == 0) {
+  if (strncasecmp(trimmed, ".FILL", 5) == 0) {
     // .FILL directive - parse the value
     char* value_str = trimmed + 5;
     while (*value_str == ' ' || *value_str == '\t') value_str++;
-    uint16_t value = (uint16_t)parse_number(value_str);
-    program_add_instruction(program, value, current_address);
+    uint16_t value = parse_fill(ctx, value_str);
+    program_add_data(program, value, current_address);
     return 1;
   }
 
-  if (strncmp(trimmed, ".STRINGZ", 8) == 0) {
+  if (strncasecmp(trimmed, ".STRINGZ", 8) == 0) {
     // .STRINGZ directive - parse the string
     char* string_start = trimmed + 8;
     while (*string_start == ' ' || *string_start == '\t') string_start++;
@@ -416,21 +601,22 @@ int parse_and_add_instruction(char* line, program_t* program,
         // Add each character as a separate instruction
         int count = 0;
         for (char* p = string_start; *p; p++) {
-          program_add_instruction(program, (uint16_t)*p,
-                                  current_address + count);
+          program_add_data(program, (uint16_t)*p, current_address + count);
           count++;
         }
         // Add null terminator
-        program_add_instruction(program, 0, current_address + count);
+        program_add_data(program, 0, current_address + count);
         count++;
 
         return count;
       }
     }
-    return 0;
+    asm_log(ctx->log, ASM_LOG_WARNING, "Warning: Malformed .STRINGZ '%s'\n",
+            trimmed);
+    return 1;
   }
 
-  if (strncmp(trimmed, ".BLKW", 5) == 0) {
+  if (strncasecmp(trimmed, ".BLKW", 5) == 0) {
     // .BLKW directive - reserve space
     char* count_str = trimmed + 5;
     while (*count_str == ' ' || *count_str == '\t') count_str++;
@@ -438,38 +624,133 @@ int parse_and_add_instruction(char* line, program_t* program,
 
     // Add zeros for the reserved space
     for (int i = 0; i < count; i++) {
-      program_add_instruction(program, 0, current_address + i);
+      program_add_data(program, 0, current_address + i);
     }
 
     return count;
   }
 
+  int relaxed_size = ctx->relax && relax_set_contains(ctx->relax, ctx->line)
+                         ? relax_size(trimmed)
+                         : 0;
+  if (relaxed_size > 0) return parse_relaxed(ctx, trimmed, relaxed_size);
+
   // Parse regular instruction
-  uint16_t instruction = parse_instruction(trimmed, symbols, current_address);
+  ctx->out_of_range = false;
+  uint16_t instruction = parse_instruction(ctx, trimmed);
   if (instruction != 0) {
     program_add_instruction(program, instruction, current_address);
-    return 1;
+  } else if (ctx->out_of_range && ctx->relax && relax_size(trimmed) > 0 &&
+             relax_set_add(ctx->relax, ctx->line) == 0) {
+    // Left as a placeholder; the next layout round sizes the long form
+  } else if (ctx->out_of_range) {
+    // No long form (STI, JSR) or no room left in the relaxation set
+    asm_log(ctx->log, ASM_LOG_ERROR,
+            "Error: Label operand of '%s' on line %d is out of range\n",
+            trimmed, ctx->line);
+  } else {
+    // The word stays reserved (zero) so later addresses match the symbols
+    asm_log(ctx->log, ASM_LOG_ERROR,
+            "Error: Could not assemble '%s' on line %d\n", trimmed, ctx->line);
+  }
+  return 1;
+}
+
+// Parse and add instruction to program. Returns the number of words the line
+// occupies, which always matches the size the symbol pass gave it.
+int parse_and_add_instruction(parse_context_t* ctx, char* line) {
+  if (!line || strlen(line) == 0) return 0;
+
+  uint16_t current_address = ctx->address;
+
+  // Make a copy of the line to work with
+  char line_copy[MAX_LINE_LENGTH];
+  strncpy(line_copy, line, MAX_LINE_LENGTH - 1);
+  line_copy[MAX_LINE_LENGTH - 1] = '\0';
+
+  // Trim leading whitespace
+  char* trimmed = line_copy;
+  while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
+
+  // Skip empty lines
+  if (*trimmed == '\0') return 0;
+
+  // Handle labels - anything that is not a known mnemonic or directive
+  char* space_pos = trimmed;
+  while (*space_pos && *space_pos != ' ' && *space_pos != '\t') space_pos++;
+
+  char saved_char = *space_pos;
+  *space_pos = '\0';
+  bool is_label = !opcode_is_mnemonic(trimmed);
+  *space_pos = saved_char;
+
+  if (is_label) {
+    // This is a label, skip to the instruction part (if any)
+    while (*space_pos == ' ' || *space_pos == '\t') space_pos++;
+    trimmed = space_pos;
+    if (*trimmed == '\0') return 0;
+  }
+
+  // Linkage declarations are handled by the symbol pass
+  if (strncasecmp(trimmed, ".GLOBAL", 7) == 0 ||
+      strncasecmp(trimmed, ".EXTERN", 7) == 0) {
+    return 0;
   }
 
-  return 0;  // No instruction added
+  // A pending literal pool goes before the line when the line would carry
+  // its first user out of reach, and after a line that never falls through
+  int size = symbol_line_size(trimmed, ctx->relax, ctx->line);
+  char literal[MAX_LITERAL_LENGTH];
+  bool uses_literal = pool_literal(trimmed, literal);
+  int placed = 0;
+  if (pool_must_flush(&ctx->pool, current_address, size,
+                      uses_literal ? literal : NULL)) {
+    placed = program_place_pool(ctx, current_address, true);
+    ctx->address = current_address + placed;
+  }
+
+  int words = parse_statement(ctx, trimmed);
+  if (pool_is_barrier(trimmed)) {
+    words += program_place_pool(ctx, ctx->address + words, false);
+  }
+  return placed + words;
 }
 
-program_t* program_create(const char* input_filename, symbol_table_t* symbols) {
+// Record where the current section ends
+static void program_close_section(program_t* program,
+                                  uint16_t current_address) {
+  if (program->section_count == 0) return;
+  section_t* section = &program->sections[program->section_count - 1];
+  section->length = (uint16_t)(current_address - section->origin);
+}
+
+program_t* program_create(const char* input_filename, symbol_table_t* symbols,
+                          relax_set_t* relax, asm_log_t* log) {
   FILE* file = fopen(input_filename, "r");
   if (!file) {
-    fprintf(stderr, "Error: Could not open input file %s\n", input_filename);
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not open input file %s\n",
+            input_filename);
     return NULL;
   }
 
   program_t* program = malloc(sizeof(program_t));
   program->instruction_count = 0;
+  program->section_count = 0;
+  program->relocation_count = 0;
   program->origin = 0x3000;  // Default origin
 
+  parse_context_t ctx = {
+      .program = program, .symbols = symbols, .log = log, .relax = relax,
+      .section = -1};
+  pool_init(&ctx.pool);
+
   char line[MAX_LINE_LENGTH];
   uint16_t current_address = 0;
   bool origin_set = false;
 
   while (fgets(line, sizeof(line), file)) {
+    ctx.line++;
+
     // Remove comments (everything after ';')
     char* comment = strchr(line, ';');
     if (comment) *comment = '\0';
@@ -485,16 +766,40 @@ program_t* program_create(const char* input_filename, symbol_table_t* symbols) {
     char* trimmed = line;
     while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
 
-    if (strncmp(trimmed, ".ORIG", 5) == 0) {  // .ORIG x3000 ; example
+    // Each .ORIG ... .END block is a separate section
+    if (strncasecmp(trimmed, ".ORIG", 5) == 0) {  // .ORIG x3000 ; example
+      if (origin_set) {
+        current_address += program_place_pool(&ctx, current_address, false);
+        program_close_section(program, current_address);
+      }
       char* addr_str = trimmed + 5;
       while (*addr_str == ' ' || *addr_str == '\t') addr_str++;
-      program->origin = (uint16_t)parse_number(addr_str);
-      current_address = program->origin;
+      current_address = (uint16_t)parse_number(addr_str);
+      if (program->section_count == 0) program->origin = current_address;
       origin_set = true;
+      ctx.section++;
+
+      if (program->section_count < MAX_SECTIONS) {
+        section_t* section = &program->sections[program->section_count++];
+        section->origin = current_address;
+        section->length = 0;
+        section->first_instruction = program->instruction_count;
+        section->instruction_count = 0;
+      } else {
+        asm_log(log, ASM_LOG_ERROR, "Error: Too many sections (max %d)\n",
+                MAX_SECTIONS);
+      }
       continue;
     }
 
-    if (strncmp(trimmed, ".END", 4) == 0) break;
+    if (strncasecmp(trimmed, ".END", 4) == 0) {
+      if (origin_set) {
+        current_address += program_place_pool(&ctx, current_address, false);
+        program_close_section(program, current_address);
+      }
+      origin_set = false;
+      continue;
+    }
 
     if (!origin_set) continue;  // Skip until .ORIG is found
 
@@ -507,45 +812,295 @@ program_t* program_create(const char* input_filename, symbol_table_t* symbols) {
                                                  sizeof(instr_buffer));
     if (lines_consumed > 0) {
       // Parse the instruction(s) and add to program
-      int added = parse_and_add_instruction(instr_buffer, program, symbols,
-                                            current_address);
-      if (added > 0) {
-        current_address +=
-            added - 1;  // -1 because current_address++ at the end of loop
+      ctx.address = current_address;
+      int first = program->instruction_count;
+      current_address += parse_and_add_instruction(&ctx, instr_buffer);
+      for (int i = first; i < program->instruction_count; i++) {
+        program->instructions[i].line = (uint16_t)ctx.line;
       }
     }
+  }
 
-    current_address++;
+  if (origin_set) {
+    current_address += program_place_pool(&ctx, current_address, false);
+    program_close_section(program, current_address);
   }
 
+  fclose(file);
   return program;
 }
 
+// A label's address and definition order, sorted without shared state so
+// that assembler runs on separate threads do not race
+typedef struct {
+  uint16_t address;
+  int index;
+} program_symbol_order_t;
+
+// Orders labels by address, then by definition order
+static int program_symbol_compare(const void* a, const void* b) {
+  const program_symbol_order_t* left = a;
+  const program_symbol_order_t* right = b;
+  int by_address = (int)left->address - (int)right->address;
+  return by_address ? by_address : left->index - right->index;
+}
+
+debug_info_t* program_debug_info(const program_t* program,
+                                 const symbol_table_t* symbols,
+                                 const char* source_filename) {
+  debug_info_t* info = debug_info_create();
+  char* source = realpath(source_filename, NULL);
+  bool valid =
+      info && debug_info_add_file(info, source ? source : source_filename) == 0;
+  free(source);
+
+  // Labels that share an address get one range, under the first of them
+  program_symbol_order_t order[MAX_SYMBOLS];
+  int count = 0;
+  for (int i = 0; i < symbols->symbol_count; i++) {
+    int section = symbols->symbols[i].section;
+    if (section != SYMBOL_NO_SECTION && section < program->section_count) {
+      order[count++] = (program_symbol_order_t){symbols->symbols[i].address, i};
+    }
+  }
+  qsort(order, count, sizeof(order[0]), program_symbol_compare);
+  for (int i = 0; valid && i < count; i++) {
+    const symbol_t* symbol = &symbols->symbols[order[i].index];
+    if (i > 0 && order[i - 1].address == symbol->address) continue;
+    const section_t* section = &program->sections[symbol->section];
+    uint32_t end = (uint32_t)section->origin + section->length;
+    for (int j = i + 1; j < count; j++) {
+      uint16_t next = order[j].address;
+      if (next > symbol->address) {
+        if (next < end) end = next;
+        break;
+      }
+    }
+    if (symbol->address < end) {
+      valid = debug_info_add_label(info, symbol->name, symbol->address,
+                                   (uint16_t)(end > UINT16_MAX ? UINT16_MAX
+                                                               : end)) >= 0;
+    }
+  }
+
+  for (int i = 0; valid && i < program->instruction_count; i++) {
+    const instruction_t* instruction = &program->instructions[i];
+    if (instruction->kind == INSTRUCTION_CODE && instruction->line != 0) {
+      valid = debug_info_add_line(info, instruction->address, 0,
+                                  instruction->line) >= 0;
+    }
+  }
+
+  if (!valid) {
+    debug_info_destroy(info);
+    return NULL;
+  }
+  debug_info_sort(info);
+  return info;
+}
+
 void program_destroy(program_t* program) {
   if (program) {
     free(program);
   }
 }
 
-// Write object file
-void program_write_file(program_t* program, const char* filename) {
-  FILE* file = fopen(filename, "wb");
-  if (!file) {
-    fprintf(stderr, "Error: Could not create output file %s\n", filename);
-    return;
+uint16_t* program_build_image(program_t* program, uint16_t* origin,
+                              size_t* count, asm_log_t* log) {
+  for (int i = 0; i < program->relocation_count; i++) {
+    relocation_t* relocation = &program->relocations[i];
+    if (!relocation->applied) {
+      asm_log(log, ASM_LOG_ERROR,
+              "Error: Unresolved reference at x%04X; assemble with -m and "
+              "link the module with lc3 link\n",
+              program->instructions[relocation->instruction].address);
+      return NULL;
+    }
   }
 
-  // Write origin (big-endian)
-  uint16_t origin_be = swap16(program->origin);
-  fwrite(&origin_be, sizeof(uint16_t), 1, file);
+  // The image spans every section and every placed word
+  int start = program->origin;
+  int end = program->origin;
+  bool empty = true;
+  for (int i = 0; i < program->section_count; i++) {
+    section_t* section = &program->sections[i];
+    if (section->length == 0) continue;
+    int section_end = section->origin + section->length;
+    if (empty || section->origin < start) start = section->origin;
+    if (empty || section_end > end) end = section_end;
+    empty = false;
+
+    for (int j = 0; j < i; j++) {
+      section_t* other = &program->sections[j];
+      if (section->origin < other->origin + other->length &&
+          other->origin < section_end) {
+        asm_log(log, ASM_LOG_ERROR,
+                "Error: Sections at x%04X and x%04X overlap\n", other->origin,
+                section->origin);
+        return NULL;
+      }
+    }
+  }
+  for (int i = 0; i < program->instruction_count; i++) {
+    int address = program->instructions[i].address;
+    if (empty || address < start) start = address;
+    if (empty || address + 1 > end) end = address + 1;
+    empty = false;
+  }
+  if (end > 0x10000) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Program runs past the end of memory\n");
+    return NULL;
+  }
 
-  // Write instructions (big-endian)
+  // One extra word keeps the allocation non-empty for empty programs
+  uint16_t* words = calloc((size_t)(end - start) + 1, sizeof(uint16_t));
+  if (!words) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory\n");
+    return NULL;
+  }
   for (int i = 0; i < program->instruction_count; i++) {
-    uint16_t instr_be = swap16(program->instructions[i].instruction);
-    fwrite(&instr_be, sizeof(uint16_t), 1, file);
+    words[program->instructions[i].address - start] =
+        program->instructions[i].instruction;
   }
 
-  fclose(file);
-  printf("Generated %s with %d instructions\n", filename,
-         program->instruction_count);
+  *origin = (uint16_t)start;
+  *count = (size_t)(end - start);
+  return words;
+}
+
+// Runs of at least this many zero words inside a section (e.g. .BLKW space)
+// are stored as zero segments with no payload
+#define PROGRAM_ZERO_RUN_MIN 16
+
+// Length of the run of zero words starting at words[i], stopping at end
+static int program_zero_run(const uint16_t* words, int i, int end) {
+  int run = i;
+  while (run < end && words[run] == 0) run++;
+  return run - i;
+}
+
+// Write the parts of an image (words starting at origin) covered by ranges as
+// a sparse image; the gaps between ranges are not stored
+static int program_write_ranges(const char* filename, uint16_t origin,
+                                const uint16_t* words, const section_t* ranges,
+                                int range_count, asm_log_t* log) {
+  int capacity = 0;
+  for (int i = 0; i < range_count; i++) {
+    capacity += 2 * (ranges[i].length / PROGRAM_ZERO_RUN_MIN) + 2;
+  }
+  image_segment_t* segments = malloc(capacity * sizeof(image_segment_t));
+  if (!segments) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory writing %s\n", filename);
+    return 1;
+  }
+
+  int segment_count = 0;
+  for (int r = 0; r < range_count; r++) {
+    int i = ranges[r].origin - origin;
+    int end = i + ranges[r].length;
+    while (i < end) {
+      image_segment_t* segment = &segments[segment_count++];
+      segment->address = (uint16_t)(origin + i);
+      int zeros = program_zero_run(words, i, end);
+      if (zeros >= PROGRAM_ZERO_RUN_MIN) {
+        segment->length = (uint16_t)zeros;
+        segment->flags = IMAGE_SEGMENT_ZERO;
+        segment->words = NULL;
+        i += zeros;
+        continue;
+      }
+
+      // Data runs until the next long zero run; short ones are kept inline
+      int j = i;
+      while (j < end) {
+        int run = program_zero_run(words, j, end);
+        if (run >= PROGRAM_ZERO_RUN_MIN) break;
+        j += run > 0 ? run : 1;
+      }
+      segment->length = (uint16_t)(j - i);
+      segment->flags = 0;
+      segment->words = words + i;
+      i = j;
+    }
+  }
+
+  int result = image_write_file(filename, segments, segment_count, true);
+  free(segments);
+  if (result != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write output file %s: %s\n",
+            filename, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+// Write a legacy object file: the origin, then every word, big-endian
+static int program_write_object(const char* filename, uint16_t origin,
+                                const uint16_t* words, size_t count,
+                                asm_log_t* log) {
+  size_t word_count = count + 1;
+  uint16_t* object = malloc(word_count * sizeof(uint16_t));
+  if (!object) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Out of memory writing %s\n", filename);
+    return 1;
+  }
+
+  object[0] = origin;
+  memcpy(object + 1, words, count * sizeof(uint16_t));
+  swap16_copy(object, object, word_count);
+  int result =
+      file_write_atomic(filename, object, word_count * sizeof(uint16_t));
+  free(object);
+  if (result != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write output file %s: %s\n",
+            filename, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+// Write object file
+int program_write_image(const char* filename, uint16_t origin,
+                        const uint16_t* words, size_t count, bool native,
+                        asm_log_t* log) {
+  if (count > (size_t)(LC3_MEMORY_MAX - origin)) {
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: %zu words from x%04X run past the end of memory\n", count,
+            origin);
+    return 1;
+  }
+  if (!native) return program_write_object(filename, origin, words, count, log);
+
+  // A range is at most UINT16_MAX words, so all of memory takes two
+  section_t ranges[2] = {{origin, (uint16_t)count, 0, 0}};
+  int range_count = 1;
+  if (count > UINT16_MAX) {
+    ranges[0].length = UINT16_MAX;
+    ranges[1] = (section_t){(uint16_t)(origin + UINT16_MAX), 1, 0, 0};
+    range_count = 2;
+  }
+  return program_write_ranges(filename, origin, words, ranges, range_count,
+                              log);
+}
+
+int program_write_file(program_t* program, const char* filename, bool native,
+                       asm_log_t* log) {
+  uint16_t origin;
+  size_t count;
+  uint16_t* words = program_build_image(program, &origin, &count, log);
+  if (!words) return 1;
+
+  // A sparse image stores only the sections, not the padding between them
+  int result = native && program->section_count > 0
+                   ? program_write_ranges(filename, origin, words,
+                                          program->sections,
+                                          program->section_count, log)
+                   : program_write_image(filename, origin, words, count,
+                                         native, log);
+  free(words);
+  if (result == 0) {
+    asm_log(log, ASM_LOG_INFO, "Generated %s with %d instructions\n",
+            filename, program->instruction_count);
+  }
+  return result;
 }
@@ -0,0 +1,56 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/asm/relax.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include "../../include/asm/opcode.h"
+
+bool relax_set_contains(const relax_set_t* relax, int line) {
+  int low = 0;
+  int high = relax->count;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (relax->lines[mid] == line) return true;
+    if (relax->lines[mid] < line) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return false;
+}
+
+int relax_set_add(relax_set_t* relax, int line) {
+  if (relax_set_contains(relax, line)) return 0;
+  if (relax->count >= MAX_RELAXATIONS) return 1;
+
+  int i = relax->count;
+  while (i > 0 && relax->lines[i - 1] > line) {
+    relax->lines[i] = relax->lines[i - 1];
+    i--;
+  }
+  relax->lines[i] = line;
+  relax->count++;
+  return 0;
+}
+
+int relax_size(const char* text) {
+  char mnemonic[16];
+  size_t length = strcspn(text, " \t,");
+  if (length == 0 || length >= sizeof(mnemonic)) return 0;
+  memcpy(mnemonic, text, length);
+  mnemonic[length] = '\0';
+
+  if (opcode_is_branch(mnemonic)) {
+    // BR and BRnzp need no inverted branch around the trampoline
+    return opcode_is_unconditional_branch(mnemonic) ? 3 : 4;
+  }
+  if (strcasecmp(mnemonic, "LD") == 0 || strcasecmp(mnemonic, "ST") == 0 ||
+      strcasecmp(mnemonic, "LEA") == 0) {
+    return 3;
+  }
+  if (strcasecmp(mnemonic, "LDI") == 0) return 4;
+  return 0;
+}
@@ -1,9 +1,16 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "../../include/asm/symbol.h"
 
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#include "../../include/asm/opcode.h"
+#include "../../include/asm/pool.h"
+#include "../../include/asm/program.h"
 
 symbol_table_t* symbol_table_create(void) {
   symbol_table_t* symbol_table = malloc(sizeof(symbol_table_t));
@@ -13,38 +20,110 @@ symbol_table_t* symbol_table_create(void) {
 
 void symbol_table_destroy(symbol_table_t* symbol_table) { free(symbol_table); }
 
-void symbol_table_add_symbol(symbol_table_t* symbol_table, const char* name,
-                             const uint16_t address) {
-  strncpy(symbol_table->symbols[symbol_table->symbol_count].name, name, 63);
-  symbol_table->symbols[symbol_table->symbol_count].name[63] = '\0';
-  symbol_table->symbols[symbol_table->symbol_count].address = address;
-  symbol_table->symbol_count++;
+int symbol_table_add_symbol(symbol_table_t* symbol_table, const char* name,
+                            uint16_t address, int section, uint8_t flags) {
+  if (symbol_table->symbol_count >= MAX_SYMBOLS) return -1;
+
+  symbol_t* symbol = &symbol_table->symbols[symbol_table->symbol_count];
+  strncpy(symbol->name, name, 63);
+  symbol->name[63] = '\0';
+  symbol->address = address;
+  symbol->section = (int16_t)section;
+  symbol->flags = flags;
+  return symbol_table->symbol_count++;
 }
 
-uint16_t symbol_table_find_address(symbol_table_t* symbol_table,
-                                   const char* label_name) {
+int symbol_table_find(symbol_table_t* symbol_table, const char* label_name) {
   for (int i = 0; i < symbol_table->symbol_count; i++) {
     if (strcmp(symbol_table->symbols[i].name, label_name) == 0) {
-      return symbol_table->symbols[i].address;
+      return i;
     }
   }
   return -1;
 }
 
-symbol_table_t* symbol_parse_file(const char* filename) {
+uint16_t symbol_table_find_address(symbol_table_t* symbol_table,
+                                   const char* label_name) {
+  int index = symbol_table_find(symbol_table, label_name);
+  if (index < 0 || symbol_table->symbols[index].section == SYMBOL_NO_SECTION) {
+    return -1;
+  }
+  return symbol_table->symbols[index].address;
+}
+
+// Record a .GLOBAL or .EXTERN declaration of name
+static void symbol_declare(symbol_table_t* symbol_table, const char* name,
+                           uint8_t flags, asm_log_t* log) {
+  int index = symbol_table_find(symbol_table, name);
+  if (index >= 0) {
+    symbol_table->symbols[index].flags |= flags;
+  } else if (symbol_table_add_symbol(symbol_table, name, 0, SYMBOL_NO_SECTION,
+                                     flags) < 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Too many symbols (max %d)\n",
+            MAX_SYMBOLS);
+  }
+}
+
+// Define a label, completing an earlier .GLOBAL declaration if there is one
+static void symbol_define(symbol_table_t* symbol_table, const char* name,
+                          uint16_t address, int section, asm_log_t* log) {
+  int index = symbol_table_find(symbol_table, name);
+  if (index >= 0 && symbol_table->symbols[index].section == SYMBOL_NO_SECTION) {
+    symbol_t* symbol = &symbol_table->symbols[index];
+    if (symbol->flags & SYMBOL_EXTERN) {
+      asm_log(log, ASM_LOG_ERROR,
+              "Error: Symbol '%s' is declared .EXTERN but defined here\n",
+              name);
+      return;
+    }
+    symbol->address = address;
+    symbol->section = (int16_t)section;
+    return;
+  }
+
+  if (symbol_table_add_symbol(symbol_table, name, address, section, 0) < 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Too many symbols (max %d)\n",
+            MAX_SYMBOLS);
+  }
+}
+
+int symbol_line_size(const char* text, const relax_set_t* relax, int line) {
+  if (strncasecmp(text, ".FILL", 5) == 0) return 1;
+  if (strncasecmp(text, ".BLKW", 5) == 0) return parse_number(text + 5);
+  if (strncasecmp(text, ".STRINGZ", 8) == 0) {
+    const char* str_start = strchr(text, '"');
+    const char* str_end = str_start ? strchr(str_start + 1, '"') : NULL;
+    if (!str_end) return 1;  // Default if malformed
+    return (int)(str_end - str_start - 1) + 1;  // +1 for null terminator
+  }
+  if (*text == '\0' || *text == ';' || *text == '\r') return 0;
+
+  // Regular instruction, or its long form when relaxed
+  int size = relax && relax_set_contains(relax, line) ? relax_size(text) : 0;
+  return size > 0 ? size : 1;
+}
+
+symbol_table_t* symbol_parse_file(const char* filename,
+                                  const relax_set_t* relax, asm_log_t* log) {
   symbol_table_t* symbol_table = symbol_table_create();
   FILE* file = fopen(filename, "r");
   if (file == NULL) {
-    fprintf(stderr, "Error: Could not open file %s to read symbols\n",
-            filename);
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: Could not open file %s to read symbols\n", filename);
+    symbol_table_destroy(symbol_table);
     return NULL;
   }
 
   char line[256];
   uint16_t current_address = 0;
   bool origin_set = false;
+  int section = -1;
+  int line_number = 0;
+  literal_pool_t pool;
+  pool_init(&pool);
 
   while (fgets(line, sizeof(line), file)) {
+    line_number++;
     char* newline = strchr(line, '\n');
     if (newline) *newline = '\0';
 
@@ -52,124 +131,132 @@ symbol_table_t* symbol_parse_file(const char* filename) {
     while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
     if (*trimmed == '\0' || *trimmed == ';') continue;
 
-    // Check for .ORIG directive
-    if (strncmp(trimmed, ".ORIG", 5) == 0) {
-      char* addr_str = trimmed + 5;
-      while (*addr_str == ' ' || *addr_str == '\t') addr_str++;
-      if (*addr_str == 'x' || *addr_str == 'X') {
-        current_address = (uint16_t)strtol(addr_str + 1, NULL, 16);
-      } else {
-        current_address = (uint16_t)strtol(addr_str, NULL, 10);
-      }
+    // Split off the first token (a label, instruction or directive)
+    char* label_end = trimmed;
+    while (*label_end && *label_end != ' ' && *label_end != '\t' &&
+           *label_end != '\r' && *label_end != ';') {
+      label_end++;
+    }
+    char* operand = label_end;
+    while (*operand == ' ' || *operand == '\t') operand++;
+
+    // Each .ORIG ... .END block is a separate section
+    if (strncasecmp(trimmed, ".ORIG", 5) == 0) {
+      current_address = (uint16_t)parse_number(operand);
       origin_set = true;
+      section++;
+      pool_init(&pool);  // The last section's pool closed it
       continue;
     }
 
-    if (strncmp(trimmed, ".END", 4) == 0) break;
-
-    if (!origin_set) continue;
+    if (strncasecmp(trimmed, ".END", 4) == 0) {
+      origin_set = false;
+      pool_init(&pool);
+      continue;
+    }
 
-    // Look for labels (identifier followed by space/tab or at start of line)
-    char* label_end = trimmed;
-    while (*label_end && *label_end != ' ' && *label_end != '\t' &&
-           *label_end != ';') {
-      label_end++;
+    // Linkage declarations may appear anywhere
+    bool is_global = strncasecmp(trimmed, ".GLOBAL", 7) == 0;
+    if (is_global || strncasecmp(trimmed, ".EXTERN", 7) == 0) {
+      char name[64];
+      if (sscanf(operand, "%63[^ \t\r;]", name) == 1) {
+        symbol_declare(symbol_table, name,
+                       is_global ? SYMBOL_GLOBAL : SYMBOL_EXTERN, log);
+      }
+      continue;
     }
 
-    // Check if this looks like a label (not an instruction)
-    bool is_label = false;
+    if (!origin_set) continue;
+
+    // Anything that is not a known mnemonic or directive is a label
     char saved_char = *label_end;
     *label_end = '\0';
+    bool is_label = !opcode_is_mnemonic(trimmed);
+    *label_end = saved_char;
 
-    // Check if it's not a common instruction
-    if (strcmp(trimmed, "ADD") != 0 && strcmp(trimmed, "AND") != 0 &&
-        strcmp(trimmed, "NOT") != 0 && strcmp(trimmed, "BR") != 0 &&
-        strcmp(trimmed, "BRn") != 0 && strcmp(trimmed, "BRz") != 0 &&
-        strcmp(trimmed, "BRp") != 0 && strcmp(trimmed, "BRnz") != 0 &&
-        strcmp(trimmed, "BRnp") != 0 && strcmp(trimmed, "BRzp") != 0 &&
-        strcmp(trimmed, "BRnzp") != 0 && strcmp(trimmed, "JMP") != 0 &&
-        strcmp(trimmed, "JSR") != 0 && strcmp(trimmed, "JSRR") != 0 &&
-        strcmp(trimmed, "RET") != 0 && strcmp(trimmed, "RTI") != 0 &&
-        strcmp(trimmed, "LD") != 0 && strcmp(trimmed, "LDI") != 0 &&
-        strcmp(trimmed, "LDR") != 0 && strcmp(trimmed, "LEA") != 0 &&
-        strcmp(trimmed, "ST") != 0 && strcmp(trimmed, "STI") != 0 &&
-        strcmp(trimmed, "STR") != 0 && strcmp(trimmed, "TRAP") != 0 &&
-        strcmp(trimmed, "GETC") != 0 && strcmp(trimmed, "OUT") != 0 &&
-        strcmp(trimmed, "PUTS") != 0 && strcmp(trimmed, "IN") != 0 &&
-        strcmp(trimmed, "PUTSP") != 0 && strcmp(trimmed, "HALT") != 0 &&
-        strncmp(trimmed, ".ORIG", 5) != 0 && strncmp(trimmed, ".END", 4) != 0) {
-      is_label = true;
-    }
+    // Without a label the first token is the instruction itself (e.g. a bare
+    // HALT or PUTS)
+    char* rest_of_line = is_label ? operand : trimmed;
+    int size = symbol_line_size(rest_of_line, relax, line_number);
+    char literal[MAX_LITERAL_LENGTH];
+    bool uses_literal = pool_literal(rest_of_line, literal);
 
-    *label_end = saved_char;
+    // Mirror the program pass's literal pool placement (see asm/pool.h)
+    if (pool_must_flush(&pool, current_address, size,
+                        uses_literal ? literal : NULL)) {
+      current_address += pool.literal_count + 1;  // BRnzp around the pool
+      pool_init(&pool);
+    }
 
-    if (is_label && symbol_table->symbol_count < MAX_SYMBOLS) {
-      // Extract label name
-      char label_name[64];
-      int label_len = label_end - trimmed;
-      if (label_len >= 64) label_len = 63;
-      strncpy(label_name, trimmed, label_len);
-      label_name[label_len] = '\0';
-
-      // Add to symbol table
-      strncpy(symbol_table->symbols[symbol_table->symbol_count].name,
-              label_name, 63);
-      symbol_table->symbols[symbol_table->symbol_count].name[63] = '\0';
-      symbol_table->symbols[symbol_table->symbol_count].address =
-          current_address;
-      symbol_table->symbol_count++;
+    if (is_label) {
+      *label_end = '\0';
+      symbol_define(symbol_table, trimmed, current_address, section, log);
+      *label_end = saved_char;
     }
 
-    // Calculate instruction/data size and increment address
-    char* rest_of_line = label_end;
-    while (*rest_of_line == ' ' || *rest_of_line == '\t') rest_of_line++;
-
-    if (strncmp(rest_of_line, ".FILL", 5) == 0) {
-      current_address += 1;
-    } else if (strncmp(rest_of_line, ".BLKW", 5) == 0) {
-      char* num_str = rest_of_line + 5;
-      while (*num_str == ' ' || *num_str == '\t') num_str++;
-      int num_words = 1;
-      if (*num_str == '#') {
-        num_words = atoi(num_str + 1);
-      } else {
-        num_words = atoi(num_str);
-      }
-      current_address += num_words;
-    } else if (strncmp(rest_of_line, ".STRINGZ", 8) == 0) {
-      char* str_start = strchr(rest_of_line, '"');
-      if (str_start) {
-        char* str_end = strchr(str_start + 1, '"');
-        if (str_end) {
-          int str_len = str_end - str_start - 1;
-          current_address += str_len + 1;  // +1 for null terminator
-        } else {
-          current_address += 1;  // Default if malformed
-        }
-      } else {
-        current_address += 1;  // Default if malformed
-      }
-    } else if (*rest_of_line != '\0' && *rest_of_line != ';') {
-      // Regular instruction
-      current_address += 1;
+    if (uses_literal) pool_add(&pool, literal, current_address, -1);
+    current_address += size;
+    if (pool_is_barrier(rest_of_line)) {
+      current_address += pool.literal_count;
+      pool_init(&pool);
     }
   }
 
   fclose(file);
+
+  for (int i = 0; i < symbol_table->symbol_count; i++) {
+    symbol_t* symbol = &symbol_table->symbols[i];
+    if ((symbol->flags & SYMBOL_GLOBAL) &&
+        symbol->section == SYMBOL_NO_SECTION) {
+      asm_log(log, ASM_LOG_ERROR,
+              "Error: Symbol '%s' is declared .GLOBAL but never defined\n",
+              symbol->name);
+    }
+  }
   return symbol_table;
 }
 
-void symbol_table_write_file(symbol_table_t* symbol_table,
-                             const char* filename) {
+int symbol_table_write_file(symbol_table_t* symbol_table, const char* filename,
+                            asm_log_t* log) {
   FILE* file = fopen(filename, "w");
   if (file == NULL) {
-    fprintf(stderr, "Error: Could not open file %s to write symbols\n",
-            filename);
-    return;
+    asm_log(log, ASM_LOG_ERROR,
+            "Error: Could not open file %s to write symbols\n", filename);
+    return 1;
   }
   for (int i = 0; i < symbol_table->symbol_count; i++) {
+    // Imports have no address in this program
+    if (symbol_table->symbols[i].section == SYMBOL_NO_SECTION) continue;
     fprintf(file, "%s\t%d\n", symbol_table->symbols[i].name,
             symbol_table->symbols[i].address);
   }
+  if (fclose(file) != 0) {
+    asm_log(log, ASM_LOG_ERROR, "Error: Could not write symbols to %s\n",
+            filename);
+    return 1;
+  }
+  return 0;
+}
+
+symbol_table_t* symbol_table_read_file(const char* filename) {
+  FILE* file = fopen(filename, "r");
+  if (!file) return NULL;
+
+  symbol_table_t* symbol_table = symbol_table_create();
+  char line[128];
+  bool valid = symbol_table != NULL;
+  while (valid && fgets(line, sizeof(line), file)) {
+    char name[64];
+    int address;
+    valid = sscanf(line, "%63[^\t]\t%d", name, &address) == 2 &&
+            address >= 0 && address <= UINT16_MAX &&
+            symbol_table_add_symbol(symbol_table, name, (uint16_t)address, 0,
+                                    0) >= 0;
+  }
   fclose(file);
+  if (!valid) {
+    symbol_table_destroy(symbol_table);
+    return NULL;
+  }
+  return symbol_table;
 }
@@ -0,0 +1,301 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/lc3/debug.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/util/file.h"
+
+// Grow *array to hold one more element of size bytes. Returns false if out
+// of memory.
+static bool debug_info_reserve(void** array, int count, int* capacity,
+                               size_t size) {
+  if (count < *capacity) return true;
+  int new_capacity = *capacity ? *capacity * 2 : 16;
+  void* grown = realloc(*array, new_capacity * size);
+  if (!grown) return false;
+  *array = grown;
+  *capacity = new_capacity;
+  return true;
+}
+
+// Capacities of the arrays being built; kept beside the public struct
+typedef struct {
+  debug_info_t info;
+  int file_capacity;
+  int label_capacity;
+  int line_capacity;
+} debug_builder_t;
+
+debug_info_t* debug_info_create(void) {
+  debug_builder_t* builder = calloc(1, sizeof(debug_builder_t));
+  return builder ? &builder->info : NULL;
+}
+
+void debug_info_destroy(debug_info_t* info) {
+  if (!info) return;
+  for (int i = 0; i < info->file_count; i++) free(info->files[i]);
+  for (int i = 0; i < info->label_count; i++) free(info->labels[i].name);
+  free(info->files);
+  free(info->labels);
+  free(info->lines);
+  free(info);
+}
+
+int debug_info_add_file(debug_info_t* info, const char* name) {
+  debug_builder_t* builder = (debug_builder_t*)info;
+  char* copy = strdup(name);
+  if (!copy || !debug_info_reserve((void**)&info->files, info->file_count,
+                                   &builder->file_capacity, sizeof(char*))) {
+    free(copy);
+    return -1;
+  }
+  info->files[info->file_count] = copy;
+  return info->file_count++;
+}
+
+int debug_info_add_label(debug_info_t* info, const char* name, uint16_t start,
+                         uint16_t end) {
+  debug_builder_t* builder = (debug_builder_t*)info;
+  char* copy = strdup(name);
+  if (!copy ||
+      !debug_info_reserve((void**)&info->labels, info->label_count,
+                          &builder->label_capacity, sizeof(debug_label_t))) {
+    free(copy);
+    return -1;
+  }
+  info->labels[info->label_count] = (debug_label_t){start, end, copy};
+  return info->label_count++;
+}
+
+int debug_info_add_line(debug_info_t* info, uint16_t address, uint16_t file,
+                        uint32_t line) {
+  debug_builder_t* builder = (debug_builder_t*)info;
+  if (!debug_info_reserve((void**)&info->lines, info->line_count,
+                          &builder->line_capacity, sizeof(debug_line_t))) {
+    return -1;
+  }
+  info->lines[info->line_count] = (debug_line_t){address, file, line};
+  return info->line_count++;
+}
+
+static int debug_label_compare(const void* a, const void* b) {
+  const debug_label_t* left = a;
+  const debug_label_t* right = b;
+  return (int)left->start - (int)right->start;
+}
+
+static int debug_line_compare(const void* a, const void* b) {
+  const debug_line_t* left = a;
+  const debug_line_t* right = b;
+  return (int)left->address - (int)right->address;
+}
+
+void debug_info_sort(debug_info_t* info) {
+  qsort(info->labels, info->label_count, sizeof(debug_label_t),
+        debug_label_compare);
+  qsort(info->lines, info->line_count, sizeof(debug_line_t),
+        debug_line_compare);
+}
+
+static void debug_put16(unsigned char* p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value & 0xFF;
+}
+
+static void debug_put32(unsigned char* p, uint32_t value) {
+  debug_put16(p, value >> 16);
+  debug_put16(p + 2, value & 0xFFFF);
+}
+
+static uint16_t debug_get16(const unsigned char* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t debug_get32(const unsigned char* p) {
+  return (uint32_t)debug_get16(p) << 16 | debug_get16(p + 2);
+}
+
+int debug_info_write_file(const debug_info_t* info, const char* filename) {
+  size_t strings = DEBUG_HEADER_SIZE +
+                   (size_t)info->file_count * DEBUG_FILE_SIZE +
+                   (size_t)info->label_count * DEBUG_LABEL_SIZE +
+                   (size_t)info->line_count * DEBUG_LINE_SIZE;
+  size_t size = strings;
+  for (int i = 0; i < info->file_count; i++) {
+    size += strlen(info->files[i]) + 1;
+  }
+  for (int i = 0; i < info->label_count; i++) {
+    size += strlen(info->labels[i].name) + 1;
+  }
+
+  unsigned char* buffer = calloc(1, size);
+  if (!buffer) return -1;
+  memcpy(buffer, DEBUG_MAGIC, 4);
+  debug_put16(buffer + 4, DEBUG_VERSION);
+  debug_put16(buffer + 6, (uint16_t)info->file_count);
+  debug_put32(buffer + 8, (uint32_t)info->label_count);
+  debug_put32(buffer + 12, (uint32_t)info->line_count);
+
+  unsigned char* p = buffer + DEBUG_HEADER_SIZE;
+  size_t string_offset = strings;
+  for (int i = 0; i < info->file_count; i++, p += DEBUG_FILE_SIZE) {
+    debug_put32(p, (uint32_t)string_offset);
+    size_t length = strlen(info->files[i]) + 1;
+    memcpy(buffer + string_offset, info->files[i], length);
+    string_offset += length;
+  }
+  for (int i = 0; i < info->label_count; i++, p += DEBUG_LABEL_SIZE) {
+    const debug_label_t* label = &info->labels[i];
+    debug_put16(p, label->start);
+    debug_put16(p + 2, label->end);
+    debug_put32(p + 4, (uint32_t)string_offset);
+    size_t length = strlen(label->name) + 1;
+    memcpy(buffer + string_offset, label->name, length);
+    string_offset += length;
+  }
+  for (int i = 0; i < info->line_count; i++, p += DEBUG_LINE_SIZE) {
+    debug_put16(p, info->lines[i].address);
+    debug_put16(p + 2, info->lines[i].file);
+    debug_put32(p + 4, info->lines[i].line);
+  }
+
+  int result = file_write_atomic(filename, buffer, size);
+  free(buffer);
+  return result;
+}
+
+// The NUL-terminated string at offset, or NULL if it runs past the end
+static const char* debug_string(const unsigned char* data, size_t size,
+                                size_t strings, uint32_t offset) {
+  if (offset < strings || offset >= size) return NULL;
+  if (!memchr(data + offset, '\0', size - offset)) return NULL;
+  return (const char*)data + offset;
+}
+
+// Decode a whole debug info file. Returns NULL if it is malformed.
+static debug_info_t* debug_info_parse(const unsigned char* data, size_t size) {
+  if (size < DEBUG_HEADER_SIZE || memcmp(data, DEBUG_MAGIC, 4) != 0 ||
+      debug_get16(data + 4) != DEBUG_VERSION) {
+    return NULL;
+  }
+  size_t file_count = debug_get16(data + 6);
+  size_t label_count = debug_get32(data + 8);
+  size_t line_count = debug_get32(data + 12);
+  size_t strings = DEBUG_HEADER_SIZE + file_count * DEBUG_FILE_SIZE +
+                   label_count * DEBUG_LABEL_SIZE +
+                   line_count * DEBUG_LINE_SIZE;
+  if (label_count > UINT16_MAX + 1 || line_count > UINT16_MAX + 1 ||
+      strings > size) {
+    return NULL;
+  }
+
+  debug_info_t* info = debug_info_create();
+  if (!info) return NULL;
+  const unsigned char* p = data + DEBUG_HEADER_SIZE;
+  bool valid = true;
+  for (size_t i = 0; valid && i < file_count; i++, p += DEBUG_FILE_SIZE) {
+    const char* name = debug_string(data, size, strings, debug_get32(p));
+    valid = name && debug_info_add_file(info, name) >= 0;
+  }
+  for (size_t i = 0; valid && i < label_count; i++, p += DEBUG_LABEL_SIZE) {
+    const char* name = debug_string(data, size, strings, debug_get32(p + 4));
+    valid = name && debug_info_add_label(info, name, debug_get16(p),
+                                         debug_get16(p + 2)) >= 0;
+  }
+  for (size_t i = 0; valid && i < line_count; i++, p += DEBUG_LINE_SIZE) {
+    valid = debug_get16(p + 2) < file_count &&
+            debug_info_add_line(info, debug_get16(p), debug_get16(p + 2),
+                                debug_get32(p + 4)) >= 0;
+  }
+  if (!valid) {
+    debug_info_destroy(info);
+    return NULL;
+  }
+  // Files from other writers are not trusted to be sorted
+  debug_info_sort(info);
+  return info;
+}
+
+debug_info_t* debug_info_read_file(const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) return NULL;
+
+  unsigned char* data = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
+  for (;;) {
+    if (size == capacity) {
+      capacity = capacity ? capacity * 2 : 4096;
+      unsigned char* grown = realloc(data, capacity);
+      if (!grown) break;
+      data = grown;
+    }
+    size_t read = fread(data + size, 1, capacity - size, file);
+    size += read;
+    if (read == 0) break;
+  }
+  // Running out of memory stops reading before the end
+  bool failed = ferror(file) || !feof(file);
+  fclose(file);
+
+  debug_info_t* info = failed ? NULL : debug_info_parse(data, size);
+  free(data);
+  return info;
+}
+
+const debug_label_t* debug_info_find_label(const debug_info_t* info,
+                                           uint16_t address) {
+  // Last label starting at or before address
+  int low = 0;
+  int high = info->label_count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (info->labels[middle].start <= address) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low == 0) return NULL;
+  const debug_label_t* label = &info->labels[low - 1];
+  return address < label->end ? label : NULL;
+}
+
+const debug_line_t* debug_info_find_line(const debug_info_t* info,
+                                         uint16_t address) {
+  debug_line_t key = {.address = address};
+  return bsearch(&key, info->lines, info->line_count, sizeof(debug_line_t),
+                 debug_line_compare);
+}
+
+char* debug_info_describe(const debug_info_t* info, uint16_t address,
+                          char* buffer, size_t size) {
+  const debug_label_t* label =
+      info ? debug_info_find_label(info, address) : NULL;
+  const debug_line_t* line = info ? debug_info_find_line(info, address) : NULL;
+
+  int length = snprintf(buffer, size, "x%04X", address);
+  if (label && length >= 0 && (size_t)length < size) {
+    length += address == label->start
+                  ? snprintf(buffer + length, size - length, " (%s",
+                             label->name)
+                  : snprintf(buffer + length, size - length, " (%s+%d",
+                             label->name, address - label->start);
+  }
+  if (line && length >= 0 && (size_t)length < size) {
+    // The file name alone is enough to find the line
+    const char* file = info->files[line->file];
+    const char* base = strrchr(file, '/');
+    length += snprintf(buffer + length, size - length, "%s%s:%u",
+                       label ? ", " : " (", base ? base + 1 : file,
+                       (unsigned)line->line);
+  }
+  if ((label || line) && length >= 0 && (size_t)length < size) {
+    snprintf(buffer + length, size - length, ")");
+  }
+  return buffer;
+}
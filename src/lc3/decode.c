@@ -0,0 +1,92 @@
+#include "../../include/lc3/decode.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+
+static lc3_decoded_t lc3_decoded[LC3_MEMORY_MAX];
+static pthread_once_t lc3_decoded_once = PTHREAD_ONCE_INIT;
+
+lc3_decoded_t lc3_decode(uint16_t instr) {
+  lc3_decoded_t decoded = {
+      .op = instr >> LC3_OP_SHIFT,
+      .format = LC3_FORMAT_INVALID,
+      .r0 = lc3_r0(instr),
+      .r1 = lc3_r1(instr),
+      .r2 = lc3_r2(instr),
+  };
+  // Bits a valid encoding leaves 0 (or, for NOT, 1)
+  bool clear = true;
+  switch (decoded.op) {
+    case LC3_OP_ADD:
+    case LC3_OP_AND:
+      if (instr & LC3_IMM_MODE) {
+        decoded.format = LC3_FORMAT_REG2_IMM;
+        decoded.imm = (int16_t)lc3_imm5(instr);
+      } else {
+        decoded.format = LC3_FORMAT_REG3;
+        clear = (instr & 0x0018) == 0;
+      }
+      break;
+    case LC3_OP_LDR:
+    case LC3_OP_STR:
+      decoded.format = LC3_FORMAT_REG2_IMM;
+      decoded.imm = (int16_t)lc3_offset6(instr);
+      break;
+    case LC3_OP_NOT:
+      decoded.format = LC3_FORMAT_REG2;
+      clear = (instr & LC3_NOT_BITS) == LC3_NOT_BITS;
+      break;
+    case LC3_OP_LD:
+    case LC3_OP_LDI:
+    case LC3_OP_LEA:
+    case LC3_OP_ST:
+    case LC3_OP_STI:
+      decoded.format = LC3_FORMAT_REG_PC;
+      decoded.imm = (int16_t)lc3_pc_offset9(instr);
+      break;
+    case LC3_OP_BR:
+      // BR with no condition never branches; it is left as data
+      decoded.format = LC3_FORMAT_BRANCH;
+      decoded.imm = (int16_t)lc3_pc_offset9(instr);
+      clear = decoded.r0 != 0;
+      break;
+    case LC3_OP_JSR:
+      if (instr & LC3_JSR_LONG) {
+        decoded.format = LC3_FORMAT_PC;
+        decoded.imm = (int16_t)lc3_pc_offset11(instr);
+      } else {
+        decoded.format = LC3_FORMAT_BASE;
+        clear = (instr & 0x0E3F) == 0;
+      }
+      break;
+    case LC3_OP_JMP:
+      decoded.format =
+          decoded.r1 == LC3_R_R7 ? LC3_FORMAT_NONE : LC3_FORMAT_BASE;
+      clear = (instr & 0x0E3F) == 0;
+      break;
+    case LC3_OP_RTI:
+      decoded.format = LC3_FORMAT_NONE;
+      clear = (instr & 0x0FFF) == 0;
+      break;
+    case LC3_OP_TRAP:
+      decoded.format = LC3_FORMAT_TRAP;
+      decoded.imm = lc3_trap_vect(instr);
+      clear = (instr & 0x0F00) == 0;
+      break;
+    default:  // LC3_OP_RES
+      break;
+  }
+  if (!clear) decoded.format = LC3_FORMAT_INVALID;
+  return decoded;
+}
+
+static void lc3_decode_build(void) {
+  for (uint32_t instr = 0; instr < LC3_MEMORY_MAX; instr++) {
+    lc3_decoded[instr] = lc3_decode((uint16_t)instr);
+  }
+}
+
+const lc3_decoded_t* lc3_decode_table(void) {
+  pthread_once(&lc3_decoded_once, lc3_decode_build);
+  return lc3_decoded;
+}
@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/lc3/image.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../../include/lc3/lc3.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/file.h"
+
+#define IMAGE_FNV_OFFSET_BASIS 0x811C9DC5U
+#define IMAGE_FNV_PRIME 0x01000193U
+
+static bool image_host_little_endian(void) {
+  uint16_t probe = 1;
+  unsigned char first_byte;
+  memcpy(&first_byte, &probe, 1);
+  return first_byte == 1;
+}
+
+static uint32_t image_checksum(const unsigned char* data, size_t size) {
+  uint32_t hash = IMAGE_FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= data[i];
+    hash *= IMAGE_FNV_PRIME;
+  }
+  return hash;
+}
+
+static void image_put16(unsigned char* p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value & 0xFF;
+}
+
+static void image_put32(unsigned char* p, uint32_t value) {
+  image_put16(p, value >> 16);
+  image_put16(p + 2, value & 0xFFFF);
+}
+
+static uint16_t image_get16(const unsigned char* p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t image_get32(const unsigned char* p) {
+  return (uint32_t)image_get16(p) << 16 | image_get16(p + 2);
+}
+
+int image_write_file(const char* filename, const image_segment_t* segments,
+                     int segment_count, bool native) {
+  size_t size = IMAGE_HEADER_SIZE + (size_t)segment_count * IMAGE_SEGMENT_SIZE;
+  for (int i = 0; i < segment_count; i++) {
+    if (!(segments[i].flags & IMAGE_SEGMENT_ZERO)) {
+      size += segments[i].length * sizeof(uint16_t);
+    }
+  }
+
+  unsigned char* buffer = calloc(1, size);
+  if (!buffer) return -1;
+
+  bool host_little_endian = image_host_little_endian();
+  bool little_endian = native && host_little_endian;
+
+  memcpy(buffer, IMAGE_MAGIC, 4);
+  image_put16(buffer + 4, IMAGE_VERSION);
+  image_put16(buffer + 6, little_endian ? IMAGE_LITTLE_ENDIAN : 0);
+  image_put16(buffer + 8, segment_count);
+
+  size_t offset = IMAGE_HEADER_SIZE + (size_t)segment_count * IMAGE_SEGMENT_SIZE;
+  for (int i = 0; i < segment_count; i++) {
+    const image_segment_t* segment = &segments[i];
+    unsigned char* entry = buffer + IMAGE_HEADER_SIZE + i * IMAGE_SEGMENT_SIZE;
+    image_put16(entry, segment->address);
+    image_put16(entry + 2, segment->length);
+    image_put16(entry + 4, segment->flags);
+    if (segment->flags & IMAGE_SEGMENT_ZERO) continue;
+
+    image_put32(entry + 8, (uint32_t)offset);
+    uint16_t* payload = (uint16_t*)(buffer + offset);
+    if (little_endian == host_little_endian) {
+      memcpy(payload, segment->words, segment->length * sizeof(uint16_t));
+    } else {
+      swap16_copy(payload, segment->words, segment->length);
+    }
+    offset += segment->length * sizeof(uint16_t);
+  }
+
+  image_put32(buffer + 12, image_checksum(buffer + IMAGE_HEADER_SIZE,
+                                          size - IMAGE_HEADER_SIZE));
+
+  int result = file_write_atomic(filename, buffer, size);
+  free(buffer);
+  return result;
+}
+
+// Check the header, segment table and checksum of a mapped image
+static bool image_validate(image_t* image) {
+  const unsigned char* data = image->data;
+  if (image->size < IMAGE_HEADER_SIZE || memcmp(data, IMAGE_MAGIC, 4) != 0 ||
+      image_get16(data + 4) != IMAGE_VERSION) {
+    return false;
+  }
+  image->flags = image_get16(data + 6);
+  image->segment_count = image_get16(data + 8);
+
+  size_t table_end =
+      IMAGE_HEADER_SIZE + (size_t)image->segment_count * IMAGE_SEGMENT_SIZE;
+  if (table_end > image->size) return false;
+
+  for (int i = 0; i < image->segment_count; i++) {
+    const unsigned char* entry = data + IMAGE_HEADER_SIZE + i * IMAGE_SEGMENT_SIZE;
+    uint32_t end = (uint32_t)image_get16(entry) + image_get16(entry + 2);
+    if (end > LC3_MEMORY_MAX) return false;
+    if (image_get16(entry + 4) & IMAGE_SEGMENT_ZERO) continue;
+
+    size_t offset = image_get32(entry + 8);
+    size_t payload_size = image_get16(entry + 2) * sizeof(uint16_t);
+    if (offset % sizeof(uint16_t) != 0 || offset < table_end ||
+        offset > image->size || payload_size > image->size - offset) {
+      return false;
+    }
+  }
+
+  return image_get32(data + 12) ==
+         image_checksum(data + IMAGE_HEADER_SIZE,
+                        image->size - IMAGE_HEADER_SIZE);
+}
+
+int image_open(const char* filename, image_t* image) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return 1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < IMAGE_HEADER_SIZE) {
+    close(fd);
+    return 1;
+  }
+
+  void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // The mapping stays valid without the descriptor
+  if (data == MAP_FAILED) return 1;
+
+  image->data = data;
+  image->size = (size_t)st.st_size;
+  image->mapped = true;
+  if (!image_validate(image)) {
+    image_close(image);
+    return 1;
+  }
+  return 0;
+}
+
+int image_open_memory(const void* data, size_t size, image_t* image) {
+  image->data = data;
+  image->size = size;
+  image->mapped = false;
+  return image_validate(image) ? 0 : 1;
+}
+
+void image_close(image_t* image) {
+  if (image->data && image->mapped) munmap((void*)image->data, image->size);
+  image->data = NULL;
+  image->size = 0;
+}
+
+bool image_is_native(const image_t* image) {
+  return ((image->flags & IMAGE_LITTLE_ENDIAN) != 0) ==
+         image_host_little_endian();
+}
+
+void image_get_segment(const image_t* image, int index,
+                       image_segment_t* segment) {
+  const unsigned char* entry =
+      image->data + IMAGE_HEADER_SIZE + index * IMAGE_SEGMENT_SIZE;
+  segment->address = image_get16(entry);
+  segment->length = image_get16(entry + 2);
+  segment->flags = image_get16(entry + 4);
+  segment->words = segment->flags & IMAGE_SEGMENT_ZERO
+                       ? NULL
+                       : (const uint16_t*)(image->data + image_get32(entry + 8));
+}
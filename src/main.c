@@ -1,39 +1,53 @@
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
+#include "../include/aot/aot.h"
 #include "../include/asm/asm.h"
+#include "../include/asm/batch.h"
+#include "../include/asm/disasm.h"
+#include "../include/asm/linker.h"
+#include "../include/util/file.h"
 #include "../include/vm/vm.h"
+#include "../include/vm/vm_cache.h"
+#include "../include/vm/vm_coverage.h"
+#include "../include/vm/vm_cycles.h"
+#include "../include/vm/vm_profile.h"
+#include "../include/vm/vm_server.h"
+#include "../include/vm/vm_session.h"
+#include "../include/vm/vm_smp.h"
+#include "../include/vm/vm_stats.h"
 
-char* change_filename_extension(const char* filename,
-                                const char* new_extension) {
-  char* new_filename = malloc(strlen(filename) + strlen(new_extension) + 1);
-  strcpy(new_filename, filename);
-  char* dot = strrchr(new_filename, '.');
-  if (dot) {
-    strcpy(dot, new_extension);
-  }
-  return new_filename;
-}
-
-int run_assembler_symbols(const char* input_filename) {
+int run_assembler_symbols(const char* input_filename,
+                          const asm_options_t* options) {
   printf("LC-3 Assembler Symbols\n");
-  char* symbols_filename = change_filename_extension(input_filename, ".sym");
-  int result = asm_symbol_run(input_filename, symbols_filename);
+  char* symbols_filename = file_change_extension(input_filename, ".sym");
+  asm_cache_t* cache = asm_cache_open_default();
+  int result = asm_symbol_run(input_filename, symbols_filename, cache,
+                              options, NULL);
+  asm_cache_close(cache);
+  free(symbols_filename);
   if (result != 0) {
     fprintf(stderr, "Assembly symbol generation failed!\n");
     return result;
   }
 
   printf("Assembly symbol generation completed successfully!\n");
-  free(symbols_filename);
   return 0;
 }
 
-int run_assembler(const char* input_filename) {
+int run_assembler(const char* input_filename, const asm_options_t* options) {
   printf("LC-3 Assembler\n");
-  char* obj_filename = change_filename_extension(input_filename, ".obj");
-  int result = asm_run(input_filename, obj_filename);
+  char* obj_filename = file_change_extension(input_filename, ".obj");
+  char* sym_filename = file_change_extension(input_filename, ".sym");
+  asm_cache_t* cache = asm_cache_open_default();
+  int result = asm_run(input_filename, obj_filename, sym_filename, cache,
+                       options, NULL);
+  asm_cache_close(cache);
+  free(obj_filename);
+  free(sym_filename);
 
   if (result != 0) {
     fprintf(stderr, "Assembly failed!\n");
@@ -41,7 +55,105 @@ int run_assembler(const char* input_filename) {
   }
 
   printf("Assembly completed successfully!\n");
-  free(obj_filename);
+  return 0;
+}
+
+// Assemble to a relocatable module (.o) for lc3 link
+int run_assembler_module(const char* input_filename,
+                         const asm_options_t* options) {
+  printf("LC-3 Assembler\n");
+  char* module_filename = file_change_extension(input_filename, ".o");
+  asm_cache_t* cache = asm_cache_open_default();
+  int result =
+      asm_module_run(input_filename, module_filename, cache, options, NULL);
+  asm_cache_close(cache);
+  free(module_filename);
+
+  if (result != 0) {
+    fprintf(stderr, "Module generation failed!\n");
+    return result;
+  }
+
+  printf("Module generation completed successfully!\n");
+  return 0;
+}
+
+int run_linker(int input_count, char* input_filenames[],
+               const char* output_filename, const asm_options_t* options) {
+  printf("LC-3 Linker\n");
+  char* default_filename = NULL;
+  if (!output_filename) {
+    default_filename = file_change_extension(input_filenames[0], ".obj");
+    output_filename = default_filename;
+  }
+
+  int result = linker_run(input_count, input_filenames, output_filename,
+                          options->native, NULL);
+  free(default_filename);
+  if (result != 0) {
+    fprintf(stderr, "Linking failed!\n");
+    return result;
+  }
+
+  printf("Linking completed successfully!\n");
+  return 0;
+}
+
+// Assemble many files (or directories of .asm files) on a pool of threads and
+// report each file's diagnostics once everything has finished
+int run_assembler_batch(int path_count, char* paths[], int thread_count,
+                        const asm_options_t* options) {
+  asm_batch_t* batch = asm_batch_create();
+  if (!batch) {
+    fprintf(stderr, "Error: Out of memory\n");
+    return 1;
+  }
+  batch->options = *options;
+
+  int result = 0;
+  for (int i = 0; i < path_count; i++) {
+    if (asm_batch_add_path(batch, paths[i]) < 0) {
+      fprintf(stderr, "Error: Could not read %s\n", paths[i]);
+      result = 1;
+    }
+  }
+
+  asm_cache_t* cache = asm_cache_open_default();
+  int failed = asm_batch_run(batch, thread_count, cache);
+  asm_cache_close(cache);
+
+  for (int i = 0; i < batch->job_count; i++) {
+    asm_job_t* job = &batch->jobs[i];
+    if (job->result == 0 && job->log.length == 0) continue;
+    printf("%s: %s\n", job->input_filename,
+           job->result == 0 ? "warnings" : "FAILED");
+    if (job->log.length > 0) fputs(job->log.buffer, stdout);
+  }
+  printf("Assembled %d files, %d failed\n", batch->job_count - failed,
+         failed);
+
+  asm_batch_destroy(batch);
+  return result || failed ? 1 : 0;
+}
+
+// Translate an object file to a native executable (or to C with -o x.c);
+// the output defaults to the input without its extension
+int run_aot(const char* program_filename, const char* output_filename) {
+  printf("LC-3 Ahead-of-Time Translator\n");
+  char* default_filename = NULL;
+  if (!output_filename) {
+    default_filename = file_change_extension(program_filename, "");
+    output_filename = default_filename;
+  }
+
+  int result = aot_run(program_filename, output_filename);
+  free(default_filename);
+  if (result != 0) {
+    fprintf(stderr, "Translation failed!\n");
+    return result;
+  }
+
+  printf("Translation completed successfully!\n");
   return 0;
 }
 
@@ -50,31 +162,227 @@ int run_vm(const char* program_filename) {
   return vm_run(program_filename);
 }
 
-int run_assembler_vm(const char* input_filename) {
-  int result = run_assembler(input_filename);
-  if (result != 0) {
+// Run a program on top of an LC-3 OS image whose trap and interrupt vector
+// tables take over from the built-in traps
+int run_vm_os(const char* os_filename, const char* program_filename) {
+  printf("LC-3 Virtual Machine\n");
+  return vm_run_os(os_filename, program_filename);
+}
+
+// Run a program on several harts that share its memory; quantum 0 gives
+// each hart a thread, otherwise they take turns of quantum instructions
+int run_vm_smp(const char* program_filename, int hart_count,
+               uint64_t quantum) {
+  printf("LC-3 Virtual Machine\n");
+  return vm_smp_run(program_filename, hart_count, quantum);
+}
+
+// Serve a program on a Unix socket, one session per connection, with
+// loop_count event loops (0 for one per CPU)
+int run_vm_sessions(const char* socket_path, const char* program_filename,
+                    int loop_count) {
+  printf("LC-3 Virtual Machine\n");
+  return vm_session_serve(socket_path, program_filename, loop_count);
+}
+
+// Run programs for clients of a Unix socket on pre-forked workers
+int run_vm_server(const char* socket_path, int worker_count) {
+  printf("LC-3 Virtual Machine Server\n");
+  return vm_server_serve(socket_path, worker_count);
+}
+
+// Assemble in memory and hand the image straight to the VM; the object file
+// is only written when an output filename is given
+int run_assembler_vm(const char* input_filename, const char* obj_filename,
+                     const asm_options_t* options) {
+  printf("LC-3 Assembler\n");
+  asm_cache_t* cache = asm_cache_open_default();
+  program_t* program = asm_assemble(input_filename, cache, options, NULL, NULL);
+  asm_cache_close(cache);
+  if (!program) {
     fprintf(stderr, "Assembly failed! Cannot run VM.\n");
-    return result;
+    return 1;
   }
 
-  char* obj_filename = change_filename_extension(input_filename, ".obj");
-  result = run_vm(obj_filename);
-  free(obj_filename);
+  if (obj_filename && program_write_file(program, obj_filename, options->native,
+                                         NULL) != 0) {
+    program_destroy(program);
+    fprintf(stderr, "Assembly failed! Cannot run VM.\n");
+    return 1;
+  }
+
+  uint16_t origin;
+  size_t count;
+  uint16_t* words = program_build_image(program, &origin, &count, NULL);
+  if (!words) {
+    program_destroy(program);
+    fprintf(stderr, "Assembly failed! Cannot run VM.\n");
+    return 1;
+  }
+
+  printf("LC-3 Virtual Machine\n");
+  int result = vm_run_image(origin, words, count);
+
+  free(words);
+  program_destroy(program);
   return result;
 }
 
+// Take assembler flags (-O, --native) out of argv wherever they appear after
+// the mode so the positional parsing below does not see them. Returns the new
+// argc.
+int parse_assembler_options(int argc, char* argv[], asm_options_t* options) {
+  int kept = 2;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "-O") == 0) {
+      options->optimize = true;
+    } else if (strcmp(argv[i], "--native") == 0) {
+      options->native = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  return argc < 2 ? argc : kept;
+}
+
+// Take VM flags (--stats[=format], --stats-file <path>, --coverage <path>,
+// --icache <spec>, --dcache <spec>, --cycles[=spec], --profile <path>) out
+// of argv wherever they appear. Returns the new argc, or -1 on a bad flag.
+int parse_vm_options(int argc, char* argv[]) {
+  vm_stats_format_t format = VM_STATS_OFF;
+  const char* stats_path = NULL;
+  vm_cache_config_t caches[2];
+  bool cached[2] = {false, false};
+  vm_cycles_config_t cycles;
+  bool profiled = false;
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stats") == 0) {
+      format = VM_STATS_TEXT;
+    } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+      if (vm_stats_parse_format(argv[i] + 8, &format) != 0) {
+        fprintf(stderr, "Error: Unknown statistics format %s\n", argv[i] + 8);
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+      stats_path = argv[++i];
+    } else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+      vm_coverage_configure(argv[++i]);
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      vm_profile_configure(argv[++i]);
+    } else if ((strcmp(argv[i], "--icache") == 0 ||
+                strcmp(argv[i], "--dcache") == 0) &&
+               i + 1 < argc) {
+      int which = argv[i][2] == 'd';
+      if (vm_cache_parse(argv[++i], &caches[which]) != 0) {
+        fprintf(stderr, "Error: Invalid cache %s\n", argv[i]);
+        return -1;
+      }
+      cached[which] = true;
+    } else if (strcmp(argv[i], "--cycles") == 0 ||
+               strncmp(argv[i], "--cycles=", 9) == 0) {
+      const char* spec = argv[i][8] == '=' ? argv[i] + 9 : "";
+      if (vm_cycles_parse(spec, &cycles) != 0) {
+        fprintf(stderr, "Error: Invalid cycle costs %s\n", spec);
+        return -1;
+      }
+      profiled = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  vm_stats_configure(format, stats_path);
+  vm_cache_configure(cached[0] ? &caches[0] : NULL,
+                     cached[1] ? &caches[1] : NULL);
+  vm_cycles_configure(profiled ? &cycles : NULL);
+  return argc < 1 ? argc : kept;
+}
+
 int main(int argc, char* argv[]) {
+  argc = parse_vm_options(argc, argv);
+  if (argc < 0) return 1;
+  asm_options_t options = {0};
+  argc = parse_assembler_options(argc, argv, &options);
+
   // Assembler symbol mode generation: lc3 -s <input.asm>
   if (argc == 3 && strcmp(argv[1], "-s") == 0) {
-    return run_assembler_symbols(argv[2]);
+    return run_assembler_symbols(argv[2], &options);
   }
-  // Assembler mode: lc3 -c <input.asm>
-  if (argc == 3 && strcmp(argv[1], "-c") == 0) {
-    return run_assembler(argv[2]);
+  // Assembler mode: lc3 -c [-j <threads>] <input.asm|directory>...
+  if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+    int first_path = 2;
+    int thread_count = 0;
+    if (strcmp(argv[2], "-j") == 0 && argc >= 5) {
+      thread_count = atoi(argv[3]);
+      first_path = 4;
+    }
+
+    struct stat st;
+    bool single_file = argc - first_path == 1 && first_path == 2 &&
+                       !(stat(argv[2], &st) == 0 && S_ISDIR(st.st_mode));
+    if (single_file) return run_assembler(argv[2], &options);
+    return run_assembler_batch(argc - first_path, argv + first_path,
+                               thread_count, &options);
+  }
+  // Module mode: lc3 -m <input.asm>
+  else if (argc == 3 && strcmp(argv[1], "-m") == 0) {
+    return run_assembler_module(argv[2], &options);
+  }
+  // Disassemble: lc3 -d <program.obj>
+  else if (argc == 3 && strcmp(argv[1], "-d") == 0) {
+    return disasm_file(stdout, argv[2]);
   }
-  // Assemble and run: lc3 -r <input.asm>
+  // Link modules: lc3 link [-o <output.obj>] <module.o>...
+  else if (argc >= 5 && strcmp(argv[1], "link") == 0 &&
+           strcmp(argv[2], "-o") == 0) {
+    return run_linker(argc - 4, argv + 4, argv[3], &options);
+  } else if (argc >= 3 && strcmp(argv[1], "link") == 0 &&
+             strcmp(argv[2], "-o") != 0) {
+    return run_linker(argc - 2, argv + 2, NULL, &options);
+  }
+  // Assemble and run: lc3 -r <input.asm> [-o <output.obj>]
   else if (argc == 3 && strcmp(argv[1], "-r") == 0) {
-    return run_assembler_vm(argv[2]);
+    return run_assembler_vm(argv[2], NULL, &options);
+  } else if (argc == 5 && strcmp(argv[1], "-r") == 0 &&
+             strcmp(argv[3], "-o") == 0) {
+    return run_assembler_vm(argv[2], argv[4], &options);
+  }
+  // Ahead-of-time translation: lc3 --aot <program.obj> [-o <output>]
+  else if (argc == 3 && strcmp(argv[1], "--aot") == 0) {
+    return run_aot(argv[2], NULL);
+  } else if (argc == 5 && strcmp(argv[1], "--aot") == 0 &&
+             strcmp(argv[3], "-o") == 0) {
+    return run_aot(argv[2], argv[4]);
+  }
+  // VM with an OS image: lc3 --os <os.obj> <program.obj>
+  else if (argc == 4 && strcmp(argv[1], "--os") == 0) {
+    return run_vm_os(argv[2], argv[3]);
+  }
+  // Several harts: lc3 --harts <n> [--quantum <instructions>] <program.obj>
+  else if (argc == 4 && strcmp(argv[1], "--harts") == 0) {
+    return run_vm_smp(argv[3], atoi(argv[2]), 0);
+  } else if (argc == 6 && strcmp(argv[1], "--harts") == 0 &&
+             strcmp(argv[3], "--quantum") == 0) {
+    return run_vm_smp(argv[5], atoi(argv[2]), strtoull(argv[4], NULL, 10));
+  }
+  // Sessions on a socket: lc3 --listen <socket> [--loops <n>] <program.obj>
+  else if (argc == 4 && strcmp(argv[1], "--listen") == 0) {
+    return run_vm_sessions(argv[2], argv[3], 0);
+  } else if (argc == 6 && strcmp(argv[1], "--listen") == 0 &&
+             strcmp(argv[3], "--loops") == 0) {
+    return run_vm_sessions(argv[2], argv[5], atoi(argv[4]));
+  }
+  // Server: lc3 --serve <socket> [--workers <n>]
+  else if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+    return run_vm_server(argv[2], 0);
+  } else if (argc == 5 && strcmp(argv[1], "--serve") == 0 &&
+             strcmp(argv[3], "--workers") == 0) {
+    return run_vm_server(argv[2], atoi(argv[4]));
+  }
+  // Run on a server with stdin as input: lc3 --request <socket> <program.obj>
+  else if (argc == 4 && strcmp(argv[1], "--request") == 0) {
+    int status = vm_server_request(argv[2], argv[3]);
+    return status < 0 ? 1 : status;
   }
   // VM only mode: <program.obj>
   else if (argc == 2) {
@@ -84,9 +392,43 @@ int main(int argc, char* argv[]) {
   else {
     printf("Error: Invalid arguments.\n\n");
     printf("LC-3 Assembler and Virtual Machine\n");
-    printf("VM usage: %s <program.obj>\n", argv[0]);
-    printf("Assembler usage: %s -c <input.asm>\n", argv[0]);
-    printf("Assembler and VM usage: %s -r <input.asm>\n", argv[0]);
+    printf("VM usage: %s [--os <os.obj>] <program.obj>\n", argv[0]);
+    printf("  --stats[=text|json|prometheus] reports counters at exit;\n");
+    printf("  --stats-file <path> writes them there, also on SIGUSR1\n");
+    printf("  --coverage <file.info> writes an lcov tracefile at exit\n");
+    printf("  --icache/--dcache size=<words>,line=<words>,ways=<n>,"
+           "policy=lru|fifo|random\n"
+           "    simulates a cache and reports hits and misses per label\n");
+    printf("  --cycles[=<op>=<n>,memory=<n>,indirect=<n>,taken=<n>] reports\n"
+           "    estimated cycles per subroutine at exit\n");
+    printf("  --profile <file.folded> writes instructions per call path\n"
+           "    as folded stacks for flame graphs at exit\n");
+    printf("SMP usage: %s --harts <n> [--quantum <instructions>] "
+           "<program.obj>\n",
+           argv[0]);
+    printf("Session usage: %s --listen <socket> [--loops <n>] <program.obj>\n",
+           argv[0]);
+    printf("Server usage: %s --serve <socket> [--workers <n>]\n", argv[0]);
+    printf("Client usage: %s --request <socket> <program.obj> < input\n",
+           argv[0]);
+    printf(
+        "Assembler usage: %s -c [-O] [--native] [-j <threads>] "
+        "<input.asm|directory>...\n",
+        argv[0]);
+    printf(
+        "Assembler and VM usage: %s -r [-O] [--native] <input.asm> "
+        "[-o <output.obj>]\n",
+        argv[0]);
+    printf("Module usage: %s -m [-O] <input.asm>\n", argv[0]);
+    printf("  -O runs the peephole optimizer over the assembled code\n");
+    printf(
+        "  --native writes a sparse image in host byte order instead of a "
+        "legacy .obj\n");
+    printf("Disassembler usage: %s -d <program.obj>\n", argv[0]);
+    printf("Linker usage: %s link [--native] [-o <output.obj>] <module.o>...\n",
+           argv[0]);
+    printf("Translator usage: %s --aot <program.obj> [-o <output|output.c>]\n",
+           argv[0]);
     return 1;
   }
 }
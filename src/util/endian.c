@@ -0,0 +1,25 @@
+#include "../../include/util/endian.h"
+
+#include <string.h>
+
+#define SWAP16_LANES_MASK 0x00FF00FF00FF00FFULL
+
+uint16_t swap16(uint16_t val) { return (uint16_t)((val << 8) | (val >> 8)); }
+
+void swap16_copy(uint16_t* dst, const uint16_t* src, size_t count) {
+  size_t i = 0;
+
+  // Swap four words at a time inside a 64-bit lane; the compiler widens this
+  // further to SIMD registers where available
+  for (; i + 4 <= count; i += 4) {
+    uint64_t lanes;
+    memcpy(&lanes, src + i, sizeof(lanes));
+    lanes = ((lanes & SWAP16_LANES_MASK) << 8) |
+            ((lanes >> 8) & SWAP16_LANES_MASK);
+    memcpy(dst + i, &lanes, sizeof(lanes));
+  }
+
+  for (; i < count; i++) {
+    dst[i] = swap16(src[i]);
+  }
+}
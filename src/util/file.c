@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/util/file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int file_write_all(int fd, const void* data, size_t size) {
+  const char* p = data;
+  while (size > 0) {
+    ssize_t written = write(fd, p, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += written;
+    size -= (size_t)written;
+  }
+  return 0;
+}
+
+int file_write_atomic(const char* filename, const void* data, size_t size) {
+  size_t len = strlen(filename);
+  char* temp_filename = malloc(len + sizeof(".XXXXXX"));
+  if (!temp_filename) return -1;
+  memcpy(temp_filename, filename, len);
+  memcpy(temp_filename + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+  int fd = mkstemp(temp_filename);
+  if (fd < 0) {
+    free(temp_filename);
+    return -1;
+  }
+
+  // mkstemp creates the file 0600; object files are meant to be shared
+  if (fchmod(fd, 0644) != 0 || file_write_all(fd, data, size) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    unlink(temp_filename);
+    free(temp_filename);
+    errno = saved_errno;
+    return -1;
+  }
+
+  if (close(fd) != 0 || rename(temp_filename, filename) != 0) {
+    int saved_errno = errno;
+    unlink(temp_filename);
+    free(temp_filename);
+    errno = saved_errno;
+    return -1;
+  }
+
+  free(temp_filename);
+  return 0;
+}
+
+char* file_change_extension(const char* filename, const char* extension) {
+  // Only a dot in the last path component starts an extension
+  const char* base = strrchr(filename, '/');
+  base = base ? base + 1 : filename;
+  const char* dot = strrchr(base, '.');
+  size_t stem_len =
+      dot && dot != base ? (size_t)(dot - filename) : strlen(filename);
+
+  char* new_filename = malloc(stem_len + strlen(extension) + 1);
+  if (!new_filename) return NULL;
+  memcpy(new_filename, filename, stem_len);
+  strcpy(new_filename + stem_len, extension);
+  return new_filename;
+}
@@ -12,42 +12,181 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "../../include/lc3/image.h"
+#include "../../include/util/clock.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/file.h"
+#include "../../include/vm/vm_cache.h"
+#include "../../include/vm/vm_coverage.h"
+#include "../../include/vm/vm_cycles.h"
+#include "../../include/vm/vm_device.h"
+#include "../../include/vm/vm_event.h"
 #include "../../include/vm/vm_exec.h"
+#include "../../include/vm/vm_idiom.h"
+#include "../../include/vm/vm_io.h"
+#include "../../include/vm/vm_limit.h"
+#include "../../include/vm/vm_os.h"
+#include "../../include/vm/vm_profile.h"
+#include "../../include/vm/vm_stats.h"
+#include "../../include/vm/vm_trap.h"
 
-uint16_t swap16(uint16_t val) { return (val << 8) | (val >> 8); }
-
-uint16_t vm_mem_read(vm_t* vm, uint16_t address) {
-  if (address == LC3_MR_KBSR) {
-    // Check if keyboard input is available
-    // This is a simplified implementation
-    return 0x0000;
-  } else if (address == LC3_MR_KBDR) {
-    // Read keyboard data
-    // This is a simplified implementation
-    return 0x0000;
-  }
+vm_t* vm_create_shared(uint16_t* memory) {
+  // Aligned so that no two VMs share a cache line
+  vm_t* vm = aligned_alloc(VM_CACHE_LINE, sizeof(vm_t));
+  if (!vm) return NULL;
 
-  return vm->memory[address];
+  vm->memory = memory;
+  vm->owns_memory = false;
+  vm->debug = NULL;
+  vm->icache = NULL;
+  vm->dcache = NULL;
+  vm->cycles = NULL;
+  vm->profile = NULL;
+  vm_io_init(vm);
+  vm->hart_id = 0;
+  vm->hart_count = 1;
+  memset(vm->traps, 0, sizeof(vm->traps));
+  vm_trap_register_extensions(vm);
+  memset(vm->idiom_at, 0, sizeof(vm->idiom_at));
+  vm->idiom_count = 0;
+  vm_reset(vm);
+  return vm;
 }
 
-vm_t* vm_init(const char* filename) {
-  FILE* file = fopen(filename, "rb");
-  if (!file) return NULL;
-
-  vm_t* vm = malloc(sizeof(vm_t));
-
-  // Clear memory
-  memset(vm->memory, 0, sizeof(vm->memory));
+void vm_reset(vm_t* vm) {
   // Clear registers
   memset(vm->reg, 0, sizeof(vm->reg));
   // Set PC to start location
   vm->reg[LC3_R_PC] = LC3_PC_START;
   // Set condition flag to zero
   vm->reg[LC3_R_COND] = LC3_FL_ZRO;
+  vm->running = false;
+  vm->stop = VM_STOP_HALT;
+  vm_io_reset(vm);
+  // Only loop heads can be set, so this is cheaper than clearing idiom_at
+  for (int i = 0; i < vm->idiom_count; i++) {
+    vm->idiom_at[vm->idioms[i].start] = 0;
+  }
+  vm->idiom_count = 0;
+  vm_os_reset(vm);
+  vm_device_reset(vm);
+  vm_limit_reset(vm);
+  memset(&vm->stats, 0, sizeof(vm->stats));
+  memset(vm->coverage, 0, sizeof(vm->coverage));
+}
+
+vm_t* vm_create(void) {
+  // Cleared memory
+  uint16_t* memory = calloc(LC3_MEMORY_MAX, sizeof(uint16_t));
+  if (!memory) return NULL;
+
+  vm_t* vm = vm_create_shared(memory);
+  if (!vm) {
+    free(memory);
+    return NULL;
+  }
+  vm->owns_memory = true;
+  return vm;
+}
+
+vm_t* vm_clone(const vm_t* src) {
+  vm_t* vm = vm_create();
+  if (!vm) return NULL;
+
+  memcpy(vm->memory, src->memory, LC3_MEMORY_MAX * sizeof(uint16_t));
+  memcpy(vm->idioms, src->idioms, src->idiom_count * sizeof(vm_idiom_t));
+  vm->idiom_count = src->idiom_count;
+  memcpy(vm->idiom_at, src->idiom_at, sizeof(vm->idiom_at));
+  memcpy(vm->stock_vectors, src->stock_vectors, sizeof(vm->stock_vectors));
+  return vm;
+}
+
+void vm_destroy(vm_t* vm) {
+  if (!vm) return;
+  vm_io_free(vm);
+  debug_info_destroy(vm->debug);
+  vm_cache_destroy(vm->icache);
+  vm_cache_destroy(vm->dcache);
+  vm_cycles_destroy(vm->cycles);
+  vm_profile_destroy(vm->profile);
+  if (vm->owns_memory) free(vm->memory);
+  free(vm);
+}
+
+int vm_load_image(vm_t* vm, uint16_t origin, const uint16_t* words,
+                  size_t count) {
+  uint64_t start_ns = clock_now_ns();
+  // Clip the program to the end of memory like the file loader does
+  size_t max_count = LC3_MEMORY_MAX - origin;
+  if (count > max_count) count = max_count;
+
+  memcpy(vm->memory + origin, words, count * sizeof(uint16_t));
+
+  vm_idiom_scan(vm);
+  vm->stats.load_ns += clock_now_ns() - start_ns;
+  printf("Program loaded at origin 0x%04X\n\n", origin);
+  return 0;
+}
+
+// Copy each segment of a mapped sparse image into memory. Native-endian
+// payloads are copied straight from the mapping.
+static int vm_load_sparse_image(vm_t* vm, const char* filename) {
+  image_t image;
+  if (image_open(filename, &image) != 0) {
+    fprintf(stderr, "Error: %s is not a valid LC-3 image\n", filename);
+    return 1;
+  }
+
+  bool native = image_is_native(&image);
+  uint16_t origin = LC3_PC_START;
+  for (int i = 0; i < image.segment_count; i++) {
+    image_segment_t segment;
+    image_get_segment(&image, i, &segment);
+    if (i == 0) origin = segment.address;
+
+    uint16_t* dst = vm->memory + segment.address;
+    if (segment.flags & IMAGE_SEGMENT_ZERO) {
+      memset(dst, 0, segment.length * sizeof(uint16_t));
+    } else if (native) {
+      memcpy(dst, segment.words, segment.length * sizeof(uint16_t));
+    } else {
+      swap16_copy(dst, segment.words, segment.length);
+    }
+  }
+  image_close(&image);
+
+  vm_idiom_scan(vm);
+  printf("Program loaded at origin 0x%04X\n\n", origin);
+  return 0;
+}
+
+static int vm_load_object_file(vm_t* vm, const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  if (!file) return 1;
+
+  // Sparse images and relocatable modules are told apart by their magic;
+  // anything else is a legacy object file
+  char magic[4];
+  bool has_magic = fread(magic, 1, sizeof(magic), file) == sizeof(magic);
+  if (has_magic && memcmp(magic, LC3_MODULE_MAGIC, sizeof(magic)) == 0) {
+    // Relocatable modules have no load address until they are linked
+    fprintf(stderr, "Error: %s is a relocatable module; link it first\n",
+            filename);
+    fclose(file);
+    return 1;
+  }
+  if (has_magic && memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0) {
+    fclose(file);
+    return vm_load_sparse_image(vm, filename);
+  }
+  rewind(file);
 
   // Read origin address
   uint16_t origin;
-  fread(&origin, sizeof(origin), 1, file);
+  if (fread(&origin, sizeof(origin), 1, file) != 1) {
+    fclose(file);
+    return 1;
+  }
   origin = swap16(origin);
 
   // Read program into memory
@@ -61,24 +200,82 @@ vm_t* vm_init(const char* filename) {
 
   fclose(file);
 
+  vm_idiom_scan(vm);
   printf("Program loaded at origin 0x%04X\n\n", origin);
-  return vm;
+  return 0;
 }
 
-int vm_run(const char* filename) {
-  vm_t* vm = vm_init(filename);
-  if (!vm) {
-    fprintf(stderr, "Error: Could not initialize VM with file %s\n", filename);
-    return 1;
-  }
+// Replace the VM's debug info with the program's, if it has any
+static void vm_load_debug_info(vm_t* vm, const char* filename) {
+  char* debug_filename = file_change_extension(filename, DEBUG_EXTENSION);
+  debug_info_destroy(vm->debug);
+  vm->debug = debug_filename ? debug_info_read_file(debug_filename) : NULL;
+  free(debug_filename);
+}
+
+int vm_load_file(vm_t* vm, const char* filename) {
+  uint64_t start_ns = clock_now_ns();
+  int result = vm_load_object_file(vm, filename);
+  if (result == 0) vm_load_debug_info(vm, filename);
+  vm->stats.load_ns += clock_now_ns() - start_ns;
+  return result;
+}
+
+char* vm_describe_pc(const vm_t* vm, char* buffer, size_t size) {
+  uint16_t address = (uint16_t)(vm->reg[LC3_R_PC] - 1);
+  return debug_info_describe(vm->debug, address, buffer, size);
+}
+
+// Stop on an opcode that no exception handler took care of
+static int vm_unknown_opcode(vm_t* vm, uint16_t op) {
+  char where[VM_DESCRIBE_MAX];
+  printf("> Unknown opcode: 0x%04X at %s\n", op,
+         vm_describe_pc(vm, where, sizeof(where)));
+  vm->running = false;
+  vm->stop = VM_STOP_ERROR;
+  return 1;
+}
+
+// The interpreter loop. Inlined into vm_execute twice with instrumented
+// constant, so caches and profiles cost the plain loop nothing.
+static inline __attribute__((always_inline)) int vm_execute_loop(
+    vm_t* vm, bool instrumented) {
   vm->running = true;
+  vm->stop = VM_STOP_HALT;
+  vm_limit_start(vm);
+  vm->stats.run_start_ns = clock_now_ns();
   int result = 0;
   while (vm->running) {
+    // Devices only need attention once their next event is due
+    if (vm->countdown <= 0) {
+      vm_device_update(vm);
+      if (!vm->running) break;
+    }
+
+    // Mark the PC executed; unconditional so the loop gains no branch
+    uint16_t pc = vm->reg[LC3_R_PC];
+    vm->coverage[pc >> 3] |= (uint8_t)(1 << (pc & 7));
+
+    // Loops recognized at load time run natively when their inputs allow;
+    // instrumentation needs to see each instruction they run
+    uint8_t idiom = instrumented ? 0 : vm->idiom_at[pc];
+    if (idiom && vm_idiom_run(vm, &vm->idioms[idiom - 1])) {
+      vm_coverage_mark(vm, vm->idioms[idiom - 1].start,
+                       vm->idioms[idiom - 1].length);
+      vm->effects++;
+      continue;
+    }
+
     // Fetch instruction
-    uint16_t instr = vm_mem_read(vm, vm->reg[LC3_R_PC]++);
+    if (instrumented && vm->icache && pc < LC3_MR_KBSR) {
+      vm_cache_access(vm->icache, pc);
+    }
+    uint16_t instr = vm_mem_fetch(vm, vm->reg[LC3_R_PC]++);
+    if (instrumented && vm->dcache) vm_cache_data(vm, instr);
 
     // Decode opcode
     uint16_t op = instr >> 12;
+    vm->stats.opcodes[op]++;
 
     // Execute instruction
     switch (op) {
@@ -124,15 +321,94 @@ int vm_run(const char* filename) {
       case LC3_OP_TRAP:
         vm_exec_trap(vm, instr);
         break;
-      case LC3_OP_RES:
       case LC3_OP_RTI:
+        if (!vm_os_rti(vm)) result = vm_unknown_opcode(vm, op);
+        break;
+      case LC3_OP_RES:
+        if (!vm_os_exception(vm, LC3_EX_ILLEGAL)) {
+          result = vm_unknown_opcode(vm, op);
+        }
+        break;
       default:
-        printf("> Unknown opcode: 0x%04X\n", op);
-        vm->running = false;
-        result = 1;
+        result = vm_unknown_opcode(vm, op);
         break;
     }
+    if (instrumented && vm->cycles) vm_cycles_step(vm, pc, instr);
+    if (instrumented && vm->profile) vm_profile_step(vm, pc, instr);
+    vm->countdown--;
   }
-  free(vm);
+  vm->stats.run_ns += clock_now_ns() - vm->stats.run_start_ns;
   return result;
 }
+
+int vm_execute(vm_t* vm) {
+  if (vm->icache || vm->dcache || vm->cycles || vm->profile) {
+    return vm_execute_loop(vm, true);
+  }
+  return vm_execute_loop(vm, false);
+}
+
+// Run a loaded program and report a limit that stopped it. Returns the exit
+// code for the command line.
+static int vm_run_loaded(vm_t* vm) {
+  vm_stats_attach(&vm, 1);
+  vm_coverage_attach(&vm, 1);
+  vm_cache_attach(&vm, 1);
+  vm_cycles_attach(&vm, 1);
+  vm_profile_attach(&vm, 1);
+  int result = vm_execute(vm);
+  switch (vm->stop) {
+    case VM_STOP_BUDGET:
+      printf("> Instruction limit reached after %llu instructions\n",
+             (unsigned long long)vm_event_now(vm));
+      break;
+    case VM_STOP_TIMEOUT:
+      printf("> Time limit reached at PC 0x%04X\n", vm->reg[LC3_R_PC]);
+      break;
+    case VM_STOP_LOOP:
+      printf("> Infinite loop at PC 0x%04X\n", vm->reg[LC3_R_PC]);
+      break;
+    default:
+      break;
+  }
+  int code = vm_limit_exit_code(vm, result);
+  vm_stats_detach();
+  vm_coverage_detach();
+  vm_cache_detach();
+  vm_cycles_detach();
+  vm_profile_detach();
+  vm_destroy(vm);
+  return code;
+}
+
+int vm_run(const char* filename) {
+  vm_t* vm = vm_create();
+  if (!vm || vm_load_file(vm, filename) != 0) {
+    fprintf(stderr, "Error: Could not initialize VM with file %s\n", filename);
+    vm_destroy(vm);
+    return 1;
+  }
+  return vm_run_loaded(vm);
+}
+
+int vm_run_os(const char* os_filename, const char* filename) {
+  vm_t* vm = vm_create();
+  if (!vm || vm_os_load(vm, os_filename) != 0 ||
+      vm_load_file(vm, filename) != 0) {
+    fprintf(stderr, "Error: Could not initialize VM with OS %s and file %s\n",
+            os_filename, filename);
+    vm_destroy(vm);
+    return 1;
+  }
+  return vm_run_loaded(vm);
+}
+
+int vm_run_image(uint16_t origin, const uint16_t* words, size_t count) {
+  vm_t* vm = vm_create();
+  if (!vm) {
+    fprintf(stderr, "Error: Could not allocate VM\n");
+    return 1;
+  }
+  vm_load_image(vm, origin, words, count);
+  return vm_run_loaded(vm);
+}
@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L  // strtok_r
+
+#include "../../include/vm/vm_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* const vm_cache_policy_names[] = {"lru", "fifo", "random"};
+
+static bool vm_cache_configured[2] = {false, false};
+static vm_cache_config_t vm_cache_configs[2];
+static vm_t** vm_cache_vms = NULL;
+static int vm_cache_count = 0;
+
+static bool vm_cache_power_of_two(uint32_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+
+int vm_cache_parse(const char* spec, vm_cache_config_t* config) {
+  *config = (vm_cache_config_t){256, 4, 2, VM_CACHE_LRU};
+
+  char copy[128];
+  if (strlen(spec) >= sizeof(copy)) return 1;
+  strcpy(copy, spec);
+  char* save_ptr = NULL;
+  for (char* key = strtok_r(copy, ",", &save_ptr); key;
+       key = strtok_r(NULL, ",", &save_ptr)) {
+    char* value = strchr(key, '=');
+    if (!value) return 1;
+    *value++ = '\0';
+    char* end;
+    unsigned long number = strtoul(value, &end, 10);
+    bool numeric = *value && *end == '\0' && number <= LC3_MEMORY_MAX;
+    if (strcmp(key, "size") == 0 && numeric) {
+      config->size = (uint32_t)number;
+    } else if (strcmp(key, "line") == 0 && numeric) {
+      config->line = (uint32_t)number;
+    } else if (strcmp(key, "ways") == 0 && numeric) {
+      config->ways = (uint32_t)number;
+    } else if (strcmp(key, "policy") == 0) {
+      int policy = 0;
+      while (policy <= VM_CACHE_RANDOM &&
+             strcmp(value, vm_cache_policy_names[policy]) != 0) {
+        policy++;
+      }
+      if (policy > VM_CACHE_RANDOM) return 1;
+      config->policy = (vm_cache_policy_t)policy;
+    } else {
+      return 1;
+    }
+  }
+
+  // Sets must come out a whole power of two
+  bool valid = vm_cache_power_of_two(config->size) &&
+               vm_cache_power_of_two(config->line) &&
+               vm_cache_power_of_two(config->ways) &&
+               config->ways <= VM_CACHE_MAX_WAYS &&
+               config->line * config->ways <= config->size;
+  return valid ? 0 : 1;
+}
+
+vm_cache_t* vm_cache_create(const vm_cache_config_t* config) {
+  vm_cache_t* cache = calloc(1, sizeof(vm_cache_t));
+  if (!cache) return NULL;
+  uint32_t sets = config->size / config->line / config->ways;
+  cache->config = *config;
+  cache->set_mask = sets - 1;
+  while ((1u << cache->line_shift) < config->line) cache->line_shift++;
+  cache->tags = calloc((size_t)sets * config->ways, sizeof(uint16_t));
+  cache->stamp = calloc((size_t)sets * config->ways, sizeof(uint64_t));
+  cache->random = 0x2545F491;
+  if (!cache->tags || !cache->stamp) {
+    vm_cache_destroy(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void vm_cache_destroy(vm_cache_t* cache) {
+  if (!cache) return;
+  free(cache->tags);
+  free(cache->stamp);
+  free(cache);
+}
+
+void vm_cache_access(vm_cache_t* cache, uint16_t address) {
+  uint16_t line = address >> cache->line_shift;
+  uint32_t ways = cache->config.ways;
+  uint16_t* tags = cache->tags + (line & cache->set_mask) * ways;
+  uint64_t* stamp = cache->stamp + (line & cache->set_mask) * ways;
+  vm_cache_counts_t* counts = &cache->by_address[address];
+  cache->clock++;
+
+  uint32_t victim = 0;
+  for (uint32_t way = 0; way < ways; way++) {
+    if (stamp[way] && tags[way] == line) {
+      if (cache->config.policy == VM_CACHE_LRU) stamp[way] = cache->clock;
+      counts->hits++;
+      cache->total.hits++;
+      return;
+    }
+    // An empty way, else the oldest stamp
+    if (stamp[way] < stamp[victim]) victim = way;
+  }
+
+  counts->misses++;
+  cache->total.misses++;
+  if (stamp[victim] && cache->config.policy == VM_CACHE_RANDOM) {
+    // Only a full set has a choice to make
+    cache->random ^= cache->random << 13;
+    cache->random ^= cache->random >> 17;
+    cache->random ^= cache->random << 5;
+    victim = cache->random & (ways - 1);
+  }
+  if (stamp[victim]) {
+    counts->evictions++;
+    cache->total.evictions++;
+  }
+  tags[victim] = line;
+  stamp[victim] = cache->clock;
+}
+
+void vm_cache_configure(const vm_cache_config_t* icache,
+                        const vm_cache_config_t* dcache) {
+  const vm_cache_config_t* configs[2] = {icache, dcache};
+  for (int i = 0; i < 2; i++) {
+    vm_cache_configured[i] = configs[i] != NULL;
+    if (configs[i]) vm_cache_configs[i] = *configs[i];
+  }
+}
+
+void vm_cache_attach(vm_t* const* vms, int count) {
+  if (!vm_cache_configured[0] && !vm_cache_configured[1]) return;
+
+  vm_cache_vms = malloc(count * sizeof(vm_t*));
+  if (!vm_cache_vms) return;
+  memcpy(vm_cache_vms, vms, count * sizeof(vm_t*));
+  vm_cache_count = count;
+  for (int i = 0; i < count; i++) {
+    if (vm_cache_configured[0]) {
+      vms[i]->icache = vm_cache_create(&vm_cache_configs[0]);
+    }
+    if (vm_cache_configured[1]) {
+      vms[i]->dcache = vm_cache_create(&vm_cache_configs[1]);
+    }
+  }
+}
+
+void vm_cache_detach(void) {
+  if (!vm_cache_vms) return;
+
+  for (int i = 0; i < vm_cache_count; i++) {
+    vm_t* vm = vm_cache_vms[i];
+    if (vm_cache_count > 1) fprintf(stderr, "Hart %d\n", vm->hart_id);
+    // Harts share one program, loaded through the first
+    const debug_info_t* debug = vm_cache_vms[0]->debug;
+    if (vm->icache) vm_cache_report(stderr, "I-cache", vm->icache, debug);
+    if (vm->dcache) vm_cache_report(stderr, "D-cache", vm->dcache, debug);
+    vm_cache_destroy(vm->icache);
+    vm_cache_destroy(vm->dcache);
+    vm->icache = NULL;
+    vm->dcache = NULL;
+  }
+  free(vm_cache_vms);
+  vm_cache_vms = NULL;
+  vm_cache_count = 0;
+}
+
+// Add counts into total
+static void vm_cache_add(vm_cache_counts_t* total,
+                         const vm_cache_counts_t* counts) {
+  total->hits += counts->hits;
+  total->misses += counts->misses;
+  total->evictions += counts->evictions;
+}
+
+static void vm_cache_report_row(FILE* out, const char* name,
+                                const vm_cache_counts_t* counts) {
+  uint64_t accesses = counts->hits + counts->misses;
+  if (accesses == 0) return;
+  fprintf(out, "  %-20s %10llu %10llu %10llu %7.2f%%\n", name,
+          (unsigned long long)counts->hits, (unsigned long long)counts->misses,
+          (unsigned long long)counts->evictions,
+          100.0 * counts->misses / accesses);
+}
+
+void vm_cache_report(FILE* out, const char* name, const vm_cache_t* cache,
+                     const debug_info_t* debug) {
+  const vm_cache_config_t* config = &cache->config;
+  fprintf(out, "%s: %u words, %u-word lines, %u-way, %s\n", name,
+          config->size, config->line, config->ways,
+          vm_cache_policy_names[config->policy]);
+  fprintf(out, "  %-20s %10s %10s %10s %8s\n", "Label", "Hits", "Misses",
+          "Evictions", "Miss");
+
+  // Labels cover disjoint ranges; whatever lies outside them is unlabeled
+  vm_cache_counts_t unlabeled = cache->total;
+  for (int i = 0; debug && i < debug->label_count; i++) {
+    const debug_label_t* label = &debug->labels[i];
+    vm_cache_counts_t counts = {0, 0, 0};
+    for (uint32_t address = label->start; address < label->end; address++) {
+      vm_cache_add(&counts, &cache->by_address[address]);
+    }
+    vm_cache_report_row(out, label->name, &counts);
+    unlabeled.hits -= counts.hits;
+    unlabeled.misses -= counts.misses;
+    unlabeled.evictions -= counts.evictions;
+  }
+  vm_cache_report_row(out, debug ? "(no label)" : "(all)", &unlabeled);
+  if (debug) vm_cache_report_row(out, "Total", &cache->total);
+}
@@ -0,0 +1,37 @@
+#include "../../include/vm/vm_calls.h"
+
+#include "../../include/lc3/lc3.h"
+
+void vm_calls_init(vm_calls_t* calls) {
+  calls->return_to[0] = 0;
+  calls->depth = 1;
+  calls->dropped = 0;
+}
+
+vm_calls_change_t vm_calls_step(vm_calls_t* calls, uint16_t pc,
+                                uint16_t instr, uint16_t next) {
+  uint16_t op = instr >> 12;
+  uint16_t return_to = (uint16_t)(pc + 1);
+  if (op == LC3_OP_JSR || (op == LC3_OP_TRAP && next != return_to)) {
+    if (calls->depth == VM_CALLS_MAX_DEPTH) {
+      calls->dropped++;
+      return VM_CALLS_NONE;
+    }
+    calls->return_to[calls->depth++] = return_to;
+    return VM_CALLS_PUSH;
+  }
+  if (op == LC3_OP_JMP || op == LC3_OP_RTI) {
+    for (int depth = calls->depth - 1; depth > 0; depth--) {
+      if (calls->return_to[depth] == next) {
+        calls->depth = depth;
+        return VM_CALLS_POP;
+      }
+    }
+  }
+  return VM_CALLS_NONE;
+}
+
+void vm_calls_drop(vm_calls_t* calls) {
+  calls->depth--;
+  calls->dropped++;
+}
@@ -0,0 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_coverage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/util/file.h"
+
+// Per source line: not an instruction line, executable, or executed
+enum { VM_COVERAGE_NONE, VM_COVERAGE_FOUND, VM_COVERAGE_HIT };
+
+static const char* vm_coverage_path = NULL;
+static vm_t** vm_coverage_vms = NULL;
+static int vm_coverage_count = 0;
+
+void vm_coverage_mark(vm_t* vm, uint16_t start, uint16_t length) {
+  for (uint16_t i = 0; i < length; i++) {
+    uint16_t address = (uint16_t)(start + i);
+    vm->coverage[address >> 3] |= (uint8_t)(1 << (address & 7));
+  }
+}
+
+void vm_coverage_configure(const char* path) { vm_coverage_path = path; }
+
+void vm_coverage_attach(vm_t* const* vms, int count) {
+  if (!vm_coverage_path) return;
+
+  vm_coverage_vms = malloc(count * sizeof(vm_t*));
+  if (!vm_coverage_vms) return;
+  memcpy(vm_coverage_vms, vms, count * sizeof(vm_t*));
+  vm_coverage_count = count;
+}
+
+// Write the record of one source file
+static int vm_coverage_write_file(FILE* out, vm_t* const* vms, int count,
+                                  const debug_info_t* debug, uint16_t file) {
+  uint32_t last_line = 0;
+  for (int i = 0; i < debug->line_count; i++) {
+    const debug_line_t* entry = &debug->lines[i];
+    if (entry->file == file && entry->line > last_line) {
+      last_line = entry->line;
+    }
+  }
+  if (last_line == 0) return 0;
+  uint8_t* state = calloc(last_line + 1, sizeof(uint8_t));
+  if (!state) return 1;
+
+  for (int i = 0; i < debug->line_count; i++) {
+    const debug_line_t* entry = &debug->lines[i];
+    if (entry->file != file) continue;
+    bool hit = false;
+    for (int h = 0; h < count; h++) {
+      hit = hit || vm_coverage_hit(vms[h], entry->address);
+    }
+    if (state[entry->line] != VM_COVERAGE_HIT) {
+      state[entry->line] = hit ? VM_COVERAGE_HIT : VM_COVERAGE_FOUND;
+    }
+  }
+
+  int found = 0;
+  int hit = 0;
+  fprintf(out, "TN:\nSF:%s\n", debug->files[file]);
+  for (uint32_t line = 1; line <= last_line; line++) {
+    if (state[line] == VM_COVERAGE_NONE) continue;
+    found++;
+    if (state[line] == VM_COVERAGE_HIT) hit++;
+    fprintf(out, "DA:%u,%d\n", line, state[line] == VM_COVERAGE_HIT);
+  }
+  fprintf(out, "LF:%d\nLH:%d\nend_of_record\n", found, hit);
+  free(state);
+  return 0;
+}
+
+int vm_coverage_write_lcov(FILE* out, vm_t* const* vms, int count,
+                           const debug_info_t* debug) {
+  for (int file = 0; file < debug->file_count; file++) {
+    if (vm_coverage_write_file(out, vms, count, debug, (uint16_t)file) != 0) {
+      return 1;
+    }
+  }
+  return ferror(out) ? 1 : 0;
+}
+
+// Write the tracefile for the attached VMs
+static void vm_coverage_report(void) {
+  // Harts share one program, loaded through the first
+  const debug_info_t* debug = vm_coverage_vms[0]->debug;
+  if (!debug) {
+    fprintf(stderr,
+            "Error: Coverage needs the program's debug info; assemble with "
+            "-c first\n");
+    return;
+  }
+
+  char* buffer = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&buffer, &size);
+  int result = out ? vm_coverage_write_lcov(out, vm_coverage_vms,
+                                            vm_coverage_count, debug)
+                   : 1;
+  if (out && fclose(out) != 0) result = 1;
+  if (result == 0 && file_write_atomic(vm_coverage_path, buffer, size) != 0) {
+    result = 1;
+  }
+  if (result != 0) {
+    fprintf(stderr, "Error: Could not write coverage to %s\n",
+            vm_coverage_path);
+  }
+  free(buffer);
+}
+
+void vm_coverage_detach(void) {
+  if (!vm_coverage_vms) return;
+
+  vm_coverage_report();
+  free(vm_coverage_vms);
+  vm_coverage_vms = NULL;
+  vm_coverage_count = 0;
+}
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_cycles.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../../include/lc3/decode.h"
+
+static const char* const vm_cycles_opcode_names[16] = {
+    "br",  "add", "ld",  "st",  "jsr", "and", "ldr", "str",
+    "rti", "not", "ldi", "sti", "jmp", "res", "lea", "trap",
+};
+
+static bool vm_cycles_configured = false;
+static vm_cycles_config_t vm_cycles_config;
+static vm_t** vm_cycles_vms = NULL;
+static int vm_cycles_count = 0;
+
+int vm_cycles_parse(const char* spec, vm_cycles_config_t* config) {
+  for (int op = 0; op < 16; op++) config->op[op] = 1;
+  config->op[LC3_OP_JSR] = 2;
+  config->op[LC3_OP_TRAP] = 2;
+  config->op[LC3_OP_RTI] = 3;
+  config->memory = 2;
+  config->indirect = 1;
+  config->taken = 1;
+
+  char copy[256];
+  if (strlen(spec) >= sizeof(copy)) return 1;
+  strcpy(copy, spec);
+  for (char* key = strtok(copy, ","); key; key = strtok(NULL, ",")) {
+    char* value = strchr(key, '=');
+    if (!value) return 1;
+    *value++ = '\0';
+    char* end;
+    unsigned long cost = strtoul(value, &end, 10);
+    if (!*value || *end != '\0' || cost > UINT16_MAX) return 1;
+
+    uint16_t* field = NULL;
+    for (int op = 0; op < 16; op++) {
+      if (strcasecmp(key, vm_cycles_opcode_names[op]) == 0) {
+        field = &config->op[op];
+      }
+    }
+    if (strcmp(key, "memory") == 0) field = &config->memory;
+    if (strcmp(key, "indirect") == 0) field = &config->indirect;
+    if (strcmp(key, "taken") == 0) field = &config->taken;
+    if (!field) return 1;
+    *field = (uint16_t)cost;
+  }
+  return 0;
+}
+
+vm_cycles_t* vm_cycles_create(const vm_cycles_config_t* config,
+                              uint16_t entry) {
+  vm_cycles_t* cycles = calloc(1, sizeof(vm_cycles_t));
+  if (!cycles) return NULL;
+  cycles->config = *config;
+  vm_calls_init(&cycles->calls);
+  cycles->frames[0] = (vm_cycles_frame_t){entry, 0};
+  cycles->active[entry] = 1;
+  cycles->routines[entry].calls = 1;
+  return cycles;
+}
+
+void vm_cycles_destroy(vm_cycles_t* cycles) { free(cycles); }
+
+// Close the frames from depth from - 1 down to depth to
+static void vm_cycles_close(vm_cycles_t* cycles, int from, int to) {
+  while (from > to) {
+    const vm_cycles_frame_t* frame = &cycles->frames[--from];
+    if (--cycles->active[frame->entry] == 0) {
+      cycles->routines[frame->entry].inclusive += cycles->total - frame->start;
+    }
+  }
+}
+
+void vm_cycles_step(vm_t* vm, uint16_t pc, uint16_t instr) {
+  vm_cycles_t* cycles = vm->cycles;
+  const vm_cycles_config_t* config = &cycles->config;
+  uint16_t op = instr >> 12;
+  uint16_t next = vm->reg[LC3_R_PC];
+  uint64_t cost = config->op[op];
+  switch (op) {
+    case LC3_OP_LD:
+    case LC3_OP_LDR:
+    case LC3_OP_ST:
+    case LC3_OP_STR:
+      cost += config->memory;
+      break;
+    case LC3_OP_LDI:
+    case LC3_OP_STI:
+      cost += 2 * config->memory + config->indirect;
+      break;
+    case LC3_OP_BR:
+      // BR leaves the condition codes it tested alone
+      if (lc3_r0(instr) & vm->reg[LC3_R_COND]) cost += config->taken;
+      break;
+    default:
+      break;
+  }
+  cycles->total += cost;
+  int depth = cycles->calls.depth;
+  cycles->routines[cycles->frames[depth - 1].entry].exclusive += cost;
+
+  switch (vm_calls_step(&cycles->calls, pc, instr, next)) {
+    case VM_CALLS_PUSH:
+      cycles->frames[depth] = (vm_cycles_frame_t){next, cycles->total};
+      cycles->routines[next].calls++;
+      cycles->active[next]++;
+      break;
+    case VM_CALLS_POP:
+      vm_cycles_close(cycles, depth, cycles->calls.depth);
+      break;
+    default:
+      break;
+  }
+}
+
+void vm_cycles_finish(vm_cycles_t* cycles) {
+  vm_cycles_close(cycles, cycles->calls.depth, 0);
+  cycles->calls.depth = 0;
+}
+
+void vm_cycles_configure(const vm_cycles_config_t* config) {
+  vm_cycles_configured = config != NULL;
+  if (config) vm_cycles_config = *config;
+}
+
+void vm_cycles_attach(vm_t* const* vms, int count) {
+  if (!vm_cycles_configured) return;
+
+  vm_cycles_vms = malloc(count * sizeof(vm_t*));
+  if (!vm_cycles_vms) return;
+  memcpy(vm_cycles_vms, vms, count * sizeof(vm_t*));
+  vm_cycles_count = count;
+  for (int i = 0; i < count; i++) {
+    vms[i]->cycles = vm_cycles_create(&vm_cycles_config, vms[i]->reg[LC3_R_PC]);
+  }
+}
+
+void vm_cycles_detach(void) {
+  if (!vm_cycles_vms) return;
+
+  for (int i = 0; i < vm_cycles_count; i++) {
+    vm_t* vm = vm_cycles_vms[i];
+    if (!vm->cycles) continue;
+    if (vm_cycles_count > 1) fprintf(stderr, "Hart %d\n", vm->hart_id);
+    vm_cycles_finish(vm->cycles);
+    // Harts share one program, loaded through the first
+    vm_cycles_report(stderr, vm->cycles, vm_cycles_vms[0]->debug);
+    vm_cycles_destroy(vm->cycles);
+    vm->cycles = NULL;
+  }
+  free(vm_cycles_vms);
+  vm_cycles_vms = NULL;
+  vm_cycles_count = 0;
+}
+
+// Sort entry addresses by inclusive cycles, descending, then by address
+static const vm_cycles_t* vm_cycles_sorting;
+
+static int vm_cycles_compare(const void* a, const void* b) {
+  uint16_t left = *(const uint16_t*)a;
+  uint16_t right = *(const uint16_t*)b;
+  uint64_t left_cycles = vm_cycles_sorting->routines[left].inclusive;
+  uint64_t right_cycles = vm_cycles_sorting->routines[right].inclusive;
+  if (left_cycles != right_cycles) return left_cycles < right_cycles ? 1 : -1;
+  return (int)left - (int)right;
+}
+
+int vm_cycles_report(FILE* out, const vm_cycles_t* cycles,
+                     const debug_info_t* debug) {
+  uint16_t* entries = malloc(LC3_MEMORY_MAX * sizeof(uint16_t));
+  if (!entries) return 1;
+  int count = 0;
+  for (uint32_t entry = 0; entry < LC3_MEMORY_MAX; entry++) {
+    if (cycles->routines[entry].calls) entries[count++] = (uint16_t)entry;
+  }
+  vm_cycles_sorting = cycles;
+  qsort(entries, count, sizeof(uint16_t), vm_cycles_compare);
+
+  double total = cycles->total ? (double)cycles->total : 1.0;
+  fprintf(out, "Estimated cycles: %llu\n", (unsigned long long)cycles->total);
+  fprintf(out, "  %-20s %10s %14s %7s %14s %7s\n", "Routine", "Calls",
+          "Inclusive", "Share", "Exclusive", "Share");
+  for (int i = 0; i < count; i++) {
+    const vm_cycles_routine_t* routine = &cycles->routines[entries[i]];
+    const debug_label_t* label =
+        debug ? debug_info_find_label(debug, entries[i]) : NULL;
+    char name[16];
+    snprintf(name, sizeof(name), "x%04X", entries[i]);
+    fprintf(out, "  %-20s %10llu %14llu %6.2f%% %14llu %6.2f%%\n",
+            label && label->start == entries[i] ? label->name : name,
+            (unsigned long long)routine->calls,
+            (unsigned long long)routine->inclusive,
+            100.0 * routine->inclusive / total,
+            (unsigned long long)routine->exclusive,
+            100.0 * routine->exclusive / total);
+  }
+  if (cycles->calls.dropped) {
+    fprintf(out, "  %llu calls deeper than %d frames were not tracked\n",
+            (unsigned long long)cycles->calls.dropped, VM_CALLS_MAX_DEPTH);
+  }
+  free(entries);
+  return ferror(out) ? 1 : 0;
+}
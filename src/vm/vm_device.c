@@ -0,0 +1,138 @@
+#include "../../include/vm/vm_device.h"
+
+#include <string.h>
+
+#include "../../include/vm/vm_event.h"
+#include "../../include/vm/vm_io.h"
+#include "../../include/vm/vm_limit.h"
+#include "../../include/vm/vm_os.h"
+#include "../../include/vm/vm_stats.h"
+
+// The register at address in this hart's device page
+#define DEVICE(vm, address) ((vm)->devices[(address) - LC3_MR_KBSR])
+
+void vm_device_reset(vm_t* vm) {
+  memset(vm->devices, 0, sizeof(vm->devices));
+  DEVICE(vm, LC3_MR_DSR) = LC3_MR_READY;
+  DEVICE(vm, LC3_MR_MCR) = LC3_MR_READY;
+  vm_event_reset(vm);
+}
+
+// Read a waiting key into KBDR, where it stays until KBDR is read
+static void vm_device_poll_keyboard(vm_t* vm) {
+  if (!(DEVICE(vm, LC3_MR_KBSR) & LC3_MR_READY) && vm_io_key_ready(vm)) {
+    DEVICE(vm, LC3_MR_KBDR) = (uint16_t)vm_io_getc(vm);
+    DEVICE(vm, LC3_MR_KBSR) |= LC3_MR_READY;
+  }
+}
+
+static bool vm_device_requests(const vm_t* vm, uint16_t status) {
+  uint16_t value = DEVICE(vm, status);
+  return (value & LC3_MR_READY) && (value & LC3_MR_IE);
+}
+
+static void vm_device_interrupt(vm_t* vm) {
+  int level = (vm->psr & LC3_PSR_PRIORITY) >> 8;
+  if (vm_device_requests(vm, LC3_MR_TMR) && VM_TIMER_PRIORITY > level) {
+    vm_os_interrupt(vm, LC3_INT_TIMER, VM_TIMER_PRIORITY);
+  } else if (vm_device_requests(vm, LC3_MR_KBSR) &&
+             VM_KEYBOARD_PRIORITY > level) {
+    vm_os_interrupt(vm, LC3_INT_KEYBOARD, VM_KEYBOARD_PRIORITY);
+  }
+}
+
+void vm_device_update(vm_t* vm) {
+  vm_event_kind_t kind;
+  while (vm_event_pop_due(vm, &kind)) {
+    switch (kind) {
+      case VM_EVENT_KEYBOARD:
+        vm_device_poll_keyboard(vm);
+        vm_event_schedule(vm, VM_EVENT_KEYBOARD, VM_KEYBOARD_POLL_INTERVAL);
+        break;
+      case VM_EVENT_DISPLAY:
+        DEVICE(vm, LC3_MR_DSR) |= LC3_MR_READY;
+        break;
+      case VM_EVENT_QUANTUM:
+        vm->running = false;
+        vm->stop = VM_STOP_QUANTUM;
+        break;
+      case VM_EVENT_BUDGET:
+      case VM_EVENT_WATCHDOG:
+        vm_limit_event(vm, kind);
+        break;
+      case VM_EVENT_STATS:
+        vm_stats_event(vm);
+        break;
+      case VM_EVENT_TIMER:
+        DEVICE(vm, LC3_MR_TMR) |= LC3_MR_READY;
+        if (DEVICE(vm, LC3_MR_TMI)) {
+          vm_event_schedule(vm, VM_EVENT_TIMER, DEVICE(vm, LC3_MR_TMI));
+        }
+        break;
+    }
+  }
+  vm_event_rearm(vm);
+  vm_device_interrupt(vm);
+}
+
+uint16_t vm_device_read(vm_t* vm, uint16_t address) {
+  vm->effects++;
+  switch (address) {
+    case LC3_MR_KBSR:
+      vm_device_poll_keyboard(vm);
+      return DEVICE(vm, LC3_MR_KBSR);
+    case LC3_MR_KBDR:
+      DEVICE(vm, LC3_MR_KBSR) &= ~LC3_MR_READY;
+      return DEVICE(vm, LC3_MR_KBDR);
+    case LC3_MR_PSR:
+      return vm->psr | vm->reg[LC3_R_COND];
+    case LC3_MR_HARTID:
+      return vm->hart_id;
+    case LC3_MR_HARTS:
+      return vm->hart_count;
+    default:
+      return DEVICE(vm, address);
+  }
+}
+
+void vm_device_write(vm_t* vm, uint16_t address, uint16_t value) {
+  switch (address) {
+    case LC3_MR_KBSR:
+      // Only the interrupt enable bit can be written
+      value = (DEVICE(vm, LC3_MR_KBSR) & LC3_MR_READY) | (value & LC3_MR_IE);
+      if (!(value & LC3_MR_IE)) {
+        vm_event_cancel(vm, VM_EVENT_KEYBOARD);
+      } else if (!(DEVICE(vm, LC3_MR_KBSR) & LC3_MR_IE)) {
+        vm_event_schedule(vm, VM_EVENT_KEYBOARD, VM_KEYBOARD_POLL_INTERVAL);
+      }
+      vm_event_wake(vm);
+      break;
+    case LC3_MR_DDR:
+      vm_io_putc(vm, (char)value);
+      vm_io_flush(vm);
+      DEVICE(vm, LC3_MR_DSR) &= ~LC3_MR_READY;
+      vm_event_schedule(vm, VM_EVENT_DISPLAY, VM_DISPLAY_DELAY);
+      break;
+    case LC3_MR_TMR:
+      // The handler acknowledges the timer by clearing the ready bit
+      value &= LC3_MR_READY | LC3_MR_IE;
+      vm_event_wake(vm);
+      break;
+    case LC3_MR_TMI:
+      if (value) {
+        vm_event_schedule(vm, VM_EVENT_TIMER, value);
+      } else {
+        vm_event_cancel(vm, VM_EVENT_TIMER);
+      }
+      break;
+    case LC3_MR_PSR:
+      vm->psr = value & (LC3_PSR_USER | LC3_PSR_PRIORITY);
+      vm->reg[LC3_R_COND] = value & (LC3_FL_NEG | LC3_FL_ZRO | LC3_FL_POS);
+      vm_event_wake(vm);
+      break;
+    case LC3_MR_MCR:
+      if (!(value & LC3_MR_READY)) vm->running = false;
+      break;
+  }
+  DEVICE(vm, address) = value;
+}
@@ -0,0 +1,101 @@
+#include "../../include/vm/vm_event.h"
+
+// The countdown used while no event is pending
+#define VM_EVENT_IDLE ((int64_t)1 << 62)
+
+void vm_event_reset(vm_t* vm) {
+  vm->event_count = 0;
+  vm->deadline = VM_EVENT_IDLE;
+  vm->countdown = VM_EVENT_IDLE;
+}
+
+uint64_t vm_event_now(const vm_t* vm) { return vm->deadline - vm->countdown; }
+
+static void vm_event_swap(vm_t* vm, int a, int b) {
+  vm_event_t event = vm->events[a];
+  vm->events[a] = vm->events[b];
+  vm->events[b] = event;
+}
+
+static void vm_event_sift_up(vm_t* vm, int i) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (vm->events[parent].time <= vm->events[i].time) break;
+    vm_event_swap(vm, i, parent);
+    i = parent;
+  }
+}
+
+static void vm_event_sift_down(vm_t* vm, int i) {
+  for (;;) {
+    int smallest = i;
+    for (int child = 2 * i + 1; child <= 2 * i + 2; child++) {
+      if (child < vm->event_count &&
+          vm->events[child].time < vm->events[smallest].time) {
+        smallest = child;
+      }
+    }
+    if (smallest == i) break;
+    vm_event_swap(vm, i, smallest);
+    i = smallest;
+  }
+}
+
+static void vm_event_remove(vm_t* vm, int i) {
+  vm->events[i] = vm->events[--vm->event_count];
+  if (i < vm->event_count) {
+    vm_event_sift_down(vm, i);
+    vm_event_sift_up(vm, i);
+  }
+}
+
+bool vm_event_pending(const vm_t* vm, vm_event_kind_t kind) {
+  for (int i = 0; i < vm->event_count; i++) {
+    if (vm->events[i].kind == kind) return true;
+  }
+  return false;
+}
+
+void vm_event_cancel(vm_t* vm, vm_event_kind_t kind) {
+  for (int i = 0; i < vm->event_count; i++) {
+    if (vm->events[i].kind == kind) {
+      vm_event_remove(vm, i);
+      return;
+    }
+  }
+}
+
+void vm_event_schedule(vm_t* vm, vm_event_kind_t kind, uint64_t delay) {
+  vm_event_cancel(vm, kind);
+  uint64_t now = vm_event_now(vm);
+  vm->events[vm->event_count] = (vm_event_t){now + delay, kind};
+  vm_event_sift_up(vm, vm->event_count++);
+
+  // An earlier deadline shortens the countdown; a later one is picked up by
+  // vm_event_rearm once the current one passes
+  if (now + delay < vm->deadline) {
+    vm->deadline = now + delay;
+    vm->countdown = (int64_t)delay;
+  }
+}
+
+bool vm_event_pop_due(vm_t* vm, vm_event_kind_t* kind) {
+  if (vm->event_count == 0 || vm->events[0].time > vm_event_now(vm)) {
+    return false;
+  }
+  *kind = vm->events[0].kind;
+  vm_event_remove(vm, 0);
+  return true;
+}
+
+void vm_event_rearm(vm_t* vm) {
+  uint64_t now = vm_event_now(vm);
+  vm->deadline = vm->event_count > 0 ? vm->events[0].time
+                                     : now + VM_EVENT_IDLE;
+  vm->countdown = (int64_t)(vm->deadline - now);
+}
+
+void vm_event_wake(vm_t* vm) {
+  vm->deadline -= vm->countdown;
+  vm->countdown = 0;
+}
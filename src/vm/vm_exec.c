@@ -1,34 +1,11 @@
 #include <stdio.h>
 
+#include "../../include/lc3/decode.h"
 #include "../../include/vm/vm.h"
-
-/*
-  INSTRUCTION FORMAT - 16 bits
-
-  |----------------------------------------------|
-  | 15 - 12 | 11 - 9 | 8 - 6 | 5 | 4 - 0         |
-  |----------------------------------------------|
-  | Opcode  | DR     | SR1   | 1 | IMM5          |
-  |----------------------------------------------|
-  | 15 - 12 | 11 - 9 | 8 - 6 | 5 | 4 - 3 | 2 - 0 |
-  |----------------------------------------------|
-  | Opcode  | DR     | SR1   | 0 |   00  |  SR2  |
-  |----------------------------------------------|
-
-  15 - 12 - Opcode (4 bits)
-  11 - 9  - DR (Destination Register) (3 bits)
-  8 - 6   - SR1 (Source Register 1) (3 bits)
-  5       - Bit indicating immediate mode (1 for immediate, 0 for register)
-  4 - 0   - IMM5 (5 bits) or SR2 (3 bits if not immediate)
-*/
-
-#define DR(instr) ((instr >> 9) & 0x7)
-#define SR1(instr) ((instr >> 6) & 0x7)
-#define IMFLAG(instr) ((instr >> 5) & 0x1)
-#define SR2(instr) ((instr) & 0x7)
-#define IMM5(instr) ((instr) & 0x1F)
-#define SIGN_EXTEND(value, bits) \
-  ((value) & (1 << ((bits) - 1)) ? (value) | ~((1 << (bits)) - 1) : (value))
+#include "../../include/vm/vm_io.h"
+#include "../../include/vm/vm_limit.h"
+#include "../../include/vm/vm_os.h"
+#include "../../include/vm/vm_trap.h"
 
 void vm_update_flags(vm_t* vm, uint16_t reg) {
   if (vm->reg[reg] == 0) {
@@ -41,15 +18,15 @@ void vm_update_flags(vm_t* vm, uint16_t reg) {
 }
 
 void vm_exec_add(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t r1 = SR1(instr);
-  uint16_t imm_flag = IMFLAG(instr);
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t r1 = lc3_r1(instr);
+  uint16_t imm_flag = (instr & LC3_IMM_MODE) != 0;
 
   if (imm_flag) {
-    uint16_t imm5 = SIGN_EXTEND(instr & 0x1F, 5);
+    uint16_t imm5 = lc3_imm5(instr);
     vm->reg[r0] = vm->reg[r1] + imm5;
   } else {
-    uint16_t r2 = instr & 0x7;
+    uint16_t r2 = lc3_r2(instr);
     vm->reg[r0] = vm->reg[r1] + vm->reg[r2];
   }
 
@@ -57,15 +34,15 @@ void vm_exec_add(vm_t* vm, uint16_t instr) {
 }
 
 void vm_exec_and(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t r1 = SR1(instr);
-  uint16_t imm_flag = IMFLAG(instr);
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t r1 = lc3_r1(instr);
+  uint16_t imm_flag = (instr & LC3_IMM_MODE) != 0;
 
   if (imm_flag) {
-    uint16_t imm5 = SIGN_EXTEND(IMM5(instr), 5);
+    uint16_t imm5 = lc3_imm5(instr);
     vm->reg[r0] = vm->reg[r1] & imm5;
   } else {
-    uint16_t r2 = SR2(instr);
+    uint16_t r2 = lc3_r2(instr);
     vm->reg[r0] = vm->reg[r1] & vm->reg[r2];
   }
 
@@ -73,8 +50,8 @@ void vm_exec_and(vm_t* vm, uint16_t instr) {
 }
 
 void vm_exec_not(vm_t* vm, uint16_t instr) {
-  uint16_t dr = DR(instr);
-  uint16_t sr = SR1(instr);
+  uint16_t dr = lc3_r0(instr);
+  uint16_t sr = lc3_r1(instr);
 
   // Perform bitwise NOT operation
   vm->reg[dr] = ~vm->reg[sr];
@@ -86,27 +63,32 @@ void vm_exec_br(vm_t* vm, uint16_t instr) {
   uint16_t n_flag = (instr >> 11) & 0x1;               // Negative flag
   uint16_t z_flag = (instr >> 10) & 0x1;               // Zero flag
   uint16_t p_flag = (instr >> 9) & 0x1;                // Positive flag
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   if ((n_flag && (vm->reg[LC3_R_COND] == LC3_FL_NEG)) ||
       (z_flag && (vm->reg[LC3_R_COND] == LC3_FL_ZRO)) ||
       (p_flag && (vm->reg[LC3_R_COND] == LC3_FL_POS))) {
     vm->reg[LC3_R_PC] += pc_offset;
+    vm->stats.branches_taken++;
+    if (vm->limits.detect_loops) vm_limit_branch(vm);
+  } else {
+    vm->stats.branches_not_taken++;
   }
 }
 
 void vm_exec_jmp(vm_t* vm, uint16_t instr) {
-  uint16_t base_r = SR1(instr);
+  uint16_t base_r = lc3_r1(instr);
 
   // Set the PC to the value in the base register
   vm->reg[LC3_R_PC] = vm->reg[base_r];
+  if (vm->limits.detect_loops) vm_limit_branch(vm);
 
   vm_update_flags(vm, LC3_R_PC);
 }
 
 void vm_exec_jsr(vm_t* vm, uint16_t instr) {
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x7FF, 11);  // PC offset
-  uint16_t long_flag = (instr >> 11) & 0x1;             // Long flag
+  uint16_t pc_offset = lc3_pc_offset11(instr);  // PC offset
+  uint16_t long_flag = instr & LC3_JSR_LONG;  // JSR rather than JSRR
 
   // Save the current PC to R7
   vm->reg[LC3_R_R7] = vm->reg[LC3_R_PC];
@@ -116,7 +98,7 @@ void vm_exec_jsr(vm_t* vm, uint16_t instr) {
     vm->reg[LC3_R_PC] += pc_offset;
   } else {
     // JSRR instruction, using base register
-    uint16_t base_r = SR1(instr);
+    uint16_t base_r = lc3_r1(instr);
     vm->reg[LC3_R_PC] = vm->reg[base_r];
   }
 
@@ -124,45 +106,45 @@ void vm_exec_jsr(vm_t* vm, uint16_t instr) {
 }
 
 void vm_exec_ld(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   // Load the value from memory at the calculated address
-  vm->reg[r0] = vm->memory[vm->reg[LC3_R_PC] + pc_offset];
+  vm->reg[r0] = vm_mem_read(vm, vm->reg[LC3_R_PC] + pc_offset);
 
   // Update flags based on the loaded value
   vm_update_flags(vm, r0);
 }
 
 void vm_exec_ldi(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   // Load the address from memory at the calculated address
   uint16_t address = vm->reg[LC3_R_PC] + pc_offset;
-  uint16_t value = vm->memory[address];
+  uint16_t value = vm_mem_read(vm, address);
 
   // Load the value from the address stored in memory
-  vm->reg[r0] = vm->memory[value];
+  vm->reg[r0] = vm_mem_read(vm, value);
 
   vm_update_flags(vm, r0);
 }
 
 void vm_exec_ldr(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t r1 = SR1(instr);
-  uint16_t offset = SIGN_EXTEND(instr & 0x3F, 6);  // Offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t r1 = lc3_r1(instr);
+  uint16_t offset = lc3_offset6(instr);  // Offset
 
   // Load the value from memory at the address calculated using base register
   // and offset
-  vm->reg[r0] = vm->memory[vm->reg[r1] + offset];
+  vm->reg[r0] = vm_mem_read(vm, vm->reg[r1] + offset);
 
   vm_update_flags(vm, r0);
 }
 
 void vm_exec_lea(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   // Load the effective address into the register
   vm->reg[r0] = vm->reg[LC3_R_PC] + pc_offset;
@@ -171,52 +153,84 @@ void vm_exec_lea(vm_t* vm, uint16_t instr) {
 }
 
 void vm_exec_st(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   // Store the value from the register into memory at the calculated address
-  vm->memory[vm->reg[LC3_R_PC] + pc_offset] = vm->reg[r0];
+  vm_mem_write(vm, vm->reg[LC3_R_PC] + pc_offset, vm->reg[r0]);
 
   vm_update_flags(vm, r0);
 }
 
 void vm_exec_sti(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t pc_offset = SIGN_EXTEND(instr & 0x1FF, 9);  // PC offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t pc_offset = lc3_pc_offset9(instr);  // PC offset
 
   // Load the address from memory at the calculated address
   uint16_t address = vm->reg[LC3_R_PC] + pc_offset;
 
   // Store the value from the register into memory at the address stored in
   // memory
-  vm->memory[vm->memory[address]] = vm->reg[r0];
+  vm_mem_write(vm, vm_mem_read(vm, address), vm->reg[r0]);
 
   vm_update_flags(vm, r0);
 }
 
 void vm_exec_str(vm_t* vm, uint16_t instr) {
-  uint16_t r0 = DR(instr);
-  uint16_t r1 = SR1(instr);
-  uint16_t offset = SIGN_EXTEND(instr & 0x3F, 6);  // Offset
+  uint16_t r0 = lc3_r0(instr);
+  uint16_t r1 = lc3_r1(instr);
+  uint16_t offset = lc3_offset6(instr);  // Offset
 
   // Store the value from the register into memory at the address calculated
   // using base register and offset
-  vm->memory[vm->reg[r1] + offset] = vm->reg[r0];
+  vm_mem_write(vm, vm->reg[r1] + offset, vm->reg[r0]);
 
   vm_update_flags(vm, r0);
 }
 
+// Stop before a console trap that cannot go on yet. The PC goes back to the
+// TRAP so that the next vm_execute runs it again.
+static void vm_exec_suspend(vm_t* vm, vm_stop_t reason) {
+  vm->reg[LC3_R_PC]--;
+  vm->running = false;
+  vm->stop = reason;
+}
+
+// Read R0 for GETC and IN; false if the VM stopped to wait for input
+static bool vm_exec_read_char(vm_t* vm) {
+  int c = vm_io_getc(vm);
+  if (c == VM_IO_EMPTY) {
+    vm_exec_suspend(vm, VM_STOP_INPUT);
+    return false;
+  }
+  vm->reg[LC3_R_R0] = (uint16_t)c;
+  return true;
+}
+
 void vm_exec_trap(vm_t* vm, uint16_t instr) {
-  uint16_t trap_vect = instr & 0xFF;
+  uint16_t trap_vect = lc3_trap_vect(instr);
+  vm->effects++;
+  vm->stats.traps[trap_vect]++;
+
+  // An OS routine installed in the trap vector table takes precedence
+  if (vm_os_trap(vm, trap_vect)) return;
+
+  // Output traps wait until the owner of a buffered channel drains it
+  bool writes = trap_vect == LC3_TRAP_OUT || trap_vect == LC3_TRAP_PUTS ||
+                trap_vect == LC3_TRAP_IN || trap_vect == LC3_TRAP_PUTSP;
+  if (writes && !vm_io_can_write(vm)) {
+    vm_exec_suspend(vm, VM_STOP_OUTPUT);
+    return;
+  }
 
   switch (trap_vect) {
     case LC3_TRAP_GETC:  // Get character from keyboard, not echoed
-      vm->reg[LC3_R_R0] = (uint16_t)getchar();
+      vm_exec_read_char(vm);
       break;
 
     case LC3_TRAP_OUT:  // x21: Output a character
-      putchar((char)vm->reg[LC3_R_R0]);
-      fflush(stdout);
+      vm_io_putc(vm, (char)vm->reg[LC3_R_R0]);
+      vm_io_flush(vm);
       break;
 
     case LC3_TRAP_PUTS:  // Output a string
@@ -224,17 +238,17 @@ void vm_exec_trap(vm_t* vm, uint16_t instr) {
       uint16_t addr = vm->reg[LC3_R_R0];
       char c;
       while ((c = (char)vm->memory[addr]) != 0) {
-        putchar(c);
+        vm_io_putc(vm, c);
         addr++;
       }
-      fflush(stdout);
+      vm_io_flush(vm);
     } break;
 
     case LC3_TRAP_IN:  // Input a character and echo it
     {
-      vm->reg[LC3_R_R0] = (uint16_t)getchar();
-      putchar((char)vm->reg[LC3_R_R0]);
-      fflush(stdout);
+      if (!vm_exec_read_char(vm)) break;
+      vm_io_putc(vm, (char)vm->reg[LC3_R_R0]);
+      vm_io_flush(vm);
     } break;
 
     case LC3_TRAP_PUTSP:  // Output a string of bytes (two chars per word)
@@ -243,19 +257,32 @@ void vm_exec_trap(vm_t* vm, uint16_t instr) {
       uint16_t word;
       while ((word = vm->memory[addr]) != 0) {
         char c1 = word & 0xFF;
-        putchar(c1);
+        vm_io_putc(vm, c1);
         char c2 = word >> 8;
-        if (c2) putchar(c2);  // Only print the second char if it's not null
+        if (c2) vm_io_putc(vm, c2);  // Only print the second char if not null
         addr++;
       }
-      fflush(stdout);
+      vm_io_flush(vm);
     } break;
     case LC3_TRAP_HALT:
       vm->running = false;
       break;
+    case LC3_TRAP_HASTRAP:  // Capability query; always available
+      vm->reg[LC3_R_R0] =
+          vm->reg[LC3_R_R0] < LC3_TRAP_COUNT &&
+          vm_trap_available(vm, (uint8_t)vm->reg[LC3_R_R0]);
+      vm_update_flags(vm, LC3_R_R0);
+      break;
     default:
-      printf("Unknown trap: 0x%02X\n", trap_vect);
+      if (vm->traps[trap_vect]) {
+        vm->traps[trap_vect](vm);
+        break;
+      }
+      char where[VM_DESCRIBE_MAX];
+      printf("Unknown trap: 0x%02X at %s\n", trap_vect,
+             vm_describe_pc(vm, where, sizeof(where)));
       vm->running = false;
+      vm->stop = VM_STOP_ERROR;
       break;
   }
 }
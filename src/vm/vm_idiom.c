@@ -0,0 +1,305 @@
+#include "../../include/vm/vm_idiom.h"
+
+#include <string.h>
+
+#include "../../include/lc3/decode.h"
+
+#define OP(instr) ((instr) >> 12)
+
+// True if instr is ADD reg, reg, #imm
+static bool vm_idiom_is_add_imm(uint16_t instr, int reg, int imm) {
+  return OP(instr) == LC3_OP_ADD && lc3_r0(instr) == reg &&
+         lc3_r1(instr) == reg && (instr & LC3_IMM_MODE) &&
+         (instr & 0x1F) == lc3_field(imm, 5);
+}
+
+// True if instr is ADD dr, a, b in register mode, in either operand order
+static bool vm_idiom_is_add_reg(uint16_t instr, int dr, int a, int b) {
+  return OP(instr) == LC3_OP_ADD && lc3_r0(instr) == dr &&
+         (instr & 0x38) == 0 &&
+         ((lc3_r1(instr) == a && lc3_r2(instr) == b) ||
+          (lc3_r1(instr) == b && lc3_r2(instr) == a));
+}
+
+// The BR with condition nzp at offset `at` of the loop that jumps to offset
+// `target`
+static uint16_t vm_idiom_branch(int nzp, int at, int target) {
+  return (uint16_t)(nzp << 9 | ((target - at - 1) & 0x1FF));
+}
+
+static bool vm_idiom_distinct(const uint8_t* reg, int count) {
+  for (int i = 0; i < count; i++) {
+    for (int j = i + 1; j < count; j++) {
+      if (reg[i] == reg[j]) return false;
+    }
+  }
+  return true;
+}
+
+// LOOP LDR Rt, Rs, #0
+//      STR Rt, Rd, #0
+//      ADD Rs, Rs, #1   ; the two pointer updates in either order
+//      ADD Rd, Rd, #1
+//      ADD Rc, Rc, #-1
+//      BRp LOOP
+// reg = {t, s, d, c}
+static int vm_idiom_match_copy(const uint16_t* w, uint8_t* reg) {
+  if (OP(w[0]) != LC3_OP_LDR || (w[0] & 0x3F) != 0 ||
+      OP(w[1]) != LC3_OP_STR || (w[1] & 0x3F) != 0 ||
+      lc3_r0(w[1]) != lc3_r0(w[0])) {
+    return 0;
+  }
+  reg[0] = lc3_r0(w[0]);
+  reg[1] = lc3_r1(w[0]);
+  reg[2] = lc3_r1(w[1]);
+  reg[3] = lc3_r0(w[4]);
+  bool pointers = (vm_idiom_is_add_imm(w[2], reg[1], 1) &&
+                   vm_idiom_is_add_imm(w[3], reg[2], 1)) ||
+                  (vm_idiom_is_add_imm(w[2], reg[2], 1) &&
+                   vm_idiom_is_add_imm(w[3], reg[1], 1));
+  if (!pointers || !vm_idiom_is_add_imm(w[4], reg[3], -1) ||
+      w[5] != vm_idiom_branch(LC3_FL_POS, 5, 0) ||
+      !vm_idiom_distinct(reg, 4)) {
+    return 0;
+  }
+  return 6;
+}
+
+// LOOP ADD Ra, Ra, Rm
+//      ADD Rc, Rc, #-1
+//      BRp LOOP
+// reg = {a, m, c}
+static int vm_idiom_match_mul_add(const uint16_t* w, uint8_t* reg) {
+  reg[0] = lc3_r0(w[0]);
+  reg[1] = lc3_r1(w[0]) == reg[0] ? lc3_r2(w[0]) : lc3_r1(w[0]);
+  reg[2] = lc3_r0(w[1]);
+  if (!vm_idiom_is_add_reg(w[0], reg[0], reg[0], reg[1]) ||
+      !vm_idiom_is_add_imm(w[1], reg[2], -1) ||
+      w[2] != vm_idiom_branch(LC3_FL_POS, 2, 0) ||
+      !vm_idiom_distinct(reg, 3)) {
+    return 0;
+  }
+  return 3;
+}
+
+// LOOP AND Rt, Rb, Rk   ; test one bit of the multiplier
+//      BRz SKIP
+//      ADD Ra, Ra, Rm
+// SKIP ADD Rm, Rm, Rm
+//      ADD Rk, Rk, Rk
+//      BRnp LOOP        ; until the mask shifts out
+// reg = {t, b, k, a, m}
+static int vm_idiom_match_mul_shift(const uint16_t* w, uint8_t* reg) {
+  if (OP(w[0]) != LC3_OP_AND || (w[0] & 0x38) != 0) return 0;
+  reg[0] = lc3_r0(w[0]);
+  reg[2] = lc3_r0(w[4]);
+  reg[1] = lc3_r1(w[0]) == reg[2] ? lc3_r2(w[0]) : lc3_r1(w[0]);
+  reg[3] = lc3_r0(w[2]);
+  reg[4] = lc3_r0(w[3]);
+  bool tests_bit = (lc3_r1(w[0]) == reg[1] && lc3_r2(w[0]) == reg[2]) ||
+                   (lc3_r1(w[0]) == reg[2] && lc3_r2(w[0]) == reg[1]);
+  if (!tests_bit || w[1] != vm_idiom_branch(LC3_FL_ZRO, 1, 3) ||
+      !vm_idiom_is_add_reg(w[2], reg[3], reg[3], reg[4]) ||
+      !vm_idiom_is_add_reg(w[3], reg[4], reg[4], reg[4]) ||
+      !vm_idiom_is_add_reg(w[4], reg[2], reg[2], reg[2]) ||
+      w[5] != vm_idiom_branch(LC3_FL_NEG | LC3_FL_POS, 5, 0) ||
+      !vm_idiom_distinct(reg, 5)) {
+    return 0;
+  }
+  return 6;
+}
+
+// LOOP ADD Rn, Rn, Rs   ; Rs holds the negated divisor
+//      BRn DONE
+//      ADD Rq, Rq, #1
+//      BRnzp LOOP
+// DONE
+// reg = {n, s, q}
+static int vm_idiom_match_div_sub(const uint16_t* w, uint8_t* reg) {
+  reg[0] = lc3_r0(w[0]);
+  reg[1] = lc3_r1(w[0]) == reg[0] ? lc3_r2(w[0]) : lc3_r1(w[0]);
+  reg[2] = lc3_r0(w[2]);
+  if (!vm_idiom_is_add_reg(w[0], reg[0], reg[0], reg[1]) ||
+      w[1] != vm_idiom_branch(LC3_FL_NEG, 1, 4) ||
+      !vm_idiom_is_add_imm(w[2], reg[2], 1) ||
+      w[3] != vm_idiom_branch(LC3_FL_NEG | LC3_FL_ZRO | LC3_FL_POS, 3, 0) ||
+      !vm_idiom_distinct(reg, 3)) {
+    return 0;
+  }
+  return 4;
+}
+
+void vm_idiom_scan(vm_t* vm) {
+  memset(vm->idiom_at, 0, sizeof(vm->idiom_at));
+  vm->idiom_count = 0;
+
+  for (uint32_t address = 0;
+       address + VM_IDIOM_MAX_LENGTH <= LC3_MEMORY_MAX &&
+       vm->idiom_count < VM_IDIOM_MAX;
+       address++) {
+    const uint16_t* w = vm->memory + address;
+    vm_idiom_t* idiom = &vm->idioms[vm->idiom_count];
+    int length;
+    if ((length = vm_idiom_match_copy(w, idiom->reg)) > 0) {
+      idiom->kind = VM_IDIOM_COPY;
+    } else if ((length = vm_idiom_match_mul_add(w, idiom->reg)) > 0) {
+      idiom->kind = VM_IDIOM_MUL_ADD;
+    } else if ((length = vm_idiom_match_mul_shift(w, idiom->reg)) > 0) {
+      idiom->kind = VM_IDIOM_MUL_SHIFT;
+    } else if ((length = vm_idiom_match_div_sub(w, idiom->reg)) > 0) {
+      idiom->kind = VM_IDIOM_DIV_SUB;
+    } else {
+      continue;
+    }
+
+    idiom->start = (uint16_t)address;
+    idiom->length = (uint16_t)length;
+    memcpy(idiom->words, w, length * sizeof(uint16_t));
+    vm->idiom_at[address] = (uint8_t)++vm->idiom_count;
+  }
+}
+
+void vm_idiom_restore(vm_t* vm, const vm_idiom_t* idioms, int count) {
+  memcpy(vm->idioms, idioms, count * sizeof(vm_idiom_t));
+  vm->idiom_count = count;
+  for (int i = 0; i < count; i++) {
+    vm->idiom_at[idioms[i].start] = (uint8_t)(i + 1);
+  }
+}
+
+// Counts outside 1..x7FFF make the counted loops run once or x8000 times;
+// those are left to the interpreter
+static bool vm_idiom_count_in_range(uint16_t count) {
+  return count >= 1 && count <= 0x7FFF;
+}
+
+// A loop that would run past the next device event is interpreted so the
+// event is handled on time
+static bool vm_idiom_fits(const vm_t* vm, int64_t steps) {
+  return steps <= vm->countdown;
+}
+
+// Each kernel returns the number of instructions the loop would have run,
+// or 0 if it has to be interpreted
+static int64_t vm_idiom_run_copy(vm_t* vm, const vm_idiom_t* idiom) {
+  uint16_t* r = vm->reg;
+  uint16_t src = r[idiom->reg[1]];
+  uint16_t dst = r[idiom->reg[2]];
+  uint16_t count = r[idiom->reg[3]];
+  if (!vm_idiom_count_in_range(count) || !vm_idiom_fits(vm, 6 * count)) {
+    return 0;
+  }
+  // Device registers are read and written one access at a time
+  if ((uint32_t)src + count > LC3_MR_KBSR ||
+      (uint32_t)dst + count > LC3_MR_KBSR) {
+    return 0;
+  }
+  // A copy over its own loop would change the code being run
+  for (int i = 0; i < idiom->length; i++) {
+    if ((uint16_t)(idiom->start + i - dst) < count) return 0;
+  }
+
+  // A destination that starts inside the source repeats the words already
+  // copied, which memmove would not do
+  if (dst > src && dst - src < count) {
+    for (uint16_t i = 0; i < count; i++) {
+      vm->memory[dst + i] = vm->memory[src + i];
+    }
+  } else {
+    memmove(vm->memory + dst, vm->memory + src, count * sizeof(uint16_t));
+  }
+
+  // The last word read is never written again after it is read
+  r[idiom->reg[0]] = vm->memory[src + count - 1];
+  r[idiom->reg[1]] = src + count;
+  r[idiom->reg[2]] = dst + count;
+  r[idiom->reg[3]] = 0;
+  r[LC3_R_COND] = LC3_FL_ZRO;
+  return 6 * count;
+}
+
+static int64_t vm_idiom_run_mul_add(vm_t* vm, const vm_idiom_t* idiom) {
+  uint16_t* r = vm->reg;
+  uint16_t count = r[idiom->reg[2]];
+  if (!vm_idiom_count_in_range(count) || !vm_idiom_fits(vm, 3 * count)) {
+    return 0;
+  }
+
+  r[idiom->reg[0]] += (uint16_t)((uint32_t)r[idiom->reg[1]] * count);
+  r[idiom->reg[2]] = 0;
+  r[LC3_R_COND] = LC3_FL_ZRO;
+  return 3 * count;
+}
+
+static int64_t vm_idiom_run_mul_shift(vm_t* vm, const vm_idiom_t* idiom) {
+  uint16_t* r = vm->reg;
+  uint16_t multiplier = r[idiom->reg[1]];
+  uint16_t mask = r[idiom->reg[2]];
+  uint16_t product = r[idiom->reg[3]];
+  uint16_t multiplicand = r[idiom->reg[4]];
+  uint16_t bit;
+  int64_t steps = 0;
+
+  // The mask reaches zero within 16 doublings, whatever its start value
+  do {
+    bit = multiplier & mask;
+    if (bit) product += multiplicand;
+    multiplicand += multiplicand;
+    mask += mask;
+    steps += bit ? 6 : 5;
+  } while (mask);
+  if (!vm_idiom_fits(vm, steps)) return 0;
+
+  r[idiom->reg[0]] = bit;
+  r[idiom->reg[2]] = 0;
+  r[idiom->reg[3]] = product;
+  r[idiom->reg[4]] = multiplicand;
+  r[LC3_R_COND] = LC3_FL_ZRO;
+  return steps;
+}
+
+static int64_t vm_idiom_run_div_sub(vm_t* vm, const vm_idiom_t* idiom) {
+  uint16_t* r = vm->reg;
+  uint16_t dividend = r[idiom->reg[0]];
+  uint16_t negated = r[idiom->reg[1]];
+  // A negative dividend or a divisor <= 0 overflows or never ends
+  if (dividend >> 15 || !(negated >> 15)) return 0;
+
+  uint16_t divisor = -negated;
+  uint16_t quotient = dividend / divisor;
+  if (!vm_idiom_fits(vm, 4 * quotient + 2)) return 0;
+  // The last subtraction goes one step below zero, leaving remainder - divisor
+  r[idiom->reg[0]] = dividend - (quotient + 1) * divisor;
+  r[idiom->reg[2]] += quotient;
+  r[LC3_R_COND] = LC3_FL_NEG;
+  return 4 * quotient + 2;
+}
+
+bool vm_idiom_run(vm_t* vm, vm_idiom_t* idiom) {
+  if (memcmp(vm->memory + idiom->start, idiom->words,
+             idiom->length * sizeof(uint16_t)) != 0) {
+    vm->idiom_at[idiom->start] = 0;
+    return false;
+  }
+
+  int64_t steps = 0;
+  switch (idiom->kind) {
+    case VM_IDIOM_COPY:
+      steps = vm_idiom_run_copy(vm, idiom);
+      break;
+    case VM_IDIOM_MUL_ADD:
+      steps = vm_idiom_run_mul_add(vm, idiom);
+      break;
+    case VM_IDIOM_MUL_SHIFT:
+      steps = vm_idiom_run_mul_shift(vm, idiom);
+      break;
+    case VM_IDIOM_DIV_SUB:
+      steps = vm_idiom_run_div_sub(vm, idiom);
+      break;
+  }
+  if (steps == 0) return false;
+
+  vm->reg[LC3_R_PC] = idiom->start + idiom->length;
+  vm->countdown -= steps;
+  return true;
+}
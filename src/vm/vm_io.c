@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define VM_IO_INITIAL_CAPACITY 256
+
+void vm_io_init(vm_t* vm) {
+  memset(&vm->io, 0, sizeof(vm->io));
+  vm->io.high_water = VM_IO_HIGH_WATER;
+}
+
+void vm_io_init_buffered(vm_t* vm) {
+  vm_io_reset(vm);
+  vm->io.buffered = true;
+}
+
+void vm_io_reset(vm_t* vm) {
+  vm_io_t* io = &vm->io;
+  io->buffered = false;
+  io->input_start = 0;
+  io->input_length = 0;
+  io->input_closed = false;
+  io->output_length = 0;
+  io->high_water = VM_IO_HIGH_WATER;
+}
+
+void vm_io_free(vm_t* vm) {
+  free(vm->io.input);
+  free(vm->io.output);
+  vm_io_init(vm);
+}
+
+// Make room for size more bytes after length in a buffer
+static int vm_io_reserve(uint8_t** buffer, size_t* capacity, size_t length,
+                         size_t size) {
+  if (length + size <= *capacity) return 0;
+  size_t grown = *capacity ? *capacity : VM_IO_INITIAL_CAPACITY;
+  while (grown < length + size) grown *= 2;
+  uint8_t* data = realloc(*buffer, grown);
+  if (!data) return 1;
+  *buffer = data;
+  *capacity = grown;
+  return 0;
+}
+
+int vm_io_feed(vm_t* vm, const void* data, size_t size) {
+  vm_io_t* io = &vm->io;
+  if (size == 0) return 0;
+  // Reuse the space of bytes already read before growing
+  if (io->input_start > 0) {
+    memmove(io->input, io->input + io->input_start,
+            io->input_length - io->input_start);
+    io->input_length -= io->input_start;
+    io->input_start = 0;
+  }
+  if (vm_io_reserve(&io->input, &io->input_capacity, io->input_length,
+                    size) != 0) {
+    return 1;
+  }
+  memcpy(io->input + io->input_length, data, size);
+  io->input_length += size;
+  return 0;
+}
+
+void vm_io_close_input(vm_t* vm) { vm->io.input_closed = true; }
+
+int vm_io_getc(vm_t* vm) {
+  vm_io_t* io = &vm->io;
+  if (!io->buffered) {
+    int c = getchar();
+    return c == EOF ? VM_IO_EOF : c;
+  }
+  if (io->input_start < io->input_length) return io->input[io->input_start++];
+  return io->input_closed ? VM_IO_EOF : VM_IO_EMPTY;
+}
+
+bool vm_io_key_ready(vm_t* vm) {
+  if (vm->io.buffered) {
+    return vm->io.input_start < vm->io.input_length || vm->io.input_closed;
+  }
+  fd_set fds;
+  FD_ZERO(&fds);
+  FD_SET(STDIN_FILENO, &fds);
+  struct timeval timeout = {0, 0};
+  return select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout) > 0;
+}
+
+bool vm_io_can_write(const vm_t* vm) {
+  return !vm->io.buffered || vm->io.output_length < vm->io.high_water;
+}
+
+void vm_io_putc(vm_t* vm, char c) {
+  vm_io_t* io = &vm->io;
+  if (!io->buffered) {
+    putchar(c);
+    return;
+  }
+  // A trap that started below the high-water mark finishes its string even
+  // if that takes the buffer past it; only running out of memory drops bytes
+  if (vm_io_reserve(&io->output, &io->output_capacity, io->output_length,
+                    1) != 0) {
+    return;
+  }
+  io->output[io->output_length++] = (uint8_t)c;
+}
+
+void vm_io_flush(vm_t* vm) {
+  if (!vm->io.buffered) fflush(stdout);
+}
+
+void vm_io_consume_output(vm_t* vm, size_t count) {
+  vm_io_t* io = &vm->io;
+  if (count > io->output_length) count = io->output_length;
+  memmove(io->output, io->output + count, io->output_length - count);
+  io->output_length -= count;
+}
@@ -0,0 +1,94 @@
+#include "../../include/vm/vm_limit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/util/clock.h"
+#include "../../include/vm/vm_event.h"
+
+static uint64_t vm_limit_env(const char* name) {
+  const char* value = getenv(name);
+  return value && *value ? strtoull(value, NULL, 10) : 0;
+}
+
+void vm_limit_reset(vm_t* vm) {
+  vm_limits_t limits = {
+      .max_instructions = vm_limit_env("LC3_MAX_INSTRUCTIONS"),
+      .timeout_ms = vm_limit_env("LC3_TIMEOUT_MS"),
+      .detect_loops = getenv("LC3_DETECT_LOOPS") != NULL,
+  };
+  vm_limit_set(vm, &limits);
+}
+
+void vm_limit_set(vm_t* vm, const vm_limits_t* limits) {
+  vm->limits = *limits;
+  vm->deadline_ns = 0;
+  // No branch so far can match
+  vm->effects++;
+  vm->loop_effects = vm->effects - 1;
+
+  if (limits->max_instructions) {
+    vm_event_schedule(vm, VM_EVENT_BUDGET, limits->max_instructions);
+  } else {
+    vm_event_cancel(vm, VM_EVENT_BUDGET);
+  }
+  if (limits->timeout_ms) {
+    vm_event_schedule(vm, VM_EVENT_WATCHDOG, VM_WATCHDOG_INTERVAL);
+  } else {
+    vm_event_cancel(vm, VM_EVENT_WATCHDOG);
+  }
+}
+
+void vm_limit_start(vm_t* vm) {
+  // Memory may have been changed by the host since the last run
+  vm->effects++;
+  if (vm->limits.timeout_ms && vm->deadline_ns == 0) {
+    vm->deadline_ns = clock_now_ns() + vm->limits.timeout_ms * 1000000ULL;
+  }
+}
+
+void vm_limit_event(vm_t* vm, vm_event_kind_t kind) {
+  if (kind == VM_EVENT_BUDGET) {
+    vm->running = false;
+    vm->stop = VM_STOP_BUDGET;
+  } else if (clock_now_ns() >= vm->deadline_ns) {
+    vm->running = false;
+    vm->stop = VM_STOP_TIMEOUT;
+  } else {
+    vm_event_schedule(vm, VM_EVENT_WATCHDOG, VM_WATCHDOG_INTERVAL);
+  }
+}
+
+// Whether anything but the program itself can change what it sees next
+static bool vm_limit_outside_input(const vm_t* vm) {
+  return vm->hart_count > 1 || vm_event_pending(vm, VM_EVENT_KEYBOARD) ||
+         vm_event_pending(vm, VM_EVENT_TIMER);
+}
+
+void vm_limit_branch(vm_t* vm) {
+  if (vm->effects == vm->loop_effects && vm->psr == vm->loop_psr &&
+      memcmp(vm->reg, vm->loop_reg, sizeof(vm->reg)) == 0 &&
+      !vm_limit_outside_input(vm)) {
+    vm->running = false;
+    vm->stop = VM_STOP_LOOP;
+    return;
+  }
+  memcpy(vm->loop_reg, vm->reg, sizeof(vm->reg));
+  vm->loop_psr = vm->psr;
+  vm->loop_effects = vm->effects;
+}
+
+int vm_limit_exit_code(const vm_t* vm, int result) {
+  switch (vm->stop) {
+    case VM_STOP_BUDGET:
+      return VM_EXIT_BUDGET;
+    case VM_STOP_TIMEOUT:
+      return VM_EXIT_TIMEOUT;
+    case VM_STOP_LOOP:
+      return VM_EXIT_LOOP;
+    case VM_STOP_ERROR:
+      return VM_EXIT_ERROR;
+    default:
+      return result == 0 ? VM_EXIT_HALT : VM_EXIT_ERROR;
+  }
+}
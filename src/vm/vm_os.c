@@ -0,0 +1,84 @@
+#include "../../include/vm/vm_os.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/vm/vm_event.h"
+#include "../../include/vm/vm_trap.h"
+
+void vm_os_reset(vm_t* vm) {
+  vm->psr = LC3_PSR_USER;
+  vm->saved_ssp = LC3_SSP_START;
+  vm->saved_usp = 0;
+  memset(vm->stock_vectors, 0, sizeof(vm->stock_vectors));
+  vm->fast_traps = getenv("LC3_NO_FAST_TRAPS") == NULL;
+}
+
+int vm_os_load(vm_t* vm, const char* filename) {
+  if (vm_load_file(vm, filename) != 0) return 1;
+  memcpy(vm->stock_vectors, vm->memory + LC3_TRAP_TABLE,
+         sizeof(vm->stock_vectors));
+  return 0;
+}
+
+static void vm_os_push(vm_t* vm, uint16_t value) {
+  vm->memory[--vm->reg[LC3_R_R6]] = value;
+}
+
+static uint16_t vm_os_pop(vm_t* vm) {
+  return vm->memory[vm->reg[LC3_R_R6]++];
+}
+
+// Save PSR and PC on the supervisor stack and jump to handler in supervisor
+// mode
+static void vm_os_enter(vm_t* vm, uint16_t handler) {
+  vm->effects++;
+  uint16_t psr = vm->psr | vm->reg[LC3_R_COND];
+  if (vm->psr & LC3_PSR_USER) {
+    vm->saved_usp = vm->reg[LC3_R_R6];
+    vm->reg[LC3_R_R6] = vm->saved_ssp;
+  }
+  vm_os_push(vm, psr);
+  vm_os_push(vm, vm->reg[LC3_R_PC]);
+  vm->psr &= ~LC3_PSR_USER;
+  vm->reg[LC3_R_PC] = handler;
+}
+
+bool vm_os_trap(vm_t* vm, uint8_t vector) {
+  uint16_t handler = vm->memory[LC3_TRAP_TABLE + vector];
+  if (handler == 0) return false;  // No LC-3 routine to run
+
+  bool stock = handler == vm->stock_vectors[vector];
+  if (stock && vm->fast_traps && vm_trap_available(vm, vector)) return false;
+  vm_os_enter(vm, handler);
+  return true;
+}
+
+bool vm_os_exception(vm_t* vm, uint8_t vector) {
+  uint16_t handler = vm->memory[LC3_INTERRUPT_TABLE + vector];
+  if (handler == 0) return false;
+  vm_os_enter(vm, handler);
+  return true;
+}
+
+bool vm_os_interrupt(vm_t* vm, uint8_t vector, int priority) {
+  if (!vm_os_exception(vm, vector)) return false;
+  vm->psr = (vm->psr & ~LC3_PSR_PRIORITY) | (uint16_t)(priority << 8);
+  return true;
+}
+
+bool vm_os_rti(vm_t* vm) {
+  if (vm->psr & LC3_PSR_USER) return vm_os_exception(vm, LC3_EX_PRIVILEGE);
+
+  vm->reg[LC3_R_PC] = vm_os_pop(vm);
+  uint16_t psr = vm_os_pop(vm);
+  vm->psr = psr & (LC3_PSR_USER | LC3_PSR_PRIORITY);
+  vm->reg[LC3_R_COND] = psr & (LC3_FL_NEG | LC3_FL_ZRO | LC3_FL_POS);
+  if (vm->psr & LC3_PSR_USER) {
+    vm->saved_ssp = vm->reg[LC3_R_R6];
+    vm->reg[LC3_R_R6] = vm->saved_usp;
+  }
+  // A lower priority may let a waiting interrupt in
+  vm_event_wake(vm);
+  return true;
+}
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/util/file.h"
+
+static const char* vm_profile_path = NULL;
+static vm_t** vm_profile_vms = NULL;
+static int vm_profile_count = 0;
+
+// Append a node for entry called from parent. Returns its index, or -1 if
+// out of memory.
+static int vm_profile_add_node(vm_profile_t* profile, uint16_t entry,
+                               int parent) {
+  if (profile->node_count == profile->node_capacity) {
+    int capacity = profile->node_capacity ? profile->node_capacity * 2 : 64;
+    vm_profile_node_t* grown =
+        realloc(profile->nodes, capacity * sizeof(vm_profile_node_t));
+    if (!grown) return -1;
+    profile->nodes = grown;
+    profile->node_capacity = capacity;
+  }
+  int node = profile->node_count++;
+  profile->nodes[node] = (vm_profile_node_t){entry, parent, -1, -1, 0, 0};
+  if (parent >= 0) {
+    profile->nodes[node].sibling = profile->nodes[parent].child;
+    profile->nodes[parent].child = node;
+  }
+  return node;
+}
+
+vm_profile_t* vm_profile_create(uint16_t entry) {
+  vm_profile_t* profile = calloc(1, sizeof(vm_profile_t));
+  if (!profile) return NULL;
+  if (vm_profile_add_node(profile, entry, -1) < 0) {
+    free(profile);
+    return NULL;
+  }
+  profile->nodes[0].calls = 1;
+  vm_calls_init(&profile->calls);
+  profile->path[0] = 0;
+  return profile;
+}
+
+void vm_profile_destroy(vm_profile_t* profile) {
+  if (!profile) return;
+  free(profile->nodes);
+  free(profile);
+}
+
+// The node of entry called from parent, added if new. Returns -1 if out of
+// memory.
+static int vm_profile_child(vm_profile_t* profile, int parent,
+                            uint16_t entry) {
+  int node = profile->nodes[parent].child;
+  while (node >= 0 && profile->nodes[node].entry != entry) {
+    node = profile->nodes[node].sibling;
+  }
+  return node >= 0 ? node : vm_profile_add_node(profile, entry, parent);
+}
+
+void vm_profile_step(vm_t* vm, uint16_t pc, uint16_t instr) {
+  vm_profile_t* profile = vm->profile;
+  int depth = profile->calls.depth;
+  profile->nodes[profile->path[depth - 1]].instructions++;
+
+  uint16_t next = vm->reg[LC3_R_PC];
+  if (vm_calls_step(&profile->calls, pc, instr, next) != VM_CALLS_PUSH) {
+    return;
+  }
+  int node = vm_profile_child(profile, profile->path[depth - 1], next);
+  if (node < 0) {
+    vm_calls_drop(&profile->calls);
+    return;
+  }
+  profile->nodes[node].calls++;
+  profile->path[depth] = node;
+}
+
+void vm_profile_configure(const char* path) { vm_profile_path = path; }
+
+void vm_profile_attach(vm_t* const* vms, int count) {
+  if (!vm_profile_path) return;
+
+  vm_profile_vms = malloc(count * sizeof(vm_t*));
+  if (!vm_profile_vms) return;
+  memcpy(vm_profile_vms, vms, count * sizeof(vm_t*));
+  vm_profile_count = count;
+  for (int i = 0; i < count; i++) {
+    vms[i]->profile = vm_profile_create(vms[i]->reg[LC3_R_PC]);
+  }
+}
+
+// Name a routine by its label, the label it lies in plus an offset, or its
+// address
+static void vm_profile_name(FILE* out, const debug_info_t* debug,
+                            uint16_t entry) {
+  const debug_label_t* label =
+      debug ? debug_info_find_label(debug, entry) : NULL;
+  if (!label) {
+    fprintf(out, "x%04X", entry);
+  } else if (label->start == entry) {
+    fputs(label->name, out);
+  } else {
+    fprintf(out, "%s+%d", label->name, entry - label->start);
+  }
+}
+
+int vm_profile_write_folded(FILE* out, const vm_profile_t* profile,
+                            const debug_info_t* debug, const char* prefix) {
+  // The tree is at most as deep as the stack
+  int path[VM_CALLS_MAX_DEPTH];
+  for (int node = 0; node < profile->node_count; node++) {
+    if (!profile->nodes[node].instructions) continue;
+    int length = 0;
+    for (int up = node; up >= 0; up = profile->nodes[up].parent) {
+      path[length++] = up;
+    }
+    if (prefix) fprintf(out, "%s;", prefix);
+    for (int i = length - 1; i >= 0; i--) {
+      vm_profile_name(out, debug, profile->nodes[path[i]].entry);
+      fputc(i ? ';' : ' ', out);
+    }
+    fprintf(out, "%llu\n",
+            (unsigned long long)profile->nodes[node].instructions);
+  }
+  return ferror(out) ? 1 : 0;
+}
+
+// Write the folded stacks of the attached VMs
+static void vm_profile_report(void) {
+  char* buffer = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&buffer, &size);
+  int result = out ? 0 : 1;
+  for (int i = 0; out && result == 0 && i < vm_profile_count; i++) {
+    const vm_t* vm = vm_profile_vms[i];
+    if (!vm->profile) continue;
+    char hart[16];
+    snprintf(hart, sizeof(hart), "hart%d", vm->hart_id);
+    // Harts share one program, loaded through the first
+    result = vm_profile_write_folded(out, vm->profile,
+                                     vm_profile_vms[0]->debug,
+                                     vm_profile_count > 1 ? hart : NULL);
+    if (vm->profile->calls.dropped) {
+      fprintf(stderr, "Warning: %llu calls were not profiled\n",
+              (unsigned long long)vm->profile->calls.dropped);
+    }
+  }
+  if (out && fclose(out) != 0) result = 1;
+  if (result == 0 && file_write_atomic(vm_profile_path, buffer, size) != 0) {
+    result = 1;
+  }
+  if (result != 0) {
+    fprintf(stderr, "Error: Could not write profile to %s\n", vm_profile_path);
+  }
+  free(buffer);
+}
+
+void vm_profile_detach(void) {
+  if (!vm_profile_vms) return;
+
+  vm_profile_report();
+  for (int i = 0; i < vm_profile_count; i++) {
+    vm_profile_destroy(vm_profile_vms[i]->profile);
+    vm_profile_vms[i]->profile = NULL;
+  }
+  free(vm_profile_vms);
+  vm_profile_vms = NULL;
+  vm_profile_count = 0;
+}
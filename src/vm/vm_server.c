@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../include/asm/cache.h"
+#include "../../include/lc3/image.h"
+#include "../../include/util/clock.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/socket.h"
+#include "../../include/vm/vm.h"
+#include "../../include/vm/vm_event.h"
+#include "../../include/vm/vm_idiom.h"
+#include "../../include/vm/vm_io.h"
+#include "../../include/vm/vm_limit.h"
+
+#define VM_SERVER_BACKLOG 128
+#define VM_SERVER_MAX_WORKERS 256
+
+// A run of words to copy into memory, in host byte order
+typedef struct {
+  uint16_t address;
+  uint16_t length;
+  uint16_t* words;
+} vm_server_segment_t;
+
+// An object file decoded once and loaded by copying its segments
+typedef struct {
+  uint64_t key;
+  uint64_t last_used;  // Request number of the last use; 0 for a free slot
+  vm_server_segment_t* segments;
+  int segment_count;
+  vm_idiom_t* idioms;
+  int idiom_count;
+} vm_server_image_t;
+
+typedef struct {
+  vm_t* vm;
+  vm_server_image_t cache[VM_SERVER_CACHE_SIZE];
+  uint64_t requests;
+  uint8_t* buffer;  // Image and input of the current request
+  size_t buffer_capacity;
+} vm_server_worker_t;
+
+static volatile sig_atomic_t vm_server_stopping = 0;
+
+uint64_t vm_server_key(const void* image, size_t size) {
+  return asm_cache_hash(image, size);
+}
+
+static int vm_server_read_full(int fd, void* data, size_t size) {
+  unsigned char* p = data;
+  while (size > 0) {
+    ssize_t count = read(fd, p, size);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return 1;
+    p += count;
+    size -= (size_t)count;
+  }
+  return 0;
+}
+
+// Write a header and a payload with as few system calls as possible
+static int vm_server_write_full(int fd, const void* header, size_t header_size,
+                                const void* payload, size_t payload_size) {
+  struct iovec parts[2] = {{(void*)header, header_size},
+                           {(void*)payload, payload_size}};
+  struct iovec* part = parts;
+  int count = payload_size > 0 ? 2 : 1;
+  while (count > 0) {
+    ssize_t written = writev(fd, part, count);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0) return 1;
+    while (count > 0 && (size_t)written >= part->iov_len) {
+      written -= (ssize_t)part->iov_len;
+      part++;
+      count--;
+    }
+    if (count > 0) {
+      part->iov_base = (unsigned char*)part->iov_base + written;
+      part->iov_len -= (size_t)written;
+    }
+  }
+  return 0;
+}
+
+static void vm_server_image_free(vm_server_image_t* image) {
+  for (int i = 0; i < image->segment_count; i++) {
+    free(image->segments[i].words);
+  }
+  free(image->segments);
+  free(image->idioms);
+  memset(image, 0, sizeof(*image));
+}
+
+static int vm_server_add_segment(vm_server_image_t* image, uint16_t address,
+                                 uint16_t length, const uint16_t* words,
+                                 bool swap) {
+  if (length == 0) return 0;
+  vm_server_segment_t* segment = &image->segments[image->segment_count];
+  segment->words = malloc(length * sizeof(uint16_t));
+  if (!segment->words) return 1;
+  segment->address = address;
+  segment->length = length;
+  if (swap) {
+    swap16_copy(segment->words, words, length);
+  } else {
+    memcpy(segment->words, words, length * sizeof(uint16_t));
+  }
+  image->segment_count++;
+  return 0;
+}
+
+// Split an object file into segments the way the VM's loaders read it.
+// data must be 2-byte aligned.
+static int vm_server_decode(const uint8_t* data, size_t size,
+                            vm_server_image_t* image) {
+  if (size >= 4 && memcmp(data, IMAGE_MAGIC, 4) == 0) {
+    image_t sparse;
+    if (image_open_memory(data, size, &sparse) != 0) return 1;
+    image->segments =
+        calloc(sparse.segment_count + 1, sizeof(vm_server_segment_t));
+    if (!image->segments) return 1;
+    bool swap = !image_is_native(&sparse);
+    for (int i = 0; i < sparse.segment_count; i++) {
+      image_segment_t segment;
+      image_get_segment(&sparse, i, &segment);
+      // Memory is cleared before every load, so zero segments cost nothing
+      if (segment.flags & IMAGE_SEGMENT_ZERO) continue;
+      if (vm_server_add_segment(image, segment.address, segment.length,
+                                segment.words, swap) != 0) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  // Relocatable modules have no load address until they are linked
+  if (size < 2 || (size >= 4 && memcmp(data, LC3_MODULE_MAGIC, 4) == 0)) {
+    return 1;
+  }
+  uint16_t origin = swap16(*(const uint16_t*)data);
+  size_t count = (size - 2) / sizeof(uint16_t);
+  if (count > (size_t)(LC3_MEMORY_MAX - origin)) {
+    count = LC3_MEMORY_MAX - origin;
+  }
+  image->segments = calloc(1, sizeof(vm_server_segment_t));
+  if (!image->segments) return 1;
+  return vm_server_add_segment(image, origin, (uint16_t)count,
+                               (const uint16_t*)(data + 2), true);
+}
+
+static void vm_server_load(vm_t* vm, const vm_server_image_t* image) {
+  vm_reset(vm);
+  memset(vm->memory, 0, LC3_MEMORY_MAX * sizeof(uint16_t));
+  for (int i = 0; i < image->segment_count; i++) {
+    const vm_server_segment_t* segment = &image->segments[i];
+    memcpy(vm->memory + segment->address, segment->words,
+           segment->length * sizeof(uint16_t));
+  }
+  vm_idiom_restore(vm, image->idioms, image->idiom_count);
+}
+
+static vm_server_image_t* vm_server_lookup(vm_server_worker_t* worker,
+                                           uint64_t key) {
+  for (int i = 0; i < VM_SERVER_CACHE_SIZE; i++) {
+    vm_server_image_t* image = &worker->cache[i];
+    if (image->last_used && image->key == key) return image;
+  }
+  return NULL;
+}
+
+// Decode an image into the least recently used slot and scan it for loops
+static vm_server_image_t* vm_server_insert(vm_server_worker_t* worker,
+                                           uint64_t key, const uint8_t* data,
+                                           size_t size) {
+  vm_server_image_t* image = &worker->cache[0];
+  for (int i = 1; i < VM_SERVER_CACHE_SIZE; i++) {
+    if (worker->cache[i].last_used < image->last_used) {
+      image = &worker->cache[i];
+    }
+  }
+  vm_server_image_free(image);
+  if (vm_server_decode(data, size, image) != 0) {
+    vm_server_image_free(image);
+    return NULL;
+  }
+
+  vm_t* vm = worker->vm;
+  vm_server_load(vm, image);
+  vm_idiom_scan(vm);
+  if (vm->idiom_count > 0) {
+    image->idioms = malloc(vm->idiom_count * sizeof(vm_idiom_t));
+    if (!image->idioms) {
+      vm_server_image_free(image);
+      return NULL;
+    }
+    memcpy(image->idioms, vm->idioms, vm->idiom_count * sizeof(vm_idiom_t));
+    image->idiom_count = vm->idiom_count;
+  }
+  image->key = key;
+  return image;
+}
+
+static vm_server_status_t vm_server_status(const vm_t* vm, int result) {
+  switch (vm->stop) {
+    case VM_STOP_HALT:
+      return result == 0 ? VM_SERVER_HALT : VM_SERVER_ERROR;
+    case VM_STOP_BUDGET:
+      return VM_SERVER_INSTRUCTION_LIMIT;
+    case VM_STOP_TIMEOUT:
+      return VM_SERVER_TIMEOUT;
+    case VM_STOP_LOOP:
+      return VM_SERVER_LOOP;
+    case VM_STOP_OUTPUT:
+      return VM_SERVER_OUTPUT_LIMIT;
+    default:
+      return VM_SERVER_ERROR;
+  }
+}
+
+// Run one request whose image and input are in the worker's buffer
+static void vm_server_run(vm_server_worker_t* worker,
+                          const vm_server_request_t* request,
+                          vm_server_response_t* response) {
+  uint64_t start = clock_now_ns();
+  const uint8_t* image_data = worker->buffer;
+  uint64_t key = request->key;
+  if (request->image_size > 0) {
+    key = vm_server_key(image_data, request->image_size);
+  }
+  response->key = key;
+
+  vm_server_image_t* image = vm_server_lookup(worker, key);
+  if (image) {
+    response->flags |= VM_SERVER_CACHE_HIT;
+    vm_server_load(worker->vm, image);
+  } else if (request->image_size == 0) {
+    response->status = VM_SERVER_UNKNOWN_IMAGE;
+    return;
+  } else {
+    image = vm_server_insert(worker, key, image_data, request->image_size);
+    if (!image) {
+      response->status = VM_SERVER_BAD_REQUEST;
+      return;
+    }
+  }
+  image->last_used = ++worker->requests;
+
+  vm_t* vm = worker->vm;
+  vm_io_init_buffered(vm);
+  vm->io.high_water =
+      request->max_output ? request->max_output : VM_SERVER_DEFAULT_OUTPUT;
+  if (vm_io_feed(vm, image_data + request->image_size,
+                 request->input_size) != 0) {
+    response->status = VM_SERVER_BAD_REQUEST;
+    return;
+  }
+  vm_io_close_input(vm);
+  vm_limits_t limits = {
+      .max_instructions = request->max_instructions
+                              ? request->max_instructions
+                              : VM_SERVER_DEFAULT_INSTRUCTIONS,
+      .timeout_ms = request->max_ms,
+      .detect_loops = request->flags & VM_SERVER_DETECT_LOOPS,
+  };
+  vm_limit_set(vm, &limits);
+  uint64_t loaded = clock_now_ns();
+  response->load_ns = loaded - start;
+
+  int result = vm_execute(vm);
+  response->run_ns = clock_now_ns() - loaded;
+  response->status = vm_server_status(vm, result);
+  response->instructions = vm_event_now(vm);
+
+  // The last output trap may have gone past the limit
+  size_t output_size = vm->io.output_length;
+  if (output_size > vm->io.high_water) output_size = vm->io.high_water;
+  response->output_size = (uint32_t)output_size;
+}
+
+// Serve one request. Returns 0 to keep the connection, 1 to close it.
+static int vm_server_handle(vm_server_worker_t* worker, int fd,
+                            const vm_server_request_t* request) {
+  vm_server_response_t response;
+  memset(&response, 0, sizeof(response));
+  memcpy(response.magic, VM_SERVER_RESPONSE_MAGIC, 4);
+
+  // A malformed header leaves no way to find the next request
+  if (memcmp(request->magic, VM_SERVER_REQUEST_MAGIC, 4) != 0 ||
+      request->image_size > VM_SERVER_MAX_IMAGE ||
+      request->input_size > VM_SERVER_MAX_INPUT) {
+    response.status = VM_SERVER_BAD_REQUEST;
+    vm_server_write_full(fd, &response, sizeof(response), NULL, 0);
+    return 1;
+  }
+
+  size_t size = (size_t)request->image_size + request->input_size;
+  if (size > worker->buffer_capacity) {
+    uint8_t* grown = realloc(worker->buffer, size);
+    if (!grown) return 1;
+    worker->buffer = grown;
+    worker->buffer_capacity = size;
+  }
+  if (vm_server_read_full(fd, worker->buffer, size) != 0) return 1;
+
+  vm_server_run(worker, request, &response);
+  const uint8_t* output =
+      response.output_size > 0 ? worker->vm->io.output : NULL;
+  return vm_server_write_full(fd, &response, sizeof(response), output,
+                              response.output_size);
+}
+
+static void vm_server_connection(vm_server_worker_t* worker, int fd) {
+  vm_server_request_t request;
+  while (vm_server_read_full(fd, &request, sizeof(request)) == 0) {
+    if (vm_server_handle(worker, fd, &request) != 0) break;
+  }
+  close(fd);
+}
+
+static int vm_server_worker(int listen_fd) {
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  // A client that disconnects early must not kill the worker
+  signal(SIGPIPE, SIG_IGN);
+
+  vm_server_worker_t worker;
+  memset(&worker, 0, sizeof(worker));
+  worker.vm = vm_create();
+  if (!worker.vm) return 1;
+
+  struct pollfd listener = {.fd = listen_fd, .events = POLLIN};
+  for (;;) {
+    if (poll(&listener, 1, -1) < 0 && errno != EINTR) break;
+    // Every worker wakes up; the ones that lose the race go back to poll
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) vm_server_connection(&worker, fd);
+  }
+
+  for (int i = 0; i < VM_SERVER_CACHE_SIZE; i++) {
+    vm_server_image_free(&worker.cache[i]);
+  }
+  free(worker.buffer);
+  vm_destroy(worker.vm);
+  return 1;
+}
+
+static pid_t vm_server_spawn(int listen_fd) {
+  pid_t pid = fork();
+  if (pid == 0) _exit(vm_server_worker(listen_fd));
+  return pid;
+}
+
+static void vm_server_on_signal(int signo) {
+  (void)signo;
+  vm_server_stopping = 1;
+}
+
+int vm_server_serve(const char* socket_path, int worker_count) {
+  if (worker_count <= 0) worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (worker_count <= 0) worker_count = 1;
+  if (worker_count > VM_SERVER_MAX_WORKERS) {
+    worker_count = VM_SERVER_MAX_WORKERS;
+  }
+
+  int listen_fd = socket_listen_unix(socket_path, VM_SERVER_BACKLOG);
+  if (listen_fd < 0) {
+    perror(socket_path);
+    return 1;
+  }
+
+  // No SA_RESTART, so a signal interrupts wait below
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = vm_server_on_signal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  printf("Serving on %s with %d workers\n", socket_path, worker_count);
+  fflush(stdout);
+
+  pid_t workers[VM_SERVER_MAX_WORKERS];
+  int result = 0;
+  for (int i = 0; i < worker_count; i++) {
+    workers[i] = vm_server_spawn(listen_fd);
+    if (workers[i] < 0) result = 1;
+  }
+
+  while (result == 0 && !vm_server_stopping) {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      result = 1;
+      break;
+    }
+    for (int i = 0; i < worker_count; i++) {
+      if (workers[i] != pid) continue;
+      fprintf(stderr, "Worker %d exited; starting a new one\n", (int)pid);
+      workers[i] = vm_server_spawn(listen_fd);
+      if (workers[i] < 0) result = 1;
+    }
+  }
+
+  for (int i = 0; i < worker_count; i++) {
+    if (workers[i] > 0) kill(workers[i], SIGTERM);
+  }
+  for (int i = 0; i < worker_count; i++) {
+    if (workers[i] > 0) waitpid(workers[i], NULL, 0);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  return result;
+}
+
+int vm_server_call(int fd, const vm_server_request_t* request,
+                   const void* image, const void* input,
+                   vm_server_response_t* response, uint8_t** output) {
+  *output = NULL;
+  if (vm_server_write_full(fd, request, sizeof(*request), image,
+                           request->image_size) != 0 ||
+      (request->input_size > 0 &&
+       vm_server_write_full(fd, input, request->input_size, NULL, 0) != 0) ||
+      vm_server_read_full(fd, response, sizeof(*response)) != 0 ||
+      memcmp(response->magic, VM_SERVER_RESPONSE_MAGIC, 4) != 0) {
+    return 1;
+  }
+
+  *output = malloc(response->output_size + 1);
+  if (!*output ||
+      vm_server_read_full(fd, *output, response->output_size) != 0) {
+    free(*output);
+    *output = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+// Read all of file into a malloc'd buffer
+static uint8_t* vm_server_read_file(FILE* file, size_t* size) {
+  size_t capacity = 4096;
+  uint8_t* data = malloc(capacity);
+  *size = 0;
+  size_t count;
+  while (data && (count = fread(data + *size, 1, capacity - *size, file)) > 0) {
+    *size += count;
+    if (*size < capacity) continue;
+    capacity *= 2;
+    uint8_t* grown = realloc(data, capacity);
+    if (!grown) free(data);
+    data = grown;
+  }
+  return data;
+}
+
+static const char* vm_server_status_name(uint32_t status) {
+  switch (status) {
+    case VM_SERVER_HALT:
+      return "halted";
+    case VM_SERVER_ERROR:
+      return "stopped on an error";
+    case VM_SERVER_INSTRUCTION_LIMIT:
+      return "ran out of instructions";
+    case VM_SERVER_OUTPUT_LIMIT:
+      return "reached the output limit";
+    case VM_SERVER_UNKNOWN_IMAGE:
+      return "was not cached";
+    case VM_SERVER_TIMEOUT:
+      return "ran out of time";
+    case VM_SERVER_LOOP:
+      return "was stuck in an infinite loop";
+    default:
+      return "was rejected";
+  }
+}
+
+int vm_server_request(const char* socket_path, const char* filename) {
+  FILE* file = fopen(filename, "rb");
+  size_t image_size = 0;
+  uint8_t* image = file ? vm_server_read_file(file, &image_size) : NULL;
+  if (file) fclose(file);
+  size_t input_size = 0;
+  uint8_t* input = vm_server_read_file(stdin, &input_size);
+  int fd = socket_connect_unix(socket_path);
+  if (!image || !input || fd < 0 || image_size > VM_SERVER_MAX_IMAGE ||
+      input_size > VM_SERVER_MAX_INPUT) {
+    fprintf(stderr, "Error: Could not send %s to %s\n", filename, socket_path);
+    if (fd >= 0) close(fd);
+    free(image);
+    free(input);
+    return -1;
+  }
+
+  // Try the key alone first; the image only goes out on a miss
+  vm_server_request_t request;
+  memset(&request, 0, sizeof(request));
+  memcpy(request.magic, VM_SERVER_REQUEST_MAGIC, 4);
+  request.key = vm_server_key(image, image_size);
+  request.input_size = (uint32_t)input_size;
+  vm_server_response_t response;
+  uint8_t* output = NULL;
+  int result = vm_server_call(fd, &request, NULL, input, &response, &output);
+  if (result == 0 && response.status == VM_SERVER_UNKNOWN_IMAGE) {
+    free(output);
+    request.image_size = (uint32_t)image_size;
+    result = vm_server_call(fd, &request, image, input, &response, &output);
+  }
+  close(fd);
+  free(image);
+  free(input);
+  if (result != 0) {
+    fprintf(stderr, "Error: No response from %s\n", socket_path);
+    return -1;
+  }
+
+  fwrite(output, 1, response.output_size, stdout);
+  fflush(stdout);
+  free(output);
+  if (response.status != VM_SERVER_HALT) {
+    fprintf(stderr, "> Program %s after %llu instructions\n",
+            vm_server_status_name(response.status),
+            (unsigned long long)response.instructions);
+  }
+  return (int)response.status;
+}
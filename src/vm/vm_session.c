@@ -0,0 +1,408 @@
+#define _GNU_SOURCE  // EPOLLEXCLUSIVE
+
+#include "../../include/vm/vm_session.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../../include/util/socket.h"
+#include "../../include/vm/vm_event.h"
+#include "../../include/vm/vm_io.h"
+
+#define VM_LOOP_EVENTS 64
+#define VM_SESSION_BACKLOG 128
+#define VM_SESSION_MAX_LOOPS 64
+
+typedef struct vm_session vm_session_t;
+
+// An fd the loop waits on. The listening socket's watch has no session.
+typedef struct {
+  vm_session_t* session;
+  int fd;
+  uint32_t events;  // Registered with epoll; 0 when not registered
+} vm_watch_t;
+
+struct vm_session {
+  vm_t* vm;
+  vm_watch_t in;
+  vm_watch_t out;
+  bool queued;    // On the run queue
+  bool finished;  // The program stopped; only its output is left
+  bool closed;    // Waiting to be freed
+  vm_session_t* next;  // Run queue or dead list
+  vm_session_t* prev_all;
+  vm_session_t* next_all;
+};
+
+struct vm_loop {
+  int epoll_fd;
+  uint64_t quantum;
+  // Sessions ready to run, in the order they became ready
+  vm_session_t* run_head;
+  vm_session_t* run_tail;
+  int run_count;
+  // Closed sessions that are freed once no event can refer to them
+  vm_session_t* dead;
+  vm_session_t* all;
+  int session_count;
+  int failures;
+  vm_watch_t listen;
+  vm_session_create_fn create;
+  void* create_arg;
+};
+
+vm_loop_t* vm_loop_create(uint64_t quantum) {
+  vm_loop_t* loop = calloc(1, sizeof(vm_loop_t));
+  if (!loop) return NULL;
+  loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epoll_fd < 0) {
+    free(loop);
+    return NULL;
+  }
+  loop->quantum = quantum ? quantum : VM_SESSION_QUANTUM;
+  loop->listen.fd = -1;
+  return loop;
+}
+
+// Register the events the loop waits for on a watch. Unwatched fds are
+// taken out of epoll entirely so hangups are not reported over and over.
+static void vm_watch_set(vm_loop_t* loop, vm_watch_t* watch, uint32_t events) {
+  if (watch->fd < 0 || watch->events == events) return;
+  struct epoll_event event = {.events = events, .data.ptr = watch};
+  if (events == 0) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+  } else {
+    int op = watch->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(loop->epoll_fd, op, watch->fd, &event) != 0) return;
+  }
+  watch->events = events;
+}
+
+static void vm_watch_close(vm_loop_t* loop, vm_watch_t* watch) {
+  vm_watch_set(loop, watch, 0);
+  if (watch->fd >= 0) close(watch->fd);
+  watch->fd = -1;
+}
+
+static void vm_session_free(vm_session_t* session) {
+  vm_destroy(session->vm);
+  free(session);
+}
+
+static void vm_session_enqueue(vm_loop_t* loop, vm_session_t* session) {
+  if (session->queued || session->closed) return;
+  session->queued = true;
+  session->next = NULL;
+  if (loop->run_tail) {
+    loop->run_tail->next = session;
+  } else {
+    loop->run_head = session;
+  }
+  loop->run_tail = session;
+  loop->run_count++;
+}
+
+static vm_session_t* vm_session_dequeue(vm_loop_t* loop) {
+  vm_session_t* session = loop->run_head;
+  loop->run_head = session->next;
+  if (!loop->run_head) loop->run_tail = NULL;
+  loop->run_count--;
+  session->queued = false;
+  return session;
+}
+
+// Close the fds now; the memory goes once nothing refers to the session
+static void vm_session_close(vm_loop_t* loop, vm_session_t* session) {
+  if (session->closed) return;
+  session->closed = true;
+  vm_watch_close(loop, &session->in);
+  vm_watch_close(loop, &session->out);
+
+  if (session->prev_all) {
+    session->prev_all->next_all = session->next_all;
+  } else {
+    loop->all = session->next_all;
+  }
+  if (session->next_all) session->next_all->prev_all = session->prev_all;
+  loop->session_count--;
+
+  // A queued session is freed when it reaches the front of the run queue
+  if (!session->queued) {
+    session->next = loop->dead;
+    loop->dead = session;
+  }
+}
+
+// Write as much buffered output as the fd takes. Returns false if the
+// session was closed because the peer went away.
+static bool vm_session_write(vm_loop_t* loop, vm_session_t* session) {
+  vm_t* vm = session->vm;
+  while (vm->io.output_length > 0) {
+    ssize_t written = write(session->out.fd, vm->io.output,
+                            vm->io.output_length);
+    if (written > 0) {
+      vm_io_consume_output(vm, (size_t)written);
+    } else if (written < 0 && errno == EINTR) {
+      continue;
+    } else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      vm_session_close(loop, session);
+      return false;
+    }
+  }
+  return true;
+}
+
+static size_t vm_session_unread(const vm_session_t* session) {
+  const vm_io_t* io = &session->vm->io;
+  return io->input_length - io->input_start;
+}
+
+// Wait for what the session needs next, queue it if it can go on, and close
+// it once a stopped program's output is all written
+static void vm_session_update(vm_loop_t* loop, vm_session_t* session) {
+  vm_t* vm = session->vm;
+  bool wants_input = vm_session_unread(session) < VM_SESSION_INPUT_MAX;
+  vm_watch_set(loop, &session->in, wants_input ? EPOLLIN : 0);
+  vm_watch_set(loop, &session->out, vm->io.output_length > 0 ? EPOLLOUT : 0);
+
+  if (session->finished) {
+    if (vm->io.output_length == 0) vm_session_close(loop, session);
+    return;
+  }
+  if ((vm->stop == VM_STOP_INPUT && vm_io_key_ready(vm)) ||
+      (vm->stop == VM_STOP_OUTPUT && vm_io_can_write(vm))) {
+    vm_session_enqueue(loop, session);
+  }
+}
+
+static void vm_session_read(vm_loop_t* loop, vm_session_t* session) {
+  char buffer[VM_SESSION_INPUT_MAX];
+  ssize_t count = read(session->in.fd, buffer, sizeof(buffer));
+  if (count < 0 &&
+      (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  if (count > 0 && vm_io_feed(session->vm, buffer, (size_t)count) == 0) {
+    vm_session_update(loop, session);
+    return;
+  }
+  // End of input, a read error, or no memory for the input
+  vm_io_close_input(session->vm);
+  vm_watch_close(loop, &session->in);
+  vm_session_update(loop, session);
+}
+
+static void vm_session_run(vm_loop_t* loop, vm_session_t* session) {
+  vm_t* vm = session->vm;
+  vm_event_schedule(vm, VM_EVENT_QUANTUM, loop->quantum);
+  int result = vm_execute(vm);
+  vm_event_cancel(vm, VM_EVENT_QUANTUM);
+
+  switch (vm->stop) {
+    case VM_STOP_QUANTUM:
+      vm_session_enqueue(loop, session);
+      break;
+    case VM_STOP_INPUT:
+    case VM_STOP_OUTPUT:
+      break;  // Resumed by vm_session_update once the fds are ready
+    default:
+      // HALT, an error or a run limit: the program is done
+      session->finished = true;
+      if (result != 0 || vm->stop != VM_STOP_HALT) loop->failures++;
+      break;
+  }
+  if (vm_session_write(loop, session)) vm_session_update(loop, session);
+}
+
+int vm_loop_add(vm_loop_t* loop, vm_t* vm, int in_fd, int out_fd) {
+  vm_session_t* session = calloc(1, sizeof(vm_session_t));
+  if (!session) return 1;
+
+  // Separate fds for a socket let each direction be watched on its own
+  int own_out_fd = in_fd == out_fd ? dup(out_fd) : out_fd;
+  if (own_out_fd < 0 || socket_set_nonblocking(in_fd) != 0 ||
+      socket_set_nonblocking(own_out_fd) != 0) {
+    if (own_out_fd >= 0 && own_out_fd != out_fd) close(own_out_fd);
+    free(session);
+    return 1;
+  }
+
+  vm_io_init_buffered(vm);
+  session->vm = vm;
+  session->in = (vm_watch_t){.session = session, .fd = in_fd};
+  session->out = (vm_watch_t){.session = session, .fd = own_out_fd};
+  session->next_all = loop->all;
+  if (loop->all) loop->all->prev_all = session;
+  loop->all = session;
+  loop->session_count++;
+
+  vm_session_enqueue(loop, session);
+  vm_session_update(loop, session);
+  return 0;
+}
+
+int vm_loop_listen(vm_loop_t* loop, int listen_fd, vm_session_create_fn create,
+                   void* arg) {
+  loop->listen = (vm_watch_t){.session = NULL, .fd = listen_fd};
+  loop->create = create;
+  loop->create_arg = arg;
+  // Only one of the loops sharing the socket is woken per connection
+  struct epoll_event event = {.events = EPOLLIN | EPOLLEXCLUSIVE,
+                              .data.ptr = &loop->listen};
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+    loop->listen.fd = -1;
+    return 1;
+  }
+  loop->listen.events = event.events;
+  return 0;
+}
+
+static void vm_loop_accept(vm_loop_t* loop) {
+  for (;;) {
+    int fd = accept(loop->listen.fd, NULL, NULL);
+    if (fd < 0) return;  // Nothing left, or another loop took it
+
+    vm_t* vm = loop->create(loop->create_arg);
+    if (!vm || vm_loop_add(loop, vm, fd, fd) != 0) {
+      vm_destroy(vm);
+      close(fd);
+    }
+  }
+}
+
+static void vm_loop_handle(vm_loop_t* loop, const struct epoll_event* event) {
+  vm_watch_t* watch = event->data.ptr;
+  if (watch == &loop->listen) {
+    vm_loop_accept(loop);
+    return;
+  }
+
+  vm_session_t* session = watch->session;
+  if (session->closed) return;
+  if (watch == &session->in) {
+    vm_session_read(loop, session);
+  } else if (event->events & (EPOLLERR | EPOLLHUP)) {
+    vm_session_close(loop, session);  // Nobody reads the output any more
+  } else if (vm_session_write(loop, session)) {
+    vm_session_update(loop, session);
+  }
+}
+
+static void vm_loop_free_dead(vm_loop_t* loop) {
+  while (loop->dead) {
+    vm_session_t* session = loop->dead;
+    loop->dead = session->next;
+    vm_session_free(session);
+  }
+}
+
+int vm_loop_run(vm_loop_t* loop) {
+  struct epoll_event events[VM_LOOP_EVENTS];
+  while (loop->session_count > 0 || loop->listen.fd >= 0) {
+    // One turn for each session that was ready when the round began
+    for (int ready = loop->run_count; ready > 0; ready--) {
+      vm_session_t* session = vm_session_dequeue(loop);
+      if (session->closed) {
+        vm_session_free(session);
+      } else {
+        vm_session_run(loop, session);
+      }
+    }
+    vm_loop_free_dead(loop);
+    if (loop->session_count == 0 && loop->listen.fd < 0) break;
+
+    // Only block when every session waits on its fds
+    int timeout = loop->run_head ? 0 : -1;
+    int count = epoll_wait(loop->epoll_fd, events, VM_LOOP_EVENTS, timeout);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    for (int i = 0; i < count; i++) vm_loop_handle(loop, &events[i]);
+    vm_loop_free_dead(loop);
+  }
+  return 0;
+}
+
+int vm_loop_failures(const vm_loop_t* loop) { return loop->failures; }
+
+void vm_loop_destroy(vm_loop_t* loop) {
+  if (!loop) return;
+  while (loop->all) vm_session_close(loop, loop->all);
+  while (loop->run_head) vm_session_free(vm_session_dequeue(loop));
+  vm_loop_free_dead(loop);
+  close(loop->epoll_fd);
+  free(loop);
+}
+
+// Every connection runs its own copy of the loaded program
+static vm_t* vm_session_clone(void* arg) { return vm_clone(arg); }
+
+static void* vm_session_thread(void* arg) {
+  return (void*)(intptr_t)vm_loop_run(arg);
+}
+
+int vm_session_serve(const char* socket_path, const char* filename,
+                     int loop_count) {
+  if (loop_count <= 0) loop_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (loop_count <= 0) loop_count = 1;
+  if (loop_count > VM_SESSION_MAX_LOOPS) loop_count = VM_SESSION_MAX_LOOPS;
+
+  vm_t* program = vm_create();
+  if (!program || vm_load_file(program, filename) != 0) {
+    fprintf(stderr, "Error: Could not initialize VM with file %s\n", filename);
+    vm_destroy(program);
+    return 1;
+  }
+  int listen_fd = socket_listen_unix(socket_path, VM_SESSION_BACKLOG);
+  if (listen_fd < 0) {
+    perror(socket_path);
+    vm_destroy(program);
+    return 1;
+  }
+  // A client that disconnects early must not take the server down
+  signal(SIGPIPE, SIG_IGN);
+
+  vm_loop_t* loops[VM_SESSION_MAX_LOOPS] = {NULL};
+  pthread_t threads[VM_SESSION_MAX_LOOPS];
+  bool started[VM_SESSION_MAX_LOOPS] = {false};
+  int result = 0;
+  for (int i = 0; i < loop_count && result == 0; i++) {
+    loops[i] = vm_loop_create(VM_SESSION_QUANTUM);
+    if (!loops[i] ||
+        vm_loop_listen(loops[i], listen_fd, vm_session_clone, program) != 0) {
+      result = 1;
+    }
+  }
+  if (result == 0) {
+    printf("Serving %s on %s with %d loops\n", filename, socket_path,
+           loop_count);
+    fflush(stdout);
+    // The calling thread runs loop 0
+    for (int i = 1; i < loop_count; i++) {
+      started[i] = pthread_create(&threads[i], NULL, vm_session_thread,
+                                  loops[i]) == 0;
+    }
+    result = vm_loop_run(loops[0]);
+    for (int i = 1; i < loop_count; i++) {
+      if (started[i]) pthread_join(threads[i], NULL);
+    }
+  }
+  if (result != 0) {
+    fprintf(stderr, "Error: Could not serve on %s\n", socket_path);
+  }
+
+  for (int i = 0; i < loop_count; i++) vm_loop_destroy(loops[i]);
+  close(listen_fd);
+  vm_destroy(program);
+  return result;
+}
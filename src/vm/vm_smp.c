@@ -0,0 +1,144 @@
+#include "../../include/vm/vm_smp.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/vm/vm_cache.h"
+#include "../../include/vm/vm_coverage.h"
+#include "../../include/vm/vm_cycles.h"
+#include "../../include/vm/vm_event.h"
+#include "../../include/vm/vm_limit.h"
+#include "../../include/vm/vm_profile.h"
+#include "../../include/vm/vm_stats.h"
+
+vm_smp_t* vm_smp_create(int hart_count) {
+  if (hart_count < 1 || hart_count > VM_SMP_MAX_HARTS) return NULL;
+
+  vm_smp_t* smp = calloc(1, sizeof(vm_smp_t));
+  if (!smp) return NULL;
+  smp->memory = calloc(LC3_MEMORY_MAX, sizeof(uint16_t));
+  if (!smp->memory) {
+    free(smp);
+    return NULL;
+  }
+
+  for (int i = 0; i < hart_count; i++) {
+    vm_t* hart = vm_create_shared(smp->memory);
+    if (!hart) {
+      vm_smp_destroy(smp);
+      return NULL;
+    }
+    hart->hart_id = (uint16_t)i;
+    hart->hart_count = (uint16_t)hart_count;
+    hart->saved_ssp = LC3_SSP_START - i * VM_SMP_STACK_SIZE;
+    smp->harts[smp->hart_count++] = hart;
+  }
+  return smp;
+}
+
+void vm_smp_destroy(vm_smp_t* smp) {
+  if (!smp) return;
+  for (int i = 0; i < smp->hart_count; i++) vm_destroy(smp->harts[i]);
+  free(smp->memory);
+  free(smp);
+}
+
+int vm_smp_load_file(vm_smp_t* smp, const char* filename) {
+  vm_t* first = smp->harts[0];
+  if (vm_load_file(first, filename) != 0) return 1;
+
+  // Recognized loops run as plain, non-atomic C; with other harts writing
+  // the same memory every loop is interpreted instead
+  memset(first->idiom_at, 0, sizeof(first->idiom_at));
+  first->idiom_count = 0;
+  return 0;
+}
+
+static void* vm_smp_thread(void* arg) {
+  vm_t* hart = arg;
+  intptr_t result = vm_execute(hart);
+  return (void*)result;
+}
+
+static void vm_smp_execute_threads(vm_smp_t* smp) {
+  pthread_t threads[VM_SMP_MAX_HARTS];
+  bool started[VM_SMP_MAX_HARTS];
+
+  // The calling thread runs hart 0
+  for (int i = 1; i < smp->hart_count; i++) {
+    started[i] = pthread_create(&threads[i], NULL, vm_smp_thread,
+                                smp->harts[i]) == 0;
+    if (!started[i]) {
+      fprintf(stderr, "Error: Could not start hart %d\n", i);
+      smp->results[i] = 1;
+    }
+  }
+  smp->results[0] = vm_execute(smp->harts[0]);
+  for (int i = 1; i < smp->hart_count; i++) {
+    void* result;
+    if (started[i] && pthread_join(threads[i], &result) == 0) {
+      smp->results[i] = (int)(intptr_t)result;
+    }
+  }
+}
+
+static void vm_smp_execute_round_robin(vm_smp_t* smp, uint64_t quantum) {
+  bool done[VM_SMP_MAX_HARTS] = {false};
+  int remaining = smp->hart_count;
+  while (remaining > 0) {
+    for (int i = 0; i < smp->hart_count; i++) {
+      if (done[i]) continue;
+      vm_t* hart = smp->harts[i];
+      vm_event_schedule(hart, VM_EVENT_QUANTUM, quantum);
+      int result = vm_execute(hart);
+      if (hart->stop == VM_STOP_QUANTUM) continue;
+
+      vm_event_cancel(hart, VM_EVENT_QUANTUM);
+      smp->results[i] = result;
+      done[i] = true;
+      remaining--;
+    }
+  }
+}
+
+int vm_smp_execute(vm_smp_t* smp, uint64_t quantum) {
+  if (quantum == 0) {
+    vm_smp_execute_threads(smp);
+  } else {
+    vm_smp_execute_round_robin(smp, quantum);
+  }
+
+  for (int i = 0; i < smp->hart_count; i++) {
+    smp->results[i] = vm_limit_exit_code(smp->harts[i], smp->results[i]);
+  }
+  for (int i = 0; i < smp->hart_count; i++) {
+    if (smp->results[i] != 0) return smp->results[i];
+  }
+  return 0;
+}
+
+int vm_smp_run(const char* filename, int hart_count, uint64_t quantum) {
+  vm_smp_t* smp = vm_smp_create(hart_count);
+  if (!smp || vm_smp_load_file(smp, filename) != 0) {
+    fprintf(stderr, "Error: Could not initialize %d harts with file %s\n",
+            hart_count, filename);
+    vm_smp_destroy(smp);
+    return 1;
+  }
+  vm_stats_attach(smp->harts, smp->hart_count);
+  vm_coverage_attach(smp->harts, smp->hart_count);
+  vm_cache_attach(smp->harts, smp->hart_count);
+  vm_cycles_attach(smp->harts, smp->hart_count);
+  vm_profile_attach(smp->harts, smp->hart_count);
+  int result = vm_smp_execute(smp, quantum);
+  vm_stats_detach();
+  vm_coverage_detach();
+  vm_cache_detach();
+  vm_cycles_detach();
+  vm_profile_detach();
+  vm_smp_destroy(smp);
+  return result;
+}
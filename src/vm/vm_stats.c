@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../include/vm/vm_stats.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/util/clock.h"
+#include "../../include/util/file.h"
+#include "../../include/vm/vm_event.h"
+
+static const char* const vm_stats_opcode_names[16] = {
+    "BR",  "ADD", "LD",  "ST",  "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP",
+};
+
+static vm_stats_format_t vm_stats_format = VM_STATS_OFF;
+static const char* vm_stats_path = NULL;
+static vm_t** vm_stats_vms = NULL;
+static int vm_stats_count = 0;
+static volatile sig_atomic_t vm_stats_requested = 0;
+static struct sigaction vm_stats_old_action;
+
+int vm_stats_parse_format(const char* name, vm_stats_format_t* format) {
+  if (strcmp(name, "text") == 0) {
+    *format = VM_STATS_TEXT;
+  } else if (strcmp(name, "json") == 0) {
+    *format = VM_STATS_JSON;
+  } else if (strcmp(name, "prometheus") == 0) {
+    *format = VM_STATS_PROMETHEUS;
+  } else {
+    return 1;
+  }
+  return 0;
+}
+
+void vm_stats_configure(vm_stats_format_t format, const char* path) {
+  if (path && format == VM_STATS_OFF) format = VM_STATS_TEXT;
+  vm_stats_format = format;
+  vm_stats_path = path;
+}
+
+static uint64_t vm_stats_instructions(const vm_t* vm) {
+  return vm_event_now(vm);
+}
+
+static double vm_stats_mips(const vm_t* vm) {
+  if (vm->stats.run_ns == 0) return 0.0;
+  double instructions = (double)vm_stats_instructions(vm);
+  return instructions * 1000.0 / (double)vm->stats.run_ns;
+}
+
+static void vm_stats_write_text(FILE* out, vm_t* const* vms, int count) {
+  for (int h = 0; h < count; h++) {
+    const vm_t* vm = vms[h];
+    const vm_stats_t* s = &vm->stats;
+    fprintf(out, "Hart %d\n", vm->hart_id);
+    fprintf(out, "  Instructions      %14llu\n",
+            (unsigned long long)vm_stats_instructions(vm));
+    fprintf(out, "  Load time         %14.3f ms\n", s->load_ns / 1e6);
+    fprintf(out, "  Run time          %14.3f ms\n", s->run_ns / 1e6);
+    fprintf(out, "  MIPS              %14.1f\n", vm_stats_mips(vm));
+    fprintf(out, "  Memory reads      %14llu\n",
+            (unsigned long long)s->memory_reads);
+    fprintf(out, "  Memory writes     %14llu\n",
+            (unsigned long long)s->memory_writes);
+    fprintf(out, "  Branches taken    %14llu\n",
+            (unsigned long long)s->branches_taken);
+    fprintf(out, "  Branches not taken%14llu\n",
+            (unsigned long long)s->branches_not_taken);
+    for (int op = 0; op < 16; op++) {
+      if (!s->opcodes[op]) continue;
+      fprintf(out, "  %-18s%14llu\n", vm_stats_opcode_names[op],
+              (unsigned long long)s->opcodes[op]);
+    }
+    for (int vect = 0; vect < LC3_TRAP_COUNT; vect++) {
+      if (!s->traps[vect]) continue;
+      fprintf(out, "  TRAP x%02X          %14llu\n", vect,
+              (unsigned long long)s->traps[vect]);
+    }
+  }
+}
+
+static void vm_stats_write_json(FILE* out, vm_t* const* vms, int count) {
+  fprintf(out, "{\"harts\": [");
+  for (int h = 0; h < count; h++) {
+    const vm_t* vm = vms[h];
+    const vm_stats_t* s = &vm->stats;
+    fprintf(out, "%s\n  {\"hart\": %d, \"instructions\": %llu, ",
+            h ? "," : "", vm->hart_id,
+            (unsigned long long)vm_stats_instructions(vm));
+    fprintf(out, "\"load_ns\": %llu, \"run_ns\": %llu, \"mips\": %.3f,\n",
+            (unsigned long long)s->load_ns, (unsigned long long)s->run_ns,
+            vm_stats_mips(vm));
+    fprintf(out,
+            "   \"memory_reads\": %llu, \"memory_writes\": %llu, "
+            "\"branches_taken\": %llu, \"branches_not_taken\": %llu,\n",
+            (unsigned long long)s->memory_reads,
+            (unsigned long long)s->memory_writes,
+            (unsigned long long)s->branches_taken,
+            (unsigned long long)s->branches_not_taken);
+    fprintf(out, "   \"opcodes\": {");
+    for (int op = 0; op < 16; op++) {
+      fprintf(out, "%s\"%s\": %llu", op ? ", " : "",
+              vm_stats_opcode_names[op], (unsigned long long)s->opcodes[op]);
+    }
+    fprintf(out, "},\n   \"traps\": {");
+    bool first = true;
+    for (int vect = 0; vect < LC3_TRAP_COUNT; vect++) {
+      if (!s->traps[vect]) continue;
+      fprintf(out, "%s\"x%02X\": %llu", first ? "" : ", ", vect,
+              (unsigned long long)s->traps[vect]);
+      first = false;
+    }
+    fprintf(out, "}}");
+  }
+  fprintf(out, "\n]}\n");
+}
+
+// One metric family: HELP and TYPE, then a sample per hart
+#define VM_STATS_PROMETHEUS_FAMILY(out, name, type, help) \
+  fprintf(out, "# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+static void vm_stats_write_prometheus(FILE* out, vm_t* const* vms,
+                                      int count) {
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_instructions_total", "counter",
+                             "Instructions retired.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_instructions_total{hart=\"%d\"} %llu\n",
+            vms[h]->hart_id,
+            (unsigned long long)vm_stats_instructions(vms[h]));
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_opcode_total", "counter",
+                             "Instructions interpreted by opcode.");
+  for (int h = 0; h < count; h++) {
+    for (int op = 0; op < 16; op++) {
+      fprintf(out, "lc3_opcode_total{hart=\"%d\",opcode=\"%s\"} %llu\n",
+              vms[h]->hart_id, vm_stats_opcode_names[op],
+              (unsigned long long)vms[h]->stats.opcodes[op]);
+    }
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_trap_total", "counter",
+                             "Traps by vector.");
+  for (int h = 0; h < count; h++) {
+    for (int vect = 0; vect < LC3_TRAP_COUNT; vect++) {
+      if (!vms[h]->stats.traps[vect]) continue;
+      fprintf(out, "lc3_trap_total{hart=\"%d\",vector=\"x%02X\"} %llu\n",
+              vms[h]->hart_id, vect,
+              (unsigned long long)vms[h]->stats.traps[vect]);
+    }
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_branches_total", "counter",
+                             "Conditional branches.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_branches_total{hart=\"%d\",taken=\"true\"} %llu\n",
+            vms[h]->hart_id,
+            (unsigned long long)vms[h]->stats.branches_taken);
+    fprintf(out, "lc3_branches_total{hart=\"%d\",taken=\"false\"} %llu\n",
+            vms[h]->hart_id,
+            (unsigned long long)vms[h]->stats.branches_not_taken);
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_memory_reads_total", "counter",
+                             "Data memory reads.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_memory_reads_total{hart=\"%d\"} %llu\n",
+            vms[h]->hart_id,
+            (unsigned long long)vms[h]->stats.memory_reads);
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_memory_writes_total", "counter",
+                             "Data memory writes.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_memory_writes_total{hart=\"%d\"} %llu\n",
+            vms[h]->hart_id,
+            (unsigned long long)vms[h]->stats.memory_writes);
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_load_seconds", "gauge",
+                             "Time spent loading the program.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_load_seconds{hart=\"%d\"} %.9f\n", vms[h]->hart_id,
+            vms[h]->stats.load_ns / 1e9);
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_run_seconds", "gauge",
+                             "Time spent executing.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_run_seconds{hart=\"%d\"} %.9f\n", vms[h]->hart_id,
+            vms[h]->stats.run_ns / 1e9);
+  }
+  VM_STATS_PROMETHEUS_FAMILY(out, "lc3_mips", "gauge",
+                             "Millions of instructions per second of run "
+                             "time.");
+  for (int h = 0; h < count; h++) {
+    fprintf(out, "lc3_mips{hart=\"%d\"} %.3f\n", vms[h]->hart_id,
+            vm_stats_mips(vms[h]));
+  }
+}
+
+int vm_stats_write(FILE* out, vm_t* const* vms, int count,
+                   vm_stats_format_t format) {
+  switch (format) {
+    case VM_STATS_TEXT:
+      vm_stats_write_text(out, vms, count);
+      break;
+    case VM_STATS_JSON:
+      vm_stats_write_json(out, vms, count);
+      break;
+    case VM_STATS_PROMETHEUS:
+      vm_stats_write_prometheus(out, vms, count);
+      break;
+    case VM_STATS_OFF:
+      break;
+  }
+  return ferror(out) ? 1 : 0;
+}
+
+// Write the report on the attached VMs where it was configured to go
+static void vm_stats_report(void) {
+  if (!vm_stats_path) {
+    vm_stats_write(stderr, vm_stats_vms, vm_stats_count, vm_stats_format);
+    return;
+  }
+
+  char* buffer = NULL;
+  size_t size = 0;
+  FILE* out = open_memstream(&buffer, &size);
+  if (!out) {
+    fprintf(stderr, "Error: Could not format statistics\n");
+    return;
+  }
+  int result =
+      vm_stats_write(out, vm_stats_vms, vm_stats_count, vm_stats_format);
+  if (fclose(out) != 0) result = 1;
+  if (result != 0 || file_write_atomic(vm_stats_path, buffer, size) != 0) {
+    fprintf(stderr, "Error: Could not write statistics to %s\n",
+            vm_stats_path);
+  }
+  free(buffer);
+}
+
+static void vm_stats_on_signal(int signal) {
+  (void)signal;
+  vm_stats_requested = 1;
+}
+
+void vm_stats_attach(vm_t* const* vms, int count) {
+  if (vm_stats_format == VM_STATS_OFF) return;
+
+  vm_stats_vms = malloc(count * sizeof(vm_t*));
+  if (!vm_stats_vms) return;
+  memcpy(vm_stats_vms, vms, count * sizeof(vm_t*));
+  vm_stats_count = count;
+  if (!vm_stats_path) return;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = vm_stats_on_signal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, &vm_stats_old_action);
+  for (int i = 0; i < count; i++) {
+    vm_event_schedule(vms[i], VM_EVENT_STATS, VM_STATS_POLL_INTERVAL);
+  }
+}
+
+void vm_stats_detach(void) {
+  if (!vm_stats_vms) return;
+
+  vm_stats_report();
+  if (vm_stats_path) sigaction(SIGUSR1, &vm_stats_old_action, NULL);
+  free(vm_stats_vms);
+  vm_stats_vms = NULL;
+  vm_stats_count = 0;
+}
+
+void vm_stats_event(vm_t* vm) {
+  if (!vm_stats_vms) return;
+  vm_event_schedule(vm, VM_EVENT_STATS, VM_STATS_POLL_INTERVAL);
+  // Keep the run time of a running VM current for reports
+  uint64_t now_ns = clock_now_ns();
+  vm->stats.run_ns += now_ns - vm->stats.run_start_ns;
+  vm->stats.run_start_ns = now_ns;
+  // Several harts may see the same request; only one of them reports
+  if (__atomic_exchange_n(&vm_stats_requested, 0, __ATOMIC_ACQ_REL)) {
+    vm_stats_report();
+  }
+}
@@ -0,0 +1,118 @@
+#include "../../include/vm/vm_trap.h"
+
+#include <string.h>
+
+#include "../../include/vm/vm_exec.h"
+
+void vm_trap_register(vm_t* vm, uint8_t vector, vm_trap_fn handler) {
+  vm->traps[vector] = handler;
+}
+
+void vm_trap_register_extensions(vm_t* vm) {
+  vm_trap_register(vm, LC3_TRAP_MUL, vm_trap_mul);
+  vm_trap_register(vm, LC3_TRAP_DIVMOD, vm_trap_divmod);
+  vm_trap_register(vm, LC3_TRAP_MEMCPY, vm_trap_memcpy);
+  vm_trap_register(vm, LC3_TRAP_MEMSET, vm_trap_memset);
+  vm_trap_register(vm, LC3_TRAP_ADD32, vm_trap_add32);
+  vm_trap_register(vm, LC3_TRAP_CAS, vm_trap_cas);
+}
+
+bool vm_trap_available(const vm_t* vm, uint8_t vector) {
+  if (vector >= LC3_TRAP_GETC && vector <= LC3_TRAP_HALT) return true;
+  return vector == LC3_TRAP_HASTRAP || vm->traps[vector] != NULL;
+}
+
+// Set the condition codes from a 32-bit result held in R1:R0
+static void vm_trap_update_flags32(vm_t* vm, uint32_t value) {
+  if (value == 0) {
+    vm->reg[LC3_R_COND] = LC3_FL_ZRO;
+  } else if (value >> 31) {
+    vm->reg[LC3_R_COND] = LC3_FL_NEG;
+  } else {
+    vm->reg[LC3_R_COND] = LC3_FL_POS;
+  }
+}
+
+static void vm_trap_set_pair(vm_t* vm, uint32_t value) {
+  vm->reg[LC3_R_R0] = value & 0xFFFF;
+  vm->reg[LC3_R_R1] = value >> 16;
+  vm_trap_update_flags32(vm, value);
+}
+
+void vm_trap_mul(vm_t* vm) {
+  int32_t product = (int32_t)(int16_t)vm->reg[LC3_R_R0] *
+                    (int32_t)(int16_t)vm->reg[LC3_R_R1];
+  vm_trap_set_pair(vm, (uint32_t)product);
+}
+
+void vm_trap_divmod(vm_t* vm) {
+  int32_t dividend = (int16_t)vm->reg[LC3_R_R0];
+  int32_t divisor = (int16_t)vm->reg[LC3_R_R1];
+
+  // Division by zero gives quotient 0 and the dividend as the remainder.
+  // Promoting to 32 bits makes -32768 / -1 wrap instead of trapping.
+  int32_t quotient = divisor ? dividend / divisor : 0;
+  int32_t remainder = divisor ? dividend % divisor : dividend;
+  vm->reg[LC3_R_R0] = (uint16_t)quotient;
+  vm->reg[LC3_R_R1] = (uint16_t)remainder;
+  vm_update_flags(vm, LC3_R_R0);
+}
+
+void vm_trap_memcpy(vm_t* vm) {
+  uint16_t dst = vm->reg[LC3_R_R0];
+  uint16_t src = vm->reg[LC3_R_R1];
+  uint32_t count = vm->reg[LC3_R_R2];
+
+  // Ranges that stay below the device registers are one memmove
+  if (dst + count <= LC3_MR_KBSR && src + count <= LC3_MR_KBSR) {
+    memmove(vm->memory + dst, vm->memory + src, count * sizeof(uint16_t));
+    return;
+  }
+
+  // Otherwise copy word by word as loads and stores would, so device
+  // registers see each access; backwards when dst overlaps the end of src
+  if ((uint16_t)(dst - src) < count) {
+    for (uint32_t i = count; i-- > 0;) {
+      vm_mem_write(vm, (uint16_t)(dst + i),
+                   vm_mem_read(vm, (uint16_t)(src + i)));
+    }
+  } else {
+    for (uint32_t i = 0; i < count; i++) {
+      vm_mem_write(vm, (uint16_t)(dst + i),
+                   vm_mem_read(vm, (uint16_t)(src + i)));
+    }
+  }
+}
+
+void vm_trap_memset(vm_t* vm) {
+  uint16_t dst = vm->reg[LC3_R_R0];
+  uint16_t value = vm->reg[LC3_R_R1];
+  uint32_t count = vm->reg[LC3_R_R2];
+
+  // A fill that stays below the device registers is a plain loop; one that
+  // reaches them (or wraps past xFFFF) stores word by word like ST would
+  if (dst + count <= LC3_MR_KBSR) {
+    for (uint32_t i = 0; i < count; i++) vm->memory[dst + i] = value;
+    return;
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    vm_mem_write(vm, (uint16_t)(dst + i), value);
+  }
+}
+
+void vm_trap_add32(vm_t* vm) {
+  uint32_t a = (uint32_t)vm->reg[LC3_R_R1] << 16 | vm->reg[LC3_R_R0];
+  uint32_t b = (uint32_t)vm->reg[LC3_R_R3] << 16 | vm->reg[LC3_R_R2];
+  vm_trap_set_pair(vm, a + b);
+}
+
+void vm_trap_cas(vm_t* vm) {
+  uint16_t expected = vm->reg[LC3_R_R1];
+  // A full barrier, so a lock taken with CAS also orders plain accesses
+  bool swapped = __atomic_compare_exchange_n(
+      &vm->memory[vm->reg[LC3_R_R0]], &expected, vm->reg[LC3_R_R2], false,
+      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  vm->reg[LC3_R_R0] = swapped;
+  vm->reg[LC3_R_R1] = expected;
+  vm_update_flags(vm, LC3_R_R0);
+}
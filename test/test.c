@@ -1,6 +1,8 @@
 #include <stdio.h>
 
+#include "test/aot_tests.h"
 #include "test/asm_tests.h"
+#include "test/linker_tests.h"
 #include "test/vm_tests.h"
 #include "test_framework.h"
 
@@ -9,6 +11,8 @@ int main(void) {
 
   run_vm_tests();
   run_asm_tests();
+  run_linker_tests();
+  run_aot_tests();
 
   REPORT_TESTS();
 }
@@ -0,0 +1,139 @@
+#ifndef AOT_TESTS_H
+#define AOT_TESTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/aot/aot.h"
+#include "../../include/asm/asm.h"
+#include "../../include/lc3/lc3.h"
+#include "../test_framework.h"
+
+// Assemble source into a zeroed LC3_MEMORY_MAX word array
+static uint16_t *aot_test_memory(const char *filename, const char *source) {
+  FILE *file = fopen(filename, "w");
+  if (!file) return NULL;
+  fputs(source, file);
+  fclose(file);
+
+  program_t *program = asm_assemble(filename, NULL, NULL, NULL, NULL);
+  remove(filename);
+  uint16_t origin = 0;
+  size_t count = 0;
+  uint16_t *words =
+      program ? program_build_image(program, &origin, &count, NULL) : NULL;
+  uint16_t *memory = words ? calloc(LC3_MEMORY_MAX, sizeof(uint16_t)) : NULL;
+  if (memory) memcpy(memory + origin, words, count * sizeof(uint16_t));
+  free(words);
+  program_destroy(program);
+  return memory;
+}
+
+// Translate and compile source, run it and capture up to size - 1 bytes of
+// its output. Returns the exit status, or -1 if it could not be built.
+static int aot_test_run(const char *source, char *output, size_t size) {
+  uint16_t *memory = aot_test_memory("/tmp/lc3_test_aot.asm", source);
+  const char *c_filename = "/tmp/lc3_test_aot.c";
+  const char *executable = "/tmp/lc3_test_aot";
+  bool built = memory &&
+               aot_write_c(memory, LC3_PC_START, c_filename) == 0 &&
+               aot_compile(c_filename, executable) == 0;
+  free(memory);
+  remove(c_filename);
+
+  output[0] = '\0';
+  int status = -1;
+  FILE *pipe = built ? popen(executable, "r") : NULL;
+  if (pipe) {
+    size_t read = fread(output, 1, size - 1, pipe);
+    output[read] = '\0';
+    status = pclose(pipe);
+  }
+  remove(executable);
+  return status;
+}
+
+// Test a translated program with a loop, a subroutine (RET goes through the
+// dispatcher) and an instruction it overwrites (run by the interpreter)
+static char *test_aot_translate_and_run(void) {
+  char output[32];
+  int status = aot_test_run(".ORIG x3000\n"
+                            "  LEA R0, MSG\n"
+                            "  PUTS\n"
+                            "  AND R1, R1, #0\n"
+                            "  ADD R1, R1, #3\n"
+                            "LOOP LD R0, STAR\n"
+                            "  OUT\n"
+                            "  ADD R1, R1, #-1\n"
+                            "  BRp LOOP\n"
+                            "  JSR NEWLINE\n"
+                            "  LD R2, OUTW\n"
+                            "  ST R2, PATCH\n"
+                            "  LD R0, BANG\n"
+                            "PATCH HALT\n"  // Becomes OUT
+                            "  HALT\n"
+                            "NEWLINE LD R0, NL\n"
+                            "  OUT\n"
+                            "  RET\n"
+                            "MSG .STRINGZ \"hi\"\n"
+                            "STAR .FILL x2A\n"
+                            "NL .FILL x0A\n"
+                            "BANG .FILL x21\n"
+                            "OUTW .FILL xF021\n"
+                            ".END\n",
+                            output, sizeof(output));
+
+  ASSERT_TRUE("Translated program matches the VM's output",
+              status == 0 && strcmp(output, "hi***\n!") == 0);
+  return NULL;
+}
+
+// Test device registers in a translated program: it polls DSR and writes
+// DDR, reads HARTS and PSR, and stops by clearing MCR. The VM prints "A1B".
+static char *test_aot_device_registers(void) {
+  char output[32];
+  int status = aot_test_run(".ORIG x3000\n"
+                            "      LD R0, CHAR\n"
+                            "POLL  LDI R1, DSRP\n"
+                            "      BRzp POLL\n"
+                            "      STI R0, DDRP\n"
+                            "      LDI R0, HARTSP\n"
+                            "      LD R1, ZERO\n"
+                            "      ADD R0, R0, R1\n"
+                            "      OUT\n"
+                            "      AND R2, R2, #0\n"
+                            "      LDI R0, PSRP\n"
+                            "      BRn USER\n"  // User mode bit
+                            "      HALT\n"
+                            "USER  LD R0, CHAR\n"
+                            "      ADD R0, R0, #1\n"
+                            "      OUT\n"
+                            "      STI R2, MCRP\n"
+                            "      OUT\n"  // Not reached
+                            "      HALT\n"
+                            "CHAR   .FILL x41\n"
+                            "ZERO   .FILL x30\n"
+                            "DSRP   .FILL xFE04\n"
+                            "DDRP   .FILL xFE06\n"
+                            "HARTSP .FILL xFE12\n"
+                            "PSRP   .FILL xFFFC\n"
+                            "MCRP   .FILL xFFFE\n"
+                            ".END\n",
+                            output, sizeof(output));
+
+  ASSERT_TRUE("Translated program uses the VM's device registers",
+              status == 0 && strcmp(output, "A1B") == 0);
+  return NULL;
+}
+
+// Run all ahead-of-time translation tests
+void run_aot_tests(void) {
+  printf("Running AOT tests...\n\n");
+  RUN_TEST(test_aot_translate_and_run);
+  RUN_TEST(test_aot_device_registers);
+}
+
+#endif /* AOT_TESTS_H */
@@ -1,11 +1,22 @@
 #ifndef ASM_TESTS_H
 #define ASM_TESTS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
 
 #include "../../include/asm/asm.h"
+#include "../../include/asm/batch.h"
+#include "../../include/asm/cache.h"
+#include "../../include/asm/disasm.h"
 #include "../../include/asm/program.h"
+#include "../../include/lc3/debug.h"
+#include "../../include/lc3/decode.h"
+#include "../../include/lc3/image.h"
 #include "../test_framework.h"
 
 // Test parsing of symbols
@@ -24,11 +35,695 @@ static char *test_asm_instruction_assembly(void) {
   return NULL;
 }
 
+// Test that the object file is a legacy big-endian .obj by default and a
+// native-endian sparse image on request
+static char *test_asm_write_object_file(void) {
+  program_t *program = calloc(1, sizeof(program_t));
+  program->origin = 0x3000;
+  program->instruction_count = 5;
+  for (int i = 0; i < program->instruction_count; i++) {
+    program->instructions[i].address = 0x3000 + i;
+    program->instructions[i].instruction = 0x1200 + i;
+  }
+
+  const char *filename = "/tmp/lc3_test_write_object.obj";
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int result = program_write_file(program, filename, false, &log);
+  unsigned char legacy[16] = {0};
+  FILE *file = fopen(filename, "rb");
+  size_t legacy_size = file ? fread(legacy, 1, sizeof(legacy), file) : 0;
+  if (file) fclose(file);
+  const unsigned char expected[] = {0x30, 0x00, 0x12, 0x00, 0x12, 0x01,
+                                    0x12, 0x02, 0x12, 0x03, 0x12, 0x04};
+  bool portable = legacy_size == sizeof(expected) &&
+                  memcmp(legacy, expected, sizeof(expected)) == 0;
+
+  result |= program_write_file(program, filename, true, &log);
+  asm_log_free(&log);
+  program_destroy(program);
+
+  image_t image;
+  image_segment_t segment = {0, 0, 0, NULL};
+  bool opened = image_open(filename, &image) == 0;
+  if (opened) image_get_segment(&image, 0, &segment);
+  bool same = opened && image_is_native(&image) && image.segment_count == 1 &&
+              segment.address == 0x3000 && segment.length == 5 &&
+              segment.words[0] == 0x1200 && segment.words[4] == 0x1204;
+  if (opened) image_close(&image);
+  remove(filename);
+
+  ASSERT_TRUE("Object file written as legacy .obj or native-endian image",
+              result == 0 && portable && same);
+  return NULL;
+}
+
+// Test that far-apart sections and .BLKW space are not stored as padding
+static char *test_asm_write_sparse_sections(void) {
+  const char *filename = "/tmp/lc3_test_sparse_sections.asm";
+  const char *obj_filename = "/tmp/lc3_test_sparse_sections.obj";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "  LDI R0, PTR\n"
+        "  HALT\n"
+        "PTR .FILL xC000\n"
+        ".END\n"
+        ".ORIG xC000\n"
+        "  .FILL x1234\n"
+        "  .BLKW #100\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  asm_options_t options = {.native = true};
+  int result = asm_run(filename, obj_filename, NULL, NULL, &options, NULL);
+  struct stat st;
+  bool small = stat(obj_filename, &st) == 0 && st.st_size < 100;
+  image_t image;
+  image_segment_t blkw = {0, 0, 0, NULL};
+  bool opened = image_open(obj_filename, &image) == 0;
+  if (opened && image.segment_count == 3) image_get_segment(&image, 2, &blkw);
+  if (opened) image_close(&image);
+  remove(filename);
+  remove(obj_filename);
+
+  ASSERT_TRUE("Sections stored as segments with .BLKW as a zero segment",
+              result == 0 && small && blkw.address == 0xC001 &&
+                  blkw.length == 100 && blkw.flags == IMAGE_SEGMENT_ZERO);
+  return NULL;
+}
+
+// Test that an image of all of memory is written whole and one running past
+// the end is rejected
+static char *test_asm_write_full_image(void) {
+  const char *obj_filename = "/tmp/lc3_test_full_image.obj";
+  uint16_t *words = calloc(0x10000, sizeof(uint16_t));
+  words[0] = 0x1234;
+  words[0xFFFF] = 0x5678;
+
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int result = program_write_image(obj_filename, 0, words, 0x10000, true, &log);
+  image_t image;
+  int total = 0;
+  uint16_t last = 0;
+  if (result == 0 && image_open(obj_filename, &image) == 0) {
+    for (int i = 0; i < image.segment_count; i++) {
+      image_segment_t segment;
+      image_get_segment(&image, i, &segment);
+      total += segment.length;
+      if (segment.address + segment.length == 0x10000 && segment.words) {
+        last = segment.words[segment.length - 1];
+      }
+    }
+    image_close(&image);
+  }
+  remove(obj_filename);
+
+  int overflow =
+      program_write_image(obj_filename, 0x3000, words, 0x10000, true, &log);
+  int errors = log.error_count;
+  asm_log_free(&log);
+  free(words);
+
+  ASSERT_TRUE("Full image written whole, overflowing image rejected",
+              result == 0 && total == 0x10000 && last == 0x5678 &&
+                  overflow == 1 && errors == 1);
+  return NULL;
+}
+
+// Test that I/O errors are reported instead of ignored
+static char *test_asm_write_object_file_error(void) {
+  program_t *program = calloc(1, sizeof(program_t));
+  program->origin = 0x3000;
+  program->instruction_count = 0;
+
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int result =
+      program_write_file(program, "/nonexistent_lc3_dir/program.obj", false,
+                         &log);
+  program_destroy(program);
+  int errors = log.error_count;
+  asm_log_free(&log);
+
+  ASSERT_TRUE("Write to missing directory fails and is logged",
+              result == 1 && errors == 1);
+  return NULL;
+}
+
+// Test assembling a source file straight into memory
+static char *test_asm_assemble_in_memory(void) {
+  program_t *program =
+      asm_assemble("test/fixtures/test_hello.asm", NULL, NULL, NULL, NULL);
+
+  // LEA, PUTS, HALT and the 19-word string
+  int count = program ? program->instruction_count : -1;
+  program_destroy(program);
+  ASSERT_INT_EQUAL("Assembled word count", 22, count);
+  return NULL;
+}
+
+// Test that a cached program round-trips through the cache directory
+static char *test_asm_cache_round_trip(void) {
+  asm_cache_t *cache = asm_cache_open("/tmp/lc3_test_cache/round_trip", 0);
+  asm_cache_evict(cache);  // Start from an empty cache
+  cache->max_bytes = 1024 * 1024;
+  uint64_t key = 0;
+  asm_cache_key_file("test/fixtures/test_hello.asm", &key);
+
+  symbol_table_t *symbols = NULL;
+  program_t *program =
+      asm_assemble("test/fixtures/test_hello.asm", cache, NULL, &symbols,
+                   NULL);
+  symbol_table_t *cached_symbols = NULL;
+  program_t *cached = asm_cache_lookup(cache, key, &cached_symbols);
+
+  bool same = program && cached && symbols && cached_symbols &&
+              cached->origin == program->origin &&
+              cached->instruction_count == program->instruction_count &&
+              memcmp(cached->instructions, program->instructions,
+                     program->instruction_count * sizeof(instruction_t)) ==
+                  0 &&
+              cached_symbols->symbol_count == symbols->symbol_count &&
+              symbol_table_find_address(cached_symbols, "HELLO") == 0x3003;
+
+  program_destroy(program);
+  program_destroy(cached);
+  symbol_table_destroy(symbols);
+  symbol_table_destroy(cached_symbols);
+  asm_cache_close(cache);
+  ASSERT_TRUE("Cached program matches assembled program", same);
+  return NULL;
+}
+
+// Test that the cache evicts entries once it outgrows its bound
+static char *test_asm_cache_eviction(void) {
+  // Room for a single entry
+  asm_cache_t *cache = asm_cache_open("/tmp/lc3_test_cache/eviction", 0);
+  asm_cache_evict(cache);  // Start from an empty cache
+  cache->max_bytes = sizeof(program_t) + sizeof(symbol_table_t) + 64;
+  program_t *program = calloc(1, sizeof(program_t));
+  symbol_table_t *symbols = symbol_table_create();
+
+  asm_cache_store(cache, 1, program, symbols);
+  asm_cache_store(cache, 2, program, symbols);
+  asm_cache_store(cache, 3, program, symbols);
+
+  program_t *newest = asm_cache_lookup(cache, 3, NULL);
+  program_t *oldest = asm_cache_lookup(cache, 1, NULL);
+  bool evicted = newest != NULL && oldest == NULL;
+
+  program_destroy(newest);
+  program_destroy(oldest);
+  program_destroy(program);
+  symbol_table_destroy(symbols);
+  asm_cache_close(cache);
+  ASSERT_TRUE("Cache keeps only the newest entry", evicted);
+  return NULL;
+}
+
+// Test that different sources get different cache keys
+static char *test_asm_cache_key_changes(void) {
+  const char *filename = "/tmp/lc3_test_cache_key.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\nHALT\n.END\n", file);
+  fclose(file);
+  uint64_t before = 0;
+  asm_cache_key_file(filename, &before);
+
+  file = fopen(filename, "w");
+  fputs(".ORIG x3000\nPUTS\n.END\n", file);
+  fclose(file);
+  uint64_t after = 0;
+  asm_cache_key_file(filename, &after);
+  remove(filename);
+
+  ASSERT_TRUE("Editing the source changes the cache key", before != after);
+  return NULL;
+}
+
+// Test assembling a directory and a missing file as one parallel batch
+static char *test_asm_batch_parallel(void) {
+  const char *dir = "/tmp/lc3_test_batch";
+  mkdir(dir, 0755);
+  char path[64];
+  for (int i = 0; i < 8; i++) {
+    sprintf(path, "%s/prog%d.asm", dir, i);
+    FILE *file = fopen(path, "w");
+    fprintf(file, ".ORIG x3000\nADD R0, R0, #%d\nHALT\n.END\n", i);
+    fclose(file);
+  }
+
+  asm_batch_t *batch = asm_batch_create();
+  batch->options.native = true;
+  int queued = asm_batch_add_path(batch, dir);
+  asm_batch_add_path(batch, "/tmp/lc3_test_batch_missing.asm");
+  int failed = asm_batch_run(batch, 4, NULL);
+
+  // The last directory entry is assembled into its own object file
+  uint16_t first_word = 0;
+  image_t image;
+  if (image_open("/tmp/lc3_test_batch/prog7.obj", &image) == 0) {
+    image_segment_t segment;
+    image_get_segment(&image, 0, &segment);
+    if (segment.length > 0) first_word = segment.words[0];
+    image_close(&image);
+  }
+  bool missing_reported = batch->job_count == 9 &&
+                          batch->jobs[8].result != 0 &&
+                          batch->jobs[8].log.error_count > 0;
+  asm_batch_destroy(batch);
+
+  ASSERT_TRUE("Batch assembles each file and reports failures per file",
+              queued == 8 && failed == 1 && missing_reported &&
+                  first_word == 0x1027);
+  return NULL;
+}
+
+// Test branch conditions, a label on its own line and a second .ORIG block
+static char *test_asm_branches_and_sections(void) {
+  const char *filename = "/tmp/lc3_test_branches.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "LOOP\n"
+        "  BRz LOOP\n"
+        "  brnp DONE\n"
+        "  JSR FAR\n"
+        "DONE HALT\n"
+        ".END\n"
+        ".ORIG x3100\n"
+        "FAR RET\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  program_t *program = asm_assemble(filename, NULL, NULL, NULL, NULL);
+  remove(filename);
+  uint16_t origin = 0;
+  size_t count = 0;
+  uint16_t *words =
+      program ? program_build_image(program, &origin, &count, NULL) : NULL;
+
+  // JSR reaches the second section at its .ORIG address
+  bool encoded = words && origin == 0x3000 && count == 0x101 &&
+                 words[0] == 0x05FF && words[1] == 0x0A01 &&
+                 words[2] == 0x48FD && words[3] == 0xF025 &&
+                 words[0x100] == 0xC1C0;
+  free(words);
+  program_destroy(program);
+  ASSERT_TRUE("Branches and sections assemble to the expected image",
+              encoded);
+  return NULL;
+}
+
+// Test that out-of-range operands get their long forms and move the labels
+static char *test_asm_relax_long_branches(void) {
+  const char *filename = "/tmp/lc3_test_relax.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "  LD R1, VALUE\n"   // LDI R1, #1; BRnzp #1; .FILL VALUE
+        "  BRz DONE\n"       // BRnp #3; LD R7, #1; JMP R7; .FILL DONE
+        "  LEA R2, VALUE\n"  // LD R2, #1; BRnzp #1; .FILL VALUE
+        "SPACE .BLKW #300\n"
+        "VALUE .FILL #42\n"
+        "DONE HALT\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  symbol_table_t *symbols = NULL;
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  program_t *program = asm_assemble(filename, NULL, NULL, &symbols, &log);
+  remove(filename);
+  uint16_t origin = 0;
+  size_t count = 0;
+  uint16_t *words =
+      program ? program_build_image(program, &origin, &count, NULL) : NULL;
+
+  // The long BR warns that it overwrites R7
+  bool relaxed = words && log.warning_count == 1 && count == 0x138 &&
+                 symbol_table_find_address(symbols, "VALUE") == 0x3136 &&
+                 symbol_table_find_address(symbols, "DONE") == 0x3137 &&
+                 words[0] == 0xA201 && words[1] == 0x0E01 &&
+                 words[2] == 0x3136 && words[3] == 0x0A03 &&
+                 words[4] == 0x2E01 && words[5] == 0xC1C0 &&
+                 words[6] == 0x3137 && words[7] == 0x2401 &&
+                 words[8] == 0x0E01 && words[9] == 0x3136 &&
+                 words[0x136] == 42 && words[0x137] == 0xF025;
+  free(words);
+  symbol_table_destroy(symbols);
+  program_destroy(program);
+  asm_log_free(&log);
+  ASSERT_TRUE("Out-of-range operands are relaxed to their long forms",
+              relaxed);
+  return NULL;
+}
+
+// Test that a far branch hops through a BRnzp to its target instead of
+// overwriting R7, and that an out-of-range STI fails the assembly
+static char *test_asm_branch_islands(void) {
+  const char *filename = "/tmp/lc3_test_islands.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "DONE HALT\n"
+        "  .BLKW #200\n"
+        "  BRnzp DONE\n"  // x30C9, in reach of both
+        "  .BLKW #100\n"
+        "  BRz DONE\n"  // x312E: BRz x30C9
+        "  HALT\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  program_t *program = asm_assemble(filename, NULL, NULL, NULL, &log);
+  uint16_t origin = 0;
+  size_t count = 0;
+  uint16_t *words =
+      program ? program_build_image(program, &origin, &count, NULL) : NULL;
+  bool island = words && log.warning_count == 0 && count == 0x130 &&
+                words[0xC9] == 0x0F36 && words[0x12E] == 0x059A;
+  free(words);
+  program_destroy(program);
+
+  file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "  STI R0, FAR\n"
+        "  HALT\n"
+        "  .BLKW #300\n"
+        "FAR .FILL x4000\n"
+        ".END\n",
+        file);
+  fclose(file);
+  int errors = log.error_count;
+  int result = asm_run(filename, "/tmp/lc3_test_islands.obj", NULL, NULL,
+                       NULL, &log);
+  bool rejected = result != 0 && log.error_count == errors + 1;
+  remove(filename);
+  remove("/tmp/lc3_test_islands.obj");
+  asm_log_free(&log);
+
+  ASSERT_TRUE("Far branches use islands and out-of-range STI is an error",
+              island && rejected);
+  return NULL;
+}
+
+// Test literal sharing and pool placement after HALT and behind a branch
+static char *test_asm_literal_pools(void) {
+  const char *filename = "/tmp/lc3_test_pools.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "  LD R1, =#1234\n"
+        "  LD R2, =x4D2\n"  // Shares the #1234 word
+        "  LDI R3, =VAL\n"
+        "  HALT\n"  // Pool placed here
+        "  LD R4, =#5\n"
+        "BUF .BLKW #300\n"  // Would carry the pool out of reach
+        "VAL .FILL #7\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  symbol_table_t *symbols = NULL;
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  program_t *program = asm_assemble(filename, NULL, NULL, &symbols, &log);
+  remove(filename);
+  uint16_t origin = 0;
+  size_t count = 0;
+  uint16_t *words =
+      program ? program_build_image(program, &origin, &count, NULL) : NULL;
+
+  bool pooled = words && log.warning_count == 0 && count == 0x136 &&
+                symbol_table_find_address(symbols, "BUF") == 0x3009 &&
+                symbol_table_find_address(symbols, "VAL") == 0x3135 &&
+                words[0] == 0x2203 && words[1] == 0x2402 &&
+                words[2] == 0xA602 && words[3] == 0xF025 &&
+                words[4] == 1234 && words[5] == 0x3135 &&
+                words[6] == 0x2801 && words[7] == 0x0E01 && words[8] == 5 &&
+                words[0x135] == 7;
+  free(words);
+  symbol_table_destroy(symbols);
+  program_destroy(program);
+  asm_log_free(&log);
+  ASSERT_TRUE("Literals are shared and placed in reachable pools", pooled);
+  return NULL;
+}
+
+// Test each peephole rule and that labels follow the removed words
+static char *test_asm_optimize(void) {
+  const char *filename = "/tmp/lc3_test_optimize.asm";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "  AND R1, R1, #0\n"  // Cleared, then overwritten by LD
+        "  LD R1, COUNT\n"
+        "  ADD R1, R1, #3\n"  // Folded with the next ADD
+        "  ADD R1, R1, #4\n"
+        "LOOP ADD R1, R1, #-1\n"
+        "  BRp HOP\n"  // Threaded straight to LOOP
+        "  BR DONE\n"
+        "HOP BR LOOP\n"
+        "  ADD R2, R2, #1\n"  // Unreachable
+        "DONE HALT\n"
+        "COUNT .FILL #2\n"
+        "PTR .FILL DONE\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  asm_options_t options = {.optimize = true};
+  symbol_table_t *symbols = NULL;
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  program_t *program = asm_assemble(filename, NULL, &options, &symbols, &log);
+  asm_log_free(&log);
+  remove(filename);
+
+  const uint16_t expected[] = {0x2206, 0x1267, 0x127F, 0x03FE,
+                               0x0E01, 0x0FFC, 0xF025, 0x0002, 0x3006};
+  bool optimized = program && program->instruction_count == 9 &&
+                   program->sections[0].length == 9 &&
+                   symbol_table_find_address(symbols, "DONE") == 0x3006 &&
+                   symbol_table_find_address(symbols, "COUNT") == 0x3007;
+  for (int i = 0; optimized && i < 9; i++) {
+    optimized = program->instructions[i].instruction == expected[i];
+  }
+  program_destroy(program);
+  symbol_table_destroy(symbols);
+  ASSERT_TRUE("Optimizer applies each rule and relocates labels", optimized);
+  return NULL;
+}
+
+// Test that the debug info lists each instruction word's source line and
+// leaves data out
+static char *test_asm_line_table(void) {
+  const char *obj_filename = "/tmp/lc3_test_lines.obj";
+  const char *sym_filename = "/tmp/lc3_test_lines.sym";
+  const char *debug_filename = "/tmp/lc3_test_lines.dbg";
+  int result = asm_run("test/fixtures/test_hello.asm", obj_filename,
+                       sym_filename, NULL, NULL, NULL);
+  debug_info_t *info = debug_info_read_file(debug_filename);
+
+  // LEA, PUTS and HALT are on lines 3 to 5; the string is data
+  bool mapped = result == 0 && info && info->line_count == 3 &&
+                info->file_count == 1 &&
+                strstr(info->files[0], "test_hello.asm") != NULL;
+  for (int i = 0; mapped && i < 3; i++) {
+    mapped = info->lines[i].address == 0x3000 + i &&
+             info->lines[i].file == 0 &&
+             info->lines[i].line == (uint32_t)(3 + i);
+  }
+  debug_info_destroy(info);
+  remove(obj_filename);
+  remove(sym_filename);
+  remove(debug_filename);
+
+  ASSERT_TRUE("Debug info maps instruction words to source lines", mapped);
+  return NULL;
+}
+
+// Test the label ranges and source lines of the debug info file and the
+// lookups over them
+static char *test_asm_debug_info(void) {
+  const char *filename = "/tmp/lc3_test_debug.asm";
+  const char *obj_filename = "/tmp/lc3_test_debug.obj";
+  const char *sym_filename = "/tmp/lc3_test_debug.sym";
+  const char *debug_filename = "/tmp/lc3_test_debug.dbg";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "MAIN  JSR SUB\n"
+        "      HALT\n"
+        "SUB   ADD R0, R0, #1\n"
+        "      RET\n"
+        "DATA  .FILL #5\n"
+        ".END\n",
+        file);
+  fclose(file);
+
+  int result = asm_run(filename, obj_filename, sym_filename, NULL, NULL,
+                       NULL);
+  debug_info_t *info = debug_info_read_file(debug_filename);
+  const debug_label_t *sub = info ? debug_info_find_label(info, 0x3003) : NULL;
+  const debug_line_t *ret = info ? debug_info_find_line(info, 0x3003) : NULL;
+  char where[64];
+  bool found = result == 0 && info && info->label_count == 3 && sub &&
+               strcmp(sub->name, "SUB") == 0 && ret && ret->line == 5 &&
+               !debug_info_find_label(info, 0x2FFF) &&
+               !debug_info_find_label(info, 0x3005) &&
+               !debug_info_find_line(info, 0x3004) &&
+               strcmp(debug_info_describe(info, 0x3003, where, sizeof(where)),
+                      "x3003 (SUB+1, lc3_test_debug.asm:5)") == 0;
+  debug_info_destroy(info);
+
+  // A file cut short is rejected rather than read past its end
+  unsigned char bytes[1024];
+  size_t size = 0;
+  file = fopen(debug_filename, "rb");
+  if (file) {
+    size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+  }
+  file = fopen(debug_filename, "wb");
+  if (file) {
+    fwrite(bytes, 1, size > 4 ? size - 4 : 0, file);
+    fclose(file);
+  }
+  info = debug_info_read_file(debug_filename);
+  bool rejected = info == NULL;
+  debug_info_destroy(info);
+  remove(filename);
+  remove(obj_filename);
+  remove(sym_filename);
+  remove(debug_filename);
+
+  ASSERT_TRUE("Debug info maps addresses to labels and lines",
+              found && rejected);
+  return NULL;
+}
+
+// Test the decode table against words with reserved bits set
+static char *test_asm_decode_table(void) {
+  const lc3_decoded_t *table = lc3_decode_table();
+  lc3_decoded_t ldr = table[0x6A7F];  // LDR R5, R1, #-1
+  bool decoded = ldr.op == LC3_OP_LDR &&
+                 ldr.format == LC3_FORMAT_REG2_IMM && ldr.r0 == 5 &&
+                 ldr.r1 == 1 && ldr.imm == -1 &&
+                 table[0xC1C0].format == LC3_FORMAT_NONE &&  // RET
+                 table[0xC080].format == LC3_FORMAT_BASE &&  // JMP R2
+                 table[0x0E00].imm == 0 &&                   // BRnzp #0
+                 table[0xF025].imm == 0x25;
+  bool invalid = table[0x0000].format == LC3_FORMAT_INVALID &&  // BR none
+                 table[0x903E].format == LC3_FORMAT_INVALID &&  // NOT
+                 table[0x1008].format == LC3_FORMAT_INVALID &&  // ADD
+                 table[0xD000].format == LC3_FORMAT_INVALID &&  // RES
+                 table[0xF125].format == LC3_FORMAT_INVALID;    // TRAP
+  bool same = true;
+  for (uint32_t word = 0; same && word < 0x10000; word += 0x101) {
+    lc3_decoded_t one = lc3_decode((uint16_t)word);
+    same = memcmp(&one, &table[word], sizeof(one)) == 0;
+  }
+
+  ASSERT_TRUE("Decode table fields and reserved bits",
+              decoded && invalid && same);
+  return NULL;
+}
+
+// Test disassembly of an assembled program, named from its symbol file
+static char *test_asm_disassemble(void) {
+  const char *filename = "/tmp/lc3_test_disasm.asm";
+  const char *obj_filename = "/tmp/lc3_test_disasm.obj";
+  const char *sym_filename = "/tmp/lc3_test_disasm.sym";
+  FILE *file = fopen(filename, "w");
+  fputs(".ORIG x3000\n"
+        "MAIN  LD R0, DATA\n"
+        "LOOP  ADD R1, R1, #-1\n"
+        "      BRnp LOOP\n"
+        "      JSRR R3\n"
+        "      NOT R2, R4\n"
+        "      TRAP x40\n"
+        "      HALT\n"
+        "DATA  .FILL #0\n"
+        ".END\n",
+        file);
+  fclose(file);
+  int result = asm_run(filename, obj_filename, sym_filename, NULL, NULL,
+                       NULL);
+  symbol_table_t *symbols = symbol_table_read_file(sym_filename);
+  disasm_t *named = disasm_create(symbols);
+  disasm_t *plain = disasm_create(NULL);
+
+  const char *expected[] = {
+      "LD R0, DATA", "ADD R1, R1, #-1", "BRnp LOOP", "JSRR R3",
+      "NOT R2, R4",  "TRAP x40",        "HALT",      ".FILL x0000",
+  };
+  const uint16_t words[] = {0x2006, 0x127F, 0x0BFE, 0x40C0,
+                            0x953F, 0xF040, 0xF025, 0x0000};
+  char text[64];
+  bool listed = result == 0 && symbols && symbols->symbol_count == 3 &&
+                named && plain;
+  for (int i = 0; listed && i < 8; i++) {
+    listed = strcmp(disasm_word(named, 0x3000 + i, words[i], text,
+                                sizeof(text)),
+                    expected[i]) == 0;
+  }
+  listed = listed &&
+           strcmp(disasm_word(plain, 0x3002, 0x0BFE, text, sizeof(text)),
+                  "BRnp x3001") == 0;
+
+  // The listing of the object file puts labels in their own column
+  char listing[512];
+  FILE *out = tmpfile();
+  bool written = out && disasm_file(out, obj_filename) == 0;
+  size_t length = 0;
+  if (out) {
+    rewind(out);
+    length = fread(listing, 1, sizeof(listing) - 1, out);
+    fclose(out);
+  }
+  listing[length] = '\0';
+  bool whole = written &&
+               strstr(listing, "x3001  127F  LOOP  ADD R1, R1, #-1\n") &&
+               strstr(listing, "x3007  0000  DATA  .FILL x0000\n");
+
+  disasm_destroy(named);
+  disasm_destroy(plain);
+  symbol_table_destroy(symbols);
+  remove(filename);
+  remove(obj_filename);
+  remove(sym_filename);
+  remove("/tmp/lc3_test_disasm.dbg");
+
+  ASSERT_TRUE("Disassembly names operands and lines from the symbol file",
+              listed && whole);
+  return NULL;
+}
+
 // Run all assembler tests
 void run_asm_tests(void) {
   printf("Running Assembler tests...\n\n");
   RUN_TEST(test_asm_label_parsing);
   RUN_TEST(test_asm_instruction_assembly);
+  RUN_TEST(test_asm_write_object_file);
+  RUN_TEST(test_asm_write_sparse_sections);
+  RUN_TEST(test_asm_write_full_image);
+  RUN_TEST(test_asm_write_object_file_error);
+  RUN_TEST(test_asm_assemble_in_memory);
+  RUN_TEST(test_asm_cache_round_trip);
+  RUN_TEST(test_asm_cache_eviction);
+  RUN_TEST(test_asm_cache_key_changes);
+  RUN_TEST(test_asm_batch_parallel);
+  RUN_TEST(test_asm_branches_and_sections);
+  RUN_TEST(test_asm_relax_long_branches);
+  RUN_TEST(test_asm_branch_islands);
+  RUN_TEST(test_asm_literal_pools);
+  RUN_TEST(test_asm_optimize);
+  RUN_TEST(test_asm_line_table);
+  RUN_TEST(test_asm_debug_info);
+  RUN_TEST(test_asm_decode_table);
+  RUN_TEST(test_asm_disassemble);
   // Add more assembler tests here
 }
 
@@ -0,0 +1,157 @@
+#ifndef LINKER_TESTS_H
+#define LINKER_TESTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/asm/asm.h"
+#include "../../include/asm/linker.h"
+#include "../../include/asm/module.h"
+#include "../../include/lc3/image.h"
+#include "../test_framework.h"
+
+// Write source to filename and assemble it into module_filename
+static int linker_test_module(const char *filename, const char *source,
+                              const char *module_filename) {
+  FILE *file = fopen(filename, "w");
+  if (!file) return 1;
+  fputs(source, file);
+  fclose(file);
+
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int result = asm_module_run(filename, module_filename, NULL, NULL, &log);
+  asm_log_free(&log);
+  remove(filename);
+  return result;
+}
+
+// Test that a module keeps its sections, symbols and relocations
+static char *test_linker_module_round_trip(void) {
+  int written = linker_test_module("/tmp/lc3_test_module.asm",
+                                   ".GLOBAL MAIN\n"
+                                   ".EXTERN PRINT\n"
+                                   ".ORIG x3000\n"
+                                   "MAIN JSR PRINT\n"
+                                   "  HALT\n"
+                                   ".END\n",
+                                   "/tmp/lc3_test_module.o");
+
+  program_t *program = NULL;
+  symbol_table_t *symbols = NULL;
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int read =
+      module_read_file("/tmp/lc3_test_module.o", &program, &symbols, &log);
+  asm_log_free(&log);
+  remove("/tmp/lc3_test_module.o");
+
+  bool same = written == 0 && read == 0 && program->section_count == 1 &&
+              program->sections[0].origin == 0x3000 &&
+              program->instruction_count == 2 &&
+              program->instructions[1].instruction == 0xF025 &&
+              program->relocation_count == 1 &&
+              program->relocations[0].type == RELOC_PC_OFFSET11 &&
+              !program->relocations[0].applied &&
+              symbols->symbol_count == 2 &&
+              symbols->symbols[0].flags == SYMBOL_GLOBAL &&
+              symbols->symbols[0].section == 0 &&
+              strcmp(symbols->symbols[1].name, "PRINT") == 0 &&
+              symbols->symbols[1].section == SYMBOL_NO_SECTION;
+
+  program_destroy(program);
+  symbol_table_destroy(symbols);
+  ASSERT_TRUE("Module round-trips through the v2 format", same);
+  return NULL;
+}
+
+// Test that linking resolves PC-relative and .FILL references across modules
+static char *test_linker_resolves_symbols(void) {
+  int main_result = linker_test_module("/tmp/lc3_test_link_main.asm",
+                                       ".EXTERN PRINT\n"
+                                       ".EXTERN MSG\n"
+                                       ".ORIG x3000\n"
+                                       "  LD R0, MSGPTR\n"
+                                       "  JSR PRINT\n"
+                                       "  HALT\n"
+                                       "MSGPTR .FILL MSG\n"
+                                       ".END\n",
+                                       "/tmp/lc3_test_link_main.o");
+  int lib_result = linker_test_module("/tmp/lc3_test_link_lib.asm",
+                                      ".GLOBAL PRINT\n"
+                                      ".GLOBAL MSG\n"
+                                      ".ORIG x5000\n"
+                                      "PRINT PUTS\n"
+                                      "  RET\n"
+                                      "MSG .STRINGZ \"Hi\"\n"
+                                      ".END\n",
+                                      "/tmp/lc3_test_link_lib.o");
+
+  char *inputs[] = {"/tmp/lc3_test_link_main.o", "/tmp/lc3_test_link_lib.o"};
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int link_result = linker_run(2, inputs, "/tmp/lc3_test_link.obj", true, &log);
+  asm_log_free(&log);
+
+  uint16_t words[16] = {0};
+  uint16_t origin = 0;
+  size_t count = 0;
+  image_t image;
+  if (image_open("/tmp/lc3_test_link.obj", &image) == 0) {
+    image_segment_t segment;
+    image_get_segment(&image, 0, &segment);
+    origin = segment.address;
+    count = segment.length;
+    if (count <= 16) memcpy(words, segment.words, count * sizeof(uint16_t));
+    image_close(&image);
+  }
+  remove(inputs[0]);
+  remove(inputs[1]);
+  remove("/tmp/lc3_test_link.obj");
+  remove("/tmp/lc3_test_link.sym");
+
+  // The library lands right after main: PRINT at x3004 and MSG at x3006
+  const uint16_t expected[] = {0x2002, 0x4802, 0xF025, 0x3006, 0xF022,
+                               0xC1C0, 0x0048, 0x0069, 0x0000};
+  ASSERT_TRUE("Linked image resolves references between modules",
+              main_result == 0 && lib_result == 0 && link_result == 0 &&
+                  origin == 0x3000 && count == 9 &&
+                  memcmp(words, expected, sizeof(expected)) == 0);
+  return NULL;
+}
+
+// Test that an import nobody exports fails the link
+static char *test_linker_undefined_symbol(void) {
+  int written = linker_test_module("/tmp/lc3_test_link_undefined.asm",
+                                   ".EXTERN MISSING\n"
+                                   ".ORIG x3000\n"
+                                   "  JSR MISSING\n"
+                                   ".END\n",
+                                   "/tmp/lc3_test_link_undefined.o");
+
+  char *inputs[] = {"/tmp/lc3_test_link_undefined.o"};
+  asm_log_t log;
+  asm_log_init(&log, true, true);
+  int result =
+      linker_run(1, inputs, "/tmp/lc3_test_link_undefined.obj", false, &log);
+  int errors = log.error_count;
+  asm_log_free(&log);
+  remove(inputs[0]);
+
+  ASSERT_TRUE("Undefined symbol is reported and fails the link",
+              written == 0 && result == 1 && errors == 1);
+  return NULL;
+}
+
+// Run all linker tests
+void run_linker_tests(void) {
+  printf("Running Linker tests...\n\n");
+  RUN_TEST(test_linker_module_round_trip);
+  RUN_TEST(test_linker_resolves_symbols);
+  RUN_TEST(test_linker_undefined_symbol);
+}
+
+#endif /* LINKER_TESTS_H */
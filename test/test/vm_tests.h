@@ -5,25 +5,72 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "../../include/vm/vm.h"
+#include "../../include/vm/vm_cache.h"
+#include "../../include/vm/vm_coverage.h"
+#include "../../include/vm/vm_cycles.h"
+#include "../../include/vm/vm_device.h"
+#include "../../include/vm/vm_event.h"
 #include "../../include/vm/vm_exec.h"
+#include "../../include/vm/vm_idiom.h"
+#include "../../include/vm/vm_io.h"
+#include "../../include/vm/vm_limit.h"
+#include "../../include/vm/vm_os.h"
+#include "../../include/vm/vm_profile.h"
+#include "../../include/vm/vm_server.h"
+#include "../../include/vm/vm_session.h"
+#include "../../include/vm/vm_smp.h"
+#include "../../include/vm/vm_stats.h"
+#include "../../include/vm/vm_trap.h"
+#include "../../include/lc3/image.h"
 #include "../../include/lc3/lc3.h"
+#include "../../include/util/endian.h"
+#include "../../include/util/socket.h"
 #include "../test_framework.h"
 
 // Helper function to create a VM for testing
 vm_t* create_test_vm(void) {
-  vm_t* vm = malloc(sizeof(vm_t));
-  memset(vm->memory, 0, sizeof(vm->memory));
+  vm_t* vm = aligned_alloc(VM_CACHE_LINE, sizeof(vm_t));
+  vm->debug = NULL;
+  vm->memory = calloc(LC3_MEMORY_MAX, sizeof(uint16_t));
+  vm->owns_memory = true;
   memset(vm->reg, 0, sizeof(vm->reg));
   vm->reg[LC3_R_PC] = 0x3000;  // Set PC to default start
   vm->reg[LC3_R_COND] = LC3_FL_ZRO;  // Set initial condition flag
   vm->running = true;
+  vm->stop = VM_STOP_HALT;
+  vm_io_init(vm);
+  vm->hart_id = 0;
+  vm->hart_count = 1;
+  memset(vm->traps, 0, sizeof(vm->traps));
+  vm_trap_register_extensions(vm);
+  memset(vm->idiom_at, 0, sizeof(vm->idiom_at));
+  vm->idiom_count = 0;
+  vm_os_reset(vm);
+  vm_device_reset(vm);
+  vm_limit_reset(vm);
+  memset(&vm->stats, 0, sizeof(vm->stats));
+  memset(vm->coverage, 0, sizeof(vm->coverage));
+  vm->icache = NULL;
+  vm->dcache = NULL;
+  vm->cycles = NULL;
+  vm->profile = NULL;
   return vm;
 }
 
 // Helper function to destroy test VM
 void destroy_test_vm(vm_t* vm) {
+  vm_io_free(vm);
+  vm_cache_destroy(vm->icache);
+  vm_cache_destroy(vm->dcache);
+  vm_cycles_destroy(vm->cycles);
+  vm_profile_destroy(vm->profile);
+  free(vm->memory);
   free(vm);
 }
 
@@ -374,6 +421,85 @@ char* test_trap_halt(void) {
   destroy_test_vm(vm);
 }
 
+// Test the arithmetic extension traps
+char* test_trap_arithmetic_extensions(void) {
+  vm_t* vm = create_test_vm();
+
+  // MUL: -300 * 200 = -60000 = xFFFF:15A0
+  vm->reg[LC3_R_R0] = (uint16_t)-300;
+  vm->reg[LC3_R_R1] = 200;
+  vm_exec_trap(vm, 0xF031);
+  bool mul = vm->reg[LC3_R_R0] == 0x15A0 && vm->reg[LC3_R_R1] == 0xFFFF &&
+             vm->reg[LC3_R_COND] == LC3_FL_NEG;
+
+  // DIVMOD: -7 / 2 = -3 remainder -1
+  vm->reg[LC3_R_R0] = (uint16_t)-7;
+  vm->reg[LC3_R_R1] = 2;
+  vm_exec_trap(vm, 0xF032);
+  bool divmod = vm->reg[LC3_R_R0] == (uint16_t)-3 &&
+                vm->reg[LC3_R_R1] == (uint16_t)-1;
+
+  // ADD32: x0001:FFFF + x0000:0001 = x0002:0000
+  vm->reg[LC3_R_R0] = 0xFFFF;
+  vm->reg[LC3_R_R1] = 0x0001;
+  vm->reg[LC3_R_R2] = 0x0001;
+  vm->reg[LC3_R_R3] = 0x0000;
+  vm_exec_trap(vm, 0xF035);
+  bool add32 = vm->reg[LC3_R_R0] == 0 && vm->reg[LC3_R_R1] == 2 &&
+               vm->reg[LC3_R_COND] == LC3_FL_POS;
+  bool running = vm->running;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("MUL, DIVMOD and ADD32 compute 32-bit results",
+              mul && divmod && add32 && running);
+}
+
+// Test the memory extension traps, including ranges that wrap past xFFFF
+// through the device registers, and the capability query
+char* test_trap_memory_extensions(void) {
+  vm_t* vm = create_test_vm();
+
+  // MEMSET 4 words from xFFFE: MCR, xFFFF, x0000, x0001. MCR bit 15 stays
+  // set, so the machine keeps running.
+  vm->reg[LC3_R_R0] = 0xFFFE;
+  vm->reg[LC3_R_R1] = 0xABCD;
+  vm->reg[LC3_R_R2] = 4;
+  vm_exec_trap(vm, 0xF034);
+  bool memset_wraps = vm_mem_read(vm, LC3_MR_MCR) == 0xABCD && vm->running &&
+                      vm->memory[0x0001] == 0xABCD && vm->memory[2] == 0;
+
+  // Clearing MCR bit 15 with MEMSET stops the machine, as ST would
+  vm->reg[LC3_R_R0] = LC3_MR_MCR;
+  vm->reg[LC3_R_R1] = 0;
+  vm->reg[LC3_R_R2] = 1;
+  vm_exec_trap(vm, 0xF034);
+  bool memset_halts = !vm->running;
+  vm->running = true;
+
+  // MEMCPY an overlapping range one word up
+  for (int i = 0; i < 4; i++) vm->memory[0x4000 + i] = (uint16_t)(i + 1);
+  vm->reg[LC3_R_R0] = 0x4001;
+  vm->reg[LC3_R_R1] = 0x4000;
+  vm->reg[LC3_R_R2] = 4;
+  vm_exec_trap(vm, 0xF033);
+  bool memcpy_overlaps = vm->memory[0x4000] == 1 && vm->memory[0x4001] == 1 &&
+                         vm->memory[0x4004] == 4;
+
+  // HASTRAP answers for registered vectors only
+  vm->reg[LC3_R_R0] = 0x33;
+  vm_exec_trap(vm, 0xF030);
+  bool has_memcpy = vm->reg[LC3_R_R0] == 1;
+  vm_trap_register(vm, 0x33, NULL);
+  vm->reg[LC3_R_R0] = 0x33;
+  vm_exec_trap(vm, 0xF030);
+  bool removed = vm->reg[LC3_R_R0] == 0;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("MEMSET and MEMCPY wrap and overlap; HASTRAP reports them",
+              memset_wraps && memset_halts && memcpy_overlaps && has_memcpy &&
+                  removed);
+}
+
 // Test condition flag updates (using ADD as example)
 char* test_condition_flags_positive(void) {
   vm_t* vm = create_test_vm();
@@ -423,7 +549,830 @@ char* test_condition_flags_negative(void) {
   destroy_test_vm(vm);
 }
 
+// Test loading an in-memory image without an object file
+char* test_vm_load_image(void) {
+  vm_t* vm = vm_create();
+
+  uint16_t words[3] = {0xE002, 0xF022, 0xF025};
+  vm_load_image(vm, 0x3000, words, 3);
+
+  // Verify: words land at the origin in host order
+  uint16_t loaded = vm->memory[0x3002];
+  vm_destroy(vm);
+  ASSERT_UINT16_EQUAL("Image loaded at origin", 0xF025, loaded);
+}
+
+// Test that an image running past the end of memory is clipped
+char* test_vm_load_image_clipped(void) {
+  vm_t* vm = vm_create();
+
+  uint16_t words[4] = {0x1111, 0x2222, 0x3333, 0x4444};
+  vm_load_image(vm, 0xFFFE, words, 4);
+
+  // Verify: the last addressable word holds the second image word
+  uint16_t last = vm->memory[0xFFFF];
+  vm_destroy(vm);
+  ASSERT_UINT16_EQUAL("Image clipped at end of memory", 0x2222, last);
+}
+
+// Test loading a sparse image, in both payload byte orders
+char* test_vm_load_sparse_image(void) {
+  uint16_t code[2] = {0xE002, 0xF025};
+  uint16_t data[1] = {0xBEEF};
+  image_segment_t segments[3] = {
+      {0x3000, 2, 0, code},
+      {0x4000, 8, IMAGE_SEGMENT_ZERO, NULL},
+      {0xC000, 1, 0, data},
+  };
+
+  bool loaded = true;
+  for (int native = 0; native <= 1; native++) {
+    const char* filename = "/tmp/lc3_test_sparse.obj";
+    vm_t* vm = vm_create();
+    vm->memory[0x4003] = 0x1234;  // Zero segments clear what was there
+    loaded = loaded && image_write_file(filename, segments, 3, native) == 0 &&
+             vm_load_file(vm, filename) == 0 && vm->memory[0x3001] == 0xF025 &&
+             vm->memory[0x4003] == 0 && vm->memory[0xC000] == 0xBEEF &&
+             vm->memory[0x8000] == 0;
+    vm_destroy(vm);
+    remove(filename);
+  }
+  ASSERT_TRUE("Sparse image segments loaded at their addresses", loaded);
+}
+
+// Test that a damaged sparse image is rejected
+char* test_vm_load_sparse_image_corrupt(void) {
+  const char* filename = "/tmp/lc3_test_sparse_corrupt.obj";
+  uint16_t code[2] = {0xE002, 0xF025};
+  image_segment_t segment = {0x3000, 2, 0, code};
+  image_write_file(filename, &segment, 1, true);
+
+  // Flip a payload bit so the checksum no longer matches
+  FILE* file = fopen(filename, "r+b");
+  fseek(file, -1, SEEK_END);
+  int byte = fgetc(file);
+  fseek(file, -1, SEEK_END);
+  fputc(byte ^ 1, file);
+  fclose(file);
+
+  vm_t* vm = vm_create();
+  int result = vm_load_file(vm, filename);
+  vm_destroy(vm);
+  remove(filename);
+  ASSERT_INT_EQUAL("Corrupt image rejected", 1, result);
+}
+
+// Test that legacy object files (origin word, big-endian words) still load
+char* test_vm_load_legacy_file(void) {
+  const char* filename = "/tmp/lc3_test_legacy.obj";
+  const uint8_t bytes[6] = {0x30, 0x00, 0xE0, 0x02, 0xF0, 0x25};
+  FILE* file = fopen(filename, "wb");
+  fwrite(bytes, 1, sizeof(bytes), file);
+  fclose(file);
+
+  vm_t* vm = vm_create();
+  int result = vm_load_file(vm, filename);
+  uint16_t loaded = vm->memory[0x3001];
+  vm_destroy(vm);
+  remove(filename);
+  ASSERT_UINT16_EQUAL("Legacy object file loaded", 0xF025,
+                      result == 0 ? loaded : 0);
+}
+
 // Run all VM tests
+// Test that a TRAP through the vector table switches to the supervisor
+// stack and RTI switches back
+char* test_os_trap_and_rti(void) {
+  vm_t* vm = create_test_vm();
+  vm->memory[LC3_TRAP_TABLE + 0x26] = 0x1000;
+  vm->reg[LC3_R_R6] = 0xBEEF;
+  vm->reg[LC3_R_PC] = 0x3001;
+  vm->reg[LC3_R_COND] = LC3_FL_NEG;
+
+  vm_exec_trap(vm, 0xF026);
+  bool entered = vm->reg[LC3_R_PC] == 0x1000 &&
+                 vm->reg[LC3_R_R6] == LC3_SSP_START - 2 &&
+                 vm->memory[LC3_SSP_START - 1] == (LC3_PSR_USER | LC3_FL_NEG) &&
+                 vm->memory[LC3_SSP_START - 2] == 0x3001 &&
+                 !(vm->psr & LC3_PSR_USER) && vm->saved_usp == 0xBEEF;
+
+  vm->reg[LC3_R_COND] = LC3_FL_ZRO;
+  bool returned = vm_os_rti(vm) && vm->reg[LC3_R_PC] == 0x3001 &&
+                  vm->reg[LC3_R_R6] == 0xBEEF &&
+                  vm->reg[LC3_R_COND] == LC3_FL_NEG &&
+                  (vm->psr & LC3_PSR_USER) &&
+                  vm->saved_ssp == LC3_SSP_START;
+
+  // RTI in user mode is a privilege exception
+  bool no_handler = !vm_os_rti(vm);
+  vm->memory[LC3_INTERRUPT_TABLE + LC3_EX_PRIVILEGE] = 0x1100;
+  bool privilege = vm_os_rti(vm) && vm->reg[LC3_R_PC] == 0x1100 &&
+                   !(vm->psr & LC3_PSR_USER);
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("TRAP enters and RTI leaves supervisor mode",
+              entered && returned && no_handler && privilege);
+}
+
+// Test that stock OS vectors run natively until the table entry changes
+char* test_os_fast_trap_path(void) {
+  vm_t* vm = create_test_vm();
+  vm->memory[LC3_TRAP_TABLE + LC3_TRAP_MUL] = 0x1000;
+  vm->stock_vectors[LC3_TRAP_MUL] = 0x1000;
+  vm->reg[LC3_R_R0] = 6;
+  vm->reg[LC3_R_R1] = 7;
+  vm->reg[LC3_R_PC] = 0x3001;
+
+  vm_exec_trap(vm, 0xF031);
+  bool native = vm->reg[LC3_R_R0] == 42 && vm->reg[LC3_R_PC] == 0x3001;
+
+  vm->memory[LC3_TRAP_TABLE + LC3_TRAP_MUL] = 0x1100;
+  vm_exec_trap(vm, 0xF031);
+  bool patched = vm->reg[LC3_R_R0] == 42 && vm->reg[LC3_R_PC] == 0x1100;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("Stock vectors run natively, patched ones run LC-3 code",
+              native && patched);
+}
+
+// Test the display and machine control registers
+char* test_os_device_registers(void) {
+  vm_t* vm = create_test_vm();
+  bool display_ready = vm_mem_read(vm, LC3_MR_DSR) & LC3_MR_READY;
+  vm->reg[LC3_R_COND] = LC3_FL_POS;
+  bool psr = vm_mem_read(vm, LC3_MR_PSR) == (LC3_PSR_USER | LC3_FL_POS);
+  vm_mem_write(vm, LC3_MR_MCR, 0);
+  bool halted = !vm->running;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("DSR is ready, PSR reads back and MCR halts",
+              display_ready && psr && halted);
+}
+
+// Test that events come out of the queue in time order once due
+char* test_event_queue_order(void) {
+  vm_t* vm = create_test_vm();
+  vm_event_schedule(vm, VM_EVENT_TIMER, 100);
+  vm_event_schedule(vm, VM_EVENT_DISPLAY, 10);
+  vm_event_schedule(vm, VM_EVENT_KEYBOARD, 50);
+  vm_event_schedule(vm, VM_EVENT_TIMER, 40);  // Replaces the first timer
+  bool countdown = vm->countdown == 10 && vm->event_count == 3;
+
+  vm_event_kind_t kind;
+  bool none_due = !vm_event_pop_due(vm, &kind);
+  vm->countdown -= 60;  // 60 instructions later
+  vm_event_kind_t order[3];
+  int popped = 0;
+  while (popped < 3 && vm_event_pop_due(vm, &order[popped])) popped++;
+  vm_event_rearm(vm);
+
+  bool in_order = popped == 3 && order[0] == VM_EVENT_DISPLAY &&
+                  order[1] == VM_EVENT_TIMER && order[2] == VM_EVENT_KEYBOARD;
+  bool idle = vm->event_count == 0 && vm_event_now(vm) == 60 &&
+              vm->countdown > 0;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("Events are due in time order",
+              countdown && none_due && in_order && idle);
+}
+
+// Test that the timer interrupts a running program on time
+char* test_timer_interrupt(void) {
+  vm_t* vm = create_test_vm();
+  vm->memory[0x3000] = 0x1021;  // LOOP ADD R0, R0, #1
+  vm->memory[0x3001] = 0x0FFE;  //      BRnzp LOOP
+  vm->memory[LC3_INTERRUPT_TABLE + LC3_INT_TIMER] = 0x1000;
+  vm->memory[0x1000] = 0xF025;  // HALT
+  vm_mem_write(vm, LC3_MR_TMR, LC3_MR_IE);
+  vm_mem_write(vm, LC3_MR_TMI, 100);
+
+  vm_execute(vm);
+  bool interrupted =
+      vm->reg[LC3_R_R0] == 50 && vm->reg[LC3_R_PC] == 0x1001 &&
+      vm->memory[LC3_SSP_START - 2] == 0x3000 &&
+      (vm->psr & LC3_PSR_PRIORITY) == VM_TIMER_PRIORITY << 8 &&
+      vm_event_now(vm) == 101;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("Timer interrupt arrives after 100 instructions", interrupted);
+}
+
+// Run 4 harts that each add 1 to a shared counter 100 times under a CAS
+// spinlock; returns the counter
+uint16_t smp_locked_counter(uint64_t quantum, uint64_t* clocks) {
+  const uint16_t program[] = {
+      0x280D,  //      LD R4, COUNT
+      0x200D,  // LOCK LD R0, LOCKADDR
+      0x5260,  //      AND R1, R1, #0
+      0x1461,  //      ADD R2, R1, #1
+      0xF036,  //      CAS
+      0x05FB,  //      BRz LOCK
+      0xAA09,  //      LDI R5, CTRADDR
+      0x1B61,  //      ADD R5, R5, #1
+      0xBA07,  //      STI R5, CTRADDR
+      0x5260,  //      AND R1, R1, #0
+      0xB204,  //      STI R1, LOCKADDR
+      0x193F,  //      ADD R4, R4, #-1
+      0x03F4,  //      BRp LOCK
+      0xF025,  //      HALT
+      100,     // COUNT
+      0x3101,  // LOCKADDR
+      0x3100,  // CTRADDR
+  };
+  vm_smp_t* smp = vm_smp_create(4);
+  memcpy(smp->memory + 0x3000, program, sizeof(program));
+  int result = vm_smp_execute(smp, quantum);
+  uint16_t counter = result == 0 ? smp->memory[0x3100] : 0;
+  for (int i = 0; clocks && i < 4; i++) clocks[i] = vm_event_now(smp->harts[i]);
+  vm_smp_destroy(smp);
+  return counter;
+}
+
+// Test that harts on threads and in round-robin turns share memory safely,
+// and that round-robin turns repeat exactly
+char* test_smp_shared_counter(void) {
+  uint64_t first[4];
+  uint64_t second[4];
+  bool round_robin = smp_locked_counter(7, first) == 400 &&
+                     smp_locked_counter(7, second) == 400 &&
+                     memcmp(first, second, sizeof(first)) == 0;
+  bool threads = smp_locked_counter(0, NULL) == 400;
+
+  ASSERT_TRUE("Every increment lands, with identical round-robin runs",
+              round_robin && threads);
+}
+
+// Test the hart number registers
+char* test_smp_hart_registers(void) {
+  vm_smp_t* smp = vm_smp_create(3);
+  bool ids = vm_mem_read(smp->harts[2], LC3_MR_HARTID) == 2 &&
+             vm_mem_read(smp->harts[0], LC3_MR_HARTID) == 0 &&
+             vm_mem_read(smp->harts[1], LC3_MR_HARTS) == 3;
+  smp->harts[1]->memory[0x4000] = 0x1234;
+  bool shared = vm_mem_read(smp->harts[2], 0x4000) == 0x1234;
+  vm_smp_destroy(smp);
+
+  ASSERT_TRUE("Harts know their number and share memory", ids && shared);
+}
+
+// Echo input until end of input: GETC; ADD R0,R0,#0; BRn +2; OUT; BRnzp -5;
+// HALT
+static const uint16_t session_echo_program[] = {0xF020, 0x1020, 0x0802,
+                                                0xF021, 0x0FFB, 0xF025};
+
+// Test that GETC stops a buffered VM until input arrives
+char* test_session_waits_for_input(void) {
+  vm_t* vm = create_test_vm();
+  vm_io_init_buffered(vm);
+  memcpy(vm->memory + 0x3000, session_echo_program,
+         sizeof(session_echo_program));
+
+  vm_execute(vm);
+  bool waited = vm->stop == VM_STOP_INPUT && vm->reg[LC3_R_PC] == 0x3000;
+  vm_io_feed(vm, "hi", 2);
+  vm_io_close_input(vm);
+  vm_execute(vm);
+  bool echoed = vm->stop == VM_STOP_HALT && vm->io.output_length == 2 &&
+                memcmp(vm->io.output, "hi", 2) == 0;
+  destroy_test_vm(vm);
+
+  ASSERT_TRUE("GETC waits for input and resumes", waited && echoed);
+}
+
+// Test that output traps stop once the output buffer is full
+char* test_session_output_backpressure(void) {
+  vm_t* vm = create_test_vm();
+  vm_io_init_buffered(vm);
+  vm->memory[0x3000] = 0xF021;  // OUT
+  vm->memory[0x3001] = 0x0FFE;  // BRnzp -2
+  vm->reg[LC3_R_R0] = 'x';
+
+  vm_execute(vm);
+  bool stopped = vm->stop == VM_STOP_OUTPUT &&
+                 vm->io.output_length == VM_IO_HIGH_WATER &&
+                 vm->reg[LC3_R_PC] == 0x3000;
+  vm_io_consume_output(vm, VM_IO_HIGH_WATER);
+  vm_execute(vm);
+  bool resumed = vm->stop == VM_STOP_OUTPUT &&
+                 vm->io.output_length == VM_IO_HIGH_WATER;
+  destroy_test_vm(vm);
+
+  ASSERT_TRUE("Output traps wait for the buffer to drain", stopped && resumed);
+}
+
+// Read everything from fd into buffer; returns the byte count
+size_t session_read_all(int fd, char* buffer, size_t size) {
+  size_t total = 0;
+  ssize_t count;
+  while (total < size && (count = read(fd, buffer + total, size - total)) > 0) {
+    total += (size_t)count;
+  }
+  return total;
+}
+
+// Test that one loop runs several sessions over pipes
+char* test_session_loop_pipes(void) {
+  const char* inputs[] = {"hello", "sessions on one loop"};
+  int output_fds[2];
+  vm_loop_t* loop = vm_loop_create(3);  // Tiny quantum to interleave them
+  bool added = loop != NULL;
+  for (int i = 0; i < 2 && added; i++) {
+    int in_pipe[2], out_pipe[2];
+    added = pipe(in_pipe) == 0 && pipe(out_pipe) == 0;
+    if (!added) break;
+    added = write(in_pipe[1], inputs[i], strlen(inputs[i])) ==
+            (ssize_t)strlen(inputs[i]);
+    close(in_pipe[1]);
+    output_fds[i] = out_pipe[0];
+
+    vm_t* vm = vm_create();
+    memcpy(vm->memory + 0x3000, session_echo_program,
+           sizeof(session_echo_program));
+    added = added && vm_loop_add(loop, vm, in_pipe[0], out_pipe[1]) == 0;
+  }
+  bool ran = added && vm_loop_run(loop) == 0 && vm_loop_failures(loop) == 0;
+  vm_loop_destroy(loop);
+
+  bool echoed = ran;
+  for (int i = 0; i < 2 && ran; i++) {
+    char buffer[64];
+    size_t count = session_read_all(output_fds[i], buffer, sizeof(buffer));
+    echoed = echoed && count == strlen(inputs[i]) &&
+             memcmp(buffer, inputs[i], count) == 0;
+    close(output_fds[i]);
+  }
+
+  ASSERT_TRUE("Each session echoes its own input", echoed);
+}
+
+// Test that a session stopped by a run limit is closed as a failure
+char* test_session_limit_closes(void) {
+  const uint16_t spin[] = {0x0FFF};  // BRnzp -1
+  int in_pipe[2], out_pipe[2];
+  bool piped = pipe(in_pipe) == 0 && pipe(out_pipe) == 0;
+  vm_loop_t* loop = vm_loop_create(64);
+  vm_t* vm = vm_create();
+  memcpy(vm->memory + 0x3000, spin, sizeof(spin));
+  vm_limit_set(vm, &(vm_limits_t){.max_instructions = 1000});
+  bool added = piped && loop && vm_loop_add(loop, vm, in_pipe[0],
+                                            out_pipe[1]) == 0;
+  bool closed = added && vm_loop_run(loop) == 0 &&
+                vm_loop_failures(loop) == 1;
+  vm_loop_destroy(loop);
+  if (piped) {
+    close(in_pipe[1]);
+    close(out_pipe[0]);
+  }
+
+  ASSERT_TRUE("A session that hits its budget ends as a failure", closed);
+}
+
+// Run program at x3000 under limits and return why it stopped
+vm_stop_t limit_run(const uint16_t* program, size_t count,
+                    const vm_limits_t* limits, uint64_t* instructions) {
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, count * sizeof(uint16_t));
+  vm->reg[LC3_R_R1] = 100;
+  vm_limit_set(vm, limits);
+  vm_execute(vm);
+  vm_stop_t stop = vm->stop;
+  *instructions = vm_event_now(vm);
+  destroy_test_vm(vm);
+  return stop;
+}
+
+// Test the instruction budget, the wall-clock limit and the loop detector
+char* test_limits_stop_runaway_programs(void) {
+  const uint16_t spin[] = {0x0FFF};  // BRnzp -1
+  // ADD R1,R1,#-1; BRp -2; HALT
+  const uint16_t count_down[] = {0x127F, 0x03FE, 0xF025};
+  // ST R1,#1; BRnzp -2: the same state every time, but it stores
+  const uint16_t store_spin[] = {0x3201, 0x0FFE};
+  vm_limits_t budget = {.max_instructions = 500};
+  vm_limits_t timeout = {.timeout_ms = 1};
+  vm_limits_t loops = {.max_instructions = 1000, .detect_loops = true};
+  uint64_t executed;
+
+  bool budgeted = limit_run(spin, 1, &budget, &executed) == VM_STOP_BUDGET &&
+                  executed == 500;
+  bool timed_out = limit_run(spin, 1, &timeout, &executed) == VM_STOP_TIMEOUT;
+  bool detected =
+      limit_run(spin, 1, &loops, &executed) == VM_STOP_LOOP && executed < 3;
+  bool counted = limit_run(count_down, 3, &loops, &executed) == VM_STOP_HALT;
+  bool stores =
+      limit_run(store_spin, 2, &loops, &executed) == VM_STOP_BUDGET;
+
+  ASSERT_TRUE("Limits stop runaway programs and spare finite ones",
+              budgeted && timed_out && detected && counted && stores);
+}
+
+// Test the counters of a short run and the reports built from them
+char* test_stats_counters_and_reports(void) {
+  // LD R2,#4; ADD R1,R1,#-1; BRp -2; ST R1,#2; HALT; a data word
+  const uint16_t program[] = {0x2404, 0x127F, 0x03FE, 0x3202, 0xF025, 7};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm->reg[LC3_R_R1] = 3;
+  vm_execute(vm);
+
+  const vm_stats_t* s = &vm->stats;
+  bool counted = vm_event_now(vm) == 9 && s->opcodes[LC3_OP_ADD] == 3 &&
+                 s->opcodes[LC3_OP_BR] == 3 && s->opcodes[LC3_OP_LD] == 1 &&
+                 s->traps[LC3_TRAP_HALT] == 1 && s->branches_taken == 2 &&
+                 s->branches_not_taken == 1 && s->memory_reads == 1 &&
+                 s->memory_writes == 1 && s->run_ns > 0;
+
+  char report[8192];
+  bool reported = true;
+  const vm_stats_format_t formats[] = {VM_STATS_JSON, VM_STATS_PROMETHEUS};
+  const char* expected[] = {
+      "\"ADD\": 3",
+      "lc3_branches_total{hart=\"0\",taken=\"true\"} 2",
+  };
+  for (int i = 0; i < 2; i++) {
+    FILE* out = tmpfile();
+    reported = reported && out && vm_stats_write(out, &vm, 1, formats[i]) == 0;
+    if (!out) continue;
+    rewind(out);
+    size_t length = fread(report, 1, sizeof(report) - 1, out);
+    report[length] = '\0';
+    fclose(out);
+    reported = reported && strstr(report, expected[i]) != NULL;
+  }
+  destroy_test_vm(vm);
+
+  ASSERT_TRUE("Counters match the run and appear in reports",
+              counted && reported);
+}
+
+// Test that executed addresses are marked and reported per source line
+char* test_coverage_lcov(void) {
+  // BRnzp +1; ADD R0,R0,#1 (skipped); HALT
+  const uint16_t program[] = {0x0E01, 0x1021, 0xF025};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm_execute(vm);
+  bool marked = vm_coverage_hit(vm, 0x3000) && !vm_coverage_hit(vm, 0x3001) &&
+                vm_coverage_hit(vm, 0x3002) && !vm_coverage_hit(vm, 0x3003);
+
+  debug_info_t* debug = debug_info_create();
+  debug_info_add_file(debug, "/src/prog.asm");
+  for (int i = 0; i < 3; i++) debug_info_add_line(debug, 0x3000 + i, 0, 10 + i);
+  char report[512];
+  FILE* out = tmpfile();
+  bool written = out && vm_coverage_write_lcov(out, &vm, 1, debug) == 0;
+  size_t length = 0;
+  if (out) {
+    rewind(out);
+    length = fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+  }
+  report[length] = '\0';
+  debug_info_destroy(debug);
+  destroy_test_vm(vm);
+
+  const char* expected =
+      "TN:\nSF:/src/prog.asm\nDA:10,1\nDA:11,0\nDA:12,1\nLF:3\nLH:2\n"
+      "end_of_record\n";
+  ASSERT_TRUE("Coverage marks executed words and reports them as lcov",
+              marked && written && strcmp(report, expected) == 0);
+}
+
+char* test_cache_simulator(void) {
+  vm_cache_config_t config;
+  bool parsed = vm_cache_parse("size=16,line=4,ways=1", &config) == 0 &&
+                config.policy == VM_CACHE_LRU &&
+                vm_cache_parse("size=24", &config) != 0 &&
+                vm_cache_parse("size=16,line=8,ways=4", &config) != 0 &&
+                vm_cache_parse("policy=mru", &config) != 0 &&
+                vm_cache_parse("ways=2,policy=fifo", &config) == 0 &&
+                config.size == 256 && config.policy == VM_CACHE_FIFO;
+
+  // Direct-mapped with four sets: x3000 and x3010 share set 0
+  vm_cache_parse("size=16,line=4,ways=1", &config);
+  vm_cache_t* cache = vm_cache_create(&config);
+  const uint16_t addresses[] = {0x3000, 0x3001, 0x3010, 0x3000};
+  for (int i = 0; i < 4; i++) vm_cache_access(cache, addresses[i]);
+  bool conflicts = cache->total.hits == 1 && cache->total.misses == 3 &&
+                   cache->total.evictions == 2 &&
+                   cache->by_address[0x3000].misses == 2;
+  vm_cache_destroy(cache);
+
+  // LD R0, DATA; LD R1, DATA; HALT; DATA .FILL 7
+  const uint16_t program[] = {0x2002, 0x2201, 0xF025, 0x0007};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm->icache = vm_cache_create(&config);
+  vm->dcache = vm_cache_create(&config);
+  vm_execute(vm);
+  bool simulated = vm->reg[1] == 7 && vm->icache->total.misses == 1 &&
+                   vm->icache->total.hits == 2 &&
+                   vm->dcache->total.misses == 1 &&
+                   vm->dcache->total.hits == 1;
+
+  debug_info_t* debug = debug_info_create();
+  debug_info_add_label(debug, "MAIN", 0x3000, 0x3003);
+  debug_info_add_label(debug, "DATA", 0x3003, 0x3004);
+  char report[1024];
+  FILE* out = tmpfile();
+  size_t length = 0;
+  if (out) {
+    vm_cache_report(out, "D-cache", vm->dcache, debug);
+    rewind(out);
+    length = fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+  }
+  report[length] = '\0';
+  debug_info_destroy(debug);
+  destroy_test_vm(vm);
+
+  bool reported = strstr(report, "D-cache: 16 words, 4-word lines, 1-way") &&
+                  strstr(report, "DATA") && !strstr(report, "MAIN");
+  ASSERT_TRUE("Cache simulator counts hits, misses and evictions by label",
+              parsed && conflicts && simulated && reported);
+}
+
+char* test_cycles_by_routine(void) {
+  vm_cycles_config_t config;
+  bool parsed = vm_cycles_parse("bogus=1", &config) != 0 &&
+                vm_cycles_parse("add=x", &config) != 0 &&
+                vm_cycles_parse("jsr=4,taken=3", &config) == 0 &&
+                config.op[LC3_OP_JSR] == 4 && config.op[LC3_OP_LD] == 1 &&
+                config.memory == 2;
+
+  // JSR SUB; JSR SUB; BRnzp #0; HALT
+  // SUB LD R0, DATA; RET
+  // DATA .FILL 7
+  const uint16_t program[] = {0x4803, 0x4802, 0x0E00, 0xF025,
+                              0x2001, 0xC1C0, 0x0007};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm->cycles = vm_cycles_create(&config, 0x3000);
+  vm_execute(vm);
+  vm_cycles_finish(vm->cycles);
+  // JSRs 2 * 4, taken BR 1 + 3, HALT 2; each call LD 1 + 2 and RET 1
+  const vm_cycles_routine_t* top = &vm->cycles->routines[0x3000];
+  const vm_cycles_routine_t* sub = &vm->cycles->routines[0x3004];
+  bool counted = vm->cycles->total == 22 && vm->cycles->calls.depth == 0 &&
+                 top->calls == 1 && top->inclusive == 22 &&
+                 top->exclusive == 14 && sub->calls == 2 &&
+                 sub->inclusive == 8 && sub->exclusive == 8;
+
+  debug_info_t* debug = debug_info_create();
+  debug_info_add_label(debug, "SUB", 0x3004, 0x3006);
+  char report[1024];
+  FILE* out = tmpfile();
+  size_t length = 0;
+  if (out) {
+    vm_cycles_report(out, vm->cycles, debug);
+    rewind(out);
+    length = fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+  }
+  report[length] = '\0';
+  debug_info_destroy(debug);
+  destroy_test_vm(vm);
+
+  // The program comes first, with the most inclusive cycles
+  char* program_row = strstr(report, "x3000");
+  char* sub_row = strstr(report, "SUB");
+  bool reported = strstr(report, "Estimated cycles: 22\n") && program_row &&
+                  sub_row && program_row < sub_row;
+  ASSERT_TRUE("Cycle profile charges costs to routines",
+              parsed && counted && reported);
+}
+
+char* test_profile_folded_stacks(void) {
+  // MAIN JSR A; JSR A; HALT
+  // A    ADD R5, R7, #0; JSR B; RET (never reached)
+  // B    ADD R0, R0, #1; JMP R5 (returns from A as well)
+  const uint16_t program[] = {0x4802, 0x4801, 0xF025, 0x1BE0,
+                              0x4801, 0xC1C0, 0x1021, 0xC140};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm->profile = vm_profile_create(0x3000);
+  vm_execute(vm);
+  bool unwound = vm->profile->calls.depth == 1 &&
+                 vm->profile->node_count == 3 &&
+                 vm->profile->nodes[1].calls == 2 && vm->reg[0] == 2;
+
+  debug_info_t* debug = debug_info_create();
+  debug_info_add_label(debug, "MAIN", 0x3000, 0x3003);
+  debug_info_add_label(debug, "A", 0x3003, 0x3006);
+  debug_info_add_label(debug, "B", 0x3006, 0x3008);
+  char report[512];
+  char unnamed[512];
+  FILE* out = tmpfile();
+  size_t length = 0;
+  size_t unnamed_length = 0;
+  if (out) {
+    vm_profile_write_folded(out, vm->profile, debug, NULL);
+    rewind(out);
+    length = fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+  }
+  out = tmpfile();
+  if (out) {
+    vm_profile_write_folded(out, vm->profile, NULL, "hart0");
+    rewind(out);
+    unnamed_length = fread(unnamed, 1, sizeof(unnamed) - 1, out);
+    fclose(out);
+  }
+  report[length] = '\0';
+  unnamed[unnamed_length] = '\0';
+  debug_info_destroy(debug);
+  destroy_test_vm(vm);
+
+  bool folded =
+      strcmp(report, "MAIN 3\nMAIN;A 4\nMAIN;A;B 4\n") == 0 &&
+      strcmp(unnamed,
+             "hart0;x3000 3\nhart0;x3000;x3003 4\n"
+             "hart0;x3000;x3003;x3006 4\n") == 0;
+  ASSERT_TRUE("Profile folds instructions by call path",
+              unwound && folded);
+}
+
+// Test that an OS trap routine's RTI closes its frame in both profiles
+char* test_profiles_os_trap_return(void) {
+  // TRAP x26; ADD R1, R1, #1 (three times); HALT
+  // x0200: ADD R0, R0, #1; RTI
+  const uint16_t program[] = {0xF026, 0x1261, 0x1261, 0x1261, 0xF025};
+  vm_t* vm = create_test_vm();
+  memcpy(vm->memory + 0x3000, program, sizeof(program));
+  vm->memory[LC3_TRAP_TABLE + 0x26] = 0x0200;
+  vm->memory[0x0200] = 0x1021;
+  vm->memory[0x0201] = 0x8000;
+  vm_cycles_config_t config;
+  vm_cycles_parse("", &config);
+  vm->cycles = vm_cycles_create(&config, 0x3000);
+  vm->profile = vm_profile_create(0x3000);
+  vm_execute(vm);
+  vm_cycles_finish(vm->cycles);
+
+  // TRAP 2, ADDs 3 and HALT 2 in the program; ADD 1 and RTI 3 in x0200
+  const vm_cycles_routine_t* top = &vm->cycles->routines[0x3000];
+  const vm_cycles_routine_t* routine = &vm->cycles->routines[0x0200];
+  bool counted = vm->reg[LC3_R_R1] == 3 && vm->cycles->total == 11 &&
+                 top->exclusive == 7 && routine->calls == 1 &&
+                 routine->inclusive == 4 && routine->exclusive == 4;
+
+  char report[128];
+  FILE* out = tmpfile();
+  size_t length = 0;
+  if (out) {
+    vm_profile_write_folded(out, vm->profile, NULL, NULL);
+    rewind(out);
+    length = fread(report, 1, sizeof(report) - 1, out);
+    fclose(out);
+  }
+  report[length] = '\0';
+  bool folded = vm->profile->calls.depth == 1 &&
+                strcmp(report, "x3000 5\nx3000;x0200 2\n") == 0;
+  destroy_test_vm(vm);
+
+  ASSERT_TRUE("RTI returns from a trap routine in the profiles",
+              counted && folded);
+}
+
+// Connect to a server that may still be starting
+int server_connect(const char* path) {
+  for (int attempt = 0; attempt < 200; attempt++) {
+    int fd = socket_connect_unix(path);
+    if (fd >= 0) return fd;
+    struct timespec delay = {0, 10000000};
+    nanosleep(&delay, NULL);
+  }
+  return -1;
+}
+
+// Send a request with input "hi" and return the response status
+uint32_t server_call(int fd, const void* image, uint32_t image_size,
+                     uint64_t key, uint64_t max_instructions,
+                     vm_server_response_t* response, bool* echoed) {
+  vm_server_request_t request = {.image_size = image_size,
+                                 .key = key,
+                                 .max_instructions = max_instructions,
+                                 .input_size = 2};
+  memcpy(request.magic, VM_SERVER_REQUEST_MAGIC, 4);
+  uint8_t* output;
+  if (vm_server_call(fd, &request, image, "hi", response, &output) != 0) {
+    return UINT32_MAX;
+  }
+  *echoed = response->output_size == 2 && memcmp(output, "hi", 2) == 0;
+  free(output);
+  return response->status;
+}
+
+// Test that the server caches images and enforces instruction limits
+char* test_server_request_cache(void) {
+  const char* path = "/tmp/lc3_test_server.sock";
+  pid_t server = fork();
+  if (server == 0) _exit(vm_server_serve(path, 1));
+
+  // Legacy object file: origin x3000, then the words, all big-endian
+  uint16_t image[7] = {swap16(0x3000)};
+  swap16_copy(image + 1, session_echo_program, 6);
+  uint64_t key = vm_server_key(image, sizeof(image));
+  const uint8_t spin[] = {0x30, 0x00, 0x0F, 0xFF};  // BRnzp -1
+
+  int fd = server_connect(path);
+  vm_server_response_t response;
+  bool echoed = false;
+  bool unknown = server_call(fd, NULL, 0, key, 0, &response, &echoed) ==
+                 VM_SERVER_UNKNOWN_IMAGE;
+  bool decoded = server_call(fd, image, sizeof(image), 0, 0, &response,
+                             &echoed) == VM_SERVER_HALT &&
+                 echoed && response.key == key && !response.flags;
+  echoed = false;
+  bool cached = server_call(fd, NULL, 0, key, 0, &response, &echoed) ==
+                    VM_SERVER_HALT &&
+                echoed && response.flags == VM_SERVER_CACHE_HIT;
+  bool limited = server_call(fd, spin, sizeof(spin), 0, 1000, &response,
+                             &echoed) == VM_SERVER_INSTRUCTION_LIMIT &&
+                 response.instructions == 1000;
+  if (fd >= 0) close(fd);
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+
+  ASSERT_TRUE("Server runs cached images within their limits",
+              unknown && decoded && cached && limited);
+}
+
+// Run program at x3000 from the registers in reg, once interpreted and once
+// with idiom recognition, and check that both end in the same state
+bool idiom_matches_interpreter(const uint16_t* program, size_t count,
+                               const uint16_t* reg) {
+  vm_t* interpreted = create_test_vm();
+  vm_t* native = create_test_vm();
+  vm_t* vms[] = {interpreted, native};
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 0x100; j++) vms[i]->memory[0x4000 + j] = j * 7;
+    memcpy(vms[i]->memory + 0x3000, program, count * sizeof(uint16_t));
+    memcpy(vms[i]->reg, reg, (LC3_R_R7 + 1) * sizeof(uint16_t));
+  }
+  vm_idiom_scan(native);
+  bool recognized = native->idiom_count == 1;
+  vm_execute(interpreted);
+  vm_execute(native);
+
+  bool same = recognized && native->idiom_at[0x3000] != 0 &&
+              vm_event_now(interpreted) == vm_event_now(native) &&
+              memcmp(interpreted->reg, native->reg, sizeof(native->reg)) == 0 &&
+              memcmp(interpreted->memory, native->memory,
+                     LC3_MEMORY_MAX * sizeof(uint16_t)) == 0;
+  destroy_test_vm(interpreted);
+  destroy_test_vm(native);
+  return same;
+}
+
+// Test that recognized loops give the same result as interpreting them
+char* test_idiom_loops_match_interpreter(void) {
+  // Overlapping copy: LDR R0,R1,#0; STR R0,R2,#0; ADD R1,R1,#1;
+  // ADD R2,R2,#1; ADD R3,R3,#-1; BRp LOOP
+  const uint16_t copy[] = {0x6040, 0x7080, 0x1261, 0x14A1,
+                           0x16FF, 0x03FA, 0xF025};
+  const uint16_t copy_reg[8] = {0, 0x4000, 0x4001, 10};
+  // Repeated addition: ADD R2,R2,R0; ADD R1,R1,#-1; BRp LOOP
+  const uint16_t mul_add[] = {0x1480, 0x127F, 0x03FD, 0xF025};
+  const uint16_t mul_add_reg[8] = {1234, 300, 5};
+  // Shift and add: AND R4,R1,R3; BRz SKIP; ADD R2,R2,R0;
+  // SKIP ADD R0,R0,R0; ADD R3,R3,R3; BRnp LOOP
+  const uint16_t mul_shift[] = {0x5843, 0x0401, 0x1480, 0x1000,
+                                0x16C3, 0x0BFA, 0xF025};
+  const uint16_t mul_shift_reg[8] = {(uint16_t)-7, 123, 0, 1};
+  // Repeated subtraction: ADD R0,R0,R1; BRn DONE; ADD R2,R2,#1; BRnzp LOOP
+  const uint16_t div_sub[] = {0x1001, 0x0802, 0x14A1, 0x0FFC, 0xF025};
+  const uint16_t div_sub_reg[8] = {1000, (uint16_t)-7, 0};
+
+  ASSERT_TRUE(
+      "Copy, multiply and divide loops match the interpreter",
+      idiom_matches_interpreter(copy, 7, copy_reg) &&
+          idiom_matches_interpreter(mul_add, 4, mul_add_reg) &&
+          idiom_matches_interpreter(mul_shift, 7, mul_shift_reg) &&
+          idiom_matches_interpreter(div_sub, 5, div_sub_reg));
+}
+
+// Test that a loop is interpreted when it changed or its count is unusual
+char* test_idiom_bails_out(void) {
+  vm_t* vm = create_test_vm();
+  const uint16_t mul_add[] = {0x1480, 0x127F, 0x03FD, 0xF025};
+  memcpy(vm->memory + 0x3000, mul_add, sizeof(mul_add));
+  vm_idiom_scan(vm);
+  vm_idiom_t* idiom = &vm->idioms[0];
+
+  vm->reg[LC3_R_R1] = 0;  // A zero count still runs the loop once
+  bool zero_count = !vm_idiom_run(vm, idiom) && vm->idiom_at[0x3000] != 0;
+
+  vm->reg[LC3_R_R1] = 3;
+  vm->memory[0x3000] = 0x14A2;  // ADD R2,R2,#2
+  bool modified = !vm_idiom_run(vm, idiom) && vm->idiom_at[0x3000] == 0 &&
+                  vm->reg[LC3_R_R1] == 3 && vm->reg[LC3_R_PC] == 0x3000;
+
+  destroy_test_vm(vm);
+  ASSERT_TRUE("Modified loops and unusual counts fall back",
+              zero_count && modified);
+}
+
 void run_vm_tests(void) {
   printf("Running VM Instruction Tests...\n\n");
 
@@ -460,11 +1409,55 @@ void run_vm_tests(void) {
 
   // Trap instruction test
   RUN_TEST(test_trap_halt);
+  RUN_TEST(test_trap_arithmetic_extensions);
+  RUN_TEST(test_trap_memory_extensions);
 
   // Condition flag tests
   RUN_TEST(test_condition_flags_positive);
   RUN_TEST(test_condition_flags_zero);
   RUN_TEST(test_condition_flags_negative);
+
+  // Program loading
+  RUN_TEST(test_vm_load_image);
+  RUN_TEST(test_vm_load_image_clipped);
+  RUN_TEST(test_vm_load_sparse_image);
+  RUN_TEST(test_vm_load_sparse_image_corrupt);
+  RUN_TEST(test_vm_load_legacy_file);
+
+  // OS support
+  RUN_TEST(test_os_trap_and_rti);
+  RUN_TEST(test_os_fast_trap_path);
+  RUN_TEST(test_os_device_registers);
+
+  // Devices and events
+  RUN_TEST(test_event_queue_order);
+  RUN_TEST(test_timer_interrupt);
+
+  // Multiple harts
+  RUN_TEST(test_smp_shared_counter);
+  RUN_TEST(test_smp_hart_registers);
+
+  // Limits
+  RUN_TEST(test_limits_stop_runaway_programs);
+
+  // Statistics and coverage
+  RUN_TEST(test_stats_counters_and_reports);
+  RUN_TEST(test_coverage_lcov);
+  RUN_TEST(test_cache_simulator);
+  RUN_TEST(test_cycles_by_routine);
+  RUN_TEST(test_profile_folded_stacks);
+  RUN_TEST(test_profiles_os_trap_return);
+
+  // Sessions
+  RUN_TEST(test_session_waits_for_input);
+  RUN_TEST(test_session_output_backpressure);
+  RUN_TEST(test_session_loop_pipes);
+  RUN_TEST(test_session_limit_closes);
+  RUN_TEST(test_server_request_cache);
+
+  // Idiom recognition
+  RUN_TEST(test_idiom_loops_match_interpreter);
+  RUN_TEST(test_idiom_bails_out);
 }
 
 #endif /* VM_TESTS_H */